@@ -0,0 +1,1259 @@
+/*
+ *
+ * archive.c     Unpack cpio, tar, and rpm archives
+ *
+ * Archives are parsed directly; gzip compressed archives are decompressed
+ * using zlib, others are piped through a decompressor process ('xz -dc',
+ * 'zstd -dc', ...).
+ *
+ * Archive members are created without following any symlinks and never
+ * outside the target directory (see ar_open_parent()).
+ *
+ * Archives are either unpacked into a directory or turned into a squashfs
+ * image on the fly (see squashfs.c).
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <spawn.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/sysmacros.h>
+#include <sys/syscall.h>
+#ifdef SYS_openat2
+#include <linux/openat2.h>
+#endif
+#include <zlib.h>
+
+#include "global.h"
+#include "util.h"
+#include "archive.h"
+#include "squashfs.h"
+
+#define AR_BUF_SIZE	(1 << 18)
+#define AR_BLOCK_SIZE	4096
+// max. number of compression threads for squashfs images
+#define AR_SQUASH_THREADS	8
+
+extern char **environ;
+
+/* input stream, possibly coming from a decompressor */
+typedef struct {
+  int src_fd;			/**< archive file */
+  int fd;			/**< read from here */
+  pid_t pid;			/**< decompressor pid, if any */
+  gzFile gz;			/**< or: zlib stream (gzip) */
+  unsigned char *buf;
+  size_t len, pos;
+  uint64_t offset;		/**< (uncompressed) bytes consumed so far */
+  unsigned eof:1;
+} ar_stream_t;
+
+/* one archive member */
+typedef struct {
+  char *name;
+  char *link;			/**< symlink target or hard link source */
+  mode_t mode;
+  uid_t uid;
+  gid_t gid;
+  time_t mtime;
+  uint64_t size;
+  dev_t rdev;
+  uint64_t ino;			/**< cpio: inode number, for hard links */
+  unsigned nlink;
+  unsigned hardlink:1;		/**< tar: hard link to 'link' */
+} ar_entry_t;
+
+/* cpio hard link tracking */
+typedef struct ar_hlink_s {
+  struct ar_hlink_s *next;
+  uint64_t ino;
+  char *name;
+  sq_node_t *node;		/**< squashfs image node */
+  unsigned data:1;		/**< file data have been stored */
+} ar_hlink_t;
+
+/* extraction state */
+typedef struct {
+  int dir_fd;			/**< target directory */
+  sq_image_t *sq;		/**< or: squashfs image */
+  slist_t *file_list;		/**< extract only these (shell patterns) */
+  ar_hlink_t *hlinks;
+  off_t src_size;		/**< archive file size, for progress */
+  unsigned progress;		/**< last reported progress (in 10%) */
+  unsigned files;		/**< extracted files */
+  uint64_t bytes;		/**< extracted data */
+} ar_ctx_t;
+
+static int ar_open(ar_stream_t *s, int src_fd, char *compr);
+static int ar_close(ar_stream_t *s);
+static size_t ar_fill(ar_stream_t *s, size_t len);
+static size_t ar_read(ar_stream_t *s, void *buf, size_t len);
+static int ar_skip(ar_stream_t *s, uint64_t len);
+static int ar_copy(ar_stream_t *s, int fd, uint64_t len);
+
+static int ar_unpack(ar_ctx_t *ctx, char *file, char *type, char *compr);
+static int ar_cpio(ar_ctx_t *ctx, ar_stream_t *s);
+static int ar_tar(ar_ctx_t *ctx, ar_stream_t *s);
+static off_t ar_rpm_payload(int fd);
+static int ar_extract_entry(ar_ctx_t *ctx, ar_stream_t *s, ar_entry_t *ae);
+static int ar_create_entry(ar_ctx_t *ctx, ar_stream_t *s, ar_entry_t *ae, ar_hlink_t *hl, char *name, int dir_fd, char *base);
+static int ar_squash_entry(ar_ctx_t *ctx, ar_stream_t *s, ar_entry_t *ae, char *name, ar_hlink_t *hl);
+static int ar_open_parent(ar_ctx_t *ctx, char *name, char **base, int create);
+static char *ar_clean_name(char *name);
+static void ar_progress(ar_ctx_t *ctx, ar_stream_t *s);
+static uint64_t ar_num(char *str, unsigned len, int base);
+
+
+/*
+ * Unpack archive to dir.
+ *
+ * type is one of "cpio", "tar", or "rpm" (as returned by util_fstype() or
+ * compressed_archive()); compr is the compression program name, if any.
+ *
+ * If file_list is set, extract only the files matching one of its shell
+ * patterns (like cpio does).
+ *
+ * Supported are newc and odc cpio archives, ustar (incl. pax and GNU long
+ * name extensions) tar archives, and rpm packages with cpio payload.
+ *
+ * Returns 0 on success, AR_UNSUPPORTED if the archive format is not
+ * supported (use external tools then), or -1 on error.
+ */
+int archive_extract(char *file, char *type, char *compr, char *dir, slist_t *file_list)
+{
+  ar_ctx_t ctx = { .dir_fd = -1 };
+  int err;
+
+  if(!file || !type || !dir) return -1;
+
+  if(strcmp(type, "cpio") && strcmp(type, "tar") && strcmp(type, "rpm")) return AR_UNSUPPORTED;
+
+  if((ctx.dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) {
+    perror_info(dir);
+
+    return -1;
+  }
+
+  ctx.file_list = file_list;
+
+  err = ar_unpack(&ctx, file, type, compr);
+
+  close(ctx.dir_fd);
+
+  return err;
+}
+
+
+/*
+ * Turn archive into squashfs image.
+ *
+ * Arguments and return value are as for archive_extract(). The image file
+ * is created (or overwritten); it is removed again if anything fails.
+ *
+ * This does the same as unpacking the archive and running mksquashfs on
+ * the result, but needs neither the space for the unpacked files nor the
+ * time to write and read them again.
+ */
+int archive_squash(char *file, char *type, char *compr, char *image, slist_t *file_list)
+{
+  ar_ctx_t ctx = { .dir_fd = -1 };
+  long threads;
+  int fd, err;
+
+  if(!file || !type || !image) return -1;
+
+  if(strcmp(type, "cpio") && strcmp(type, "tar") && strcmp(type, "rpm")) return AR_UNSUPPORTED;
+
+  if((fd = open(image, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC | O_LARGEFILE, 0644)) == -1) {
+    perror_info(image);
+
+    return -1;
+  }
+
+  threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if(threads < 1) threads = 1;
+  if(threads > AR_SQUASH_THREADS) threads = AR_SQUASH_THREADS;
+
+  ctx.sq = sq_new(fd, threads);
+  ctx.file_list = file_list;
+
+  err = ar_unpack(&ctx, file, type, compr);
+
+  if(!err && sq_finish(ctx.sq)) {
+    log_info("%s: error writing squashfs image\n", image);
+    err = -1;
+  }
+
+  sq_free(ctx.sq);
+
+  if(close(fd)) err = -1;
+
+  if(err) unlink(image);
+
+  return err;
+}
+
+
+/*
+ * Unpack archive to ctx->dir_fd or ctx->sq.
+ */
+int ar_unpack(ar_ctx_t *ctx, char *file, char *type, char *compr)
+{
+  ar_stream_t s = { };
+  ar_hlink_t *hl, *next;
+  struct timespec t0, t1;
+  struct stat sbuf;
+  off_t ofs = 0;
+  int fd, err = -1, i;
+  char *payload_compr = compr;
+
+  if((fd = open(file, O_RDONLY | O_LARGEFILE | O_CLOEXEC)) == -1) {
+    perror_info(file);
+
+    return -1;
+  }
+
+  if(!fstat(fd, &sbuf)) ctx->src_size = sbuf.st_size;
+
+  if(!strcmp(type, "rpm")) {
+    unsigned char magic[8];
+
+    ofs = ar_rpm_payload(fd);
+    if(
+      ofs <= 0 ||
+      pread(fd, magic, sizeof magic, ofs) != sizeof magic ||
+      lseek(fd, ofs, SEEK_SET) != ofs
+    ) {
+      log_info("%s: unsupported rpm format\n", file);
+      close(fd);
+
+      return AR_UNSUPPORTED;
+    }
+    // rpm payloads may also use zstd or bzip2
+    payload_compr = compress_type(magic);
+    if(!payload_compr && !memcmp(magic, "\x28\xb5\x2f\xfd", 4)) payload_compr = "zstd";
+    if(!payload_compr && !memcmp(magic, "BZh", 3)) payload_compr = "bzip2";
+    log_debug("%s: rpm payload at 0x%llx, %s\n", file, (unsigned long long) ofs, payload_compr ?: "uncompressed");
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
+  if(!ar_open(&s, fd, payload_compr)) {
+    if(ar_fill(&s, 512) >= 512 && !memcmp(s.buf + s.pos + 257, "ustar", 5)) {
+      err = ar_tar(ctx, &s);
+    }
+    else if(s.len - s.pos >= 6 && !memcmp(s.buf + s.pos, "07070", 5)) {
+      err = ar_cpio(ctx, &s);
+    }
+    else {
+      err = AR_UNSUPPORTED;
+    }
+
+    i = ar_close(&s);
+    if(i && err != AR_UNSUPPORTED) {
+      log_info("%s: %s decompression failed (%d)\n", file, payload_compr, i);
+      err = -1;
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  if(!err) {
+    log_info(
+      "%s: %u files, %llu bytes %s in %.2fs\n",
+      file, ctx->files, (unsigned long long) ctx->bytes,
+      ctx->sq ? "converted to squashfs" : "unpacked",
+      (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9
+    );
+  }
+  else if(err == AR_UNSUPPORTED) {
+    log_info("%s: unsupported %s format\n", file, type);
+  }
+
+  for(hl = ctx->hlinks; hl; hl = next) {
+    next = hl->next;
+    free(hl->name);
+    free(hl);
+  }
+  ctx->hlinks = NULL;
+
+  close(fd);
+
+  return err;
+}
+
+
+/*
+ * Set up input stream.
+ *
+ * If compr is set, start decompressor reading from src_fd.
+ *
+ * Returns 0 on success.
+ */
+int ar_open(ar_stream_t *s, int src_fd, char *compr)
+{
+  posix_spawn_file_actions_t fa;
+  char *argv[] = { compr, "-dc", NULL };
+  int pfd[2], i;
+
+  s->src_fd = src_fd;
+  s->fd = src_fd;
+  s->buf = malloc(AR_BUF_SIZE);
+
+  if(!compr) return 0;
+
+  // no need for an extra process
+  if(!strcmp(compr, "gzip")) {
+    if((i = dup(src_fd)) == -1 || !(s->gz = gzdopen(i, "rb"))) {
+      if(i != -1) close(i);
+      free(s->buf);
+      s->buf = NULL;
+
+      return -1;
+    }
+    gzbuffer(s->gz, AR_BUF_SIZE);
+
+    return 0;
+  }
+
+  if(pipe2(pfd, O_CLOEXEC)) {
+    free(s->buf);
+    s->buf = NULL;
+
+    return -1;
+  }
+
+  posix_spawn_file_actions_init(&fa);
+  posix_spawn_file_actions_adddup2(&fa, src_fd, 0);
+  posix_spawn_file_actions_adddup2(&fa, pfd[1], 1);
+
+  i = posix_spawnp(&s->pid, compr, &fa, NULL, argv, environ);
+
+  posix_spawn_file_actions_destroy(&fa);
+  close(pfd[1]);
+
+  if(i) {
+    log_info("%s: %s\n", compr, strerror(i));
+    close(pfd[0]);
+    s->pid = 0;
+    free(s->buf);
+    s->buf = NULL;
+
+    return -1;
+  }
+
+  s->fd = pfd[0];
+
+  return 0;
+}
+
+
+/*
+ * Close input stream.
+ *
+ * Returns decompressor exit status.
+ */
+int ar_close(ar_stream_t *s)
+{
+  int status = 0;
+
+  if(s->gz) {
+    // read the rest, to get the checksum verified
+    while(gzread(s->gz, s->buf, AR_BUF_SIZE) > 0);
+    gzerror(s->gz, &status);
+    if(gzclose(s->gz) != Z_OK) status = 1;
+    s->gz = NULL;
+    free(s->buf);
+    s->buf = NULL;
+
+    return status ? 1 : 0;
+  }
+
+  if(!s->pid) {
+    free(s->buf);
+    s->buf = NULL;
+
+    return 0;
+  }
+
+  // read the rest (padding), to get a meaningful exit status
+  while(read(s->fd, s->buf, AR_BUF_SIZE) > 0);
+  free(s->buf);
+  s->buf = NULL;
+
+  close(s->fd);
+
+  while(waitpid(s->pid, &status, 0) == -1 && errno == EINTR);
+
+  // we might have stopped reading early: SIGPIPE is ok then
+  if(WIFSIGNALED(status) && WTERMSIG(status) == SIGPIPE) return 0;
+
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+
+/*
+ * Try to have at least len bytes in buffer (len <= AR_BUF_SIZE).
+ *
+ * Returns number of buffered bytes.
+ */
+size_t ar_fill(ar_stream_t *s, size_t len)
+{
+  ssize_t i;
+
+  if(s->len - s->pos >= len || s->eof) return s->len - s->pos;
+
+  if(s->pos) {
+    memmove(s->buf, s->buf + s->pos, s->len - s->pos);
+    s->len -= s->pos;
+    s->pos = 0;
+  }
+
+  while(s->len < len) {
+    if(s->gz) {
+      i = gzread(s->gz, s->buf + s->len, AR_BUF_SIZE - s->len);
+    }
+    else {
+      i = read(s->fd, s->buf + s->len, AR_BUF_SIZE - s->len);
+      if(i < 0 && errno == EINTR) continue;
+    }
+    if(i <= 0) {
+      s->eof = 1;
+      break;
+    }
+    s->len += i;
+  }
+
+  return s->len;
+}
+
+
+/*
+ * Read len bytes.
+ *
+ * Returns number of bytes actually read.
+ */
+size_t ar_read(ar_stream_t *s, void *buf, size_t len)
+{
+  size_t l, cnt = 0;
+
+  while(len) {
+    if(!(l = ar_fill(s, 1))) break;
+    if(l > len) l = len;
+    memcpy(buf, s->buf + s->pos, l);
+    s->pos += l;
+    s->offset += l;
+    buf += l;
+    len -= l;
+    cnt += l;
+  }
+
+  return cnt;
+}
+
+
+/*
+ * Skip len bytes.
+ *
+ * Returns 0 on success.
+ */
+int ar_skip(ar_stream_t *s, uint64_t len)
+{
+  size_t l;
+
+  while(len) {
+    if(!(l = ar_fill(s, 1))) return -1;
+    if(l > len) l = len;
+    s->pos += l;
+    s->offset += l;
+    len -= l;
+  }
+
+  return 0;
+}
+
+
+/*
+ * Copy len bytes to fd.
+ *
+ * All-zero blocks are skipped, leaving holes (like 'cpio --sparse').
+ *
+ * Returns 0 on success.
+ */
+int ar_copy(ar_stream_t *s, int fd, uint64_t len)
+{
+  static const unsigned char zero[AR_BLOCK_SIZE];
+  uint64_t total = len;
+  unsigned char *p;
+  size_t l, blk;
+  ssize_t i;
+  int hole = 0;
+
+  while(len) {
+    if(!(l = ar_fill(s, len < AR_BUF_SIZE ? len : AR_BUF_SIZE))) return -1;
+    if(l > len) l = len;
+
+    p = s->buf + s->pos;
+
+    while(l) {
+      // look for a run of data blocks
+      for(blk = 0; blk < l; blk += AR_BLOCK_SIZE) {
+        if(blk + AR_BLOCK_SIZE <= l && !memcmp(p + blk, zero, AR_BLOCK_SIZE)) break;
+      }
+      if(blk > l) blk = l;
+
+      if(blk) {
+        i = write(fd, p, blk);
+        if(i < 0 && errno == EINTR) continue;
+        if(i <= 0) return -1;
+        hole = 0;
+      }
+      else {
+        // hole
+        i = AR_BLOCK_SIZE;
+        if(lseek(fd, i, SEEK_CUR) == -1) return -1;
+        hole = 1;
+      }
+
+      p += i;
+      l -= i;
+      len -= i;
+      s->pos += i;
+      s->offset += i;
+    }
+  }
+
+  if(hole && ftruncate(fd, total)) return -1;
+
+  return 0;
+}
+
+
+/*
+ * Parse number in cpio/tar header.
+ *
+ * tar uses base-256 encoding for large numbers.
+ */
+uint64_t ar_num(char *str, unsigned len, int base)
+{
+  char buf[32];
+  uint64_t u = 0;
+
+  if(base == 8 && (*str & 0x80)) {
+    // base-256; ignore negative numbers
+    if(*str & 0x40) return 0;
+    u = *str++ & 0x3f;
+    while(--len) u = (u << 8) + (unsigned char) *str++;
+
+    return u;
+  }
+
+  if(len >= sizeof buf) len = sizeof buf - 1;
+  memcpy(buf, str, len);
+  buf[len] = 0;
+
+  return strtoull(buf, NULL, base);
+}
+
+
+/*
+ * Unpack cpio archive (newc & odc format).
+ */
+int ar_cpio(ar_ctx_t *ctx, ar_stream_t *s)
+{
+  char hdr[110];
+  ar_entry_t ae;
+  unsigned namesize, odc;
+  uint64_t start;
+  int err = 0;
+
+  for(;;) {
+    memset(&ae, 0, sizeof ae);
+
+    start = s->offset;
+
+    if(ar_read(s, hdr, 6) != 6 || memcmp(hdr, "07070", 5)) {
+      log_info("cpio: bad header at 0x%llx\n", (unsigned long long) start);
+      return -1;
+    }
+
+    odc = hdr[5] == '7';
+
+    if(odc) {
+      if(ar_read(s, hdr + 6, 70) != 70) return -1;
+      ae.ino = ar_num(hdr + 12, 6, 8);
+      ae.mode = ar_num(hdr + 18, 6, 8);
+      ae.uid = ar_num(hdr + 24, 6, 8);
+      ae.gid = ar_num(hdr + 30, 6, 8);
+      ae.nlink = ar_num(hdr + 36, 6, 8);
+      ae.rdev = ar_num(hdr + 42, 6, 8);
+      ae.mtime = ar_num(hdr + 48, 11, 8);
+      namesize = ar_num(hdr + 59, 6, 8);
+      ae.size = ar_num(hdr + 65, 11, 8);
+    }
+    else if(hdr[5] == '1' || hdr[5] == '2') {
+      if(ar_read(s, hdr + 6, 104) != 104) return -1;
+      ae.ino = ar_num(hdr + 6, 8, 16);
+      ae.mode = ar_num(hdr + 14, 8, 16);
+      ae.uid = ar_num(hdr + 22, 8, 16);
+      ae.gid = ar_num(hdr + 30, 8, 16);
+      ae.nlink = ar_num(hdr + 38, 8, 16);
+      ae.mtime = ar_num(hdr + 46, 8, 16);
+      ae.size = ar_num(hdr + 54, 8, 16);
+      ae.rdev = makedev(ar_num(hdr + 78, 8, 16), ar_num(hdr + 86, 8, 16));
+      namesize = ar_num(hdr + 94, 8, 16);
+    }
+    else {
+      return AR_UNSUPPORTED;
+    }
+
+    if(!namesize || namesize > 0x10000) return -1;
+
+    ae.name = malloc(namesize + 1);
+    if(ar_read(s, ae.name, namesize) != namesize) {
+      free(ae.name);
+      return -1;
+    }
+    ae.name[namesize] = 0;
+
+    // newc: header + name are padded to 4 bytes
+    if(!odc) ar_skip(s, (4 - (s->offset - start) % 4) % 4);
+
+    if(!strcmp(ae.name, "TRAILER!!!")) {
+      free(ae.name);
+      break;
+    }
+
+    // symlink target is stored as file data
+    if(S_ISLNK(ae.mode)) {
+      if(ae.size > 0x10000) {
+        free(ae.name);
+        return -1;
+      }
+      ae.link = calloc(1, ae.size + 1);
+      if(ar_read(s, ae.link, ae.size) != ae.size) err = -1;
+      ae.size = 0;
+    }
+
+    if(!err) err = ar_extract_entry(ctx, s, &ae);
+
+    if(!err && !odc) ar_skip(s, (4 - s->offset % 4) % 4);
+
+    free(ae.name);
+    free(ae.link);
+
+    if(err) break;
+
+    ar_progress(ctx, s);
+  }
+
+  return err;
+}
+
+
+/*
+ * Unpack tar archive (ustar format, with pax & GNU extensions for long
+ * names and large files).
+ */
+int ar_tar(ar_ctx_t *ctx, ar_stream_t *s)
+{
+  char hdr[512], *long_name = NULL, *long_link = NULL, *pax = NULL, *p, *key, *val;
+  ar_entry_t ae;
+  unsigned zero_blocks = 0;
+  uint64_t pax_size = 0, u;
+  int err = 0, i;
+  char type;
+
+  for(;;) {
+    if(ar_read(s, hdr, sizeof hdr) != sizeof hdr) {
+      // missing end marker is fine
+      break;
+    }
+
+    for(i = 0; i < (int) sizeof hdr && !hdr[i]; i++);
+    if(i == sizeof hdr) {
+      if(++zero_blocks == 2) break;
+      continue;
+    }
+    zero_blocks = 0;
+
+    if(memcmp(hdr + 257, "ustar", 5)) {
+      log_info("tar: bad header at 0x%llx\n", (unsigned long long) s->offset - sizeof hdr);
+      err = -1;
+      break;
+    }
+
+    memset(&ae, 0, sizeof ae);
+
+    type = hdr[156];
+    ae.mode = ar_num(hdr + 100, 8, 8) & 07777;
+    ae.uid = ar_num(hdr + 108, 8, 8);
+    ae.gid = ar_num(hdr + 116, 8, 8);
+    ae.size = ar_num(hdr + 124, 12, 8);
+    ae.mtime = ar_num(hdr + 136, 12, 8);
+    ae.rdev = makedev(ar_num(hdr + 329, 8, 8), ar_num(hdr + 337, 8, 8));
+
+    // extended headers: read contents and apply to next entry
+    if(type == 'x' || type == 'g' || type == 'L' || type == 'K') {
+      if(ae.size > 0x100000) {
+        err = -1;
+        break;
+      }
+      p = calloc(1, ae.size + 1);
+      if(ar_read(s, p, ae.size) != ae.size) {
+        free(p);
+        err = -1;
+        break;
+      }
+      ar_skip(s, (512 - ae.size % 512) % 512);
+
+      if(type == 'L') {
+        free(long_name);
+        long_name = p;
+      }
+      else if(type == 'K') {
+        free(long_link);
+        long_link = p;
+      }
+      else if(type == 'x') {
+        // records: '<len> <key>=<value>\n'
+        for(key = p; key < p + ae.size; key += u) {
+          u = strtoul(key, &val, 10);
+          if(!u || key + u > p + ae.size) break;
+          val = strchr(val, ' ');
+          if(!val) break;
+          val++;
+          key[u - 1] = 0;
+          if(!strncmp(val, "path=", 5)) {
+            free(long_name);
+            long_name = strdup(val + 5);
+          }
+          else if(!strncmp(val, "linkpath=", 9)) {
+            free(long_link);
+            long_link = strdup(val + 9);
+          }
+          else if(!strncmp(val, "size=", 5)) {
+            pax_size = strtoull(val + 5, NULL, 10);
+          }
+        }
+        free(pax);
+        pax = p;
+        continue;
+      }
+      else {
+        // global header: ignore
+        free(p);
+      }
+      continue;
+    }
+
+    if(long_name) {
+      ae.name = long_name;
+      long_name = NULL;
+    }
+    else {
+      // name = prefix + '/' + name
+      asprintf(&ae.name, "%.*s%s%.*s",
+        (int) strnlen(hdr + 345, 155), hdr + 345,
+        hdr[345] ? "/" : "",
+        (int) strnlen(hdr, 100), hdr
+      );
+    }
+
+    if(long_link) {
+      ae.link = long_link;
+      long_link = NULL;
+    }
+    else {
+      ae.link = strndup(hdr + 157, 100);
+    }
+
+    if(pax_size) {
+      ae.size = pax_size;
+      pax_size = 0;
+    }
+    free(pax);
+    pax = NULL;
+
+    switch(type) {
+      case '0':
+      case '7':
+      case 0:
+        ae.mode |= S_IFREG;
+        break;
+      case '1':
+        ae.mode |= S_IFREG;
+        ae.hardlink = 1;
+        ae.size = 0;
+        break;
+      case '2':
+        ae.mode |= S_IFLNK;
+        ae.size = 0;
+        break;
+      case '3':
+        ae.mode |= S_IFCHR;
+        ae.size = 0;
+        break;
+      case '4':
+        ae.mode |= S_IFBLK;
+        ae.size = 0;
+        break;
+      case '5':
+        ae.mode |= S_IFDIR;
+        ae.size = 0;
+        break;
+      case '6':
+        ae.mode |= S_IFIFO;
+        ae.size = 0;
+        break;
+      default:
+        log_info("tar: %s: unsupported type '%c', skipped\n", ae.name, type);
+        ae.mode = 0;
+        break;
+    }
+
+    u = ae.size;
+
+    if(ae.mode) {
+      err = ar_extract_entry(ctx, s, &ae);
+    }
+    else {
+      err = ar_skip(s, ae.size);
+    }
+
+    if(!err) ar_skip(s, (512 - u % 512) % 512);
+
+    free(ae.name);
+    free(ae.link);
+
+    if(err) break;
+
+    ar_progress(ctx, s);
+  }
+
+  free(long_name);
+  free(long_link);
+  free(pax);
+
+  return err;
+}
+
+
+/*
+ * Get offset of rpm payload.
+ *
+ * Returns 0 if fd does not look like an rpm.
+ */
+off_t ar_rpm_payload(int fd)
+{
+  unsigned char buf[16];
+  off_t ofs = 96;	/* rpm lead */
+  unsigned nindex, hsize;
+  int i;
+
+  if(pread(fd, buf, 4, 0) != 4 || memcmp(buf, "\xed\xab\xee\xdb", 4)) return 0;
+
+  // signature header, then main header
+  for(i = 0; i < 2; i++) {
+    if(pread(fd, buf, sizeof buf, ofs) != sizeof buf || memcmp(buf, "\x8e\xad\xe8\x01", 4)) return 0;
+    nindex = (buf[8] << 24) + (buf[9] << 16) + (buf[10] << 8) + buf[11];
+    hsize = (buf[12] << 24) + (buf[13] << 16) + (buf[14] << 8) + buf[15];
+    ofs += sizeof buf + 16 * (off_t) nindex + hsize;
+    // signature header is padded to 8 bytes
+    if(i == 0) ofs = (ofs + 7) & ~(off_t) 7;
+  }
+
+  return ofs;
+}
+
+
+/*
+ * Remove leading '/' and './' from file name (like cpio
+ * --no-absolute-filenames).
+ *
+ * Returns NULL if name contains '..' components.
+ */
+char *ar_clean_name(char *name)
+{
+  char *s;
+
+  for(;;) {
+    if(*name == '/') {
+      name++;
+    }
+    else if(name[0] == '.' && name[1] == '/') {
+      name += 2;
+    }
+    else {
+      break;
+    }
+  }
+
+  for(s = name; (s = strstr(s, "..")); s += 2) {
+    if((s == name || s[-1] == '/') && (!s[2] || s[2] == '/')) return NULL;
+  }
+
+  return name;
+}
+
+
+/*
+ * Open parent directory of name (relative to ctx->dir_fd) and set *base to
+ * the last path component.
+ *
+ * No symlinks are followed: earlier archive members might be symlinks
+ * pointing anywhere (think 'x -> /etc' followed by 'x/passwd'). If create
+ * is set, missing directories are created.
+ *
+ * Returns directory fd (ctx->dir_fd if name has no directory part - don't
+ * close it then) or -1.
+ */
+int ar_open_parent(ar_ctx_t *ctx, char *name, char **base, int create)
+{
+  char *dir, *s, *next;
+  int fd, fd2;
+
+  if(!(s = strrchr(name, '/'))) {
+    *base = name;
+
+    return ctx->dir_fd;
+  }
+
+  *base = s + 1;
+  dir = strndup(name, s - name);
+
+#ifdef SYS_openat2
+  {
+    struct open_how how = {
+      .flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC,
+      .resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS | RESOLVE_NO_MAGICLINKS
+    };
+
+    fd = syscall(SYS_openat2, ctx->dir_fd, dir, &how, sizeof how);
+
+    // else: not supported, or directories must be created
+    if(fd >= 0 || (errno != ENOSYS && errno != EPERM && (errno != ENOENT || !create))) {
+      free(dir);
+
+      return fd;
+    }
+  }
+#endif
+
+  // walk the path, one component at a time
+  fd = ctx->dir_fd;
+
+  for(s = dir; s && fd != -1; s = next) {
+    if((next = strchr(s, '/'))) *next++ = 0;
+    if(!*s || !strcmp(s, ".")) continue;
+
+    fd2 = openat(fd, s, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if(fd2 == -1 && errno == ENOENT && create) {
+      mkdirat(fd, s, 0755);
+      fd2 = openat(fd, s, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    }
+
+    if(fd != ctx->dir_fd) close(fd);
+    fd = fd2;
+  }
+
+  free(dir);
+
+  return fd;
+}
+
+
+/*
+ * Create archive member and read its data.
+ *
+ * Existing files are replaced (like cpio -u); ownership, permissions and
+ * modification time are kept (cpio -m, tar -p).
+ */
+int ar_extract_entry(ar_ctx_t *ctx, ar_stream_t *s, ar_entry_t *ae)
+{
+  ar_hlink_t *hl = NULL;
+  char *name, *base;
+  slist_t *sl;
+  int dir_fd, i, err;
+
+  for(sl = ctx->file_list; sl; sl = sl->next) {
+    if(!fnmatch(sl->key, ae->name, 0)) break;
+  }
+
+  if(
+    (ctx->file_list && !sl) ||
+    !(name = ar_clean_name(ae->name)) ||
+    !*name
+  ) {
+    if(ae->name && !ar_clean_name(ae->name)) log_info("%s: unsafe name, skipped\n", ae->name);
+
+    return ar_skip(s, ae->size);
+  }
+
+  // tar: directories end with '/'
+  for(i = strlen(name); i > 1 && name[i - 1] == '/'; ) name[--i] = 0;
+
+  // cpio hard links: the data comes with the last link
+  if(ae->nlink > 1 && !S_ISDIR(ae->mode)) {
+    for(hl = ctx->hlinks; hl; hl = hl->next) {
+      if(hl->ino == ae->ino) break;
+    }
+  }
+
+  if(ctx->sq) return ar_squash_entry(ctx, s, ae, name, hl);
+
+  if((dir_fd = ar_open_parent(ctx, name, &base, 1)) == -1) {
+    log_info("%s: unsafe path (%s), skipped\n", name, strerror(errno));
+
+    return ar_skip(s, ae->size);
+  }
+
+  err = ar_create_entry(ctx, s, ae, hl, name, dir_fd, base);
+
+  if(dir_fd != ctx->dir_fd) close(dir_fd);
+
+  return err;
+}
+
+
+/*
+ * Create archive member 'base' in directory dir_fd and read its data.
+ *
+ * name is the full name (for messages and hard links).
+ */
+int ar_create_entry(ar_ctx_t *ctx, ar_stream_t *s, ar_entry_t *ae, ar_hlink_t *hl, char *name, int dir_fd, char *base)
+{
+  struct timespec ts[2] = { { .tv_nsec = UTIME_OMIT }, { .tv_sec = ae->mtime } };
+  char *link, *link_base;
+  int fd, link_fd, i, err = 0;
+
+  if(S_ISDIR(ae->mode)) {
+    if(mkdirat(dir_fd, base, ae->mode & 07777) && errno != EEXIST) {
+      perror_info(name);
+
+      return 0;
+    }
+    // an existing symlink must not be followed
+    if((fd = openat(dir_fd, base, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)) == -1) {
+      perror_info(name);
+
+      return 0;
+    }
+    fchown(fd, ae->uid, ae->gid);
+    fchmod(fd, ae->mode & 07777);
+    close(fd);
+    ctx->files++;
+
+    return 0;
+  }
+
+  unlinkat(dir_fd, base, 0);
+
+  if(hl || ae->hardlink) {
+    link = hl ? hl->name : ar_clean_name(ae->link ?: "");
+    if(!link || !*link) return ar_skip(s, ae->size);
+
+    if((link_fd = ar_open_parent(ctx, link, &link_base, 0)) == -1) {
+      log_info("%s: unsafe link target %s, skipped\n", name, link);
+
+      return ar_skip(s, ae->size);
+    }
+
+    i = linkat(link_fd, link_base, dir_fd, base, 0);
+
+    if(link_fd != ctx->dir_fd) close(link_fd);
+
+    if(i) {
+      perror_info(name);
+
+      return ar_skip(s, ae->size);
+    }
+
+    if(!ae->size) {
+      ctx->files++;
+
+      return 0;
+    }
+
+    // cpio: data comes with the last link; write it through the new link
+  }
+
+  if(S_ISLNK(ae->mode)) {
+    if(symlinkat(ae->link ?: "", dir_fd, base)) {
+      perror_info(name);
+
+      return 0;
+    }
+    fchownat(dir_fd, base, ae->uid, ae->gid, AT_SYMLINK_NOFOLLOW);
+    utimensat(dir_fd, base, ts, AT_SYMLINK_NOFOLLOW);
+    ctx->files++;
+
+    return 0;
+  }
+
+  if(S_ISCHR(ae->mode) || S_ISBLK(ae->mode) || S_ISFIFO(ae->mode)) {
+    if(mknodat(dir_fd, base, ae->mode, ae->rdev)) {
+      perror_info(name);
+    }
+    else {
+      fchownat(dir_fd, base, ae->uid, ae->gid, AT_SYMLINK_NOFOLLOW);
+      utimensat(dir_fd, base, ts, AT_SYMLINK_NOFOLLOW);
+      ctx->files++;
+    }
+
+    return ar_skip(s, ae->size);
+  }
+
+  if(!S_ISREG(ae->mode)) {
+    log_info("%s: unsupported file type 0%o, skipped\n", name, ae->mode & S_IFMT);
+
+    return ar_skip(s, ae->size);
+  }
+
+  fd = openat(dir_fd, base, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC | O_LARGEFILE, 0600);
+  if(fd == -1) {
+    perror_info(name);
+
+    return ar_skip(s, ae->size);
+  }
+
+  if(ae->size) {
+    if(ar_copy(s, fd, ae->size)) {
+      log_info("%s: write error or unexpected end of archive\n", name);
+      err = -1;
+    }
+    ctx->bytes += ae->size;
+  }
+
+  fchown(fd, ae->uid, ae->gid);
+  fchmod(fd, ae->mode & 07777);
+  futimens(fd, ts);
+
+  close(fd);
+
+  ctx->files++;
+
+  if(ae->nlink > 1 && !hl) {
+    hl = calloc(1, sizeof *hl);
+    hl->ino = ae->ino;
+    hl->name = strdup(name);
+    hl->next = ctx->hlinks;
+    ctx->hlinks = hl;
+  }
+
+  return err;
+}
+
+
+/*
+ * Add archive member to squashfs image.
+ */
+int ar_squash_entry(ar_ctx_t *ctx, ar_stream_t *s, ar_entry_t *ae, char *name, ar_hlink_t *hl)
+{
+  sq_node_t *node = NULL;
+  char *link;
+  uint64_t len;
+  size_t l;
+  int err = 0;
+
+  if(hl || ae->hardlink) {
+    if(hl) {
+      node = hl->node;
+    }
+    else if((link = ar_clean_name(ae->link ?: "")) && *link) {
+      node = sq_lookup(ctx->sq, link);
+    }
+
+    if(sq_link(ctx->sq, name, node)) {
+      log_info("%s: hard link failed\n", name);
+
+      return ar_skip(s, ae->size);
+    }
+
+    // odc cpio: every link comes with the data
+    if(hl && hl->data) return ar_skip(s, ae->size);
+  }
+  else {
+    node = sq_add(ctx->sq, name, ae->mode, ae->uid, ae->gid, ae->mtime, ae->link, ae->rdev);
+    if(!node) {
+      log_info("%s: unsupported file type 0%o or name too long, skipped\n", name, ae->mode & S_IFMT);
+
+      return ar_skip(s, ae->size);
+    }
+  }
+
+  ctx->files++;
+
+  if(!S_ISREG(ae->mode)) return ar_skip(s, ae->size);
+
+  if(ae->size) {
+    err = sq_file_start(ctx->sq, node, ae->size);
+
+    for(len = ae->size; !err && len; len -= l) {
+      if(!(l = ar_fill(s, len < AR_BUF_SIZE ? len : AR_BUF_SIZE))) {
+        err = -1;
+        break;
+      }
+      if(l > len) l = len;
+      err = sq_file_write(ctx->sq, s->buf + s->pos, l);
+      s->pos += l;
+      s->offset += l;
+    }
+
+    if(sq_file_end(ctx->sq)) err = -1;
+
+    if(err) log_info("%s: write error or unexpected end of archive\n", name);
+
+    ctx->bytes += ae->size;
+  }
+
+  if(ae->nlink > 1 && !hl && !ae->hardlink) {
+    hl = calloc(1, sizeof *hl);
+    hl->ino = ae->ino;
+    hl->name = strdup(name);
+    hl->next = ctx->hlinks;
+    ctx->hlinks = hl;
+  }
+
+  if(hl) {
+    hl->node = node;
+    if(ae->size) hl->data = 1;
+  }
+
+  return err;
+}
+
+
+/*
+ * Log progress in 10% steps.
+ *
+ * This is based on the position in the archive file, which is shared with
+ * the decompressor (or zlib), if any.
+ */
+void ar_progress(ar_ctx_t *ctx, ar_stream_t *s)
+{
+  off_t ofs;
+  unsigned u;
+
+  if(ctx->src_size <= 0) return;
+
+  ofs = s->pid || s->gz ? lseek(s->src_fd, 0, SEEK_CUR) : (off_t) s->offset;
+  if(ofs < 0) return;
+
+  u = (ofs * 10) / ctx->src_size;
+  if(u > ctx->progress && u <= 10) {
+    ctx->progress = u;
+    log_debug("unpacking: %u%%, %u files, %llu bytes\n", u * 10, ctx->files, (unsigned long long) ctx->bytes);
+  }
+}
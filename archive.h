@@ -0,0 +1,11 @@
+/*
+ *
+ * archive.h     Header file for archive.c
+ *
+ */
+
+// archive_extract() return value: use external tools
+#define AR_UNSUPPORTED	-2
+
+int archive_extract(char *file, char *type, char *compr, char *dir, slist_t *file_list);
+int archive_squash(char *file, char *type, char *compr, char *image, slist_t *file_list);
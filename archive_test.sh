@@ -0,0 +1,59 @@
+#! /bin/bash
+
+# Check that archive members can't be written outside the target directory.
+#
+# test/escape.* contain a symlink 'x -> ../escape', followed by the files
+# 'x/passwd' and 'x/sub/deep', a directory 'x/' with mode 0, and (tar) a
+# hard link 'z' to 'x/secret'. Only the harmless member 'ok/file' must be
+# unpacked; '../escape' must stay untouched.
+#
+# The tar archive is gzip compressed and is unpacked without any gzip
+# binary in PATH (archive.c uses zlib).
+
+# exit on error immediately
+set -e
+
+DIR=$(mktemp -d)
+
+function cleanup()
+{
+  chmod -R u+rwx "$DIR" 2> /dev/null || true
+  rm -rf "$DIR"
+}
+
+trap cleanup EXIT
+
+function fail()
+{
+  echo "ERROR: $1"
+  exit 1
+}
+
+function check_archive()
+{
+  local archive=$1 type=$2
+
+  echo "$archive: expect nothing outside the target directory"
+
+  cleanup
+  mkdir -p "$DIR/root" "$DIR/escape"
+  echo secret > "$DIR/escape/secret"
+  chmod 755 "$DIR/escape"
+
+  env PATH=/nonexistent ./test/archivetest "test/$archive" $type "$DIR/root" || fail "unpacking failed"
+
+  [ "$(cat "$DIR/root/ok/file")" = hello ] || fail "ok/file missing"
+  [ -L "$DIR/root/x" ] || fail "symlink x missing"
+  [ "$(ls -A "$DIR/escape")" = secret ] || fail "files created outside: $(ls -A "$DIR/escape" | tr '\n' ' ')"
+  [ "$(stat -c %a "$DIR/escape")" = 755 ] || fail "mode of directory outside changed"
+  [ ! -e "$DIR/root/z" ] || fail "hard link to file outside created"
+}
+
+###############################################################################
+
+make -s -C test archivetest
+
+check_archive escape.tar.gz tar
+check_archive escape.cpio cpio
+
+echo "archive test ok"
@@ -33,6 +33,7 @@
 #include "settings.h"
 #include "url.h"
 #include "checkmedia.h"
+#include "trace.h"
 
 static int driver_is_active(hd_t *hd);
 static void auto2_progress(char *pos, char *msg);
@@ -59,12 +60,17 @@ int auto2_init()
   char *device;
   slist_t *sl;
 
+  trace_begin("hardware", NULL);
   auto2_scan_hardware();
+  trace_end();
 
   /* set default repository: try dvd drives */
   if(!config.url.install) {
     install_unset = 1;
-    config.url.install = url_set(config.defaultrepo ? config.defaultrepo->key : "cd:/");
+    config.url.install = url_set(
+      config.url.mirrors ? config.url.mirrors->key :
+      config.defaultrepo ? config.defaultrepo->key : "cd:/"
+    );
   }
   if(!config.url.instsys) {
     config.url.instsys = url_set(config.url.instsys_default ?: config.rescue ? config.rescueimage : config.rootimage);
@@ -1068,7 +1074,6 @@ void auto2_driverupdate(url_t *url)
 int auto2_add_extension(char *extension)
 {
   int err = 0;
-  char *argv[3] = { };
   char *s, *cmd = NULL;
   slist_t *sl;
 
@@ -1128,9 +1133,7 @@ int auto2_add_extension(char *extension)
     for(sl = config.url.instsys_list; sl; sl = sl->next) {
       log_info("integrating %s (%s)\n", sl->key, sl->value);
       if(!config.test) {
-        argv[1] = sl->value;
-        argv[2] = "/";
-        util_lndir_main(3, argv);
+        util_layer_add(sl->value, "/");
         if(util_check_exist2(sl->value, ".init") == 'r') {
           strprintf(&cmd, "%s/.init %s", sl->value, sl->value);
           lxrc_run(cmd);
@@ -1180,7 +1183,8 @@ int auto2_remove_extension(char *extension)
                 lxrc_run(cmd);
                 str_copy(&cmd, NULL);
               }
-              util_umount(sl->key);
+              // still in use: leave it mounted
+              if(!util_layer_remove(sl->key, "/")) util_umount(sl->key);
             }
           }
         }
@@ -4,30 +4,93 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 #include "global.h"
 #include "dialog.h"
 #include "window.h"
 #include "util.h"
 #include "keyboard.h"
+#include "file.h"
 
 #include <mediacheck.h>
 
-static int check_media_device(char *device);
+// read ahead in chunks of this size...
+#define CHECK_RA_CHUNK		(4 << 20)
+// ...but at most this much (or 2% of the medium) ahead of the checking thread
+#define CHECK_RA_WINDOW		(32 << 20)
+
+// number of threads used by check_media_files()
+#define CHECK_FILE_THREADS	4
+#define CHECK_FILE_BUF		(1 << 20)
+
+// medium to check in check_media_devices()
+typedef struct {
+  char *device;
+  mediacheck_t *media;
+  pthread_t thread;		// runs mediacheck_calculate_digest()
+  pthread_t ra_thread;		// reads ahead, see check_media_readahead()
+  int fd;			// used for readahead
+  uint64_t size;		// bytes to check
+  unsigned percent;		// progress
+  unsigned running:1;		// thread has been started
+  unsigned ra_running:1;	// ra_thread has been started
+  unsigned done:1;		// check finished
+} check_job_t;
+
+// file to check in check_media_files()
+typedef struct {
+  char *name;			// path relative to medium root
+  char *digest;			// digest type
+  char *value;			// expected digest
+  uint64_t size;
+  unsigned missing:1;		// can't be read
+  unsigned skipped:1;		// unsupported digest type
+} check_file_t;
+
+typedef struct {
+  char *dir;			// mountpoint
+  check_file_t *list;
+  unsigned len, next, done;
+  uint64_t size, size_done;	// bytes
+  check_file_t *bad;		// first corrupt file
+} check_files_t;
+
+static mediacheck_t *check_media_init(char *device, char **msg);
+static int check_media_result(mediacheck_t *media, char **msg);
+static int check_media_devices(slist_t *devices);
+static void *check_media_worker(void *arg);
+static void *check_media_readahead(void *arg);
+static void check_media_status(window_t *win, check_job_t *jobs, unsigned len, struct timespec *t0);
+static int check_media_files(slist_t *devices);
+static int check_media_files_device(char *device, char **msg);
+static void *check_media_file_worker(void *arg);
 static int progress(unsigned percent);
 
-window_t win;
+// protects the job list while checks are running
+static pthread_mutex_t check_lock = PTHREAD_MUTEX_INITIALIZER;
+// signalled on progress
+static pthread_cond_t check_cond = PTHREAD_COND_INITIALIZER;
+// set to stop the checks, protected by check_lock as well
+static int check_abort;
+// job handled by the current thread, for progress()
+static __thread check_job_t *check_job;
 
 /*
- * Check single SUSE installation medium.
+ * Prepare check of a single SUSE installation medium.
  *
  * device: device name of the device to check
+ * msg: error message, if any
  *
- * return 1 if ok, else 0
+ * return media info or NULL if there's nothing to check
  */
-int check_media_device(char *device)
+mediacheck_t *check_media_init(char *device, char **msg)
 {
-  int i, ok;
+  int i;
   mediacheck_t *media = NULL;
 
   log_info("digest_media_verify(%s)\n", device);
@@ -46,18 +109,18 @@ int check_media_device(char *device)
     media->err ||
     (media->iso_blocks && media->pad_blocks >= media->iso_blocks)
   ) {
-    dia_message("This is not a SUSE medium.", MSGTYPE_ERROR);
-    config.manual=1;
-    return 1;
+    str_copy(msg, "This is not a SUSE medium.");
+    mediacheck_done(media);
+    return NULL;
   }
 
   if(
     !mediacheck_digest_valid(media->digest.iso) &&
     !mediacheck_digest_valid(media->digest.part)
   ) {
-    dia_message("No digests to check.", MSGTYPE_ERROR);
-    config.manual=1;
-    return 1;
+    str_copy(msg, "No digests to check.");
+    mediacheck_done(media);
+    return NULL;
   }
 
   if(media->app_id) log_info("app: %s\n", media->app_id);
@@ -98,9 +161,20 @@ int check_media_device(char *device)
     log_info("part ref: %s\n", mediacheck_digest_hex_ref(media->digest.part));
   }
 
-  dia_status_on(&win, media->app_id);
-  mediacheck_calculate_digest(media);
-  dia_status_off(&win);
+  return media;
+}
+
+
+/*
+ * Log media check result.
+ *
+ * msg: result message
+ *
+ * return 1 if ok, else 0
+ */
+int check_media_result(mediacheck_t *media, char **msg)
+{
+  int ok;
 
   log_info("media check: %s\n", media->abort ? "aborted" : "finished");
 
@@ -151,35 +225,568 @@ int check_media_device(char *device)
   ok = mediacheck_digest_ok(media->digest.iso) || mediacheck_digest_ok(media->digest.part);
 
   if(ok) {
-    dia_message("No errors found.", MSGTYPE_INFO);
+    str_copy(msg, "No errors found.");
   }
   else if(media->abort) {
-    dia_message("Media check canceled.", MSGTYPE_INFO);
+    str_copy(msg, "Media check canceled.");
   }
   else {
-    char buf[256];
-
     if(media->err_block) {
-      sprintf(buf, "Error reading block %u.", media->err_block);
+      strprintf(msg, "Error reading block %u.", media->err_block);
     }
     else {
-      sprintf(buf, "Checksum wrong.");
+      str_copy(msg, "Checksum wrong.");
     }
-    sprintf(buf + strlen(buf), "\nThis medium is broken.");
+    strprintf(msg, "%s\nThis medium is broken.", *msg);
+  }
+
+  return ok;
+}
+
+
+/*
+ * Check SUSE installation media.
+ *
+ * devices: list of devices to check
+ *
+ * All media are checked in parallel. While a medium is checked, a separate
+ * thread reads ahead so reading and calculating the digest overlap.
+ *
+ * return 1 if ok, else 0
+ */
+int check_media_devices(slist_t *devices)
+{
+  int ok = 1, media_ok, aborted = 0, failed = 0, key;
+  unsigned u, len = 0;
+  char *msg = NULL, *buf = NULL;
+  check_job_t *jobs, *job;
+  slist_t *sl;
+  window_t win;
+  struct timespec t0, t;
+
+  if(config.mediacheck_files) return check_media_files(devices);
+
+  for(sl = devices; sl; sl = sl->next) len++;
+
+  jobs = calloc(len + 1, sizeof *jobs);
+
+  for(len = 0, sl = devices; sl; sl = sl->next) {
+    job = jobs + len;
+    job->device = sl->key;
+    if(!(job->media = check_media_init(job->device, &msg))) {
+      if(devices->next) {
+        strprintf(&buf, "%s%s%s: %s", buf ?: "", buf ? "\n" : "", job->device, msg);
+      }
+      else {
+        str_copy(&buf, msg);
+      }
+      config.manual = 1;
+      continue;
+    }
+    job->size = (uint64_t) (job->media->full_blocks ?: job->media->iso_blocks) << 9;
+    job->fd = open(long_dev(job->device), O_RDONLY | O_CLOEXEC);
+    len++;
+  }
+
+  if(!len) {
     dia_message(buf, MSGTYPE_ERROR);
-    config.manual=1;
+    str_copy(&buf, NULL);
+    str_copy(&msg, NULL);
+    free(jobs);
+
+    return 1;
+  }
+
+  if(len == 1) {
+    str_copy(&msg, jobs->media->app_id);
+  }
+  else {
+    strprintf(&msg, "Checking %u media", len);
+  }
+
+  dia_status_on(&win, msg);
+
+  check_abort = 0;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
+  pthread_mutex_lock(&check_lock);
+
+  for(u = 0; u < len; u++) {
+    job = jobs + u;
+    job->running = !pthread_create(&job->thread, NULL, check_media_worker, job);
+    if(!job->running) {
+      log_info("%s: failed to start thread\n", job->device);
+      job->done = 1;
+      continue;
+    }
+    if(job->fd >= 0) {
+      job->ra_running = !pthread_create(&job->ra_thread, NULL, check_media_readahead, job);
+    }
+  }
+
+  for(;;) {
+    for(u = 0; u < len && jobs[u].done; u++);
+    if(u == len) break;
+
+    check_media_status(&win, jobs, len, &t0);
+
+    pthread_mutex_unlock(&check_lock);
+    key = kbd_getch_old(0);
+    pthread_mutex_lock(&check_lock);
+    if(key == KEY_ESC) check_abort = 1;
+
+    clock_gettime(CLOCK_REALTIME, &t);
+    t.tv_nsec += 200 * 1000000;
+    if(t.tv_nsec >= 1000000000) {
+      t.tv_sec++;
+      t.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&check_cond, &check_lock, &t);
   }
 
-  mediacheck_done(media);
+  check_media_status(&win, jobs, len, &t0);
+
+  pthread_mutex_unlock(&check_lock);
+
+  for(u = 0; u < len; u++) {
+    job = jobs + u;
+    if(job->running) pthread_join(job->thread, NULL);
+    if(job->ra_running) pthread_join(job->ra_thread, NULL);
+    if(job->fd >= 0) close(job->fd);
+  }
+
+  dia_status_off(&win);
+
+  for(u = 0; u < len; u++) {
+    job = jobs + u;
+    if(len > 1) log_info("%s:\n", job->device);
+    media_ok = job->running && check_media_result(job->media, &msg);
+    if(!job->running) str_copy(&msg, "Media check failed.");
+    if(!media_ok) {
+      ok = 0;
+      if(job->media->abort) {
+        aborted = 1;
+      }
+      else {
+        failed = 1;
+      }
+    }
+    if(len > 1 || buf) {
+      strprintf(&buf, "%s%s%s: %s", buf ?: "", buf ? "\n" : "", job->device, msg);
+    }
+    else {
+      str_copy(&buf, msg);
+    }
+    mediacheck_done(job->media);
+  }
+
+  if(ok) {
+    dia_message(buf, MSGTYPE_INFO);
+  }
+  else if(aborted && !failed) {
+    dia_message(buf, MSGTYPE_INFO);
+  }
+  else {
+    dia_message(buf, MSGTYPE_ERROR);
+    config.manual = 1;
+  }
+
+  str_copy(&buf, NULL);
+  str_copy(&msg, NULL);
+  free(jobs);
 
   return ok;
 }
 
 
 /*
- * Check SUSE installation medium.
+ * Thread calculating the digests of a medium.
+ */
+void *check_media_worker(void *arg)
+{
+  check_job_t *job = arg;
+
+  check_job = job;
+
+  mediacheck_calculate_digest(job->media);
+
+  pthread_mutex_lock(&check_lock);
+  job->done = 1;
+  pthread_cond_broadcast(&check_cond);
+  pthread_mutex_unlock(&check_lock);
+
+  return NULL;
+}
+
+
+/*
+ * Thread reading ahead of check_media_worker().
  *
- * device: device name of the device to check or NULL
+ * Data are read into the page cache; the window is limited so we don't
+ * evict what hasn't been checked yet.
+ */
+void *check_media_readahead(void *arg)
+{
+  check_job_t *job = arg;
+  uint64_t pos = 0, window;
+
+  window = job->size / 50;
+  if(window < CHECK_RA_WINDOW) window = CHECK_RA_WINDOW;
+
+  pthread_mutex_lock(&check_lock);
+
+  while(!job->done && !check_abort && pos < job->size) {
+    if(pos >= job->percent * job->size / 100 + window) {
+      pthread_cond_wait(&check_cond, &check_lock);
+      continue;
+    }
+
+    pthread_mutex_unlock(&check_lock);
+    if(readahead(job->fd, pos, CHECK_RA_CHUNK)) pos = job->size;
+    pos += CHECK_RA_CHUNK;
+    pthread_mutex_lock(&check_lock);
+  }
+
+  pthread_mutex_unlock(&check_lock);
+
+  return NULL;
+}
+
+
+/*
+ * Show overall progress, throughput, and estimated time left.
+ *
+ * Must be called with check_lock held.
+ */
+void check_media_status(window_t *win, check_job_t *jobs, unsigned len, struct timespec *t0)
+{
+  uint64_t size = 0, done = 0;
+  unsigned u, percent;
+  struct timespec t;
+  double secs, rate;
+  char buf[64];
+
+  for(u = 0; u < len; u++) {
+    size += jobs[u].size;
+    done += (jobs[u].done ? 100 : jobs[u].percent) * jobs[u].size / 100;
+  }
+
+  percent = size ? done * 100 / size : 0;
+
+  dia_status(win, percent);
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  secs = (t.tv_sec - t0->tv_sec) + (t.tv_nsec - t0->tv_nsec) / 1e9;
+
+  if(secs < 1 || !done) return;
+
+  rate = done / secs;
+
+  snprintf(buf, sizeof buf, "%.1f MB/s, %u:%02u left",
+    rate / (1 << 20),
+    (unsigned) ((size - done) / rate) / 60,
+    (unsigned) ((size - done) / rate) % 60
+  );
+
+  dia_status_info(win, buf);
+}
+
+
+/*
+ * Check SUSE installation media file by file.
+ *
+ * devices: list of devices to check
+ *
+ * Instead of reading the whole medium, verify the files listed in
+ * CHECKSUMS and repodata/repomd.xml. If config.mediacheck_files is 2,
+ * only the files needed to start the installation are checked.
+ *
+ * return 1 if ok, else 0
+ */
+int check_media_files(slist_t *devices)
+{
+  int ok = 1, media_ok, type = MSGTYPE_INFO;
+  char *msg = NULL, *buf = NULL;
+  slist_t *sl;
+
+  // check every medium, unless the user canceled
+  for(sl = devices; sl; sl = sl->next) {
+    media_ok = check_media_files_device(sl->key, &msg);
+    if(!media_ok) ok = 0;
+    if(media_ok < 0 || (!media_ok && !check_abort)) {
+      type = MSGTYPE_ERROR;
+      config.manual = 1;
+    }
+    if(devices->next) {
+      strprintf(&buf, "%s%s%s: %s", buf ?: "", buf ? "\n" : "", sl->key, msg);
+    }
+    else {
+      str_copy(&buf, msg);
+    }
+    if(!media_ok && check_abort) break;
+  }
+
+  dia_message(buf, type);
+
+  str_copy(&buf, NULL);
+  str_copy(&msg, NULL);
+
+  return ok;
+}
+
+
+/*
+ * Check files on a single medium.
+ *
+ * msg: result message
+ *
+ * return 1 if ok, 0 if not, -1 if there's nothing to check
+ */
+int check_media_files_device(char *device, char **msg)
+{
+  int ok = 1, key;
+  unsigned u, threads = 0;
+  char *dir, *path = NULL, *prefix = NULL, *s;
+  slist_t *sl, *sl0, *digests = NULL;
+  check_files_t files = { };
+  check_file_t *file;
+  pthread_t thread[CHECK_FILE_THREADS];
+  struct stat sbuf;
+  struct timespec t0, t;
+  window_t win;
+  double secs;
+
+  log_info("checkmedia: %s: checking files\n", device);
+
+  dir = files.dir = strdup(new_mountpoint());
+
+  if(util_mount_ro(long_dev(device), dir, NULL)) {
+    str_copy(msg, "This is not a SUSE medium.");
+    rmdir(dir);
+    free(dir);
+
+    return -1;
+  }
+
+  strprintf(&path, "%s/CHECKSUMS", dir);
+  file_parse_checksums(path, &digests);
+  strprintf(&path, "%s/repodata/repomd.xml", dir);
+  file_parse_repomd(path, &digests, NULL);
+
+  // only the installation system and the repo metadata
+  if(config.mediacheck_files == 2) {
+    if(config.url.instsys && config.url.instsys->scheme == inst_rel && config.url.instsys->path) {
+      for(s = config.url.instsys->path; *s == '/'; s++);
+      str_copy(&prefix, s);
+      if((s = strrchr(prefix, '/'))) {
+        s[1] = 0;
+      }
+      else {
+        *prefix = 0;
+      }
+    }
+    if(!prefix || !*prefix) str_copy(&prefix, "boot/");
+    log_info("checkmedia: only %s and repodata/\n", prefix);
+  }
+
+  for(sl = digests; sl; sl = sl->next) files.len++;
+
+  files.list = calloc(files.len + 1, sizeof *files.list);
+  files.len = 0;
+
+  for(sl = digests; sl; sl = sl->next) {
+    for(s = sl->value; *s == '.' && s[1] == '/'; s += 2);
+    while(*s == '/') s++;
+    if(
+      prefix &&
+      strncmp(s, prefix, strlen(prefix)) &&
+      strncmp(s, "repodata/", sizeof "repodata/" - 1)
+    ) continue;
+    sl0 = slist_split(' ', sl->key);
+    if(sl0->next) {
+      file = files.list + files.len++;
+      file->name = strdup(s);
+      // repomd uses 'sha' for sha1
+      file->digest = strdup(strcasecmp(sl0->key, "sha") ? sl0->key : "sha1");
+      file->value = strdup(sl0->next->key);
+      strprintf(&path, "%s/%s", dir, file->name);
+      if(!stat(path, &sbuf)) file->size = sbuf.st_size;
+      files.size += file->size;
+    }
+    slist_free(sl0);
+  }
+
+  slist_free(digests);
+  str_copy(&prefix, NULL);
+
+  log_info("checkmedia: %u files, %"PRIu64" kB\n", files.len, files.size >> 10);
+
+  if(!files.len) {
+    str_copy(msg, "No digests to check.");
+    util_umount(dir);
+    rmdir(dir);
+    free(dir);
+    str_copy(&path, NULL);
+    free(files.list);
+
+    return -1;
+  }
+
+  strprintf(&path, "Checking files on %s", device);
+  dia_status_on(&win, path);
+
+  check_abort = 0;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
+  pthread_mutex_lock(&check_lock);
+
+  for(u = 0; u < CHECK_FILE_THREADS && u < files.len; u++) {
+    if(!pthread_create(thread + threads, NULL, check_media_file_worker, &files)) threads++;
+  }
+
+  while(threads && files.done < files.len && !files.bad && !check_abort) {
+    dia_status(&win, files.size ? files.size_done * 100 / files.size : files.done * 100 / files.len);
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    secs = (t.tv_sec - t0.tv_sec) + (t.tv_nsec - t0.tv_nsec) / 1e9;
+    if(secs >= 1) {
+      strprintf(&path, "%u/%u files, %.1f MB/s", files.done, files.len, files.size_done / secs / (1 << 20));
+      dia_status_info(&win, path);
+    }
+
+    pthread_mutex_unlock(&check_lock);
+    key = kbd_getch_old(0);
+    pthread_mutex_lock(&check_lock);
+    if(key == KEY_ESC) check_abort = 1;
+
+    clock_gettime(CLOCK_REALTIME, &t);
+    t.tv_nsec += 200 * 1000000;
+    if(t.tv_nsec >= 1000000000) {
+      t.tv_sec++;
+      t.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&check_cond, &check_lock, &t);
+  }
+
+  pthread_mutex_unlock(&check_lock);
+
+  for(u = 0; u < threads; u++) pthread_join(thread[u], NULL);
+
+  dia_status_off(&win);
+
+  util_umount(dir);
+  rmdir(dir);
+
+  for(u = 0; u < files.len; u++) {
+    file = files.list + u;
+    if(file->skipped) log_info("checkmedia: %s: %s not supported\n", file->name, file->digest);
+  }
+
+  if((file = files.bad)) {
+    log_info("checkmedia: %s: %s\n", file->name, file->missing ? "read error" : "wrong digest");
+    strprintf(msg, "%s: %s\nThis medium is broken.", file->name, file->missing ? "Read error." : "Checksum wrong.");
+    ok = 0;
+  }
+  else if(!threads) {
+    str_copy(msg, "Media check failed.");
+    ok = 0;
+  }
+  else if(check_abort) {
+    log_info("checkmedia: aborted\n");
+    str_copy(msg, "Media check canceled.");
+    ok = 0;
+  }
+  else {
+    log_info("checkmedia: %u files ok\n", files.done);
+    str_copy(msg, "No errors found.");
+  }
+
+  for(u = 0; u < files.len; u++) {
+    free(files.list[u].name);
+    free(files.list[u].digest);
+    free(files.list[u].value);
+  }
+  free(files.list);
+  str_copy(&path, NULL);
+  free(dir);
+
+  return ok;
+}
+
+
+/*
+ * Thread verifying files from the list in check_media_files_device().
+ */
+void *check_media_file_worker(void *arg)
+{
+  check_files_t *files = arg;
+  check_file_t *file;
+  mediacheck_digest_t *digest;
+  unsigned char *buf = malloc(CHECK_FILE_BUF);
+  char *path = NULL, *hex;
+  ssize_t r = 0;
+  int fd, ok, stop;
+
+  pthread_mutex_lock(&check_lock);
+
+  while(!check_abort && !files->bad && files->next < files->len) {
+    file = files->list + files->next++;
+
+    pthread_mutex_unlock(&check_lock);
+
+    ok = 1;
+    strprintf(&path, "%s/%s", files->dir, file->name);
+
+    if(!(digest = mediacheck_digest_init(file->digest, NULL))) {
+      file->skipped = 1;
+    }
+    else if((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+      file->missing = 1;
+      ok = 0;
+    }
+    else {
+      posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+      do {
+        if((r = read(fd, buf, CHECK_FILE_BUF)) <= 0) break;
+        mediacheck_digest_process(digest, buf, r);
+        pthread_mutex_lock(&check_lock);
+        files->size_done += r;
+        stop = check_abort || files->bad;
+        pthread_mutex_unlock(&check_lock);
+      } while(!stop);
+      close(fd);
+      if(r < 0) {
+        file->missing = 1;
+        ok = 0;
+      }
+      else if(!r) {
+        hex = mediacheck_digest_hex(digest);
+        ok = hex && !strcasecmp(hex, file->value);
+      }
+    }
+
+    mediacheck_digest_done(digest);
+
+    pthread_mutex_lock(&check_lock);
+
+    files->done++;
+    if(!ok && !files->bad) files->bad = file;
+    pthread_cond_broadcast(&check_cond);
+  }
+
+  pthread_mutex_unlock(&check_lock);
+
+  free(path);
+  free(buf);
+
+  return NULL;
+}
+
+
+/*
+ * Check SUSE installation media.
+ *
+ * device: device name of the device to check, a comma-separated list, or NULL
  *
  * If device is NULL, a device selection dialog is shown to the user first.
  *
@@ -188,13 +795,19 @@ int check_media_device(char *device)
 int check_media(char *device)
 {
   int item_cnt, item_width;
-  int list_len = 0, device_name_len = 0, ok = 1;
-  char **items, **values;
+  int list_len = 0, device_name_len = 0, ok = 1, media_cnt;
+  char **items, **values, *all = NULL;
   window_t dia_win;
   slist_t *sl, *device_list = NULL;
   hd_t *hd;
 
-  if(device) return check_media_device(device);
+  if(device) {
+    device_list = slist_split(',', device);
+    ok = check_media_devices(device_list);
+    slist_free(device_list);
+
+    return ok;
+  }
 
   dia_info(&dia_win, "Searching for storage devices...", MSGTYPE_INFO);
   update_device_list(0);
@@ -212,14 +825,15 @@ int check_media(char *device)
   /*
    * just max values, actual lists might be shorter
    *
-   * "+2" due to "other device" + final NULL
+   * "+3" due to "all media" + "other device" + final NULL
    */
-  items = calloc(list_len + 2, sizeof *items);
-  values = calloc(list_len + 2, sizeof *values);
+  items = calloc(list_len + 3, sizeof *items);
+  values = calloc(list_len + 3, sizeof *values);
 
   item_cnt = 0;
 
   const char other_device[] = "- other device -";
+  const char all_media[] = "- all media -";
 
   item_width = sizeof other_device - 1;
 
@@ -237,6 +851,8 @@ int check_media(char *device)
       len = strlen(items[item_cnt]);
       if(len > item_width) item_width = len;
 
+      strprintf(&all, "%s%s%s", all ?: "", all ? "," : "", sl->key);
+
       item_cnt++;
     }
     else {
@@ -246,9 +862,22 @@ int check_media(char *device)
     mediacheck_done(media);
   }
 
+  slist_free(device_list);
+
+  media_cnt = item_cnt;
+
+  // several media: offer to check them all at once
+  if(media_cnt > 1) {
+    values[item_cnt] = all;
+    all = NULL;
+    items[item_cnt++] = strdup(all_media);
+  }
+
   values[item_cnt] = NULL;
   items[item_cnt++] = strdup(other_device);
 
+  str_copy(&all, NULL);
+
   if(item_width > 72) item_width = 72;
 
   int selected_item = 1;
@@ -283,7 +912,7 @@ int check_media(char *device)
   free(values);
 
   if(ok && device) {
-    ok = check_media_device(device);
+    ok = check_media(device);
   }
 
   str_copy(&device, NULL);
@@ -293,15 +922,22 @@ int check_media(char *device)
 
 
 /*
- * Callback function to visualize media check progress.
+ * Callback function to record media check progress.
  *
- * This just shows the percentage.
+ * Runs in the checking thread; the status window is updated by
+ * check_media_devices().
  *
- * Check for ESC to allow aborting the checking process.
+ * Return 1 to abort the checking process.
  */
 int progress(unsigned percent)
 {
-  dia_status(&win, percent);
+  int abort;
+
+  pthread_mutex_lock(&check_lock);
+  if(check_job) check_job->percent = percent;
+  abort = check_abort;
+  pthread_cond_broadcast(&check_cond);
+  pthread_mutex_unlock(&check_lock);
 
-  return kbd_getch_old(0) == KEY_ESC ? 1 : 0;
+  return abort;
 }
@@ -808,7 +808,7 @@ int dia_menu (char *head_tv,     item_t  items_arv [],
                        items_arv [offset_ii + current_ii].text);
             }
 
-        fflush (stdout);
+        disp_flush ();
         }
     while (key_ii != KEY_ENTER && key_ii != KEY_ESC);
 
@@ -900,7 +900,27 @@ void dia_status (window_t *win, int p)
     disp_write_string(buf);
   }
 
-  fflush(stdout);
+  disp_flush();
+}
+
+/*
+ * Show an additional line of text (e.g. throughput) in status window.
+ */
+void dia_status_info(window_t *win, char *txt)
+{
+  char buf[STATUS_SIZE * 6 + 1];
+
+  if(!config.win || config.linemode) return;
+
+  strncpy(buf, txt, STATUS_SIZE);
+  buf[STATUS_SIZE] = 0;
+  util_center_text(buf, STATUS_SIZE);
+
+  disp_set_color(win->fg_color, win->bg_color);
+  disp_gotoxy(win->x_left + 3, win->y_left + 4);
+  disp_write_string(buf);
+
+  disp_flush();
 }
 
 void dia_status_off (window_t *win_prv)
@@ -1255,7 +1275,7 @@ int dia_show_lines (char *head_tv, char *lines_atv [], int nr_lines_iv,
                 disp_flush_area (&file_win_ri);
                 }
 
-            fflush (stdout);
+            disp_flush ();
             }
 
         key_ii = kbd_getch (TRUE);
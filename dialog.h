@@ -124,6 +124,7 @@ extern int  dia_menu         (char *head_tv,     item_t items_arv [],
                               int   nr_items_iv, int    default_iv);
 extern void dia_status_on    (window_t *win_prr, char *txt_tv);
 extern void dia_status       (window_t *win_prv, int percent_iv);
+extern void dia_status_info  (window_t *win, char *txt);
 extern void dia_status_off   (window_t *win_prr);
 extern int  dia_show_file    (char *head_tv, char *file_tv, int eof_iv);
 extern void dia_info         (window_t *win_prr, char *txt_tv, int type);
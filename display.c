@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 
 #include "global.h"
 #include "display.h"
@@ -34,6 +35,31 @@ static int  disp_state_im = DISP_ON;
 
 static character_t **disp_screen_aprm;
 
+/*
+ * Screen output is double buffered: all drawing goes to disp_screen_aprm,
+ * disp_flush() compares it with disp_front_aprm (what the terminal shows)
+ * and sends only the changed cells in a single write().
+ *
+ * disp_dirty_x0_aim/disp_dirty_x1_aim hold the changed column range per
+ * line (x0 > x1: line unchanged). A front buffer char of -1 means 'unknown'.
+ */
+static character_t **disp_front_aprm;
+static int *disp_dirty_x0_aim;
+static int *disp_dirty_x1_aim;
+
+// terminal state while building a frame; 0 resp. -1: unknown
+static int disp_term_x_im;
+static int disp_term_y_im;
+static int disp_term_attr_im = -1;
+// where the cursor was left after the last update
+static int disp_term_cx_im;
+static int disp_term_cy_im;
+
+static struct {
+  char *buf;
+  int len, size;
+} disp_out_rm;
+
 colorset_t  disp_vgacolors_rm;
 static colorset_t  disp_mono_rm;
 static colorset_t  disp_alternate_rm;
@@ -46,6 +72,16 @@ graphics_t graphics_sg;
  *
  */
 
+static void disp_front_init(void);
+static void disp_front_done(void);
+static void disp_invalidate(void);
+static void disp_mark(int x0, int x1, int y);
+static void disp_put(int c);
+static void disp_out(char *str, int len);
+static void disp_out_goto(int x, int y);
+static void disp_out_attr(int attr);
+static void disp_out_write(void);
+
 
 /*
  *
@@ -157,7 +193,9 @@ void disp_init (void)
 
     disp_screen_aprm = malloc (sizeof (character_t *) * max_y_ig);
     for (i_ii = 0; i_ii < max_y_ig; i_ii++)
-        disp_screen_aprm [i_ii] = malloc (sizeof (character_t) * max_x_ig);
+        disp_screen_aprm [i_ii] = calloc (max_x_ig, sizeof (character_t));
+
+    disp_front_init ();
     }
 
 
@@ -173,12 +211,12 @@ void disp_end (void)
 	return;
       }
 
-    disp_set_color (COL_WHITE, COL_BLACK);
-    printf ("\033[2J");
-    disp_gotoxy (1, 1);
-    disp_graph_off ();
-    printf ("\033c");
-    fflush (stdout);
+    disp_flush ();
+    disp_out_attr ((COL_WHITE << 3) | COL_BLACK);
+    disp_out ("\033[2J\033[1;1f\033c", -1);
+    disp_out_write ();
+
+    disp_front_done ();
 
     if (disp_screen_aprm)
       {
@@ -207,15 +245,12 @@ void disp_end (void)
 
 void disp_gotoxy(int x, int y)
 {
-  if(x == disp_x_im && y == disp_y_im) return;
-
 //  log_info("gotoxy %d x %d\n", x, y);
 
   if(
     x > 0 && x <= max_x_ig &&
     y > 0 && y <= max_y_ig
   ) {
-    printf("\033[%d;%df", y, x);
     disp_x_im = x;
     disp_y_im = y;
   }
@@ -228,20 +263,7 @@ void disp_set_color(char fg, char bg)
 
   attr = (disp_attr_cm & 0x80) | (fg << 3) | bg;
 
-  if(attr != disp_attr_cm) {
-    disp_attr_cm = attr;
-
-    if(IS_BRIGHT(fg)) {
-      attr = ATTR_BRIGHT;
-    }
-    else {
-      attr = ATTR_NORMAL;
-    }
-
-    if(!config.linemode) {
-      printf("\033[%d;%d;%dm", (int) attr, (int) (fg & 0x07) + 30, (int) bg + 40);
-    }
-  }
+  disp_attr_cm = attr;
 }
 
 
@@ -272,7 +294,10 @@ void disp_cursor_on()
 {
   if(config.linemode) return;
 
+  // show the cursor only after the pending screen update
+  disp_flush();
   printf("\033[?25h");
+  fflush(stdout);
 }
 
 
@@ -280,15 +305,7 @@ void disp_graph_on()
 {
   if(config.utf8) return;
 
-  if(!IS_ALTERNATE(disp_attr_cm)) {
-    if(config.serial || config.test) {
-      printf("%c", 14);
-    }
-    else {
-      printf("\033[11m");
-    }
-    disp_attr_cm |= 0x80;
-  }
+  disp_attr_cm |= 0x80;
 }
 
 
@@ -296,15 +313,7 @@ void disp_graph_off()
 {
   if(config.utf8) return;
 
-  if(IS_ALTERNATE(disp_attr_cm)) {
-    if(config.serial || config.test) {
-      printf("%c", 15);
-    }
-    else {
-      printf("\033[10m");
-    }
-    disp_attr_cm &= 0x7f;
-  }
+  disp_attr_cm &= 0x7f;
 }
 
 
@@ -406,7 +415,7 @@ void disp_restore_area(window_t *win)
       x += disp_write_char(win->save_area[y][x].c);
     }
   }
-  fflush(stdout);
+  disp_flush();
 
   for(y = 0; y < y_len; y++) free(win->save_area[y]);
   free(win->save_area);
@@ -471,29 +480,83 @@ void disp_set_display()
 }
 
 
+/*
+ * Redraw the whole screen (e.g. after the terminal has been reset).
+ */
 void disp_restore_screen()
 {
-  int x, y;
-
   log_info("restore screen\n");
 
-  disp_x_im = 0;
+  disp_invalidate();
+  disp_flush();
+}
 
-  for(y = 0; y < max_y_ig; y++) {
-    disp_gotoxy(1, y + 1);
-    for(x = 0; x < max_x_ig; x++) {
-      disp_set_attr(disp_screen_aprm[y][x].attr);
-      disp_write_char(disp_screen_aprm[y][x].c);
-    }
-  }
 
+void disp_clear_screen()
+{
+  disp_flush();
+  printf("\033[H\033[J");
   fflush(stdout);
+
+  // terminal contents no longer match the front buffer
+  disp_invalidate();
 }
 
 
-void disp_clear_screen()
+/*
+ * Send all pending screen changes to the terminal.
+ *
+ * Changed cells are compared against what the terminal already shows;
+ * cursor movements and attribute changes are only emitted when needed
+ * and the whole update goes out with a single write().
+ */
+void disp_flush()
 {
-  printf("\033[H\033[J");
+  int x, y, x1, width;
+  character_t *back, *front;
+
+  // anything printed directly has to come first
+  fflush(stdout);
+
+  if(config.linemode || !disp_front_aprm || disp_state_im == DISP_OFF) return;
+
+  // others may have moved the cursor; don't rely on it
+  disp_term_x_im = disp_term_y_im = 0;
+
+  for(y = 0; y < max_y_ig; y++) {
+    if((x = disp_dirty_x0_aim[y]) > (x1 = disp_dirty_x1_aim[y])) continue;
+
+    back = disp_screen_aprm[y];
+    front = disp_front_aprm[y];
+
+    for(; x <= x1; x++) {
+      if(back[x].c == front[x].c && back[x].attr == front[x].attr) continue;
+
+      front[x] = back[x];
+
+      // 2nd half of a double width char
+      if(!back[x].c) continue;
+
+      disp_out_goto(x + 1, y + 1);
+      disp_out_attr((unsigned char) back[x].attr);
+      disp_out((char *) utf8_encode(back[x].c), -1);
+
+      width = utf32_char_width(back[x].c);
+      disp_term_x_im += width ?: 1;
+      if(disp_term_x_im > max_x_ig) disp_term_x_im = 0;
+    }
+
+    disp_dirty_x0_aim[y] = max_x_ig;
+    disp_dirty_x1_aim[y] = -1;
+  }
+
+  if(disp_out_rm.len || disp_x_im != disp_term_cx_im || disp_y_im != disp_term_cy_im) {
+    disp_out_goto(disp_x_im, disp_y_im);
+    disp_term_cx_im = disp_x_im;
+    disp_term_cy_im = disp_y_im;
+  }
+
+  disp_out_write();
 }
 
 
@@ -502,8 +565,26 @@ void disp_clear_screen()
  */
 void disp_write_utf32string(int *str)
 {
-  int i, j, len, buf_len, width;
-  unsigned char *buf;
+  if(
+    disp_x_im > 0 &&
+    disp_x_im <= max_x_ig &&
+    disp_y_im > 0 &&
+    disp_y_im <= max_y_ig
+  ) {
+    while(*str) disp_put(*str++);
+
+    if(disp_x_im > max_x_ig) disp_gotoxy(1, 1);
+  }
+}
+
+
+/*
+ * Write utf8 string.
+ */
+void disp_write_string(char *str)
+{
+  unsigned char *s = (unsigned char *) str;
+  int c, len;
 
   if(
     disp_x_im > 0 &&
@@ -511,89 +592,249 @@ void disp_write_utf32string(int *str)
     disp_y_im > 0 &&
     disp_y_im <= max_y_ig
   ) {
-    len = utf32_len(str);
+    // decode in place, stopping at invalid sequences like utf8_to_utf32()
+    while(*s && (len = utf8_enc_len(*s)) && (c = utf8_decode(s))) {
+      disp_put(c);
+      s += len;
+    }
+
+    if(disp_x_im > max_x_ig) disp_gotoxy(1, 1);
+  }
+}
 
-    if(disp_state_im == DISP_ON) {
-      buf = malloc(buf_len = len * 6 + 1);
-      utf32_to_utf8(buf, buf_len, str);
-      printf("%s", buf);
-      free(buf);
+
+/*
+ * Write utf32 char. Returns char width.
+ */
+int disp_write_char(int c)
+{
+  int width = 1;
+
+  if(
+    disp_x_im > 0 &&
+    disp_x_im <= max_x_ig &&
+    disp_y_im > 0 &&
+    disp_y_im <= max_y_ig
+  ) {
+    width = utf32_char_width(c);
+    if(!width) width = 1;
+
+    disp_put(c);
+  }
+
+  return width;
+}
+
+
+/*
+ *
+ * local functions
+ *
+ */
+
+/*
+ * Allocate front buffer and line state.
+ */
+static void disp_front_init()
+{
+  int i;
+
+  disp_front_done();
+
+  disp_front_aprm = malloc(sizeof (character_t *) * max_y_ig);
+  for(i = 0; i < max_y_ig; i++) {
+    disp_front_aprm[i] = malloc(sizeof (character_t) * max_x_ig);
+  }
+  disp_dirty_x0_aim = malloc(sizeof (int) * max_y_ig);
+  disp_dirty_x1_aim = malloc(sizeof (int) * max_y_ig);
+
+  disp_invalidate();
+}
+
+
+static void disp_front_done()
+{
+  int i;
+
+  if(disp_front_aprm) {
+    for(i = 0; i < max_y_ig; i++) free(disp_front_aprm[i]);
+    free(disp_front_aprm);
+    disp_front_aprm = NULL;
+  }
+
+  free(disp_dirty_x0_aim);
+  free(disp_dirty_x1_aim);
+  disp_dirty_x0_aim = disp_dirty_x1_aim = NULL;
+
+  free(disp_out_rm.buf);
+  memset(&disp_out_rm, 0, sizeof disp_out_rm);
+}
+
+
+/*
+ * Forget what the terminal shows; the next disp_flush() redraws everything.
+ */
+static void disp_invalidate()
+{
+  int x, y;
+
+  if(!disp_front_aprm) return;
+
+  for(y = 0; y < max_y_ig; y++) {
+    for(x = 0; x < max_x_ig; x++) {
+      disp_front_aprm[y][x].c = -1;
     }
+    disp_dirty_x0_aim[y] = 0;
+    disp_dirty_x1_aim[y] = max_x_ig - 1;
+  }
 
-    for(i = 0; i < len; i++) {
+  disp_term_attr_im = -1;
+  disp_term_cx_im = disp_term_cy_im = 0;
+}
 
-      width = 1;
 
-      width = utf32_char_width(str[i]);
-      if(!width) width = 1;
+/*
+ * Mark columns x0 - x1 (0-based) of line y (1-based) as changed.
+ */
+static void disp_mark(int x0, int x1, int y)
+{
+  if(!disp_front_aprm || y < 1 || y > max_y_ig) return;
 
-      if(disp_x_im <= max_x_ig) {
-        disp_screen_aprm[disp_y_im - 1][disp_x_im - 1].attr = disp_attr_cm;
-        disp_screen_aprm[disp_y_im - 1][disp_x_im - 1].c = str[i];
-        for(j = 1; j < width; j++) {
-          disp_screen_aprm[disp_y_im - 1][disp_x_im - 1 + j].attr = disp_attr_cm;
-          disp_screen_aprm[disp_y_im - 1][disp_x_im - 1 + j].c = 0;
-        }
-      }
+  if(x1 >= max_x_ig) x1 = max_x_ig - 1;
 
-      disp_x_im += width;
+  y--;
+  if(x0 < disp_dirty_x0_aim[y]) disp_dirty_x0_aim[y] = x0;
+  if(x1 > disp_dirty_x1_aim[y]) disp_dirty_x1_aim[y] = x1;
+}
+
+
+/*
+ * Put utf32 char at current position and advance.
+ */
+static void disp_put(int c)
+{
+  int i, width;
+  character_t *line;
+
+  width = utf32_char_width(c);
+  if(!width) width = 1;
+
+  if(disp_x_im <= max_x_ig) {
+    line = disp_screen_aprm[disp_y_im - 1] + disp_x_im - 1;
+
+    line[0].attr = disp_attr_cm;
+    line[0].c = c;
+
+    for(i = 1; i < width && disp_x_im + i <= max_x_ig; i++) {
+      line[i].attr = disp_attr_cm;
+      line[i].c = 0;
     }
 
-    if(disp_x_im > max_x_ig) disp_gotoxy(1, 1);
+    disp_mark(disp_x_im - 1, disp_x_im + width - 2, disp_y_im);
   }
+
+  disp_x_im += width;
 }
 
 
 /*
- * Write utf8 string.
+ * Append to output buffer; len < 0: zero-terminated string.
  */
-void disp_write_string(char *str)
+static void disp_out(char *str, int len)
 {
-  int len, *buf;
+  if(len < 0) len = strlen(str);
+
+  if(disp_out_rm.len + len > disp_out_rm.size) {
+    disp_out_rm.size = disp_out_rm.len + len + 0x1000;
+    disp_out_rm.buf = realloc(disp_out_rm.buf, disp_out_rm.size);
+  }
+
+  memcpy(disp_out_rm.buf + disp_out_rm.len, str, len);
+  disp_out_rm.len += len;
+}
+
 
-//  log_info("[* <%s>", str);
-//  getchar();
+/*
+ * Move terminal cursor, if necessary.
+ */
+static void disp_out_goto(int x, int y)
+{
+  char buf[32];
 
-  len = strlen(str) + 1;
+  if(
+    x < 1 || x > max_x_ig ||
+    y < 1 || y > max_y_ig ||
+    (x == disp_term_x_im && y == disp_term_y_im)
+  ) return;
 
-  buf = malloc(len * sizeof *buf);
-  utf8_to_utf32(buf, len, str);
-  disp_write_utf32string(buf);
+  if(y == disp_term_y_im && x > disp_term_x_im && disp_term_x_im) {
+    sprintf(buf, "\033[%dC", x - disp_term_x_im);
+  }
+  else {
+    sprintf(buf, "\033[%d;%df", y, x);
+  }
 
-//  log_info("#]\n");
+  disp_out(buf, -1);
 
-  free(buf);
+  disp_term_x_im = x;
+  disp_term_y_im = y;
 }
 
 
 /*
- * Write utf32 char. Returns char width.
+ * Switch terminal attributes, if necessary.
  */
-int disp_write_char(int c)
+static void disp_out_attr(int attr)
 {
-  int i, width = 1;
+  char buf[32];
+  int fg;
+
+  if(attr == disp_term_attr_im) return;
 
   if(
-    disp_x_im > 0 &&
-    disp_x_im <= max_x_ig &&
-    disp_y_im > 0 &&
-    disp_y_im <= max_y_ig
+    !config.utf8 &&
+    (disp_term_attr_im < 0 || IS_ALTERNATE(attr) != IS_ALTERNATE(disp_term_attr_im))
   ) {
-    if(disp_state_im == DISP_ON && c) printf("%s", utf8_encode(c));
+    if(config.serial || config.test) {
+      disp_out(IS_ALTERNATE(attr) ? "\016" : "\017", 1);
+    }
+    else {
+      disp_out(IS_ALTERNATE(attr) ? "\033[11m" : "\033[10m", -1);
+    }
+  }
 
-    width = utf32_char_width(c);
-    if(!width) width = 1;
+  if(disp_term_attr_im < 0 || (attr & 0x7f) != (disp_term_attr_im & 0x7f)) {
+    fg = FOREGROUND(attr);
+    sprintf(buf, "\033[%d;%d;%dm",
+      IS_BRIGHT(fg) ? ATTR_BRIGHT : ATTR_NORMAL,
+      (fg & 0x07) + 30,
+      BACKGROUND(attr) + 40
+    );
+    disp_out(buf, -1);
+  }
 
-    disp_screen_aprm[disp_y_im - 1][disp_x_im - 1].attr = disp_attr_cm;
-    disp_screen_aprm[disp_y_im - 1][disp_x_im - 1].c = c;
+  disp_term_attr_im = attr;
+}
 
-    for(i = 1; i < width; i++) {
-      disp_screen_aprm[disp_y_im - 1][disp_x_im - 1 + i].attr = disp_attr_cm;
-      disp_screen_aprm[disp_y_im - 1][disp_x_im - 1 + i].c = 0;
-    }
 
-    disp_x_im += width;
+/*
+ * Send output buffer to terminal.
+ */
+static void disp_out_write()
+{
+  char *buf = disp_out_rm.buf;
+  int len = disp_out_rm.len;
+  ssize_t i;
+
+  while(len > 0) {
+    i = write(STDOUT_FILENO, buf, len);
+    if(i < 0) {
+      if(errno == EINTR) continue;
+      break;
+    }
+    buf += i;
+    len -= i;
   }
 
-  return width;
+  disp_out_rm.len = 0;
 }
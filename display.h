@@ -79,6 +79,7 @@ extern void disp_refresh_char   (int x_iv, int y_iv);
 extern void disp_set_display    (void);
 extern void disp_restore_screen (void);
 extern void disp_clear_screen   (void);
+extern void disp_flush          (void);
 
 int disp_write_char(int c);
 void disp_write_string(char *str);
@@ -21,6 +21,7 @@
 #include <netinet/in.h>
 #include <fcntl.h>
 #include <sys/select.h>
+#include <sys/mman.h>
 
 #include <hd.h>
 
@@ -36,6 +37,7 @@
 #include "display.h"
 #include "keyboard.h"
 #include "url.h"
+#include "trace.h"
 
 #define YAST_INF_FILE		"/etc/yast.inf"
 #define INSTALL_INF_FILE	"/etc/install.inf"
@@ -63,6 +65,10 @@ static void file_dump_mlist(module_t *ml);
 static void add_driver(char *str);
 static void parse_ethtool(slist_t *sl, char *str);
 static void wait_for_conn(int port);
+static slist_t *file_parse_xmllike_inplace(char *buf, char *tag);
+static void *file_map(char *name, size_t *len);
+static char *file_memstr(char *start, char *end, char *str);
+static char *file_xml_attr(char *start, char *end, char *attr, int *len);
 
 
 static struct {
@@ -283,6 +289,16 @@ static struct {
   { key_mediacheck,     "mediacheck",     kf_cfg + kf_cmd_early          },
   { key_y2gdb,          "Y2GDB",          kf_cfg + kf_cmd                },
   { key_squash,         "squash",         kf_cfg + kf_cmd                },
+  { key_logasync,       "LogAsync",       kf_cfg + kf_cmd + kf_cmd_early },
+  { key_overlay,        "Overlay",        kf_cfg + kf_cmd_early          },
+  { key_prefetch,       "prefetch",       kf_cfg + kf_cmd                },
+  { key_lazyinstsys,    "LazyInstsys",    kf_cfg + kf_cmd                },
+  { key_multicast,      "multicast",      kf_cfg + kf_cmd                },
+  { key_mirrors,        "Mirrors",        kf_cfg + kf_cmd                },
+  { key_mirrorlist,     "MirrorList",     kf_cfg + kf_cmd                },
+  { key_mirrorspread,   "MirrorSpread",   kf_cfg + kf_cmd                },
+  { key_zram,           "zram",           kf_cfg + kf_cmd                },
+  { key_zramsize,       "zram.size",      kf_cfg + kf_cmd                },
   { key_devbyid,        "devbyid",        kf_cfg + kf_cmd_early          },
   { key_braille,        "braille",        kf_cfg + kf_cmd_early          },
   { key_nfsopts,        "nfs.opts",       kf_cfg + kf_cmd                },
@@ -1036,9 +1052,7 @@ void file_do_info(file_t *f0, file_key_flag_t flags)
             !config.log.dest[1].name ||
             strcmp(config.log.dest[1].name, f->value)
           ) {
-            str_copy(&config.log.dest[1].name, f->value);
-            if(config.log.dest[1].f) fclose(config.log.dest[1].f);
-            config.log.dest[1].f = NULL;
+            util_log_set_file(config.log.dest + 1, f->value);
           }
         }
         break;
@@ -1510,7 +1524,18 @@ void file_do_info(file_t *f0, file_key_flag_t flags)
         break;
 
       case key_mediacheck:
-        if(f->is.numeric) config.mediacheck = f->nvalue;
+        if(f->is.numeric) {
+          config.mediacheck = f->nvalue;
+          config.mediacheck_files = 0;
+        }
+        else if(!strcasecmp(f->value, "files")) {
+          config.mediacheck = 1;
+          config.mediacheck_files = 1;
+        }
+        else if(!strcasecmp(f->value, "quick")) {
+          config.mediacheck = 1;
+          config.mediacheck_files = 2;
+        }
         break;
 
       case key_wlan_essid:
@@ -1647,6 +1672,52 @@ void file_do_info(file_t *f0, file_key_flag_t flags)
         if(f->is.numeric) config.squash = f->nvalue;
         break;
 
+      case key_prefetch:
+        if(f->is.numeric) config.prefetch = f->nvalue;
+        break;
+
+      case key_lazyinstsys:
+        if(f->is.numeric) config.lazyinstsys = f->nvalue;
+        break;
+
+      case key_multicast:
+        str_copy(&config.multicast, *f->value && strcmp(f->value, "0") ? f->value : NULL);
+        break;
+
+      case key_mirrors:
+        config.url.mirrors = slist_free(config.url.mirrors);
+        if(*f->value) config.url.mirrors = slist_split(',', f->value);
+        break;
+
+      case key_mirrorlist:
+        str_copy(&config.url.mirrorlist, *f->value ? f->value : NULL);
+        break;
+
+      case key_mirrorspread:
+        if(f->is.numeric) config.mirrorspread = f->nvalue;
+        break;
+
+      case key_zram:
+        // '1': use kernel default compression
+        str_copy(&config.zram.algo,
+          !*f->value || (f->is.numeric && !f->nvalue) ? NULL :
+          f->is.numeric ? "" : f->value
+        );
+        break;
+
+      case key_zramsize:
+        if(f->is.numeric) config.zram.size = (int64_t) f->nvalue << 10;
+        break;
+
+      case key_logasync:
+        if(f->is.numeric) config.log.async = f->nvalue;
+        if(!config.log.async) util_log_flush(1);
+        break;
+
+      case key_overlay:
+        if(f->is.numeric) config.overlay = f->nvalue;
+        break;
+
       case key_kexec_reboot:
         if(f->is.numeric) config.kexec_reboot = f->nvalue;
         break;
@@ -1972,6 +2043,8 @@ void file_write_install_inf(char *dir)
 
   file_write_num(f, key_sourcemounted, url->mount ? 1 : 0);
 
+  trace_summary(f);
+
   fprintf(f, "RepoURL: %s\n", url_print(url, 3));
   if(!config.norepo)   fprintf(f, "ZyppRepoURL: %s\n", url_print(url, 4));
   if(!config.sslcerts) fprintf(f, "ssl_verify: no\n");
@@ -2672,17 +2745,32 @@ void wait_for_conn(int port)
  */
 slist_t *file_parse_xmllike_buf(char *buf, char *tag)
 {
-  slist_t *sl, *sl0 = NULL;
-  char *tag_start = NULL, *tag_end = NULL;
-  char *attr = NULL, *data = NULL;
-  int i;
-  char *ptr, *s0, *s1;
+  slist_t *sl0;
 
-  if(!tag || !buf || !*buf) return sl0;
+  if(!tag || !buf || !*buf) return NULL;
 
   // we're going to modify the buffer
   buf = strdup(buf);
 
+  sl0 = file_parse_xmllike_inplace(buf, tag);
+
+  free(buf);
+
+  return sl0;
+}
+
+
+/*
+ * Like file_parse_xmllike_buf() but modifies 'buf'.
+ */
+slist_t *file_parse_xmllike_inplace(char *buf, char *tag)
+{
+  slist_t *sl, *sl0 = NULL, **sl_tail = &sl0;
+  char *tag_start = NULL, *tag_end = NULL;
+  char *attr = NULL, *data = NULL;
+  int i;
+  char *ptr, *s0, *s1;
+
   strprintf(&tag_start, "<%s ", tag);
   strprintf(&tag_end, "</%s>", tag);
 
@@ -2697,7 +2785,8 @@ slist_t *file_parse_xmllike_buf(char *buf, char *tag)
         i = strlen(data);
         while(i > 0 && isspace(data[i - 1])) data[--i] = 0;
 
-        sl = slist_append(&sl0, slist_new());
+        *sl_tail = sl = slist_new();
+        sl_tail = &sl->next;
         str_copy(&sl->key, attr);
         str_copy(&sl->value, data);
 
@@ -2722,7 +2811,6 @@ slist_t *file_parse_xmllike_buf(char *buf, char *tag)
     }
   }
 
-  free(buf);
   free(tag_start);
   free(tag_end);
 
@@ -2741,26 +2829,21 @@ slist_t *file_parse_xmllike_buf(char *buf, char *tag)
 slist_t *file_parse_xmllike(char *name, char *tag)
 {
   slist_t *sl0 = NULL;
-  FILE *f;
-  char *buf = NULL;
-  int buf_size = 0, buf_ptr = 0, i;
+  char *buf, *map;
+  size_t len;
 
   if(!tag) return sl0;
 
-  if(!(f = fopen(name, "r"))) return sl0;
-
-  do {
-    buf = realloc(buf, buf_size += 0x1000);
-    i = fread(buf + buf_ptr, 1, buf_size - buf_ptr - 1, f);
-    buf_ptr += i;
-  }
-  while(buf_ptr == buf_size - 1);
+  if(!(map = file_map(name, &len))) return sl0;
 
-  buf[buf_ptr] = 0;
+  // one copy, as the parser needs a modifiable, 0-terminated buffer
+  buf = malloc(len + 1);
+  memcpy(buf, map, len);
+  buf[len] = 0;
 
-  fclose(f);
+  munmap(map, len);
 
-  sl0 = file_parse_xmllike_buf(buf, tag);
+  sl0 = file_parse_xmllike_inplace(buf, tag);
 
   free(buf);
 
@@ -2771,71 +2854,176 @@ slist_t *file_parse_xmllike(char *name, char *tag)
 /*
  * Parse repomd data.
  *
- * - add file digest info to config.digests.list
+ * - add file digest info to digests (usually config.digests.list)
  * - associate 'types' to file names (e.g. 'license' -> 'XXX-license.tar.gz'
- *   (stored in config.repomd_data)
+ *   (stored in data, usually config.repomd_data, if not NULL)
+ *
+ * Single pass over the mapped file, looking for
+ *
+ *   <data type="TYPE">
+ *     <checksum type="ALGO">DIGEST</checksum>
+ *     <location href="LOCATION"/>
+ *   </data>
  */
-void file_parse_repomd(char *file)
+void file_parse_repomd(char *file, slist_t **digests, slist_t **data)
 {
-  slist_t *repo, *sl, *sl_chk, *sl_digest, *sl_data;
-  char buf_digest[256], buf_type[256], buf_loc[256], *s;
+  slist_t *sl, **digests_tail, **data_tail = NULL;
+  char *map, *ptr, *end, *tag_end, *elem_end, *s;
+  char *type, *algo, *sum, *sum_end, *loc;
+  int type_len, algo_len, loc_len;
+  size_t len;
 
-  repo = file_parse_xmllike(file, "data");
+  if(!(map = file_map(file, &len))) return;
 
-  for(sl = repo; sl; sl = sl->next) {
-    if(sscanf(sl->key, "type=\"%255[^\"]\"", buf_type) == 1) {
-      if((sl_chk = file_parse_xmllike_buf(sl->value, "checksum"))) {
-        if(sscanf(sl_chk->key, "type=\"%255[^\"]\"", buf_digest) == 1) {
-          if(
-            (s = strstr(sl->value, "<location href=")) &&
-            sscanf(s, "<location href=\"%255[^\"]\"", buf_loc) == 1
-          ) {
-            sl_digest = slist_append(&config.digests.list, slist_new());
-            strprintf(&sl_digest->key, "%s %s", buf_digest, sl_chk->value);
-            str_copy(&sl_digest->value, buf_loc);
+  // append without walking the lists each time
+  for(digests_tail = digests; *digests_tail; digests_tail = &(*digests_tail)->next);
+  if(data) for(data_tail = data; *data_tail; data_tail = &(*data_tail)->next);
 
-            sl_data = slist_append_str(&config.repomd_data, buf_type);
-            str_copy(&sl_data->value, buf_loc);
-          }
-        }
-      }
+  end = map + len;
+
+  for(ptr = map; (ptr = file_memstr(ptr, end, "<data ")); ptr = elem_end) {
+    if(
+      !(tag_end = memchr(ptr, '>', end - ptr)) ||
+      !(elem_end = file_memstr(tag_end, end, "</data>"))
+    ) break;
+
+    if(!(type = file_xml_attr(ptr, tag_end, "type", &type_len))) continue;
+
+    if(
+      !(sum = file_memstr(tag_end, elem_end, "<checksum ")) ||
+      !(s = memchr(sum, '>', elem_end - sum)) ||
+      !(algo = file_xml_attr(sum, s, "type", &algo_len)) ||
+      !(sum_end = file_memstr(s, elem_end, "</checksum>"))
+    ) continue;
 
-      slist_free(sl_chk);
+    for(sum = s + 1; sum < sum_end && isspace(*sum); sum++);
+    while(sum_end > sum && isspace(sum_end[-1])) sum_end--;
+
+    if(
+      !(loc = file_memstr(tag_end, elem_end, "<location ")) ||
+      !(s = memchr(loc, '>', elem_end - loc)) ||
+      !(loc = file_xml_attr(loc, s, "href", &loc_len))
+    ) continue;
+
+    *digests_tail = sl = slist_new();
+    digests_tail = &sl->next;
+    strprintf(&sl->key, "%.*s %.*s", algo_len, algo, (int) (sum_end - sum), sum);
+    sl->value = strndup(loc, loc_len);
+
+    if(data) {
+      *data_tail = sl = slist_new();
+      data_tail = &sl->next;
+      sl->key = strndup(type, type_len);
+      sl->value = strndup(loc, loc_len);
     }
   }
 
-  slist_free(repo);
+  munmap(map, len);
 }
 
 
 /*
  * Parse CHECKSUMS file.
  *
- * Add digest info to config.digests.list.
+ * Add digest info to digests (usually config.digests.list).
  *
  * File format: lines with
  *   SHA256 FILENAME
  */
-void file_parse_checksums(char *file)
+void file_parse_checksums(char *file, slist_t **digests)
 {
-  FILE *fh;
-  char *buf = NULL;
-  size_t buf_size = 0;
-  char sha256[65], name[256];
-  slist_t *sl_digest;
+  slist_t *sl, **digests_tail;
+  char *map, *ptr, *end, *line_end, *sum, *name;
+  int sum_len, name_len;
+  size_t len;
 
-  if(!(fh = fopen(file, "r"))) return;
+  if(!(map = file_map(file, &len))) return;
 
-  while(getline(&buf, &buf_size, fh) > 0) {
-    if(sscanf(buf, "%64s %255s", sha256, name) == 2) {
-      sl_digest = slist_append(&config.digests.list, slist_new());
-      strprintf(&sl_digest->key, "sha256 %s", sha256);
-      str_copy(&sl_digest->value, name);
-    }
+  for(digests_tail = digests; *digests_tail; digests_tail = &(*digests_tail)->next);
+
+  end = map + len;
+
+  for(ptr = map; ptr < end; ptr = line_end + 1) {
+    if(!(line_end = memchr(ptr, '\n', end - ptr))) line_end = end;
+
+    for(sum = ptr; sum < line_end && isspace(*sum); sum++);
+    for(sum_len = 0; sum + sum_len < line_end && !isspace(sum[sum_len]); sum_len++);
+    for(name = sum + sum_len; name < line_end && isspace(*name); name++);
+    for(name_len = 0; name + name_len < line_end && !isspace(name[name_len]); name_len++);
+
+    if(!sum_len || !name_len) continue;
+
+    *digests_tail = sl = slist_new();
+    digests_tail = &sl->next;
+    strprintf(&sl->key, "sha256 %.*s", sum_len, sum);
+    sl->value = strndup(name, name_len);
   }
 
-  free(buf);
+  munmap(map, len);
+}
+
 
-  fclose(fh);
+/*
+ * Map file 'name' read-only.
+ *
+ * Return NULL if that fails or the file is empty; else the start address
+ * (with the size in *len). Release with munmap().
+ */
+void *file_map(char *name, size_t *len)
+{
+  struct stat sbuf;
+  void *map = NULL;
+  int fd;
+
+  if((fd = open(name, O_RDONLY)) == -1) return NULL;
+
+  if(!fstat(fd, &sbuf) && sbuf.st_size > 0) {
+    *len = sbuf.st_size;
+    map = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map == MAP_FAILED) map = NULL;
+  }
+
+  close(fd);
+
+  return map;
+}
+
+
+/*
+ * Find 'str' in memory area [start, end).
+ */
+char *file_memstr(char *start, char *end, char *str)
+{
+  return start < end ? memmem(start, end - start, str, strlen(str)) : NULL;
+}
+
+
+/*
+ * Find value of attribute 'attr' in tag [start, end).
+ *
+ * Return start of value (and its length in *len) or NULL.
+ */
+char *file_xml_attr(char *start, char *end, char *attr, int *len)
+{
+  char *s, *t;
+  int attr_len = strlen(attr);
+
+  for(s = start; (s = file_memstr(s, end, attr)); s += attr_len) {
+    // must be a complete attribute name
+    if(
+      !isspace(s[-1]) ||
+      end - s < attr_len + 2 ||
+      s[attr_len] != '=' ||
+      s[attr_len + 1] != '"'
+    ) continue;
+
+    s += attr_len + 2;
+    if(!(t = memchr(s, '"', end - s))) break;
+    *len = t - s;
+
+    return s;
+  }
+
+  return NULL;
 }
 
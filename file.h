@@ -57,7 +57,10 @@ typedef enum {
   key_nanny, key_vlanid,
   key_sshkey, key_systemboot, key_sethostname, key_debugshell, key_self_update,
   key_ibft_devices, key_linuxrc_core, key_norepo, key_auto_assembly, key_autoyast_parse,
-  key_device_auto_config, key_autoyast_passurl, key_rd_zdev, key_insmod_pre
+  key_device_auto_config, key_autoyast_passurl, key_rd_zdev, key_insmod_pre,
+  key_logasync, key_overlay, key_prefetch, key_lazyinstsys,
+  key_multicast, key_mirrors, key_mirrorlist, key_mirrorspread, key_zram,
+  key_zramsize
 } file_key_t;
 
 typedef enum {
@@ -109,6 +112,6 @@ file_t *file_parse_buffer(char *buf, file_key_flag_t flags);
 void file_do_info(file_t *f0, file_key_flag_t flags);
 void get_ide_options(void);
 slist_t *file_parse_xmllike(char *name, char *tag);
-void file_parse_repomd(char *file);
-void file_parse_checksums(char *file);
+void file_parse_repomd(char *file, slist_t **digests, slist_t **data);
+void file_parse_checksums(char *file, slist_t **digests);
 
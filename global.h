@@ -127,6 +127,13 @@ enum langid_t {
 // run command and redirect stderr to log file
 #define lxrc_run_console(a) util_run(a, 0)
 
+// util_run_argv() flags
+#define RUN_LOG_STDOUT	(1 << 0)	// redirect and log also stdout
+#define RUN_SHELL	(1 << 1)	// argv[0] is a shell command line
+
+// run program (no shell) and redirect stdout & stderr to log file
+#define lxrc_run_argv(...) util_run_argv((char *[]) { __VA_ARGS__, NULL }, RUN_LOG_STDOUT, 0)
+
 #define RAMDISK_2  "/dev/ram2"
 
 #define MAX_FILENAME     300
@@ -338,9 +345,26 @@ typedef struct {
   unsigned level;
   char *name;
   FILE *f;
+  struct log_ring_s *ring;	/**< buffer for asynchronous writing, if any */
 } log_file_t;
 
 
+/*
+ * process table snapshot, see util_proc_snapshot()
+ */
+typedef struct {
+  pid_t pid;
+  unsigned kthread:1;		/**< kernel thread */
+  unsigned zombie:1;		/**< process has exited */
+  char name[16];		/**< process name (comm) */
+} proc_entry_t;
+
+typedef struct {
+  unsigned len;
+  proc_entry_t *list;		/**< sorted by name, then pid */
+} proc_table_t;
+
+
 /* > 100 and <= 1000 */
 #define MAX_UPDATES		1000
 
@@ -419,6 +443,7 @@ typedef struct {
   unsigned listen:1;		/**< listen on port */
   unsigned zombies:1;		/**< keep zombies around */
   unsigned mediacheck:1;	/**< check media */
+  unsigned mediacheck_files:2;	/**< check files listed in CHECKSUMS & repomd.xml instead (1: all, 2: only those needed) */
   unsigned installfilesread:1;	/**< already got install files */
   unsigned zen;			/**< zenworks mode */
   char *zenconfig;		/**< zenworks config file */
@@ -431,6 +456,11 @@ typedef struct {
   unsigned nomodprobe:1;	/**< disable modprobe */
   unsigned y2gdb:1;		/**< pass to yast */
   unsigned squash:1;		/**< convert archive files to squashfs after download */
+  unsigned overlay:1;		/**< integrate parts and instsys images via overlayfs, not symlinks */
+  unsigned prefetch:1;		/**< load repo metadata and instsys parts in the background */
+  unsigned lazyinstsys:1;	/**< load instsys images on demand via nbd, if possible */
+  unsigned mirrorspread:1;	/**< load instsys parts from several mirrors */
+  char *multicast;		/**< multicast group ('address:port') to receive images from */
   unsigned keepinstsysconfig:1;	/**< don't reload instsys config data */
   unsigned device_by_id:1;	/**< use /dev/disk/by-id device names */
   unsigned withiscsi;		/**< iSCSI parameter */
@@ -552,6 +582,8 @@ typedef struct {
     slist_t *instsys_deps;	/**< instsys dependencies */
     slist_t *instsys_list;	/**< instsys list */
     url_t *install;		/**< install url */
+    slist_t *mirrors;		/**< alternative locations of the install repo */
+    char *mirrorlist;		/**< url of a file listing more of them */
     url_t *instsys;		/**< instsys url */
     url_t *proxy;		/**< proxy url */
     url_t *autoyast;		/**< yast autoinstall parameter */
@@ -624,6 +656,12 @@ typedef struct {
     int64_t ram_min;		/**< min required memory (ram size) needed for install */
   } memoryXXX;
 
+  struct {			/**< compressed swap in RAM, see zram.c */
+    char *algo;			/**< compression algorithm (NULL: no zram, "": kernel default) */
+    int64_t size;		/**< uncompressed size in bytes (0: half the RAM) */
+    char *dev;			/**< zram device in use */
+  } zram;
+
   struct {			/**< mountpoints */
     unsigned cnt;		/**< mp counter */
     unsigned initrd_parts;	/**< initrd parts counter */
@@ -717,6 +755,7 @@ typedef struct {
 
   struct {
     log_file_t dest[3];		/**< logging destinations, see linuxrc.c */
+    unsigned async:1;		/**< write log files asynchronously */
   } log;
 
 #if defined(__s390__) || defined(__s390x__)
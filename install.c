@@ -46,6 +46,7 @@
 #include "auto2.h"
 #include "url.h"
 #include "checkmedia.h"
+#include "trace.h"
 
 #ifndef MNT_DETACH
 #define MNT_DETACH	(1 << 1)
@@ -1171,7 +1172,7 @@ int inst_start_install()
  */
 int add_instsys()
 {
-  char *buf = NULL, *argv[3] = { }, *mp;
+  char *buf = NULL, *mp;
   int err = 0, i;
   slist_t *sl;
 
@@ -1187,9 +1188,7 @@ int add_instsys()
     for(sl = config.url.instsys_list; sl; sl = sl->next) {
       log_debug("instsys_list: key = %s, value = %s\n", sl->key, sl->value);
       if(!sl->value) return 1;
-      argv[1] = sl->value;
-      argv[2] = "/";
-      util_lndir_main(3, argv);
+      util_layer_add(sl->value, "/");
     }
   }
 
@@ -1197,17 +1196,14 @@ int add_instsys()
     mp = new_mountpoint();
     strprintf(&buf, "%s/dud_%04u", config.download.base, i);
     if(!util_mount_ro(buf, mp, 0)) {
-      if(!config.test) {
-        argv[1] = mp;
-        argv[2] = "/";
-        util_lndir_main(3, argv);
-      }
+      if(!config.test) util_layer_add(mp, "/");
     }
   }
 
   file_read_info_file("file:/.instsys.config", kf_cfg);
 
   file_write_install_inf("");
+  trace_write();
 
   if(
     config.instsys_complain &&
@@ -1516,6 +1512,7 @@ int inst_commit_install()
         break;
       }
 
+      util_log_flush(1);
       reboot(RB_AUTOBOOT);
       break;
 
@@ -1525,6 +1522,7 @@ int inst_commit_install()
         break;
       }
 
+      util_log_flush(1);
       reboot(RB_POWER_OFF);
       break;
 
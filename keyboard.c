@@ -25,6 +25,7 @@
 #include "keyboard.h"
 #include "util.h"
 #include "utf8.h"
+#include "display.h"
 
 /*
  *
@@ -323,6 +324,9 @@ int kbd_getch_raw(int do_wait)
 
   if(kbd.key || !do_wait) return kbd.key;
 
+  // make sure the screen is up to date before we wait
+  if(config.win) disp_flush();
+
   esc_count = 0;
 
   for(;;) {
@@ -383,6 +387,9 @@ int kbd_getch_old (int wait_iv)
 
 
     keypress_ci = 0;
+    if (wait_iv && config.win)
+        disp_flush ();
+
     do
         {
         kbd_set_timeout (KBD_TIMEOUT);
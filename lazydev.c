@@ -0,0 +1,558 @@
+/*
+ *
+ * lazydev.c     Read-only block device backed by http range requests
+ *
+ * An image file on a (http) server is made available as nbd device. The
+ * device is served by a child process; data are loaded on demand in fixed
+ * size chunks and kept in a local cache file. Each chunk is checked against
+ * a digest from a manifest file before it is used.
+ *
+ * Manifest format (one entry per line):
+ *
+ *   size <image size in bytes>
+ *   chunk <chunk size in bytes>
+ *   <digest name> <digest of chunk 0>
+ *   <digest name> <digest of chunk 1>
+ *   ...
+ *
+ * Note: the child processes must not log - they are forked from a
+ * (possibly) multi-threaded process.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <endian.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/prctl.h>
+#include <arpa/inet.h>
+#include <linux/nbd.h>
+
+#include <curl/curl.h>
+#include <mediacheck.h>
+
+#include "global.h"
+#include "util.h"
+#include "module.h"
+#include "lazydev.h"
+
+// block size of the nbd device
+#define LAZY_BLOCK_SIZE	4096
+
+// number of nbd devices we look at
+#define LAZY_MAX_DEVS	16
+
+// download attempts per chunk
+#define LAZY_RETRIES	3
+
+typedef struct {
+  char *url;
+  char *proxy;
+  unsigned ssl_verify:1;
+  uint64_t size;		/**< image size */
+  unsigned chunk;		/**< chunk size */
+  unsigned chunks;		/**< number of chunks */
+  char *digest_name;
+  char **digest;		/**< expected digest (hex) for each chunk */
+  unsigned char *cached;	/**< chunk has been stored in cache file */
+  int cache_fd;
+  CURL *c_handle;
+  unsigned char *buf;		/**< chunk download buffer */
+  unsigned buf_len;
+} lazy_dev_t;
+
+static int lazy_read_manifest(lazy_dev_t *ld, char *manifest);
+static int lazy_find_device(void);
+static void lazy_serve(lazy_dev_t *ld, int sock);
+static int lazy_read(lazy_dev_t *ld, unsigned char *buf, uint64_t ofs, unsigned len);
+static int lazy_load_chunk(lazy_dev_t *ld, unsigned idx);
+static size_t lazy_write_cb(void *buffer, size_t size, size_t nmemb, void *userp);
+static int lazy_read_all(int fd, void *buf, size_t len);
+static int lazy_write_all(int fd, void *buf, size_t len);
+static void lazy_free(lazy_dev_t *ld);
+
+
+/*
+ * Set up nbd device for image at 'url'.
+ *
+ * 'manifest' is a local copy of the image's manifest file. It must have
+ * been verified already (it's what the image data are checked against).
+ *
+ * Return device name (static buffer) or NULL if it didn't work out.
+ */
+char *lazydev_setup(char *url, char *manifest, char *proxy, unsigned ssl_verify)
+{
+  static char dev[64];
+  lazy_dev_t ld = { .cache_fd = -1 };
+  char *buf = NULL;
+  int nbd, nbd_fd = -1, sv[2] = { -1, -1 }, i, ok = 0;
+  pid_t pid;
+
+  if(!url || !manifest) return NULL;
+
+  if(!lazy_read_manifest(&ld, manifest)) {
+    log_info("%s: invalid manifest\n", manifest);
+    lazy_free(&ld);
+
+    return NULL;
+  }
+
+  str_copy(&ld.url, url);
+  str_copy(&ld.proxy, proxy);
+  ld.ssl_verify = ssl_verify;
+
+  if((nbd = lazy_find_device()) < 0) {
+    log_info("lazy: no nbd device available\n");
+    lazy_free(&ld);
+
+    return NULL;
+  }
+
+  snprintf(dev, sizeof dev, "/dev/nbd%d", nbd);
+
+  // the cache lives only as long as the server process
+  str_copy(&buf, new_download());
+  ld.cache_fd = open(buf, O_RDWR | O_CREAT | O_TRUNC | O_LARGEFILE, 0600);
+  if(ld.cache_fd >= 0) unlink(buf);
+
+  if(
+    ld.cache_fd >= 0 &&
+    (nbd_fd = open(dev, O_RDWR)) >= 0 &&
+    !socketpair(AF_UNIX, SOCK_STREAM, 0, sv) &&
+    !ioctl(nbd_fd, NBD_SET_BLKSIZE, (unsigned long) LAZY_BLOCK_SIZE) &&
+    !ioctl(nbd_fd, NBD_SET_SIZE_BLOCKS, (unsigned long) ((ld.size + LAZY_BLOCK_SIZE - 1) / LAZY_BLOCK_SIZE)) &&
+    !ioctl(nbd_fd, NBD_CLEAR_SOCK) &&
+    !ioctl(nbd_fd, NBD_SET_FLAGS, (unsigned long) (NBD_FLAG_HAS_FLAGS | NBD_FLAG_READ_ONLY)) &&
+    !ioctl(nbd_fd, NBD_SET_SOCK, sv[0])
+  ) {
+    ok = 1;
+  }
+  else {
+    log_info("%s: setup failed: %s\n", dev, strerror(errno));
+  }
+
+  // server process
+  if(ok && !(pid = fork())) {
+    close(sv[0]);
+    close(nbd_fd);
+    prctl(PR_SET_NAME, LAZYDEV_NAME);
+    lazy_serve(&ld, sv[1]);
+    _exit(0);
+  }
+
+  if(ok && pid == -1) ok = 0;
+
+  // this one just waits in the kernel until the device is disconnected
+  if(ok && !(pid = fork())) {
+    close(sv[0]);
+    close(sv[1]);
+    prctl(PR_SET_NAME, LAZYDEV_NAME);
+    ioctl(nbd_fd, NBD_DO_IT);
+    ioctl(nbd_fd, NBD_CLEAR_QUE);
+    ioctl(nbd_fd, NBD_CLEAR_SOCK);
+    _exit(0);
+  }
+
+  if(ok && pid == -1) ok = 0;
+
+  if(sv[0] >= 0) close(sv[0]);
+  if(sv[1] >= 0) close(sv[1]);
+  if(nbd_fd >= 0) close(nbd_fd);
+
+  // wait until the device is up
+  if(ok) {
+    strprintf(&buf, "/sys/block/nbd%d/pid", nbd);
+    for(i = 0; i < 50 && !util_check_exist(buf); i++) usleep(100000);
+    if(!util_check_exist(buf)) {
+      log_info("%s: device did not come up\n", dev);
+      ok = 0;
+    }
+  }
+
+  if(ok) {
+    log_info("%s: %s (%llu bytes, %u chunks of %u bytes, %s)\n",
+      dev, url, (unsigned long long) ld.size, ld.chunks, ld.chunk, ld.digest_name
+    );
+  }
+
+  str_copy(&buf, NULL);
+
+  lazy_free(&ld);
+
+  return ok ? dev : NULL;
+}
+
+
+/*
+ * Disconnect device 'dev' set up by lazydev_setup().
+ *
+ * The server processes notice and exit.
+ */
+void lazydev_release(char *dev)
+{
+  int fd;
+
+  if(!dev || (fd = open(dev, O_RDWR)) < 0) return;
+
+  if(ioctl(fd, NBD_DISCONNECT)) log_info("%s: disconnect failed: %s\n", dev, strerror(errno));
+
+  close(fd);
+}
+
+
+/*
+ * Parse manifest file.
+ *
+ * return:
+ *   0: failed
+ *   1: ok
+ */
+int lazy_read_manifest(lazy_dev_t *ld, char *manifest)
+{
+  FILE *f;
+  char *line = NULL, key[32], val[256];
+  size_t line_size = 0;
+  unsigned long long u;
+  unsigned cnt = 0;
+  int ok = 1;
+
+  if(!(f = fopen(manifest, "r"))) return 0;
+
+  while(ok && getline(&line, &line_size, f) > 0) {
+    if(*line == '#' || sscanf(line, "%31s %255s", key, val) != 2) continue;
+
+    if(!strcmp(key, "size")) {
+      ld->size = strtoull(val, NULL, 0);
+    }
+    else if(!strcmp(key, "chunk")) {
+      u = strtoull(val, NULL, 0);
+      // 'size' must come first
+      if(!ld->size || ld->digest || !u || u > 64 << 20) {
+        ok = 0;
+        break;
+      }
+      ld->chunk = u;
+      ld->chunks = (ld->size + ld->chunk - 1) / ld->chunk;
+      ld->digest = calloc(ld->chunks, sizeof *ld->digest);
+      ld->cached = calloc(ld->chunks, 1);
+    }
+    else if(ld->digest && cnt < ld->chunks) {
+      if(!ld->digest_name) str_copy(&ld->digest_name, key);
+      if(strcmp(key, ld->digest_name)) ok = 0;
+      str_copy(&ld->digest[cnt++], val);
+    }
+    else {
+      ok = 0;
+    }
+  }
+
+  fclose(f);
+  free(line);
+
+  if(!ld->chunks || cnt != ld->chunks) ok = 0;
+
+  // check that we can handle the digest
+  if(ok) {
+    mediacheck_digest_t *digest = mediacheck_digest_init(ld->digest_name, ld->digest[0]);
+    if(!mediacheck_digest_valid(digest)) ok = 0;
+    mediacheck_digest_done(digest);
+  }
+
+  return ok;
+}
+
+
+/*
+ * Find unused nbd device; load nbd module if necessary.
+ *
+ * Return device number or -1.
+ */
+int lazy_find_device()
+{
+  char *buf = NULL;
+  int i, nbd = -1;
+
+  if(util_check_exist("/sys/block/nbd0") != 'd') {
+    mod_modprobe("nbd", NULL);
+    // give udev a moment to create the device nodes
+    for(i = 0; i < 20 && util_check_exist("/dev/nbd0") != 'b'; i++) usleep(100000);
+  }
+
+  for(i = 0; i < LAZY_MAX_DEVS && nbd < 0; i++) {
+    strprintf(&buf, "/sys/block/nbd%d", i);
+    if(util_check_exist(buf) != 'd') break;
+    strprintf(&buf, "/sys/block/nbd%d/pid", i);
+    if(util_check_exist(buf)) continue;
+    strprintf(&buf, "/dev/nbd%d", i);
+    if(util_check_exist(buf) == 'b') nbd = i;
+  }
+
+  str_copy(&buf, NULL);
+
+  return nbd;
+}
+
+
+/*
+ * Handle nbd requests until the device is disconnected.
+ */
+void lazy_serve(lazy_dev_t *ld, int sock)
+{
+  struct nbd_request req;
+  struct nbd_reply reply;
+  unsigned char *buf = NULL;
+  unsigned buf_size = 0, len, type, err;
+  uint64_t ofs;
+
+  signal(SIGPIPE, SIG_IGN);
+
+  ld->c_handle = curl_easy_init();
+
+  curl_easy_setopt(ld->c_handle, CURLOPT_WRITEFUNCTION, lazy_write_cb);
+  curl_easy_setopt(ld->c_handle, CURLOPT_WRITEDATA, ld);
+  curl_easy_setopt(ld->c_handle, CURLOPT_NOSIGNAL, 1);
+  curl_easy_setopt(ld->c_handle, CURLOPT_FAILONERROR, 1);
+  curl_easy_setopt(ld->c_handle, CURLOPT_FOLLOWLOCATION, 1);
+  curl_easy_setopt(ld->c_handle, CURLOPT_MAXREDIRS, 10);
+  curl_easy_setopt(ld->c_handle, CURLOPT_SSL_VERIFYPEER, ld->ssl_verify ? 1 : 0);
+  curl_easy_setopt(ld->c_handle, CURLOPT_SSL_VERIFYHOST, ld->ssl_verify ? 2 : 0);
+  curl_easy_setopt(ld->c_handle, CURLOPT_CONNECTTIMEOUT, 30);
+  curl_easy_setopt(ld->c_handle, CURLOPT_LOW_SPEED_LIMIT, 1);
+  curl_easy_setopt(ld->c_handle, CURLOPT_LOW_SPEED_TIME, 60);
+  curl_easy_setopt(ld->c_handle, CURLOPT_URL, ld->url);
+  if(ld->proxy) curl_easy_setopt(ld->c_handle, CURLOPT_PROXY, ld->proxy);
+
+  ld->buf = malloc(ld->chunk);
+
+  while(lazy_read_all(sock, &req, sizeof req)) {
+    if(ntohl(req.magic) != NBD_REQUEST_MAGIC) break;
+
+    type = ntohl(req.type) & 0xffff;
+    ofs = be64toh(req.from);
+    len = ntohl(req.len);
+
+    memset(&reply, 0, sizeof reply);
+    reply.magic = htonl(NBD_REPLY_MAGIC);
+    memcpy(reply.handle, req.handle, sizeof reply.handle);
+
+    if(type == NBD_CMD_DISC) break;
+
+    if(len > buf_size) buf = realloc(buf, buf_size = len);
+
+    err = 0;
+
+    switch(type) {
+      case NBD_CMD_READ:
+        if(!lazy_read(ld, buf, ofs, len)) err = EIO;
+        break;
+
+      case NBD_CMD_WRITE:
+        // read-only: drop the data
+        if(!lazy_read_all(sock, buf, len)) goto done;
+        err = EPERM;
+        break;
+
+      case NBD_CMD_FLUSH:
+        break;
+
+      default:
+        err = EINVAL;
+        break;
+    }
+
+    reply.error = htonl(err);
+
+    if(!lazy_write_all(sock, &reply, sizeof reply)) break;
+    if(type == NBD_CMD_READ && !err && !lazy_write_all(sock, buf, len)) break;
+  }
+
+done:
+
+  free(buf);
+
+  curl_easy_cleanup(ld->c_handle);
+}
+
+
+/*
+ * Read 'len' bytes at offset 'ofs' from image.
+ *
+ * Missing chunks are loaded first. The device is a bit larger than the
+ * image (it is a multiple of LAZY_BLOCK_SIZE), the rest reads as zeros.
+ *
+ * return:
+ *   0: failed
+ *   1: ok
+ */
+int lazy_read(lazy_dev_t *ld, unsigned char *buf, uint64_t ofs, unsigned len)
+{
+  unsigned idx, l;
+  uint64_t end;
+
+  if(ofs >= ld->size) {
+    memset(buf, 0, len);
+
+    return 1;
+  }
+
+  if(ofs + len > ld->size) {
+    l = ofs + len - ld->size;
+    memset(buf + len - l, 0, l);
+    len -= l;
+  }
+
+  end = ofs + len;
+
+  for(idx = ofs / ld->chunk; (uint64_t) idx * ld->chunk < end; idx++) {
+    if(!ld->cached[idx] && !lazy_load_chunk(ld, idx)) return 0;
+  }
+
+  while(len) {
+    ssize_t r = pread(ld->cache_fd, buf, len, ofs);
+    if(r <= 0) {
+      if(r < 0 && errno == EINTR) continue;
+      return 0;
+    }
+    buf += r;
+    ofs += r;
+    len -= r;
+  }
+
+  return 1;
+}
+
+
+/*
+ * Load chunk 'idx', verify it, and add it to the cache file.
+ *
+ * return:
+ *   0: failed
+ *   1: ok
+ */
+int lazy_load_chunk(lazy_dev_t *ld, unsigned idx)
+{
+  uint64_t ofs = (uint64_t) idx * ld->chunk;
+  unsigned len = ld->size - ofs < ld->chunk ? ld->size - ofs : ld->chunk;
+  mediacheck_digest_t *digest;
+  char range[64];
+  int i, ok = 0;
+
+  snprintf(range, sizeof range, "%llu-%llu", (unsigned long long) ofs, (unsigned long long) ofs + len - 1);
+
+  curl_easy_setopt(ld->c_handle, CURLOPT_RANGE, range);
+
+  for(i = 0; i < LAZY_RETRIES && !ok; i++) {
+    if(i) sleep(1);
+
+    ld->buf_len = 0;
+
+    // a server that ignores the range request sends too much data; lazy_write_cb() catches this
+    if(curl_easy_perform(ld->c_handle) || ld->buf_len != len) continue;
+
+    digest = mediacheck_digest_init(ld->digest_name, ld->digest[idx]);
+    mediacheck_digest_process(digest, ld->buf, len);
+    ok = mediacheck_digest_ok(digest);
+    mediacheck_digest_done(digest);
+  }
+
+  if(ok && pwrite(ld->cache_fd, ld->buf, len, ofs) != len) ok = 0;
+
+  if(ok) ld->cached[idx] = 1;
+
+  return ok;
+}
+
+
+size_t lazy_write_cb(void *buffer, size_t size, size_t nmemb, void *userp)
+{
+  lazy_dev_t *ld = userp;
+  size_t len = size * nmemb;
+
+  if(len > ld->chunk - ld->buf_len) return 0;
+
+  memcpy(ld->buf + ld->buf_len, buffer, len);
+  ld->buf_len += len;
+
+  return len;
+}
+
+
+/*
+ * Read exactly 'len' bytes.
+ *
+ * return:
+ *   0: failed
+ *   1: ok
+ */
+int lazy_read_all(int fd, void *buf, size_t len)
+{
+  ssize_t r;
+
+  while(len) {
+    r = read(fd, buf, len);
+    if(r < 0 && errno == EINTR) continue;
+    if(r <= 0) return 0;
+    buf += r;
+    len -= r;
+  }
+
+  return 1;
+}
+
+
+/*
+ * Write exactly 'len' bytes.
+ *
+ * return:
+ *   0: failed
+ *   1: ok
+ */
+int lazy_write_all(int fd, void *buf, size_t len)
+{
+  ssize_t r;
+
+  while(len) {
+    r = write(fd, buf, len);
+    if(r < 0 && errno == EINTR) continue;
+    if(r <= 0) return 0;
+    buf += r;
+    len -= r;
+  }
+
+  return 1;
+}
+
+
+/*
+ * Free lazy_dev_t data; closes the cache file.
+ */
+void lazy_free(lazy_dev_t *ld)
+{
+  unsigned u;
+
+  if(ld->digest) {
+    for(u = 0; u < ld->chunks; u++) free(ld->digest[u]);
+    free(ld->digest);
+  }
+
+  free(ld->url);
+  free(ld->proxy);
+  free(ld->digest_name);
+  free(ld->cached);
+  free(ld->buf);
+
+  if(ld->cache_fd >= 0) close(ld->cache_fd);
+
+  memset(ld, 0, sizeof *ld);
+  ld->cache_fd = -1;
+}
@@ -0,0 +1,11 @@
+/*
+ *
+ * lazydev.h     Header file for lazydev.c
+ *
+ */
+
+// process name of the block device server (see do_not_kill())
+#define LAZYDEV_NAME	"linuxrc-nbd"
+
+char *lazydev_setup(char *url, char *manifest, char *proxy, unsigned ssl_verify);
+void lazydev_release(char *dev);
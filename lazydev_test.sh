@@ -0,0 +1,129 @@
+#! /bin/bash
+
+# Check on-demand instsys loading (lazyinstsys) against a local http server.
+#
+# Two runs:
+#   - a plain squashfs image must be mounted via nbd
+#   - a compressed image can't be mounted that way; linuxrc must release
+#     the nbd device and download the image as usual
+#
+# Needs root, the nbd module, mksquashfs, python3, and tmux. linuxrc runs
+# in its own mount namespace but otherwise modifies the system (log file,
+# network setup) - use a VM.
+
+# exit on error immediately
+set -e
+
+PORT=8765
+SESSION=lazydev
+LOG=/var/log/linuxrc.log
+ARCH=$(uname -m)
+DIR=$(mktemp -d)
+
+function cleanup()
+{
+  tmux kill-session -t $SESSION 2> /dev/null || true
+  [ -n "$SERVER" ] && kill $SERVER 2> /dev/null || true
+  rm -rf "$DIR"
+}
+
+trap cleanup EXIT
+
+function skip()
+{
+  echo "SKIPPED: $1"
+  exit 0
+}
+
+# write manifest for image $1 (see lazydev.c)
+function make_manifest()
+{
+  python3 - "$1" > "$1.chunks" <<'EOF'
+import hashlib, os, sys
+chunk = 1 << 20
+print("size", os.path.getsize(sys.argv[1]))
+print("chunk", chunk)
+with open(sys.argv[1], "rb") as f:
+  while data := f.read(chunk):
+    print("sha256", hashlib.sha256(data).hexdigest())
+EOF
+}
+
+# wait up to 60 s for log message $1
+function wait_for_log()
+{
+  for i in $(seq 60) ; do
+    if grep -q -- "$1" $LOG 2> /dev/null ; then
+      echo "Matched expected log message: '$1'"
+      return 0
+    fi
+    sleep 1
+  done
+
+  echo "ERROR: No match for expected log message '$1'"
+  tail -n 30 $LOG
+  exit 1
+}
+
+function not_in_log()
+{
+  if grep -q -- "$1" $LOG ; then
+    echo "ERROR: Matched unexpected log message: '$1'"
+    exit 1
+  fi
+}
+
+# run linuxrc against the repo in $DIR/repo
+function run_linuxrc()
+{
+  tmux kill-session -t $SESSION 2> /dev/null || true
+  rm -f $LOG
+
+  echo "Starting linuxrc..."
+  TERM=screen tmux new-session -d -s $SESSION -x 80 -y 25 \
+    unshare -m ./linuxrc linemode=1 insecure=1 lazyinstsys=1 netsetup=0 \
+      install=http://127.0.0.1:$PORT/repo
+}
+
+###############################################################################
+
+[ $(id -u) = 0 ] || skip "must be run as root"
+[ -x ./linuxrc ] || skip "linuxrc not built"
+for i in mksquashfs python3 tmux unshare ; do
+  type -p $i > /dev/null || skip "$i missing"
+done
+[ -d /sys/block/nbd0 ] || modprobe nbd 2> /dev/null || skip "no nbd support"
+
+mkdir -p "$DIR/repo/boot/$ARCH" "$DIR/root/etc"
+echo lazydev > "$DIR/root/etc/lazydev-test"
+printf "LABEL lazydev test\n" > "$DIR/repo/content"
+mksquashfs "$DIR/root" "$DIR/root.img" -noappend -quiet > /dev/null
+
+(cd "$DIR" && exec python3 -m http.server --bind 127.0.0.1 $PORT > /dev/null 2>&1) &
+SERVER=$!
+sleep 1
+
+###############################################################################
+
+echo "Plain image: expect nbd mount"
+
+cp "$DIR/root.img" "$DIR/repo/boot/$ARCH/root"
+make_manifest "$DIR/repo/boot/$ARCH/root"
+
+run_linuxrc
+wait_for_log "mount /dev/nbd[0-9]* -> "
+not_in_log "mount failed, loading image"
+
+###############################################################################
+
+echo "Compressed image: expect fallback to download"
+
+gzip -c "$DIR/root.img" > "$DIR/repo/boot/$ARCH/root"
+make_manifest "$DIR/repo/boot/$ARCH/root"
+
+run_linuxrc
+wait_for_log "/dev/nbd[0-9]*: mount failed, loading image"
+wait_for_log "loading .*/boot/$ARCH/root.* -> "
+not_in_log "instsys mount failed"
+
+echo "lazydev test ok"
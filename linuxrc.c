@@ -45,6 +45,9 @@
 #include "scsi_rename.h"
 #include "checkmedia.h"
 #include "url.h"
+#include "trace.h"
+#include "lazydev.h"
+#include "zram.h"
 #include <sys/utsname.h>
 #ifdef __s390x__
 #include <query_capacity.h>
@@ -151,6 +154,9 @@ int main(int argc, char **argv, char **env)
   config.log.dest[2].level = LOG_LEVEL_SHOW | LOG_LEVEL_INFO | LOG_LEVEL_DEBUG | LOG_TIMESTAMP;
   str_copy(&config.log.dest[2].name, "/var/log/linuxrc.log");
 
+  // write log files & log console asynchronously
+  config.log.async = 1;
+
   str_copy(&config.product, "SUSE Linux");
 
   config.update.next_name = &config.update.name_list;
@@ -222,7 +228,9 @@ int main(int argc, char **argv, char **env)
 
   setenv("PATH", "/lbin:/bin:/sbin:/usr/bin:/usr/sbin:/usr/local/bin", 1);
 
+  trace_begin("init", NULL);
   lxrc_init();
+  trace_end();
 
   if(config.rootpassword && !strcmp(config.rootpassword, "ask")) {
     int win_old;
@@ -247,7 +255,9 @@ int main(int argc, char **argv, char **env)
       if(!win_old) util_disp_done();
       
     }
+    trace_begin("install", NULL);
     err = inst_start_install();
+    trace_end();
   }
   else {
     err = 99;
@@ -274,6 +284,7 @@ void lxrc_reboot()
   }
 
   if(dia_yesno("Reboot the system now?", 1) == YES) {
+    util_log_flush(1);
     reboot(RB_AUTOBOOT);
   }
 }
@@ -288,6 +299,7 @@ void lxrc_halt()
   }
 
   if(dia_yesno("Do you want to halt the system now?", 1) == YES) {
+    util_log_flush(1);
     reboot(RB_POWER_OFF);
   }
 }
@@ -298,7 +310,6 @@ void lxrc_change_root()
   int i;
   char *buf = NULL, *mp = "/mnt", **s;
   slist_t *sl;
-  char *argv[3] = { };
   char *dirs[] = {
     "bin", "boot", "etc", "home", "lib", "run",
     "media", "mounts", "mounts/initrd", "mnt", "parts", "parts/mp_0000", "proc", "sbin",
@@ -368,9 +379,7 @@ void lxrc_change_root()
 
     // add rescue images
     for(sl = config.url.instsys_list; sl; sl = sl->next) {
-      argv[1] = sl->value;
-      argv[2] = mp;
-      util_lndir_main(3, argv);
+      util_layer_add(sl->value, mp);
     }
 
     // move image mountpoints
@@ -494,6 +503,8 @@ void lxrc_end()
 
   log_info("all killed\n");
 
+  trace_write();
+
 //  while(waitpid(-1, NULL, WNOHANG) == 0);
 
   log_info("all done\n");
@@ -521,6 +532,9 @@ void lxrc_end()
   kbd_end(1);
   disp_end();
 
+  // write out pending log messages; from now on log synchronously
+  util_log_flush(1);
+
   if(!config.restarting) lxrc_change_root();
 }
 
@@ -534,7 +548,7 @@ int do_not_kill(char *name)
     "portmap", "rpciod", "lockd", "cifsd", "mount.smbfs", "udevd",
     "mount.ntfs-3g", "brld", "sbl", "wickedd", "wickedd-auto4", "wickedd-dhcp4",
     "wickedd-dhcp6", "wickedd-nanny", "dbus-daemon", "rpc.idmapd", "sh", "haveged",
-    "wpa_supplicant", "rsyslogd"
+    "wpa_supplicant", "rsyslogd", LAZYDEV_NAME
   };
   int i;
 
@@ -553,52 +567,44 @@ int do_not_kill(char *name)
  */
 void lxrc_killall(int really_all_iv)
 {
-  pid_t mypid;
-  struct dirent *de;
-  DIR *d;
-  pid_t pid;
-  char *s;
-  slist_t *sl0 = NULL, *sl;
-  int sig;
+  pid_t mypid, *pids;
+  proc_table_t *pt;
+  proc_entry_t *pe;
+  unsigned len = 0;
 
   if(config.test) return;
 
   mypid = getpid();
 
-  if(!(d = opendir("/proc"))) return;
-
-  /* make a (reversed) list of all process ids */
-  while((de = readdir(d))) {
-    pid = strtoul(de->d_name, &s, 10);
-    if(!*s && *util_process_cmdline(pid)) {
-      sl = slist_add(&sl0, slist_new());
-      sl->key = strdup(de->d_name);
-      sl->value = strdup(util_process_name(pid));
+  pt = util_proc_snapshot();
+  pids = calloc(pt->len + 1, sizeof *pids);
+
+  for(pe = pt->list; pe < pt->list + pt->len; pe++) {
+    if(
+      !pe->kthread &&
+      !pe->zombie &&
+      pe->pid > mypid &&
+      (really_all_iv || !do_not_kill(pe->name))
+    ) {
+      log_info("killing %s (%d)\n", pe->name, pe->pid);
+      pids[len++] = pe->pid;
     }
   }
 
-  closedir(d);
+  util_proc_free(pt);
 
-  for(sig = 15; sig >= 9; sig -= 6) {
-    for(sl = sl0; sl; sl = sl->next) {
-      pid = strtoul(sl->key, NULL, 10);
-      if(
-        pid > mypid &&
-        (really_all_iv || !do_not_kill(sl->value))
-      ) {
-        if(sig == 15) log_info("killing %s (%d)\n", sl->value, pid);
-        kill(pid, sig);
-        usleep(20000);
-      }
-    }
+  /* give them a second to terminate, then kill the rest */
+  if(util_proc_kill(pids, len, SIGTERM, 1000)) {
+    util_proc_kill(pids, len, SIGKILL, 1000);
   }
 
-  slist_free(sl0);
+  free(pids);
 
   while(waitpid(-1, NULL, WNOHANG) > 0);
 }
 
 
+
 /*
  *
  * Local functions
@@ -649,6 +655,9 @@ void lxrc_catch_signal_11(SIGNAL_ARGS)
   ip = scp.sc_fpc_eir;
 #endif
 
+  // get everything logged up to now written
+  util_log_flush(1);
+
   config.error_trace = 1;
   util_error_trace("***  signal 11 ***\n");
 
@@ -805,6 +814,7 @@ void lxrc_init()
   config.secure = 1;
   config.sslcerts = 1;
   config.squash = 1;
+  config.prefetch = 1;
   config.kexec_reboot = 1;
   config.efi = -1;
   config.udev_mods = 1;
@@ -851,6 +861,7 @@ void lxrc_init()
   config.defaultrepo = slist_split(',', "cd:/,hd:/");
 
   file_do_info(file_get_cmdline(key_lxrcdebug), kf_cmd + kf_cmd_early);
+  file_do_info(file_get_cmdline(key_overlay), kf_cmd + kf_cmd_early);
 
   LXRC_WAIT
 
@@ -1176,6 +1187,14 @@ void lxrc_init()
   }
 #endif
 
+  // compressed swap for the download area; before the RAM check as it helps there, too
+  if(config.zram.algo && !config.test && !zram_setup()) {
+    util_free_mem();
+    if(!config.download.instsys_set) {
+      config.download.instsys = config.memoryXXX.free > config.memoryXXX.load_image ? 1 : 0;
+    }
+  }
+
   if(config.memoryXXX.ram_min && !config.had_segv) {
     int window = config.win;
     int64_t ram;
@@ -1185,7 +1204,7 @@ void lxrc_init()
 
     ram = config.memoryXXX.ram_min - config.memoryXXX.ram_min / 8;
 
-    if(config.memoryXXX.ram < ram) {
+    if(config.memoryXXX.ram + zram_gain() < ram) {
       if(!window) util_disp_init();
       strprintf(&msg, "Your computer does not have enough RAM for the installation of %s. You need at least %d MB.", config.product, (int) (config.memoryXXX.ram_min >> 20));
       dia_message(msg, MSGTYPE_REBOOT);
@@ -1197,6 +1216,7 @@ void lxrc_init()
           log_info("*** reboot ***\n");
         }
         else {
+          util_log_flush(1);
           reboot(RB_AUTOBOOT);
         }
       }
@@ -1654,7 +1674,7 @@ void lxrc_add_parts()
   struct dirent *de;
   DIR *d;
   slist_t *sl0 = NULL, *sl;
-  char *mp = NULL, *argv[3] = { };
+  char *mp = NULL;
   int insmod_done = 0;
 
   if((d = opendir("/parts"))) {
@@ -1679,9 +1699,7 @@ void lxrc_add_parts()
       strprintf(&mp, "/parts/mp_%04u", config.mountpoint.initrd_parts++);
       mkdir(mp, 0755);
       util_mount_ro(sl->key, mp, NULL);
-      argv[1] = mp;
-      argv[2] = "/";
-      util_lndir_main(3, argv);
+      util_layer_add(mp, "/");
     }
   }
 
@@ -1692,16 +1710,14 @@ void lxrc_add_parts()
 
 void lxrc_readd_parts()
 {
-  char *mp = NULL, *argv[3] = { };
+  char *mp = NULL;
   unsigned u;
 
   if(config.test) return;
 
   for(u = 0; u < config.mountpoint.initrd_parts; u++) {
     strprintf(&mp, "/parts/mp_%04u", u);
-    argv[1] = mp;
-    argv[2] = "/";
-    util_lndir_main(3, argv);
+    util_layer_add(mp, "/");
   }
 
   free(mp);
@@ -0,0 +1,478 @@
+/*
+ *
+ * mcast.c       Receive images via multicast
+ *
+ * A sender (mcast/mcastsend) continuously loops over a set of images and
+ * sends them to a multicast group. Receivers join the group, collect the
+ * blocks of the image they need in any order, and load whatever is still
+ * missing after a full pass via unicast range requests.
+ *
+ * The complete file is then processed like a normal download (see
+ * url_read()), so digests and signatures are checked as usual.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <endian.h>
+
+#include <curl/curl.h>
+
+#include "global.h"
+#include "util.h"
+#include "url.h"
+#include "mcast.h"
+
+// seconds to wait for the sender to announce the file
+#define MCAST_WAIT		3
+
+// seconds without new data before falling back to unicast
+#define MCAST_STALL		5
+
+// after a full pass, load the rest via unicast if no more than this is missing
+#define MCAST_REPAIR_MAX	(4 << 20)
+
+// combine missing ranges closer than this (in blocks) into one request
+#define MCAST_REPAIR_GAP	16
+
+typedef struct {
+  int fd;			// output file
+  uint64_t size;
+  unsigned blocks;
+  unsigned missing;		// number of missing blocks
+  unsigned char *have;		// block received
+} mcast_file_t;
+
+typedef struct {
+  int fd;
+  uint64_t ofs, end;		// current write position, end of range
+} mcast_range_t;
+
+static int mcast_open(struct sockaddr_in *group);
+static int mcast_match(char *path, char *name);
+static int mcast_wait(int sock, char *path, uint32_t *id, uint64_t *size);
+static int mcast_collect(int sock, url_data_t *url_data, uint32_t id, mcast_file_t *mf);
+static int mcast_repair(url_data_t *url_data, mcast_file_t *mf);
+static int mcast_repair_range(CURL *c_handle, int fd, uint64_t start, uint64_t end);
+static size_t mcast_write_cb(void *buffer, size_t size, size_t nmemb, void *userp);
+static double mcast_time(void);
+
+// set if nobody is sending at all
+static int mcast_dead;
+
+// files announced by the sender; complete once it has been through all of them
+static slist_t *mcast_offered;
+static int mcast_offered_all;
+
+
+/*
+ * Receive file url_data->url via multicast and store it in 'file'.
+ *
+ * The multicast group is taken from config.multicast ('address:port').
+ *
+ * return:
+ *   0: ok
+ *   1: failed (do a normal download)
+ */
+int mcast_receive(url_data_t *url_data, char *file)
+{
+  struct sockaddr_in group = { };
+  mcast_file_t mf = { .fd = -1 };
+  char *addr = NULL, *s;
+  uint32_t id;
+  double start;
+  int sock, err = 1;
+
+  if(!config.multicast || mcast_dead || !url_data->url->path) return 1;
+
+  str_copy(&addr, config.multicast);
+  if((s = strrchr(addr, ':'))) *s++ = 0;
+  group.sin_family = AF_INET;
+  group.sin_port = htons(s ? atoi(s) : 0);
+  if(!group.sin_port || inet_pton(AF_INET, addr, &group.sin_addr) != 1) {
+    log_info("multicast: %s: invalid address\n", config.multicast);
+    str_copy(&addr, NULL);
+    mcast_dead = 1;
+
+    return 1;
+  }
+  str_copy(&addr, NULL);
+
+  if((sock = mcast_open(&group)) < 0) {
+    mcast_dead = 1;
+
+    return 1;
+  }
+
+  start = mcast_time();
+
+  switch(mcast_wait(sock, url_data->url->path, &id, &mf.size)) {
+    case 0:
+      log_info("multicast: %s: nobody is sending\n", config.multicast);
+      mcast_dead = 1;
+      break;
+
+    case 1:
+      log_info("multicast: %s: not offered\n", url_data->url->path);
+      break;
+
+    case 2:
+      mf.blocks = (mf.size + MCAST_BLOCK_SIZE - 1) / MCAST_BLOCK_SIZE;
+      mf.missing = mf.blocks;
+      mf.have = calloc(mf.blocks + 1, 1);
+      mf.fd = open(file, O_RDWR | O_CREAT | O_TRUNC | O_LARGEFILE, 0644);
+      if(mf.fd < 0 || ftruncate(mf.fd, mf.size)) {
+        perror_info(file);
+        break;
+      }
+
+      log_info("multicast: receiving %s (%llu bytes)\n", url_data->url->path, (unsigned long long) mf.size);
+
+      err = mcast_collect(sock, url_data, id, &mf);
+
+      log_info("multicast: %u of %u blocks received in %.1f s\n",
+        mf.blocks - mf.missing, mf.blocks, mcast_time() - start
+      );
+
+      if(!err && mf.missing) err = mcast_repair(url_data, &mf);
+      break;
+  }
+
+  close(sock);
+  if(mf.fd >= 0 && close(mf.fd)) err = 1;
+  free(mf.have);
+
+  // the real download starts from scratch
+  url_data->p_now = url_data->p_total = 0;
+  url_data->stats.pos = 0;
+
+  return err;
+}
+
+
+/*
+ * Create socket and join multicast group.
+ *
+ * Return socket or -1.
+ */
+int mcast_open(struct sockaddr_in *group)
+{
+  struct sockaddr_in addr = { };
+  struct ip_mreq mreq = { };
+  int sock, i = 1;
+
+  if((sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0) {
+    perror_info("multicast: socket");
+
+    return -1;
+  }
+
+  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &i, sizeof i);
+
+  // we might not be fast enough to keep up
+  i = 4 << 20;
+  setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &i, sizeof i);
+
+  addr.sin_family = AF_INET;
+  addr.sin_port = group->sin_port;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+  mreq.imr_multiaddr = group->sin_addr;
+  mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+
+  if(
+    bind(sock, (struct sockaddr *) &addr, sizeof addr) ||
+    setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof mreq)
+  ) {
+    perror_info("multicast: join");
+    close(sock);
+
+    return -1;
+  }
+
+  return sock;
+}
+
+
+/*
+ * Check if announced file 'name' matches url path 'path' (the path must end
+ * with '/name').
+ */
+int mcast_match(char *path, char *name)
+{
+  size_t path_len = strlen(path), name_len = strlen(name);
+
+  while(*name == '/') name++, name_len--;
+
+  if(!name_len || name_len >= path_len) return 0;
+
+  return path[path_len - name_len - 1] == '/' && !strcmp(path + path_len - name_len, name);
+}
+
+
+/*
+ * Wait for an announcement of 'path'.
+ *
+ * The sender announces its files in turn. When the first announcement seen
+ * comes around again, we know all files and can stop waiting. Files not on
+ * that list are not waited for at all next time.
+ *
+ * return:
+ *   0: nothing received at all
+ *   1: file not offered
+ *   2: ok, id and size are set
+ */
+int mcast_wait(int sock, char *path, uint32_t *id, uint64_t *size)
+{
+  unsigned char buf[sizeof (mcast_header_t) + MCAST_BLOCK_SIZE + 1];
+  mcast_header_t *hdr = (mcast_header_t *) buf;
+  struct pollfd pfd = { .fd = sock, .events = POLLIN };
+  double end = mcast_time() + MCAST_WAIT;
+  int len, got_any = 0, got_announce = 0;
+  unsigned name_len;
+  uint32_t first_id = 0;
+  char *name;
+  slist_t *sl;
+
+  if(mcast_offered_all) {
+    for(sl = mcast_offered; sl && !mcast_match(path, sl->key); sl = sl->next);
+    if(!sl) return 1;
+  }
+
+  while(mcast_time() < end) {
+    if(poll(&pfd, 1, 200) <= 0) continue;
+
+    len = recv(sock, buf, sizeof buf - 1, 0);
+    if(len < (int) sizeof *hdr || ntohl(hdr->magic) != MCAST_MAGIC) continue;
+
+    got_any = 1;
+
+    if(hdr->type != MCAST_ANNOUNCE) continue;
+
+    name_len = ntohs(hdr->len);
+    if(name_len != len - sizeof *hdr) continue;
+    buf[sizeof *hdr + name_len] = 0;
+    name = (char *) buf + sizeof *hdr;
+
+    if(!slist_getentry(mcast_offered, name)) slist_append_str(&mcast_offered, name);
+
+    if(mcast_match(path, name)) {
+      *id = ntohl(hdr->id);
+      *size = be64toh(hdr->size);
+
+      return 2;
+    }
+
+    if(!got_announce) {
+      got_announce = 1;
+      first_id = ntohl(hdr->id);
+    }
+    else if(ntohl(hdr->id) == first_id) {
+      mcast_offered_all = 1;
+      break;
+    }
+  }
+
+  return got_any ? 1 : 0;
+}
+
+
+/*
+ * Collect data packets for file 'id'.
+ *
+ * Stops when the file is complete, when the sender has started a new pass
+ * and only little is missing, or when no new data arrive.
+ *
+ * return:
+ *   0: ok (but the file may be incomplete)
+ *   1: failed or aborted
+ */
+int mcast_collect(int sock, url_data_t *url_data, uint32_t id, mcast_file_t *mf)
+{
+  unsigned char buf[sizeof (mcast_header_t) + MCAST_BLOCK_SIZE];
+  mcast_header_t *hdr = (mcast_header_t *) buf;
+  struct pollfd pfd = { .fd = sock, .events = POLLIN };
+  unsigned block, len, data_len;
+  double now, last_new;
+  int i;
+
+  last_new = mcast_time();
+
+  url_data->p_total = mf->size;
+
+  while(mf->missing) {
+    now = mcast_time();
+
+    if(now - last_new > MCAST_STALL) {
+      log_info("multicast: no data for %d s\n", MCAST_STALL);
+      break;
+    }
+
+    if(poll(&pfd, 1, 200) > 0) {
+      // fetch everything that's there
+      while(mf->missing && (i = recv(sock, buf, sizeof buf, MSG_DONTWAIT)) > 0) {
+        len = i;
+        if(
+          len < sizeof *hdr ||
+          ntohl(hdr->magic) != MCAST_MAGIC ||
+          hdr->type != MCAST_DATA ||
+          ntohl(hdr->id) != id ||
+          be64toh(hdr->size) != mf->size
+        ) continue;
+
+        block = ntohl(hdr->block);
+        data_len = ntohs(hdr->len);
+
+        if(
+          block >= mf->blocks ||
+          data_len != len - sizeof *hdr ||
+          (uint64_t) block * MCAST_BLOCK_SIZE + data_len != (block == mf->blocks - 1 ? mf->size : (uint64_t) (block + 1) * MCAST_BLOCK_SIZE)
+        ) continue;
+
+        if(mf->have[block]) {
+          // sender is repeating what we have - maybe it's faster to get the rest via unicast
+          if((uint64_t) mf->missing * MCAST_BLOCK_SIZE <= MCAST_REPAIR_MAX) return 0;
+
+          continue;
+        }
+
+        if(pwrite(mf->fd, buf + sizeof *hdr, data_len, (off_t) block * MCAST_BLOCK_SIZE) != data_len) {
+          perror_info("multicast: write");
+
+          return 1;
+        }
+
+        mf->have[block] = 1;
+        mf->missing--;
+        last_new = now;
+      }
+    }
+
+    url_data->p_now = (uint64_t) (mf->blocks - mf->missing) * MCAST_BLOCK_SIZE;
+    if(url_data->p_now > mf->size) url_data->p_now = mf->size;
+
+    if(url_progress_tick(url_data, !mf->missing)) {
+      url_data->err = 102;
+
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+
+/*
+ * Load missing blocks via unicast range requests.
+ *
+ * return:
+ *   0: ok
+ *   1: failed
+ */
+int mcast_repair(url_data_t *url_data, mcast_file_t *mf)
+{
+  CURL *c_handle;
+  char *proxy_url = NULL;
+  unsigned start, end, next, ranges = 0;
+  int err = 0;
+
+  c_handle = curl_easy_init();
+
+  curl_easy_setopt(c_handle, CURLOPT_WRITEFUNCTION, mcast_write_cb);
+  curl_easy_setopt(c_handle, CURLOPT_URL, url_data->url->str);
+
+  // same timeouts as any other download
+  str_copy(&proxy_url, url_print(config.url.proxy, 1));
+  url_curl_setopt(c_handle, config.sslcerts, url_ip_resolve(), proxy_url);
+
+  for(start = 0; start < mf->blocks && !err; start = end) {
+    if(mf->have[start]) {
+      end = start + 1;
+      continue;
+    }
+
+    // find end of range, skipping small gaps
+    for(end = next = start; next < mf->blocks && next - end < MCAST_REPAIR_GAP; next++) {
+      if(!mf->have[next]) end = next + 1;
+    }
+
+    err = mcast_repair_range(c_handle, mf->fd,
+      (uint64_t) start * MCAST_BLOCK_SIZE,
+      end == mf->blocks ? mf->size : (uint64_t) end * MCAST_BLOCK_SIZE
+    );
+
+    ranges++;
+  }
+
+  log_info("multicast: %u blocks in %u ranges loaded via unicast%s\n", mf->missing, ranges, err ? " - failed" : "");
+
+  curl_easy_cleanup(c_handle);
+
+  str_copy(&proxy_url, NULL);
+
+  return err;
+}
+
+
+/*
+ * Load bytes start ... end - 1 of the file and store them at the same offset.
+ *
+ * return:
+ *   0: ok
+ *   1: failed
+ */
+int mcast_repair_range(CURL *c_handle, int fd, uint64_t start, uint64_t end)
+{
+  mcast_range_t range = { .fd = fd, .ofs = start, .end = end };
+  char buf[64];
+
+  snprintf(buf, sizeof buf, "%llu-%llu", (unsigned long long) start, (unsigned long long) end - 1);
+
+  curl_easy_setopt(c_handle, CURLOPT_RANGE, buf);
+  curl_easy_setopt(c_handle, CURLOPT_WRITEDATA, &range);
+
+  if(curl_easy_perform(c_handle)) return 1;
+
+  // a server ignoring the range request sends too much; mcast_write_cb() catches this
+  return range.ofs == end ? 0 : 1;
+}
+
+
+size_t mcast_write_cb(void *buffer, size_t size, size_t nmemb, void *userp)
+{
+  mcast_range_t *range = userp;
+  size_t len = size * nmemb;
+
+  if(len > range->end - range->ofs) return 0;
+
+  if(pwrite(range->fd, buffer, len, range->ofs) != (ssize_t) len) return 0;
+
+  range->ofs += len;
+
+  return len;
+}
+
+
+/*
+ * Current time in seconds (monotonic clock).
+ */
+double mcast_time()
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
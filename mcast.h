@@ -0,0 +1,36 @@
+/*
+ *
+ * mcast.h       Multicast image distribution (see mcast.c and mcast/mcastsend.c)
+ *
+ */
+
+#include <stdint.h>
+
+/*
+ * Wire format: each UDP packet starts with an mcast_header_t (all fields
+ * in network byte order).
+ *
+ * The sender loops over its files ('data carousel'). Every file is sent in
+ * MCAST_BLOCK_SIZE blocks (the last one may be shorter); from time to time
+ * it sends announce packets for all its files in a row. Each maps the file
+ * name (path relative to the repository, e.g. 'boot/x86_64/root') to the
+ * file id used in the data packets.
+ */
+#define MCAST_MAGIC		0x4c584d43	// 'LXMC'
+#define MCAST_ANNOUNCE		1		// payload: file name
+#define MCAST_DATA		2		// payload: file data
+#define MCAST_BLOCK_SIZE	1400
+
+typedef struct {
+  uint32_t magic;
+  uint8_t type;
+  uint8_t reserved;
+  uint16_t len;			// payload size
+  uint32_t id;			// file id
+  uint32_t block;		// block number (data packets)
+  uint64_t size;		// file size
+} __attribute__((packed)) mcast_header_t;
+
+struct url_data_s;
+
+int mcast_receive(struct url_data_s *url_data, char *file);
@@ -0,0 +1,315 @@
+/*
+ *
+ * mcastsend.c   Send images to a multicast group for linuxrc's 'multicast' option
+ *
+ * The files are sent in a loop (round-robin, block by block) until the
+ * program is stopped (or --passes is reached). Receivers may join at any
+ * time; anything they miss they load via unicast from the repository.
+ *
+ * Usage: mcastsend [options] GROUP:PORT DIR FILE...
+ *
+ * FILE is the path relative to the repository root DIR (e.g.
+ * boot/x86_64/root); it is matched against the end of the url linuxrc
+ * loads.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <inttypes.h>
+#include <endian.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../mcast.h"
+
+/* announce all files every that many rounds (one block of each file) */
+#define ANNOUNCE_INTERVAL	256
+
+struct option options[] = {
+  { "rate", 1, NULL, 'r' },
+  { "ttl", 1, NULL, 't' },
+  { "interface", 1, NULL, 'i' },
+  { "passes", 1, NULL, 'n' },
+  { "verbose", 0, NULL, 'v' },
+  { "help", 0, NULL, 'h' },
+  { }
+};
+
+typedef struct {
+  char *name;			/* as announced */
+  int fd;
+  uint64_t size;
+  uint32_t id;
+  unsigned blocks;
+  unsigned next;		/* next block to send */
+  unsigned passes;		/* complete passes so far */
+} file_t;
+
+int opt_verbose = 0;
+double opt_rate = 10 << 20;	/* bytes/s */
+int opt_ttl = 1;
+char *opt_interface = NULL;
+unsigned opt_passes = 0;	/* 0: forever */
+
+void usage(void);
+double now(void);
+int send_packet(int sock, struct sockaddr_in *group, file_t *file, int type);
+
+
+int main(int argc, char **argv)
+{
+  struct sockaddr_in group = { };
+  struct in_addr if_addr;
+  struct stat sbuf;
+  file_t *files;
+  unsigned files_len, u, done, round;
+  char *s, *addr, *dir, *path = NULL;
+  double next_send, t;
+  uint64_t sent = 0;
+  uint32_t id_base;
+  int i, sock;
+  struct timespec ts;
+
+  opterr = 0;
+
+  while((i = getopt_long(argc, argv, "r:t:i:n:vh", options, NULL)) != -1) {
+    switch(i) {
+      case 'r':
+        opt_rate = strtod(optarg, &s);
+        if(*s == 'k' || *s == 'K') opt_rate *= 1 << 10, s++;
+        else if(*s == 'M') opt_rate *= 1 << 20, s++;
+        else if(*s == 'G') opt_rate *= 1 << 30, s++;
+        if(*s || opt_rate < MCAST_BLOCK_SIZE) {
+          fprintf(stderr, "invalid rate: %s\n", optarg);
+          return 1;
+        }
+        break;
+
+      case 't':
+        opt_ttl = strtol(optarg, &s, 0);
+        if(*s || opt_ttl < 0 || opt_ttl > 255) {
+          fprintf(stderr, "invalid ttl: %s\n", optarg);
+          return 1;
+        }
+        break;
+
+      case 'i':
+        opt_interface = optarg;
+        break;
+
+      case 'n':
+        opt_passes = strtoul(optarg, &s, 0);
+        if(*s) {
+          fprintf(stderr, "invalid number of passes: %s\n", optarg);
+          return 1;
+        }
+        break;
+
+      case 'v':
+        opt_verbose++;
+        break;
+
+      default:
+        usage();
+        return i == 'h' ? 0 : 1;
+    }
+  }
+
+  argc -= optind;
+  argv += optind;
+
+  if(argc < 3) {
+    usage();
+    return 1;
+  }
+
+  addr = strdup(argv[0]);
+  if((s = strrchr(addr, ':'))) *s++ = 0;
+  group.sin_family = AF_INET;
+  group.sin_port = htons(s ? atoi(s) : 0);
+  if(!group.sin_port || inet_pton(AF_INET, addr, &group.sin_addr) != 1) {
+    fprintf(stderr, "invalid multicast group: %s\n", argv[0]);
+    return 1;
+  }
+
+  dir = argv[1];
+
+  files_len = argc - 2;
+  files = calloc(files_len, sizeof *files);
+
+  // distinguish sender restarts
+  id_base = (time(NULL) ^ getpid()) << 8;
+
+  for(u = 0; u < files_len; u++) {
+    files[u].name = argv[u + 2];
+    while(*files[u].name == '/') files[u].name++;
+    if(strlen(files[u].name) > MCAST_BLOCK_SIZE) {
+      fprintf(stderr, "%s: name too long\n", files[u].name);
+      return 1;
+    }
+    if(asprintf(&path, "%s/%s", dir, files[u].name) < 0) return 1;
+    if((files[u].fd = open(path, O_RDONLY)) < 0 || fstat(files[u].fd, &sbuf)) {
+      perror(path);
+      return 1;
+    }
+    if(!S_ISREG(sbuf.st_mode) || !sbuf.st_size) {
+      fprintf(stderr, "%s: not a regular file or empty\n", path);
+      return 1;
+    }
+    files[u].size = sbuf.st_size;
+    files[u].blocks = (files[u].size + MCAST_BLOCK_SIZE - 1) / MCAST_BLOCK_SIZE;
+    files[u].id = id_base + u;
+    if(opt_verbose) printf("%s: %"PRIu64" bytes, %u blocks\n", files[u].name, files[u].size, files[u].blocks);
+    free(path);
+    path = NULL;
+  }
+
+  if((sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+    perror("socket");
+    return 1;
+  }
+
+  if(setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &opt_ttl, sizeof opt_ttl)) {
+    perror("ttl");
+    return 1;
+  }
+
+  if(opt_interface) {
+    if(inet_pton(AF_INET, opt_interface, &if_addr) != 1) {
+      fprintf(stderr, "invalid interface address: %s\n", opt_interface);
+      return 1;
+    }
+    if(setsockopt(sock, IPPROTO_IP, IP_MULTICAST_IF, &if_addr, sizeof if_addr)) {
+      perror(opt_interface);
+      return 1;
+    }
+  }
+
+  next_send = now();
+
+  for(done = round = 0; !opt_passes || done < files_len; round++) {
+    // announce all files together: receivers know the full list once an announcement repeats
+    if(!(round % ANNOUNCE_INTERVAL)) {
+      for(u = 0; u < files_len; u++) {
+        if(opt_passes && files[u].passes >= opt_passes) continue;
+        if(send_packet(sock, &group, files + u, MCAST_ANNOUNCE)) return 1;
+      }
+    }
+
+    for(u = 0; u < files_len; u++) {
+      if(opt_passes && files[u].passes >= opt_passes) continue;
+
+      if(send_packet(sock, &group, files + u, MCAST_DATA)) return 1;
+
+      sent += sizeof (mcast_header_t) + MCAST_BLOCK_SIZE;
+
+      if(++files[u].next == files[u].blocks) {
+        files[u].next = 0;
+        files[u].passes++;
+        if(opt_verbose) printf("%s: pass %u done\n", files[u].name, files[u].passes);
+        if(opt_passes && files[u].passes >= opt_passes) done++;
+      }
+
+      // keep the rate
+      next_send += (sizeof (mcast_header_t) + MCAST_BLOCK_SIZE) / opt_rate;
+      t = next_send - now();
+      if(t > 0.001) {
+        ts.tv_sec = t;
+        ts.tv_nsec = (t - ts.tv_sec) * 1e9;
+        nanosleep(&ts, NULL);
+      }
+      else if(t < -1) {
+        // we're too slow; don't try to catch up
+        next_send = now();
+      }
+    }
+  }
+
+  if(opt_verbose) printf("%"PRIu64" bytes sent\n", sent);
+
+  return 0;
+}
+
+
+void usage()
+{
+  fprintf(stderr,
+    "Usage: mcastsend [options] GROUP:PORT DIR FILE...\n"
+    "Send FILEs (relative to repository DIR) to multicast GROUP in a loop.\n"
+    "  -r, --rate RATE       send at most RATE bytes/s (suffixes k, M, G; default: 10M)\n"
+    "  -t, --ttl TTL         multicast ttl (default: 1)\n"
+    "  -i, --interface ADDR  send via interface with address ADDR\n"
+    "  -n, --passes N        stop after sending every file N times (default: run forever)\n"
+    "  -v, --verbose         show progress\n"
+    "  -h, --help            show this text\n"
+  );
+}
+
+
+/*
+ * Current time in seconds (monotonic clock).
+ */
+double now()
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+
+/*
+ * Send data packet (the next block of 'file') or announcement.
+ *
+ * Returns 0 if ok.
+ */
+int send_packet(int sock, struct sockaddr_in *group, file_t *file, int type)
+{
+  unsigned char buf[sizeof (mcast_header_t) + MCAST_BLOCK_SIZE];
+  mcast_header_t *hdr = (mcast_header_t *) buf;
+  unsigned char *data = buf + sizeof *hdr;
+  ssize_t len;
+
+  memset(hdr, 0, sizeof *hdr);
+  hdr->magic = htonl(MCAST_MAGIC);
+  hdr->type = type;
+  hdr->id = htonl(file->id);
+  hdr->size = htobe64(file->size);
+
+  if(type == MCAST_ANNOUNCE) {
+    len = strlen(file->name);
+    memcpy(data, file->name, len);
+  }
+  else {
+    hdr->block = htonl(file->next);
+    len = pread(file->fd, data, MCAST_BLOCK_SIZE, (off_t) file->next * MCAST_BLOCK_SIZE);
+    if(len <= 0) {
+      perror(file->name);
+      return 1;
+    }
+  }
+
+  hdr->len = htons(len);
+
+  while(sendto(sock, buf, sizeof *hdr + len, 0, (struct sockaddr *) group, sizeof *group) < 0) {
+    // socket buffer full: just retry
+    if(errno == ENOBUFS || errno == EAGAIN || errno == EINTR) continue;
+    perror("sendto");
+    return 1;
+  }
+
+  return 0;
+}
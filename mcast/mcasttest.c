@@ -0,0 +1,152 @@
+/*
+ *
+ * mcasttest.c   Receive files like linuxrc's 'multicast' option does
+ *
+ * Test driver for ../mcast.c: provides the few linuxrc functions it needs
+ * and calls mcast_receive() for each url. See mcast_test.sh.
+ *
+ * Usage: mcasttest GROUP:PORT URL FILE [URL FILE...]
+ *
+ * URL must be a plain http url (no query, no credentials); its path is
+ * matched against the names the sender announces and it is used for
+ * unicast repair.
+ *
+ * Exit status is the number of urls that could not be received.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#include <curl/curl.h>
+
+#include "../global.h"
+#include "../util.h"
+#include "../url.h"
+#include "../mcast.h"
+
+config_t config;
+
+
+void util_log(unsigned level, char *format, ...)
+{
+  va_list args;
+
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+}
+
+
+void util_perror(unsigned level, char *msg)
+{
+  perror(msg);
+}
+
+
+void str_copy(char **dst, const char *src)
+{
+  char *s;
+
+  if(!dst) return;
+
+  s = src ? strdup(src) : NULL;
+  free(*dst);
+  *dst = s;
+}
+
+
+slist_t *slist_getentry(slist_t *sl, char *key)
+{
+  for(; sl; sl = sl->next) {
+    if(sl->key && !strcmp(key, sl->key)) return sl;
+  }
+
+  return NULL;
+}
+
+
+slist_t *slist_append_str(slist_t **sl0, char *str)
+{
+  slist_t *sl;
+
+  while(*sl0) sl0 = &(*sl0)->next;
+
+  *sl0 = sl = calloc(1, sizeof *sl);
+  sl->key = strdup(str);
+
+  return sl;
+}
+
+
+char *url_print(url_t *url, int format)
+{
+  return url ? url->str : NULL;
+}
+
+
+int url_progress_tick(url_data_t *url_data, int force)
+{
+  return 0;
+}
+
+
+long url_ip_resolve()
+{
+  return CURL_IPRESOLVE_WHATEVER;
+}
+
+
+void url_curl_setopt(CURL *c_handle, unsigned ssl_verify, long ip_resolve, char *proxy)
+{
+  curl_easy_setopt(c_handle, CURLOPT_FAILONERROR, 1);
+  curl_easy_setopt(c_handle, CURLOPT_CONNECTTIMEOUT, 10);
+  curl_easy_setopt(c_handle, CURLOPT_LOW_SPEED_LIMIT, 1);
+  curl_easy_setopt(c_handle, CURLOPT_LOW_SPEED_TIME, 10);
+  curl_easy_setopt(c_handle, CURLOPT_IPRESOLVE, ip_resolve);
+  if(proxy) curl_easy_setopt(c_handle, CURLOPT_PROXY, proxy);
+}
+
+
+int main(int argc, char **argv)
+{
+  url_t url = { };
+  url_data_t url_data = { .url = &url };
+  struct timespec t0, t1;
+  char *s;
+  int i, err, failed = 0;
+
+  if(argc < 4 || (argc & 1)) {
+    fprintf(stderr, "usage: mcasttest GROUP:PORT URL FILE [URL FILE...]\n");
+    return 1;
+  }
+
+  curl_global_init(CURL_GLOBAL_ALL);
+
+  config.multicast = argv[1];
+
+  for(i = 2; i < argc; i += 2) {
+    url.str = argv[i];
+    // path component of 'http://host[:port]/path'
+    url.path = (s = strstr(url.str, "://")) ? strchr(s + 3, '/') : NULL;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    err = mcast_receive(&url_data, argv[i + 1]);
+    failed += err ? 1 : 0;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    printf("%s: %s in %.1f s\n",
+      url.str, err ? "failed" : "ok",
+      (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9
+    );
+  }
+
+  curl_global_cleanup();
+
+  return failed;
+}
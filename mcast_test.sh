@@ -0,0 +1,165 @@
+#! /bin/bash
+
+# Check multicast image distribution (mcast.c, mcast/mcastsend) on loopback.
+#
+# Runs in a private network namespace (only 'lo', with a multicast route),
+# so it doesn't disturb the system. mcast/mcasttest receives files exactly
+# like linuxrc's 'multicast' option; a local http server stands in for the
+# repository that missing blocks are loaded from.
+#
+# Needs unshare (root or user namespaces), ip, python3, and a built linuxrc
+# tree (for version.h).
+
+# exit on error immediately
+set -e
+
+GROUP=239.255.42.1:4242
+PORT=8766
+URL=http://127.0.0.1:$PORT/repo/boot/x86_64
+DIR=$(mktemp -d)
+
+function cleanup()
+{
+  [ -n "$SENDER" ] && kill $SENDER 2> /dev/null || true
+  [ -n "$SERVER" ] && kill $SERVER 2> /dev/null || true
+  rm -rf "$DIR"
+}
+
+function skip()
+{
+  echo "SKIPPED: $1"
+  exit 0
+}
+
+function fail()
+{
+  echo "ERROR: $1"
+  cat "$DIR/log"
+  exit 1
+}
+
+# start sender in background; args are passed to mcastsend
+function start_sender()
+{
+  ./mcast/mcastsend "$@" $GROUP "$DIR/repo" boot/x86_64/root boot/x86_64/other &
+  SENDER=$!
+}
+
+function stop_sender()
+{
+  kill $SENDER 2> /dev/null || true
+  wait $SENDER 2> /dev/null || true
+  SENDER=
+}
+
+function expect_log()
+{
+  if grep -q -- "$1" "$DIR/log" ; then
+    echo "Matched expected text: '$1'"
+  else
+    fail "No match for expected text '$1'"
+  fi
+}
+
+function not_in_log()
+{
+  if grep -q -- "$1" "$DIR/log" ; then
+    fail "Matched unexpected text: '$1'"
+  fi
+}
+
+###############################################################################
+
+# re-run in a private network namespace
+if [ -z "$MCAST_TEST_NETNS" ] ; then
+  for i in unshare ip python3 ; do
+    type -p $i > /dev/null || skip "$i missing"
+  done
+  unshare -rn true 2> /dev/null || skip "no network namespaces"
+  MCAST_TEST_NETNS=1 exec unshare -rn "$0" "$@"
+fi
+
+trap cleanup EXIT
+
+ip link set lo up
+ip route add 224.0.0.0/4 dev lo
+
+make -s -C mcast mcastsend mcasttest || skip "mcasttest not built"
+
+mkdir -p "$DIR/repo/boot/x86_64"
+head -c 3000000 /dev/urandom > "$DIR/repo/boot/x86_64/root"
+head -c 50000 /dev/urandom > "$DIR/repo/boot/x86_64/other"
+
+# http.server doesn't do range requests
+cat > "$DIR/server.py" <<'EOF'
+import http.server, os, re, sys
+
+class Handler(http.server.SimpleHTTPRequestHandler):
+  def do_GET(self):
+    m = re.fullmatch(r"bytes=(\d+)-(\d+)", self.headers.get("Range", ""))
+    path = self.translate_path(self.path)
+    if not m or not os.path.isfile(path):
+      return super().do_GET()
+    size = os.path.getsize(path)
+    start, end = int(m[1]), min(int(m[2]), size - 1)
+    with open(path, "rb") as f:
+      f.seek(start)
+      data = f.read(end - start + 1)
+    self.send_response(206)
+    self.send_header("Content-Range", f"bytes {start}-{end}/{size}")
+    self.send_header("Content-Length", str(len(data)))
+    self.end_headers()
+    self.wfile.write(data)
+
+http.server.ThreadingHTTPServer(("127.0.0.1", int(sys.argv[1])), Handler).serve_forever()
+EOF
+
+(cd "$DIR" && exec python3 server.py $PORT > /dev/null 2>&1) &
+SERVER=$!
+sleep 1
+
+###############################################################################
+
+echo "Carousel: expect complete file without unicast"
+
+start_sender -r 5M
+./mcast/mcasttest $GROUP $URL/root "$DIR/root" > "$DIR/log" 2>&1 || fail "receive failed"
+stop_sender
+
+expect_log "receiving /repo/boot/x86_64/root"
+not_in_log "via unicast"
+cmp "$DIR/root" "$DIR/repo/boot/x86_64/root" || fail "file differs"
+
+###############################################################################
+
+echo "Files not offered: expect no MCAST_WAIT timeout"
+
+start_sender -r 5M
+./mcast/mcasttest $GROUP \
+  $URL/foo "$DIR/foo" \
+  $URL/bar "$DIR/bar" \
+  $URL/other "$DIR/other" > "$DIR/log" 2>&1 && fail "unexpected success"
+stop_sender
+
+expect_log "foo: not offered"
+expect_log "bar: not offered"
+# 3 s would mean mcast_wait() waited for the full MCAST_WAIT
+expect_log "foo: failed in [0-2]\."
+expect_log "bar: failed in 0\.0 s"
+expect_log "other: ok"
+cmp "$DIR/other" "$DIR/repo/boot/x86_64/other" || fail "file differs"
+
+###############################################################################
+
+echo "Late join, single pass: expect unicast repair"
+
+start_sender -r 2M -n 1
+sleep 0.7
+./mcast/mcasttest $GROUP $URL/root "$DIR/root" > "$DIR/log" 2>&1 || fail "receive failed"
+stop_sender
+
+expect_log "no data for"
+expect_log "loaded via unicast$"
+cmp "$DIR/root" "$DIR/repo/boot/x86_64/root" || fail "file differs"
+
+echo "mcast test ok"
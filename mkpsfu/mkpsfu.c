@@ -14,6 +14,12 @@
 #define GFX_START	0xc0
 #define GFX_END		0xdf
 
+/* max. unicode char + 1 */
+#define MAX_UNICODE	0x110000
+/* chars per page in char table, see find_char() */
+#define PAGE_BITS	8
+#define PAGE_SIZE	(1 << PAGE_BITS)
+
 struct option options[] = {
   { "verbose", 0, NULL, 'v' },
   { "font", 1, NULL, 'f' },
@@ -48,6 +54,7 @@ typedef struct {
   unsigned char *bitmap;
   unsigned unimap_len;
   unsigned char *unimap;
+  int *glyph;			/* unicode char -> glyph index, -1 if missing; 0x10000 entries */
   unsigned height;
   int yofs;
   int height2;
@@ -86,6 +93,7 @@ font_t font_list[16];
 int fonts;
 
 char_data_t *char_list;
+char_data_t **char_table[MAX_UNICODE / PAGE_SIZE];	/* index to char_list */
 
 unsigned char gfx_char[0x10000];
 
@@ -99,6 +107,8 @@ static void dump_char(char_data_t *cd);
 static void dump_char_list(void);
 static void sort_char_list(void);
 static int char_sort(const void *a, const void *b);
+static void find_dups(void);
+static unsigned bitmap_hash(unsigned char *bitmap, int len);
 static void locate_char(char_data_t *cd);
 static int char_index(font_t *font, int c);
 static void adjust_height(char_data_t *cd, int height);
@@ -122,6 +132,8 @@ int main(int argc, char **argv)
   FILE *f;
   unsigned char uc[4], *dummy_bitmap;
   font_t tmp_font;
+  int *glyph_start, *glyph_pos;
+  char_data_t **glyph_chars;
 
   opterr = 0;
 
@@ -277,6 +289,7 @@ int main(int argc, char **argv)
 
         free(tmp_font.bitmap);
         free(tmp_font.unimap);
+        free(tmp_font.glyph);
         break;
 
       case 'v':
@@ -418,9 +431,36 @@ int main(int argc, char **argv)
     }
   }
 
+  /*
+   * Sort chars by output font index (keeping char_list order):
+   * chars with index i are glyph_chars[glyph_start[i]] ... glyph_chars[glyph_start[i + 1] - 1].
+   */
+  glyph_start = calloc(max_chars + 1, sizeof *glyph_start);
+
+  for(j = 0, cd = char_list; cd; cd = cd->next) {
+    if(cd->ok && cd->new_index >= 0 && cd->new_index < max_chars) {
+      glyph_start[cd->new_index + 1]++;
+      j++;
+    }
+  }
+
+  for(i = 0; i < max_chars; i++) glyph_start[i + 1] += glyph_start[i];
+
+  glyph_chars = calloc(j + 1, sizeof *glyph_chars);
+  glyph_pos = calloc(max_chars, sizeof *glyph_pos);
+
+  for(cd = char_list; cd; cd = cd->next) {
+    if(cd->ok && cd->new_index >= 0 && cd->new_index < max_chars) {
+      glyph_chars[glyph_start[cd->new_index] + glyph_pos[cd->new_index]++] = cd;
+    }
+  }
+
   for(i = 0; i < max_chars; i++) {
-    for(cd = char_list; cd; cd = cd->next) {
-      if(cd->ok && !cd->dup && cd->new_index == i) break;
+    for(cd = NULL, j = glyph_start[i]; j < glyph_start[i + 1]; j++) {
+      if(!glyph_chars[j]->dup) {
+        cd = glyph_chars[j];
+        break;
+      }
     }
     add_data(&font, cd ? cd->bitmap : dummy_bitmap, font_height);
   }
@@ -428,15 +468,13 @@ int main(int argc, char **argv)
   uc[2] = uc[3] = 0xff;
   
   for(i = 0; i < max_chars; i++) {
-    for(j = 0, cd = char_list; cd; cd = cd->next) {
-      if(cd->ok && cd->new_index == i) {
-        uc[0] = cd->c;
-        uc[1] = cd->c >> 8;
-        add_data(&font, uc, 2);
-        j = 1;
-      }
+    for(j = glyph_start[i]; j < glyph_start[i + 1]; j++) {
+      cd = glyph_chars[j];
+      uc[0] = cd->c;
+      uc[1] = cd->c >> 8;
+      add_data(&font, uc, 2);
     }
-    if(!j) {
+    if(glyph_start[i] == glyph_start[i + 1]) {
       uc[0] = 0xfd;
       uc[1] = 0xff;
       add_data(&font, uc, 2);
@@ -444,6 +482,10 @@ int main(int argc, char **argv)
     add_data(&font, uc + 2, 2);
   }
 
+  free(glyph_start);
+  free(glyph_pos);
+  free(glyph_chars);
+
   if(opt_verbose) dump_char_list();
 
   write_data(opt_file);
@@ -460,7 +502,8 @@ int load_font(font_t *font)
   FILE *f;
   char *cmd = NULL;
   unsigned char head[4];
-  int ok = 0;
+  int i, ok = 0;
+  unsigned u, u1;
 
   if(!font->name) return 0;
 
@@ -499,6 +542,21 @@ int load_font(font_t *font)
     }
   }
 
+  /* build unicode -> glyph index table; the first glyph for a char wins */
+  if(ok) {
+    font->glyph = malloc(0x10000 * sizeof *font->glyph);
+    for(u = 0; u < 0x10000; u++) font->glyph[u] = -1;
+
+    for(i = u = 0; u < font->unimap_len; u += 2) {
+      u1 = font->unimap[u] + (font->unimap[u + 1] << 8);
+      if(u1 == 0xffff) {
+        i++;
+        continue;
+      }
+      if(font->glyph[u1] == -1) font->glyph[u1] = i;
+    }
+  }
+
   pclose(f);
 
   return ok;
@@ -507,7 +565,9 @@ int load_font(font_t *font)
 
 char_data_t *add_char(int c)
 {
-  char_data_t *cd;
+  char_data_t *cd, ***page;
+
+  if(c < 0 || c >= MAX_UNICODE) return NULL;
 
   if((cd = find_char(c))) return cd;
 
@@ -519,19 +579,29 @@ char_data_t *add_char(int c)
 
   cd->orig_c = orig_char >= 0 ? orig_char : cd->c;
 
+  page = char_table + (c >> PAGE_BITS);
+  if(!*page) *page = calloc(PAGE_SIZE, sizeof **page);
+  (*page)[c & (PAGE_SIZE - 1)] = cd;
+
   return char_list = cd;
 }
 
 
+/*
+ * Look up char in char_list.
+ *
+ * char_table has an entry for each unicode char, split into pages that
+ * are allocated only when needed.
+ */
 char_data_t *find_char(int c)
 {
-  char_data_t *cd;
+  char_data_t **page;
 
-  for(cd = char_list; cd; cd = cd->next) {
-    if(cd->c == c) return cd;
-  }
+  if(c < 0 || c >= MAX_UNICODE) return NULL;
+
+  page = char_table[c >> PAGE_BITS];
 
-  return NULL;
+  return page ? page[c & (PAGE_SIZE - 1)] : NULL;
 }
 
 
@@ -613,6 +683,61 @@ int char_sort(const void *a, const void *b)
 }
 
 
+/*
+ * Find chars with identical bitmaps.
+ *
+ * Duplicates point to the first char in char_list with that bitmap.
+ */
+void find_dups()
+{
+  char_data_t *cd, *cd2, **hash;
+  unsigned u, len, hash_size;
+
+  for(len = 0, cd = char_list; cd; cd = cd->next) len++;
+
+  /* open addressing, at most half full */
+  for(hash_size = 64; hash_size < 2 * len; hash_size <<= 1);
+
+  hash = calloc(hash_size, sizeof *hash);
+
+  for(cd = char_list; cd; cd = cd->next) {
+    if(!cd->ok || cd->dup) continue;
+
+    u = bitmap_hash(cd->bitmap, cd->height);
+
+    for(;; u++) {
+      u &= hash_size - 1;
+      if(!(cd2 = hash[u])) {
+        hash[u] = cd;
+        break;
+      }
+      if(cd2->height == cd->height && !memcmp(cd->bitmap, cd2->bitmap, cd->height)) {
+        cd->dup = cd2;
+        break;
+      }
+    }
+  }
+
+  free(hash);
+}
+
+
+/*
+ * FNV-1a hash.
+ */
+unsigned bitmap_hash(unsigned char *bitmap, int len)
+{
+  unsigned h = 2166136261u;
+
+  while(len-- > 0) {
+    h ^= *bitmap++;
+    h *= 16777619;
+  }
+
+  return h;
+}
+
+
 void locate_char(char_data_t *cd)
 {
   int i, j, k, idx;
@@ -650,21 +775,9 @@ void locate_char(char_data_t *cd)
 
 int char_index(font_t *font, int c)
 {
-  int i;
-  unsigned u, u1;
-
-  if(!font || !font->unimap || c < 0 || c >= 0xffff) return -1;
+  if(!font || !font->glyph || c < 0 || c >= 0xffff) return -1;
 
-  for(i = u = 0; u < font->unimap_len; u += 2) {
-    u1 = font->unimap[u] + (font->unimap[u + 1] << 8);
-    if(u1 == 0xffff) {
-      i++;
-      continue;
-    }
-    if(u1 == c) return i;
-  }
-
-  return -1;
+  return font->glyph[c];
 }
 
 
@@ -756,7 +869,7 @@ int is_special_nongfx(char_data_t *cd)
 int assign_char_pos()
 {
   int char_count, char_index, i;
-  char_data_t *cd, *cd2;
+  char_data_t *cd;
   char_data_t *used[512] = { };
   int max_chars;
 
@@ -765,16 +878,7 @@ int assign_char_pos()
   }
 
   /* first, find identical bitmaps */
-  for(cd = char_list; cd; cd = cd->next) {
-    if(!cd->ok || cd->dup) continue;
-
-    for(cd2 = cd->next; cd2; cd2 = cd2->next) {
-      if(!cd2->ok || cd2->dup) continue;
-      if(!memcmp(cd->bitmap, cd2->bitmap, cd->height)) {
-        cd2->dup = cd;
-      }
-    }
-  }
+  find_dups();
 
   char_count = 0;
   for(cd = char_list; cd; cd = cd->next) {
@@ -34,6 +34,7 @@
 #include "auto2.h"
 #include "file.h"
 #include "install.h"
+#include "trace.h"
 
 // #define DEBUG_MODULE
 
@@ -532,11 +533,9 @@ int mod_load_manually(int type)
 
 void mod_unload_module(char *module)
 {
-  char cmd[300];
   int err;
 
-  sprintf(cmd, "rmmod %s", module);
-  err = lxrc_run(cmd);
+  err = lxrc_run_argv("rmmod", module);
   util_update_kernellog();
 
   if(!err) {
@@ -799,19 +798,26 @@ int mod_modprobe(char *module, char *param)
 
   if(!module) return -1;
 
-  ml = mod_get_entry(module);
+  trace_begin("modprobe", module);
 
-  if(!ml) return mod_insmod(module, param);
+  ml = mod_get_entry(module);
 
-  err = 0;
-  if(ml->pre_inst) {
-    err = !mod_load_modules(ml->pre_inst, 0);
+  if(ml) {
+    err = 0;
+    if(ml->pre_inst) {
+      err = !mod_load_modules(ml->pre_inst, 0);
+    }
+    if(!err) err = mod_insmod(ml->name, param);
+    if(!err && ml->post_inst) {
+      err = mod_load_modules(ml->post_inst, 0);
+    }
   }
-  if(!err) err = mod_insmod(ml->name, param);
-  if(!err && ml->post_inst) {
-    err = mod_load_modules(ml->post_inst, 0);
+  else {
+    err = mod_insmod(module, param);
   }
 
+  trace_end();
+
   return err;
 }
 
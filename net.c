@@ -43,6 +43,7 @@
 #include "module.h"
 #include "url.h"
 #include "auto2.h"
+#include "trace.h"
 
 
 #if defined(__s390__) || defined(__s390x__)
@@ -174,13 +175,17 @@ int net_config()
   if(rc == ESCAPE) return -1;
 
   if(rc == YES) {
+    trace_begin("network", net_get_ifname(config.ifcfg.manual));
     rc = net_dhcp();
+    trace_end();
     if(!rc) config.net.configured = nc_dhcp;
   }
   else {
     rc = net_input_data();
     if(!rc) {
+      trace_begin("network", net_get_ifname(config.ifcfg.manual));
       net_static();
+      trace_end();
       config.net.configured = nc_static;
     }
   }
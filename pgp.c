@@ -0,0 +1,1816 @@
+/*
+ *
+ * pgp.c         Verify OpenPGP signatures
+ *
+ * Handles RSA signatures over binary data: inline signed files, detached
+ * signatures, and rpm signatures. The keyrings are loaded once.
+ *
+ * Key revocations and expiration dates from the keyring are honored; the
+ * keyring itself is trusted, so its self-signatures are not verified.
+ *
+ * Anything else (other key types, text signatures, armored messages, ...)
+ * is reported as PGP_UNSUPPORTED and left to gpg or rpmkeys.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <mediacheck.h>
+
+#include "global.h"
+#include "util.h"
+#include "pgp.h"
+
+#define PGP_BUF_SIZE	(1 << 16)
+#define PGP_MAX_LIMBS	(8192 / 32)	/**< max RSA key size */
+#define PGP_MAX_PACKET	(1 << 20)	/**< max size of key & signature packets */
+
+/* input stream: memory, a file, or the contents of a compressed packet */
+typedef struct {
+  int fd;			/**< file, if >= 0 */
+  struct pgp_body_s *body;	/**< compressed packet, if any */
+  unsigned char *buf;
+  size_t len, pos;
+  z_stream z;
+  unsigned char *zbuf;		/**< compressed data */
+  unsigned eof:1;
+  unsigned error:1;
+  unsigned zlib:1;		/**< inflate body */
+  unsigned zin_eof:1;		/**< all compressed data read */
+} pgp_stream_t;
+
+/* packet body */
+typedef struct pgp_body_s {
+  pgp_stream_t *st;
+  uint64_t left;		/**< bytes left in current chunk */
+  unsigned partial:1;		/**< more chunks follow */
+  unsigned to_eof:1;		/**< old format, indeterminate length */
+} pgp_body_t;
+
+/* public key */
+typedef struct pgp_key_s {
+  struct pgp_key_s *next;
+  unsigned char id[8];
+  unsigned char *n, *e;		/**< RSA modulus & exponent, big-endian */
+  unsigned n_len, e_len;
+  struct pgp_key_s *primary;	/**< primary key, for subkeys */
+  uint32_t created;		/**< creation time */
+  uint32_t expires;		/**< expiration time (0: never) */
+  uint32_t self_sig;		/**< creation time of self-signature expires is from */
+  unsigned rsa:1;		/**< key can be used */
+  unsigned revoked:1;
+} pgp_key_t;
+
+typedef struct {
+  char *name;			/**< file or directory */
+  pgp_key_t *keys;
+  unsigned loaded:1;
+} pgp_keyring_t;
+
+/* signature */
+typedef struct {
+  unsigned version;
+  unsigned type;
+  unsigned pub_algo;
+  unsigned hash_algo;
+  unsigned char id[8];		/**< issuer */
+  unsigned char *hashed;	/**< signature data to hash */
+  unsigned hashed_len;
+  unsigned char *s;		/**< RSA signature, big-endian */
+  unsigned s_len;
+  uint32_t created;		/**< creation time */
+  uint32_t expires;		/**< signature validity period (0: forever) */
+  uint32_t key_expires;		/**< self-signatures: key validity period (0: forever) */
+  unsigned has_id:1;
+  unsigned has_key_expires:1;
+  unsigned char *packet;	/**< packet body, everything above points into it */
+} pgp_sig_t;
+
+/* state while going through a signed message */
+typedef struct {
+  pgp_keyring_t *keyring;
+  mediacheck_digest_t *digest;
+  pgp_sig_t sig;		/**< leading signature, if any */
+  int out_fd;
+  off_t out_pos;
+  char *tmp_name;		/**< temporary output file, if not writing in place */
+  unsigned digest_algo;
+  unsigned char onepass_id[8];
+  unsigned onepass:1;
+  unsigned literal:1;		/**< literal data packet done */
+  unsigned written:1;		/**< something has been written */
+} pgp_msg_t;
+
+static pgp_keyring_t keyring_gpg = { .name = "/installkey.gpg" };
+static pgp_keyring_t keyring_rpm = { .name = "/pubkeys" };
+
+static void pgp_stream_mem(pgp_stream_t *st, unsigned char *buf, size_t len);
+static void pgp_stream_fd(pgp_stream_t *st, int fd);
+static void pgp_stream_done(pgp_stream_t *st);
+static size_t pgp_fill(pgp_stream_t *st);
+static size_t pgp_read(pgp_stream_t *st, unsigned char *buf, size_t len);
+static int pgp_getc(pgp_stream_t *st);
+static int pgp_length(pgp_stream_t *st, uint64_t *len, int *partial);
+static int pgp_packet(pgp_stream_t *st, pgp_body_t *body);
+static ssize_t pgp_body_read(pgp_body_t *body, unsigned char *buf, size_t len);
+static int pgp_body_skip(pgp_body_t *body);
+static unsigned char *pgp_body_get(pgp_body_t *body, size_t *len);
+static unsigned char *pgp_read_file(char *name, size_t *len);
+static size_t pgp_dearmor(unsigned char *buf, size_t len);
+static char *pgp_hash_name(unsigned algo);
+static int pgp_digest_raw(mediacheck_digest_t *digest, unsigned char *buf, unsigned len);
+static void pgp_keyring_load(pgp_keyring_t *keyring);
+static void pgp_keyring_add(pgp_keyring_t *keyring, unsigned char *buf, size_t len);
+static pgp_key_t *pgp_key_add(pgp_keyring_t *keyring, unsigned char *data, size_t len, pgp_key_t *primary);
+static void pgp_key_self_sig(pgp_key_t *key, pgp_sig_t *sig);
+static pgp_key_t *pgp_key_find(pgp_keyring_t *keyring, unsigned char *id, int *unusable);
+static int pgp_key_valid(pgp_key_t *key, pgp_sig_t *sig);
+static int pgp_sig_parse(pgp_sig_t *sig, unsigned char *data, size_t len);
+static int pgp_sig_read(pgp_sig_t *sig, unsigned char *buf, size_t len);
+static int pgp_detached_sig(pgp_sig_t *sig, char *sig_file);
+static void pgp_sig_free(pgp_sig_t *sig);
+static int pgp_sig_usable(pgp_keyring_t *keyring, pgp_sig_t *sig, char *file);
+static int pgp_sig_verify(pgp_keyring_t *keyring, pgp_sig_t *sig, mediacheck_digest_t *digest);
+static int pgp_rsa_verify(pgp_key_t *key, pgp_sig_t *sig, unsigned char *hash, unsigned hash_len);
+static int pgp_rpm_payload(int fd, off_t hdr_start, char *file);
+static uint32_t pgp_be32(unsigned char *p);
+static int pgp_msg(pgp_msg_t *msg, pgp_stream_t *st, char *file, int depth);
+static int pgp_msg_literal(pgp_msg_t *msg, pgp_body_t *body);
+static int pgp_write(pgp_msg_t *msg, unsigned char *buf, size_t len);
+
+static unsigned bn_n0(uint32_t *n);
+static void bn_from_bytes(uint32_t *a, unsigned k, unsigned char *buf, unsigned len);
+static void bn_to_bytes(uint32_t *a, unsigned k, unsigned char *buf, unsigned len);
+static int bn_cmp(uint32_t *a, uint32_t *b, unsigned k);
+static void bn_sub(uint32_t *a, uint32_t *b, unsigned k);
+static void bn_mont_mul(uint32_t *r, uint32_t *a, uint32_t *b, uint32_t *n, uint32_t n0, unsigned k);
+static void bn_mod_exp(uint32_t *r, uint32_t *a, unsigned char *e, unsigned e_len, uint32_t *n, unsigned k);
+
+
+/*
+ * Verify inline signed file (as created by 'gpg --sign').
+ *
+ * If it is signed, replace the file with its unpacked contents. This is
+ * done in place unless the data are compressed.
+ *
+ * Return PGP_OK, PGP_BAD, PGP_NOSIG, or PGP_UNSUPPORTED.
+ */
+int pgp_verify_inline(char *file)
+{
+  pgp_msg_t msg = { .keyring = &keyring_gpg };
+  pgp_stream_t st;
+  unsigned char head[16];
+  int fd, err, tag;
+
+  if((fd = open(file, O_RDWR | O_CLOEXEC)) == -1) return PGP_UNSUPPORTED;
+
+  err = pread(fd, head, sizeof head, 0);
+
+  if(err >= (int) sizeof "-----BEGIN PGP" - 1 && !memcmp(head, "-----BEGIN PGP", sizeof "-----BEGIN PGP" - 1)) {
+    log_debug("%s: armored, using gpg\n", file);
+    close(fd);
+
+    return PGP_UNSUPPORTED;
+  }
+
+  tag = err > 0 && (*head & 0x80) ? (*head & 0x40 ? *head & 0x3f : (*head >> 2) & 0xf) : 0;
+
+  // marker, compressed data, one-pass signature, signature
+  if(!(tag == 10 || tag == 8 || tag == 4 || tag == 2)) {
+    close(fd);
+
+    return PGP_NOSIG;
+  }
+
+  pgp_keyring_load(msg.keyring);
+
+  if(!msg.keyring->keys) {
+    log_debug("%s: no keys in %s, using gpg\n", file, msg.keyring->name);
+    close(fd);
+
+    return PGP_UNSUPPORTED;
+  }
+
+  msg.out_fd = fd;
+
+  pgp_stream_fd(&st, fd);
+  err = pgp_msg(&msg, &st, file, 0);
+  pgp_stream_done(&st);
+
+  if(msg.literal && err == PGP_NOSIG) err = PGP_BAD;
+
+  // we can't go back once something has been written
+  if(msg.written && err == PGP_UNSUPPORTED) err = PGP_BAD;
+
+  if(msg.tmp_name) {
+    close(msg.out_fd);
+    if(msg.literal && err != PGP_UNSUPPORTED) {
+      if(rename(msg.tmp_name, file)) {
+        log_info("%s: %s\n", file, strerror(errno));
+        err = PGP_BAD;
+      }
+    }
+    unlink(msg.tmp_name);
+    free(msg.tmp_name);
+  }
+  else if(msg.written) {
+    if(ftruncate(fd, msg.out_pos)) err = PGP_BAD;
+  }
+
+  close(fd);
+
+  mediacheck_digest_done(msg.digest);
+  pgp_sig_free(&msg.sig);
+
+  log_debug("%s: pgp = %d\n", file, err);
+
+  return err;
+}
+
+
+/*
+ * Verify file against detached signature sig_file.
+ *
+ * Return PGP_OK, PGP_BAD, or PGP_UNSUPPORTED.
+ */
+int pgp_verify_detached(char *file, char *sig_file)
+{
+  pgp_sig_t sig;
+  mediacheck_digest_t *digest;
+  unsigned char *buf;
+  ssize_t r;
+  int fd, err;
+
+  if((err = pgp_detached_sig(&sig, sig_file))) return err;
+
+  if((fd = open(file, O_RDONLY | O_CLOEXEC)) == -1) {
+    pgp_sig_free(&sig);
+
+    return PGP_BAD;
+  }
+
+  digest = mediacheck_digest_init(pgp_hash_name(sig.hash_algo), NULL);
+
+  buf = malloc(PGP_BUF_SIZE);
+
+  while((r = read(fd, buf, PGP_BUF_SIZE)) > 0) {
+    mediacheck_digest_process(digest, buf, r);
+  }
+
+  close(fd);
+  free(buf);
+
+  err = r ? PGP_BAD : pgp_sig_verify(&keyring_gpg, &sig, digest);
+
+  mediacheck_digest_done(digest);
+  pgp_sig_free(&sig);
+
+  log_debug("%s: pgp = %d\n", file, err);
+
+  return err;
+}
+
+
+/*
+ * Digest algorithm needed to verify detached signature sig_file.
+ *
+ * Return libmediacheck digest name or NULL if we can't handle it.
+ */
+char *pgp_detached_hash(char *sig_file)
+{
+  pgp_sig_t sig;
+  char *name = NULL;
+
+  if(!pgp_detached_sig(&sig, sig_file)) name = pgp_hash_name(sig.hash_algo);
+
+  pgp_sig_free(&sig);
+
+  return name;
+}
+
+
+/*
+ * Verify detached signature sig_file against data already fed into digest.
+ *
+ * digest must be of the type returned by pgp_detached_hash() and is
+ * finalized afterwards.
+ *
+ * Return PGP_OK, PGP_BAD, or PGP_UNSUPPORTED.
+ */
+int pgp_verify_digest(char *sig_file, mediacheck_digest_t *digest)
+{
+  pgp_sig_t sig;
+  char *name;
+  int err;
+
+  if((err = pgp_detached_sig(&sig, sig_file))) return err;
+
+  name = mediacheck_digest_name(digest);
+
+  if(!name || strcasecmp(name, pgp_hash_name(sig.hash_algo))) {
+    err = PGP_UNSUPPORTED;
+  }
+  else {
+    err = pgp_sig_verify(&keyring_gpg, &sig, digest);
+  }
+
+  pgp_sig_free(&sig);
+
+  log_debug("%s: pgp = %d\n", sig_file, err);
+
+  return err;
+}
+
+
+/*
+ * Verify rpm signatures.
+ *
+ * Header-only (RSAHEADER) and header+payload (PGP) signatures are checked.
+ * With only a header signature, the payload is checked against the payload
+ * digest in the (signed) header.
+ *
+ * Return PGP_OK, PGP_BAD, PGP_NOSIG, or PGP_UNSUPPORTED.
+ */
+int pgp_verify_rpm(char *file)
+{
+  static const unsigned tags[] = { 268 /* RSA */, 1002 /* PGP */, 267 /* DSA */, 1005 /* GPG */ };
+  unsigned char head[16], *index = NULL, *buf = NULL;
+  unsigned u, i, il, dl, cnt, sigs = 0, tag, ofs, payload_ok = 0;
+  off_t hdr_start, hdr_len, pos;
+  ssize_t r = 0;
+  int fd, err = PGP_NOSIG, err1;
+  pgp_sig_t sig;
+  mediacheck_digest_t *digest;
+
+  if((fd = open(file, O_RDONLY | O_CLOEXEC)) == -1) return PGP_UNSUPPORTED;
+
+  // lead + signature header intro
+  if(
+    pread(fd, head, 4, 0) != 4 ||
+    memcmp(head, "\xed\xab\xee\xdb", 4) ||
+    pread(fd, head, 16, 96) != 16 ||
+    memcmp(head, "\x8e\xad\xe8\x01", 4)
+  ) {
+    close(fd);
+
+    return PGP_NOSIG;
+  }
+
+  il = (head[8] << 24) + (head[9] << 16) + (head[10] << 8) + head[11];
+  dl = (head[12] << 24) + (head[13] << 16) + (head[14] << 8) + head[15];
+
+  if(il > 0x10000 || dl > PGP_MAX_PACKET) {
+    close(fd);
+
+    return PGP_BAD;
+  }
+
+  index = malloc(il * 16 + dl);
+
+  if(pread(fd, index, il * 16 + dl, 96 + 16) != il * 16 + dl) {
+    free(index);
+    close(fd);
+
+    return PGP_BAD;
+  }
+
+  // main header follows signature header, 8-byte aligned
+  hdr_start = (96 + 16 + il * 16 + dl + 7) & ~7;
+
+  if(pread(fd, head, 16, hdr_start) != 16 || memcmp(head, "\x8e\xad\xe8\x01", 4)) {
+    free(index);
+    close(fd);
+
+    return PGP_BAD;
+  }
+
+  hdr_len = 16 + 16 * (off_t) ((head[8] << 24) + (head[9] << 16) + (head[10] << 8) + head[11]) +
+    ((head[12] << 24) + (head[13] << 16) + (head[14] << 8) + head[15]);
+
+  pgp_keyring_load(&keyring_rpm);
+
+  buf = malloc(PGP_BUF_SIZE);
+
+  for(u = 0; u < il; u++) {
+    unsigned char *e = index + u * 16;
+
+    tag = (e[0] << 24) + (e[1] << 16) + (e[2] << 8) + e[3];
+    ofs = (e[8] << 24) + (e[9] << 16) + (e[10] << 8) + e[11];
+    cnt = (e[12] << 24) + (e[13] << 16) + (e[14] << 8) + e[15];
+
+    for(i = 0; i < sizeof tags / sizeof *tags; i++) {
+      if(tag == tags[i]) break;
+    }
+
+    if(i == sizeof tags / sizeof *tags) continue;
+
+    sigs++;
+
+    if(i >= 2 || ofs > dl || cnt > dl - ofs) {
+      err = PGP_UNSUPPORTED;
+      break;
+    }
+
+    if(
+      pgp_sig_read(&sig, index + il * 16 + ofs, cnt) ||
+      (err1 = pgp_sig_usable(&keyring_rpm, &sig, file)) == PGP_UNSUPPORTED
+    ) {
+      pgp_sig_free(&sig);
+      err = PGP_UNSUPPORTED;
+      break;
+    }
+
+    if(!err1) {
+      digest = mediacheck_digest_init(pgp_hash_name(sig.hash_algo), NULL);
+
+      // RSA: header only; PGP: header + payload
+      for(pos = hdr_start; i == 1 || pos < hdr_start + hdr_len; pos += r) {
+        r = i == 1 ? PGP_BUF_SIZE : hdr_start + hdr_len - pos;
+        if(r > PGP_BUF_SIZE) r = PGP_BUF_SIZE;
+        if((r = pread(fd, buf, r, pos)) <= 0) break;
+        mediacheck_digest_process(digest, buf, r);
+      }
+
+      err1 = r < 0 ? PGP_BAD : pgp_sig_verify(&keyring_rpm, &sig, digest);
+
+      mediacheck_digest_done(digest);
+    }
+
+    pgp_sig_free(&sig);
+
+    log_debug("%s: rpm sig %u = %d\n", file, tag, err1);
+
+    if(i == 1 && !err1) payload_ok = 1;
+
+    if(err == PGP_NOSIG || err == PGP_OK) err = err1;
+  }
+
+  // header signature only: the header must vouch for the payload
+  if(err == PGP_OK && !payload_ok) err = pgp_rpm_payload(fd, hdr_start, file);
+
+  free(buf);
+  free(index);
+  close(fd);
+
+  log_debug("%s: pgp = %d (%u sigs)\n", file, err, sigs);
+
+  return err;
+}
+
+
+/*
+ * Check rpm payload against the payload digest in the main header
+ * (PAYLOADDIGEST, PAYLOADDIGESTALGO).
+ *
+ * Return PGP_OK, PGP_BAD, or PGP_UNSUPPORTED.
+ */
+int pgp_rpm_payload(int fd, off_t hdr_start, char *file)
+{
+  unsigned char head[16], *index, *buf;
+  char value[129];
+  unsigned u, il, dl, tag, type, ofs, algo = 0, have_algo = 0;
+  off_t pos, data_start;
+  ssize_t r;
+  mediacheck_digest_t *digest;
+  int err = PGP_UNSUPPORTED;
+
+  *value = 0;
+
+  if(pread(fd, head, 16, hdr_start) != 16) return PGP_BAD;
+
+  il = pgp_be32(head + 8);
+  dl = pgp_be32(head + 12);
+
+  if(il > 0x10000) return PGP_BAD;
+
+  index = malloc(il * 16 + 1);
+
+  if(pread(fd, index, il * 16, hdr_start + 16) != il * 16) {
+    free(index);
+
+    return PGP_BAD;
+  }
+
+  data_start = hdr_start + 16 + il * 16;
+
+  for(u = 0; u < il; u++) {
+    tag = pgp_be32(index + u * 16);
+    type = pgp_be32(index + u * 16 + 4);
+    ofs = pgp_be32(index + u * 16 + 8);
+
+    if(ofs >= dl) continue;
+
+    // PAYLOADDIGEST: string array, we need the first one
+    if(tag == 5092 && type == 8) {
+      r = pread(fd, value, sizeof value - 1, data_start + ofs);
+      value[r > 0 ? r : 0] = 0;
+    }
+
+    // PAYLOADDIGESTALGO: int32, same numbers as OpenPGP
+    if(tag == 5093 && type == 4 && pread(fd, head, 4, data_start + ofs) == 4) {
+      algo = pgp_be32(head);
+      have_algo = 1;
+    }
+  }
+
+  free(index);
+
+  if(!*value || !have_algo || !pgp_hash_name(algo)) {
+    log_debug("%s: no usable payload digest\n", file);
+
+    return PGP_UNSUPPORTED;
+  }
+
+  digest = mediacheck_digest_init(pgp_hash_name(algo), NULL);
+  buf = malloc(PGP_BUF_SIZE);
+
+  for(pos = data_start + dl; (r = pread(fd, buf, PGP_BUF_SIZE, pos)) > 0; pos += r) {
+    mediacheck_digest_process(digest, buf, r);
+  }
+
+  if(r == 0) {
+    err = strcasecmp(mediacheck_digest_hex(digest) ?: "", value) ? PGP_BAD : PGP_OK;
+    if(err) log_info("%s: payload digest mismatch\n", file);
+  }
+  else {
+    err = PGP_BAD;
+  }
+
+  mediacheck_digest_done(digest);
+  free(buf);
+
+  return err;
+}
+
+
+uint32_t pgp_be32(unsigned char *p)
+{
+  return ((uint32_t) p[0] << 24) + (p[1] << 16) + (p[2] << 8) + p[3];
+}
+
+
+/*
+ * Go through OpenPGP message, verify signature, and write out literal data.
+ *
+ * depth: compression level
+ */
+int pgp_msg(pgp_msg_t *msg, pgp_stream_t *st, char *file, int depth)
+{
+  pgp_stream_t zst;
+  pgp_body_t body;
+  pgp_sig_t sig = { };
+  unsigned char *data, buf[13];
+  struct stat sbuf;
+  size_t len;
+  int tag, algo, err = PGP_NOSIG;
+
+  while((tag = pgp_packet(st, &body)) > 0) {
+    switch(tag) {
+      case 8:		/* compressed data */
+        algo = pgp_body_read(&body, buf, 1) == 1 ? *buf : -1;
+        if(depth || msg->written || !(algo == 1 || algo == 2)) {
+          log_debug("%s: compression %d not supported\n", file, algo);
+          return PGP_UNSUPPORTED;
+        }
+
+        // data will grow, write to temporary file
+        strprintf(&msg->tmp_name, "%s.XXXXXX", file);
+        if((msg->out_fd = mkostemp(msg->tmp_name, O_CLOEXEC)) == -1) {
+          str_copy(&msg->tmp_name, NULL);
+          return PGP_UNSUPPORTED;
+        }
+        if(!fstat(st->fd, &sbuf)) fchmod(msg->out_fd, sbuf.st_mode & 0777);
+
+        memset(&zst, 0, sizeof zst);
+        zst.fd = -1;
+        zst.body = &body;
+        zst.zlib = 1;
+        zst.buf = malloc(PGP_BUF_SIZE);
+        zst.zbuf = malloc(PGP_BUF_SIZE);
+        if(inflateInit2(&zst.z, algo == 1 ? -15 : 15) != Z_OK) {
+          pgp_stream_done(&zst);
+          return PGP_UNSUPPORTED;
+        }
+
+        err = pgp_msg(msg, &zst, file, depth + 1);
+
+        pgp_stream_done(&zst);
+
+        return err;
+
+      case 10:		/* marker */
+        if(pgp_body_skip(&body)) return PGP_BAD;
+        break;
+
+      case 4:		/* one-pass signature */
+        if(pgp_body_read(&body, buf, sizeof buf) != sizeof buf || pgp_body_skip(&body)) return PGP_BAD;
+        if(msg->onepass || msg->digest || buf[0] != 3) return PGP_UNSUPPORTED;
+        sig.version = 3;
+        sig.type = buf[1];
+        sig.hash_algo = buf[2];
+        sig.pub_algo = buf[3];
+        memcpy(sig.id, buf + 4, 8);
+        sig.has_id = 1;
+        if((err = pgp_sig_usable(msg->keyring, &sig, file))) return err;
+        memcpy(msg->onepass_id, sig.id, 8);
+        msg->onepass = 1;
+        msg->digest_algo = sig.hash_algo;
+        msg->digest = mediacheck_digest_init(pgp_hash_name(sig.hash_algo), NULL);
+        err = PGP_NOSIG;
+        break;
+
+      case 2:		/* signature */
+        if(!(data = pgp_body_get(&body, &len))) return PGP_BAD;
+        if((err = pgp_sig_parse(&sig, data, len))) {
+          pgp_sig_free(&sig);
+          return msg->literal ? PGP_BAD : err;
+        }
+        if(!msg->literal) {
+          // signature before data
+          if(msg->digest || (err = pgp_sig_usable(msg->keyring, &sig, file))) {
+            pgp_sig_free(&sig);
+            return msg->digest ? PGP_UNSUPPORTED : err;
+          }
+          msg->sig = sig;
+          msg->digest_algo = sig.hash_algo;
+          msg->digest = mediacheck_digest_init(pgp_hash_name(sig.hash_algo), NULL);
+          err = PGP_NOSIG;
+        }
+        else {
+          if(
+            sig.hash_algo != msg->digest_algo ||
+            (msg->onepass && (!sig.has_id || memcmp(sig.id, msg->onepass_id, 8)))
+          ) {
+            err = PGP_BAD;
+          }
+          else {
+            err = pgp_sig_verify(msg->keyring, &sig, msg->digest);
+          }
+          pgp_sig_free(&sig);
+          return err;
+        }
+        break;
+
+      case 11:		/* literal data */
+        if(msg->literal || !msg->digest) return msg->literal ? PGP_BAD : PGP_NOSIG;
+        if((err = pgp_msg_literal(msg, &body))) return err;
+        msg->literal = 1;
+        if(msg->sig.packet) {
+          err = pgp_sig_verify(msg->keyring, &msg->sig, msg->digest);
+          return err;
+        }
+        err = PGP_NOSIG;
+        break;
+
+      default:
+        log_debug("%s: packet type %d not supported\n", file, tag);
+        return PGP_UNSUPPORTED;
+    }
+  }
+
+  return tag < 0 || st->error ? PGP_BAD : err;
+}
+
+
+/*
+ * Hash literal data and write them out.
+ */
+int pgp_msg_literal(pgp_msg_t *msg, pgp_body_t *body)
+{
+  unsigned char *buf = malloc(PGP_BUF_SIZE);
+  ssize_t len = 0;
+  int err = 0;
+
+  // format, file name length, file name, date
+  if(
+    pgp_body_read(body, buf, 2) != 2 ||
+    pgp_body_read(body, buf + 2, buf[1] + 4) != buf[1] + 4
+  ) err = PGP_BAD;
+
+  while(!err && (len = pgp_body_read(body, buf, PGP_BUF_SIZE)) > 0) {
+    mediacheck_digest_process(msg->digest, buf, len);
+    err = pgp_write(msg, buf, len);
+  }
+
+  if(!err && len < 0) err = PGP_BAD;
+
+  free(buf);
+
+  return err;
+}
+
+
+/*
+ * Write data to output file.
+ */
+int pgp_write(pgp_msg_t *msg, unsigned char *buf, size_t len)
+{
+  ssize_t r;
+
+  msg->written = 1;
+
+  while(len) {
+    if((r = pwrite(msg->out_fd, buf, len, msg->out_pos)) <= 0) {
+      if(r < 0 && errno == EINTR) continue;
+      log_info("pgp: write: %s\n", strerror(errno));
+
+      return PGP_BAD;
+    }
+    buf += r;
+    len -= r;
+    msg->out_pos += r;
+  }
+
+  return 0;
+}
+
+
+/*
+ * Check whether we can verify the signature.
+ *
+ * Return PGP_OK if yes, PGP_BAD if there's no such key,
+ * else PGP_UNSUPPORTED.
+ */
+int pgp_sig_usable(pgp_keyring_t *keyring, pgp_sig_t *sig, char *file)
+{
+  int unusable = 0;
+
+  if(sig->type != 0 || !(sig->pub_algo == 1 || sig->pub_algo == 3) || !pgp_hash_name(sig->hash_algo)) {
+    log_debug("%s: signature type %u/%u/%u not supported\n", file, sig->type, sig->pub_algo, sig->hash_algo);
+
+    return PGP_UNSUPPORTED;
+  }
+
+  pgp_keyring_load(keyring);
+
+  if(!sig->has_id || !pgp_key_find(keyring, sig->id, &unusable)) {
+    if(unusable) {
+      log_debug("%s: key type not supported\n", file);
+
+      return PGP_UNSUPPORTED;
+    }
+
+    log_info("%s: no matching key in %s\n", file, keyring->name);
+
+    return PGP_BAD;
+  }
+
+  return PGP_OK;
+}
+
+
+/*
+ * Verify signature; digest must contain the hashed data.
+ *
+ * Return PGP_OK or PGP_BAD.
+ */
+int pgp_sig_verify(pgp_keyring_t *keyring, pgp_sig_t *sig, mediacheck_digest_t *digest)
+{
+  unsigned char hash[64], trailer[6];
+  int hash_len, unusable = 0;
+  pgp_key_t *key;
+
+  mediacheck_digest_process(digest, sig->hashed, sig->hashed_len);
+
+  if(sig->version == 4) {
+    trailer[0] = 4;
+    trailer[1] = 0xff;
+    trailer[2] = sig->hashed_len >> 24;
+    trailer[3] = sig->hashed_len >> 16;
+    trailer[4] = sig->hashed_len >> 8;
+    trailer[5] = sig->hashed_len;
+    mediacheck_digest_process(digest, trailer, sizeof trailer);
+  }
+
+  if((hash_len = pgp_digest_raw(digest, hash, sizeof hash)) <= 0) return PGP_BAD;
+
+  if(!(key = pgp_key_find(keyring, sig->id, &unusable))) return PGP_BAD;
+
+  if(!pgp_key_valid(key, sig)) return PGP_BAD;
+
+  return pgp_rsa_verify(key, sig, hash, hash_len);
+}
+
+
+/*
+ * Check RSA signature (EMSA-PKCS1-v1_5).
+ */
+int pgp_rsa_verify(pgp_key_t *key, pgp_sig_t *sig, unsigned char *hash, unsigned hash_len)
+{
+  // DER encoded DigestInfo prefixes
+  static const struct {
+    unsigned algo;
+    unsigned len;
+    unsigned char prefix[19];
+  } info[] = {
+    { 2, 15, { 0x30, 0x21, 0x30, 0x09, 0x06, 0x05, 0x2b, 0x0e, 0x03, 0x02, 0x1a, 0x05, 0x00, 0x04, 0x14 } },
+    { 8, 19, { 0x30, 0x31, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x01, 0x05, 0x00, 0x04, 0x20 } },
+    { 9, 19, { 0x30, 0x41, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x02, 0x05, 0x00, 0x04, 0x30 } },
+    { 10, 19, { 0x30, 0x51, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x03, 0x05, 0x00, 0x04, 0x40 } },
+    { 11, 19, { 0x30, 0x2d, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x04, 0x05, 0x00, 0x04, 0x1c } },
+  };
+  uint32_t n[PGP_MAX_LIMBS], s[PGP_MAX_LIMBS], m[PGP_MAX_LIMBS];
+  unsigned char em[PGP_MAX_LIMBS * 4];
+  unsigned u, i, k, pad;
+
+  for(u = 0; u < sizeof info / sizeof *info; u++) {
+    if(info[u].algo == sig->hash_algo) break;
+  }
+
+  if(u == sizeof info / sizeof *info) return PGP_BAD;
+
+  k = (key->n_len + 3) / 4;
+
+  if(
+    !key->n_len ||
+    k > PGP_MAX_LIMBS ||
+    !(key->n[key->n_len - 1] & 1) ||
+    sig->s_len > key->n_len ||
+    key->n_len < 11 + info[u].len + hash_len
+  ) return PGP_BAD;
+
+  bn_from_bytes(n, k, key->n, key->n_len);
+  bn_from_bytes(s, k, sig->s, sig->s_len);
+
+  if(bn_cmp(s, n, k) >= 0) return PGP_BAD;
+
+  bn_mod_exp(m, s, key->e, key->e_len, n, k);
+  bn_to_bytes(m, k, em, key->n_len);
+
+  // 00 01 ff ... ff 00 DigestInfo hash
+  pad = key->n_len - 3 - info[u].len - hash_len;
+
+  if(em[0] != 0 || em[1] != 1 || em[pad + 2] != 0) return PGP_BAD;
+
+  for(i = 2; i < pad + 2; i++) {
+    if(em[i] != 0xff) return PGP_BAD;
+  }
+
+  if(
+    memcmp(em + pad + 3, info[u].prefix, info[u].len) ||
+    memcmp(em + pad + 3 + info[u].len, hash, hash_len)
+  ) return PGP_BAD;
+
+  return PGP_OK;
+}
+
+
+/*
+ * Parse signature packet; data must be malloc'ed and is owned by sig
+ * afterwards.
+ *
+ * Return PGP_OK, PGP_BAD, or PGP_UNSUPPORTED.
+ */
+int pgp_sig_parse(pgp_sig_t *sig, unsigned char *data, size_t len)
+{
+  unsigned char *p, *end, *sub, *sub_end;
+  unsigned u, sub_len, pass;
+
+  memset(sig, 0, sizeof *sig);
+  sig->packet = data;
+
+  if(len < 1) return PGP_BAD;
+
+  sig->version = data[0];
+  end = data + len;
+
+  if(sig->version == 3) {
+    // ver, len (5), type, time, id, pub, hash, left16
+    if(len < 19 || data[1] != 5) return PGP_BAD;
+    sig->type = data[2];
+    sig->created = pgp_be32(data + 3);
+    sig->hashed = data + 2;
+    sig->hashed_len = 5;
+    memcpy(sig->id, data + 7, 8);
+    sig->has_id = 1;
+    sig->pub_algo = data[15];
+    sig->hash_algo = data[16];
+    p = data + 19;
+  }
+  else if(sig->version == 4) {
+    // ver, type, pub, hash, hashed subpackets, unhashed subpackets, left16
+    if(len < 6) return PGP_BAD;
+    sig->type = data[1];
+    sig->pub_algo = data[2];
+    sig->hash_algo = data[3];
+    sig->hashed = data;
+    p = data + 4;
+
+    for(pass = 0; pass < 2; pass++) {
+      if(end - p < 2) return PGP_BAD;
+      u = (p[0] << 8) + p[1];
+      p += 2;
+      if(end - p < u) return PGP_BAD;
+      if(!pass) sig->hashed_len = p + u - data;
+
+      // look for issuer
+      for(sub = p, sub_end = p + u; sub < sub_end; sub += sub_len) {
+        sub_len = *sub++;
+        if(sub_len >= 192 && sub_len < 255) {
+          if(sub >= sub_end) return PGP_BAD;
+          sub_len = ((sub_len - 192) << 8) + *sub++ + 192;
+        }
+        else if(sub_len == 255) {
+          if(sub_end - sub < 4) return PGP_BAD;
+          sub_len = (sub[0] << 24) + (sub[1] << 16) + (sub[2] << 8) + sub[3];
+          sub += 4;
+        }
+        if(!sub_len || sub_end - sub < sub_len) return PGP_BAD;
+        // creation & expiration times: only if hashed
+        if(!pass && sub_len == 5) {
+          if((*sub & 0x7f) == 2) sig->created = pgp_be32(sub + 1);
+          if((*sub & 0x7f) == 3) sig->expires = pgp_be32(sub + 1);
+          if((*sub & 0x7f) == 9) {
+            sig->key_expires = pgp_be32(sub + 1);
+            sig->has_key_expires = 1;
+          }
+        }
+        if((*sub & 0x7f) == 16 && sub_len == 9 && !sig->has_id) {
+          memcpy(sig->id, sub + 1, 8);
+          sig->has_id = 1;
+        }
+        // v4 fingerprint: key id are the last 8 bytes
+        if((*sub & 0x7f) == 33 && sub_len == 22 && sub[1] == 4 && !sig->has_id) {
+          memcpy(sig->id, sub + 14, 8);
+          sig->has_id = 1;
+        }
+      }
+
+      p += u;
+    }
+
+    // left16
+    if(end - p < 2) return PGP_BAD;
+    p += 2;
+  }
+  else {
+    return PGP_UNSUPPORTED;
+  }
+
+  // RSA signature: one MPI
+  if(end - p < 2) return PGP_BAD;
+  u = ((p[0] << 8) + p[1] + 7) / 8;
+  p += 2;
+  if(end - p < u) return PGP_BAD;
+  sig->s = p;
+  sig->s_len = u;
+
+  return PGP_OK;
+}
+
+
+/*
+ * Parse first signature packet in buffer.
+ *
+ * Return PGP_OK, PGP_BAD, or PGP_UNSUPPORTED.
+ */
+int pgp_sig_read(pgp_sig_t *sig, unsigned char *buf, size_t len)
+{
+  pgp_stream_t st;
+  pgp_body_t body;
+  unsigned char *data;
+  int tag, err = PGP_BAD;
+
+  memset(sig, 0, sizeof *sig);
+
+  pgp_stream_mem(&st, buf, len);
+
+  while((tag = pgp_packet(&st, &body)) > 0) {
+    if(tag == 2) {
+      if((data = pgp_body_get(&body, &len))) err = pgp_sig_parse(sig, data, len);
+      break;
+    }
+    if(pgp_body_skip(&body)) break;
+  }
+
+  pgp_stream_done(&st);
+
+  return err;
+}
+
+
+/*
+ * Read detached signature and check that we can verify it.
+ *
+ * sig must be freed with pgp_sig_free() in any case.
+ *
+ * Return PGP_OK, PGP_BAD, or PGP_UNSUPPORTED.
+ */
+int pgp_detached_sig(pgp_sig_t *sig, char *sig_file)
+{
+  unsigned char *buf;
+  size_t len;
+  int err;
+
+  memset(sig, 0, sizeof *sig);
+
+  if(!(buf = pgp_read_file(sig_file, &len))) return PGP_BAD;
+
+  err = pgp_sig_read(sig, buf, pgp_dearmor(buf, len));
+
+  free(buf);
+
+  if(err) {
+    log_info("%s: no usable signature\n", sig_file);
+
+    return err;
+  }
+
+  return pgp_sig_usable(&keyring_gpg, sig, sig_file);
+}
+
+
+void pgp_sig_free(pgp_sig_t *sig)
+{
+  free(sig->packet);
+  memset(sig, 0, sizeof *sig);
+}
+
+
+/*
+ * Load keyring (once).
+ *
+ * keyring->name may be a single file or a directory with key files.
+ */
+void pgp_keyring_load(pgp_keyring_t *keyring)
+{
+  struct stat sbuf;
+  DIR *d;
+  struct dirent *de;
+  unsigned char *buf;
+  char *name = NULL;
+  size_t len;
+  pgp_key_t *key;
+  unsigned keys = 0, rsa = 0;
+
+  if(keyring->loaded) return;
+
+  keyring->loaded = 1;
+
+  if(stat(keyring->name, &sbuf)) return;
+
+  if(S_ISDIR(sbuf.st_mode)) {
+    if((d = opendir(keyring->name))) {
+      while((de = readdir(d))) {
+        if(*de->d_name == '.') continue;
+        strprintf(&name, "%s/%s", keyring->name, de->d_name);
+        if((buf = pgp_read_file(name, &len))) {
+          pgp_keyring_add(keyring, buf, len);
+          free(buf);
+        }
+      }
+      closedir(d);
+    }
+    str_copy(&name, NULL);
+  }
+  else if((buf = pgp_read_file(keyring->name, &len))) {
+    pgp_keyring_add(keyring, buf, len);
+    free(buf);
+  }
+
+  for(key = keyring->keys; key; key = key->next) {
+    keys++;
+    if(key->rsa) rsa++;
+  }
+
+  log_info("%s: %u keys (%u usable)\n", keyring->name, keys, rsa);
+}
+
+
+/*
+ * Add all keys found in buffer.
+ */
+void pgp_keyring_add(pgp_keyring_t *keyring, unsigned char *buf, size_t len)
+{
+  pgp_stream_t st;
+  pgp_body_t body;
+  pgp_sig_t sig;
+  pgp_key_t *primary = NULL, *key = NULL;
+  unsigned char *data;
+  size_t data_len;
+  int tag;
+
+  len = pgp_dearmor(buf, len);
+
+  pgp_stream_mem(&st, buf, len);
+
+  while((tag = pgp_packet(&st, &body)) > 0) {
+    // public key, public subkey
+    if(tag == 6 || tag == 14) {
+      if(!(data = pgp_body_get(&body, &data_len))) break;
+      key = pgp_key_add(keyring, data, data_len, tag == 14 ? primary : NULL);
+      if(tag == 6) primary = key;
+      free(data);
+    }
+    // signatures on the current key: revocations, expiration dates
+    else if(tag == 2 && key) {
+      if(!(data = pgp_body_get(&body, &data_len))) break;
+      if(!pgp_sig_parse(&sig, data, data_len)) {
+        if(sig.type == 0x20 && primary) primary->revoked = 1;
+        if(sig.type == 0x28 && key != primary) key->revoked = 1;
+        if(((sig.type >= 0x10 && sig.type <= 0x13) || sig.type == 0x1f) && primary) {
+          pgp_key_self_sig(primary, &sig);
+        }
+        if(sig.type == 0x18 && key != primary) pgp_key_self_sig(key, &sig);
+      }
+      pgp_sig_free(&sig);
+    }
+    else if(pgp_body_skip(&body)) {
+      break;
+    }
+  }
+
+  pgp_stream_done(&st);
+}
+
+
+/*
+ * Parse public key packet and add it to keyring.
+ *
+ * For subkeys, primary is the primary key.
+ *
+ * Return the new key or NULL.
+ */
+pgp_key_t *pgp_key_add(pgp_keyring_t *keyring, unsigned char *data, size_t len, pgp_key_t *primary)
+{
+  pgp_key_t *key;
+  mediacheck_digest_t *digest;
+  unsigned char *p, *end = data + len, fpr[20], prefix[3];
+  unsigned u, algo;
+
+  if(len < 8 || !(data[0] == 3 || data[0] == 4)) return NULL;
+
+  // v3 has 2 more bytes (validity)
+  p = data + (data[0] == 3 ? 7 : 5);
+  algo = *p++;
+
+  key = calloc(1, sizeof *key);
+  key->primary = primary;
+  key->created = pgp_be32(data + 1);
+
+  // v3: validity in days
+  if(data[0] == 3 && (data[5] || data[6])) key->expires = key->created + ((data[5] << 8) + data[6]) * 86400;
+
+  if(algo == 1 || algo == 2 || algo == 3) {
+    if(end - p >= 2) {
+      u = ((p[0] << 8) + p[1] + 7) / 8;
+      p += 2;
+      if(end - p >= u) {
+        key->n = malloc(u);
+        memcpy(key->n, p, key->n_len = u);
+        p += u;
+      }
+    }
+    if(key->n && end - p >= 2) {
+      u = ((p[0] << 8) + p[1] + 7) / 8;
+      p += 2;
+      if(end - p >= u) {
+        key->e = malloc(u);
+        memcpy(key->e, p, key->e_len = u);
+        key->rsa = algo != 2 && key->n_len / 4 <= PGP_MAX_LIMBS;
+      }
+    }
+  }
+
+  if(data[0] == 4) {
+    prefix[0] = 0x99;
+    prefix[1] = len >> 8;
+    prefix[2] = len;
+    digest = mediacheck_digest_init("sha1", NULL);
+    mediacheck_digest_process(digest, prefix, sizeof prefix);
+    mediacheck_digest_process(digest, data, len);
+    if(pgp_digest_raw(digest, fpr, sizeof fpr) == sizeof fpr) memcpy(key->id, fpr + 12, 8);
+    mediacheck_digest_done(digest);
+  }
+  else if(key->n_len >= 8) {
+    memcpy(key->id, key->n + key->n_len - 8, 8);
+  }
+
+  key->next = keyring->keys;
+  keyring->keys = key;
+
+  return key;
+}
+
+
+/*
+ * Apply self-signature (certification or subkey binding) to key.
+ *
+ * The most recent one determines the expiration date; if it has no key
+ * expiration time, the key doesn't expire (that's how keys get un-expired).
+ */
+void pgp_key_self_sig(pgp_key_t *key, pgp_sig_t *sig)
+{
+  pgp_key_t *primary = key->primary ?: key;
+
+  // third-party certifications don't count
+  if(!sig->has_id || memcmp(sig->id, primary->id, 8)) return;
+
+  // v3 signatures have no subpackets; v3 keys keep the validity from the key packet
+  if(sig->version != 4 || sig->created < key->self_sig) return;
+
+  key->self_sig = sig->created;
+  key->expires = sig->has_key_expires && sig->key_expires ? key->created + sig->key_expires : 0;
+}
+
+
+/*
+ * Check that key (and its primary key) was valid when sig was made and
+ * that sig has not expired.
+ */
+int pgp_key_valid(pgp_key_t *key, pgp_sig_t *sig)
+{
+  pgp_key_t *k;
+  unsigned long long id;
+  unsigned u;
+
+  for(u = 0, id = 0; u < 8; u++) id = (id << 8) + key->id[u];
+
+  for(k = key; k; k = k == key ? key->primary : NULL) {
+    if(k->revoked) {
+      log_info("key %016llx: revoked\n", id);
+
+      return 0;
+    }
+
+    if(k->expires && sig->created >= k->expires) {
+      log_info("key %016llx: expired\n", id);
+
+      return 0;
+    }
+  }
+
+  if(sig->expires && (uint64_t) sig->created + sig->expires <= (uint64_t) time(NULL)) {
+    log_info("key %016llx: signature expired\n", id);
+
+    return 0;
+  }
+
+  return 1;
+}
+
+
+/*
+ * Find key with key id.
+ *
+ * If there are only keys we can't use, set *unusable.
+ */
+pgp_key_t *pgp_key_find(pgp_keyring_t *keyring, unsigned char *id, int *unusable)
+{
+  pgp_key_t *key;
+
+  for(key = keyring->keys; key; key = key->next) {
+    if(!memcmp(key->id, id, 8)) {
+      if(key->rsa) return key;
+      *unusable = 1;
+    }
+  }
+
+  return NULL;
+}
+
+
+/*
+ * Map OpenPGP hash algorithm to libmediacheck digest name.
+ */
+char *pgp_hash_name(unsigned algo)
+{
+  switch(algo) {
+    case 2: return "sha1";
+    case 8: return "sha256";
+    case 9: return "sha384";
+    case 10: return "sha512";
+    case 11: return "sha224";
+  }
+
+  return NULL;
+}
+
+
+/*
+ * Get binary digest value.
+ *
+ * Return digest length or -1.
+ */
+int pgp_digest_raw(mediacheck_digest_t *digest, unsigned char *buf, unsigned len)
+{
+  char *hex = mediacheck_digest_hex(digest);
+  unsigned u;
+
+  if(!hex || strlen(hex) / 2 > len) return -1;
+
+  for(u = 0; hex[2 * u] && hex[2 * u + 1]; u++) {
+    if(sscanf(hex + 2 * u, "%2hhx", buf + u) != 1) return -1;
+  }
+
+  return u;
+}
+
+
+/*
+ * Read file into memory (up to PGP_MAX_PACKET bytes).
+ */
+unsigned char *pgp_read_file(char *name, size_t *len)
+{
+  unsigned char *buf;
+  ssize_t r;
+  int fd;
+
+  if((fd = open(name, O_RDONLY | O_CLOEXEC)) == -1) return NULL;
+
+  buf = malloc(PGP_MAX_PACKET);
+  *len = 0;
+
+  while(*len < PGP_MAX_PACKET && (r = read(fd, buf + *len, PGP_MAX_PACKET - *len)) > 0) *len += r;
+
+  close(fd);
+
+  return buf;
+}
+
+
+/*
+ * Decode ASCII armor (all blocks) in place.
+ *
+ * If buf does not start with an armor header, leave it alone.
+ *
+ * Return new length.
+ */
+size_t pgp_dearmor(unsigned char *buf, size_t len)
+{
+  static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  unsigned char *line, *eol, *end = buf + len, *s;
+  size_t out = 0;
+  unsigned bits = 0, val = 0;
+  char *c;
+  enum { outside, header, data, crc } state = outside;
+
+  for(s = buf; s < end && isspace(*s); s++);
+
+  if(end - s < (int) sizeof "-----BEGIN PGP" - 1 || memcmp(s, "-----BEGIN PGP", sizeof "-----BEGIN PGP" - 1)) {
+    return len;
+  }
+
+  for(line = buf; line < end; line = eol + 1) {
+    if(!(eol = memchr(line, '\n', end - line))) eol = end;
+
+    if(eol - line >= 5 && !memcmp(line, "-----", 5)) {
+      state = state == outside ? header : outside;
+      continue;
+    }
+
+    if(state == header) {
+      // headers end with an empty line
+      for(s = line; s < eol && (*s == ' ' || *s == '\t' || *s == '\r'); s++);
+      if(s == eol) state = data;
+      continue;
+    }
+
+    if(state == data) {
+      if(*line == '=') {
+        state = crc;
+        continue;
+      }
+      for(s = line; s < eol; s++) {
+        if(!*s || !(c = strchr(b64, *s))) continue;
+        val = (val << 6) + (c - b64);
+        bits += 6;
+        if(bits >= 8) {
+          bits -= 8;
+          // always behind the read position
+          buf[out++] = val >> bits;
+          val &= (1 << bits) - 1;
+        }
+      }
+    }
+  }
+
+  return out;
+}
+
+
+/*
+ * Input streams.
+ */
+void pgp_stream_mem(pgp_stream_t *st, unsigned char *buf, size_t len)
+{
+  memset(st, 0, sizeof *st);
+
+  st->fd = -1;
+  st->buf = buf;
+  st->len = len;
+  st->eof = 1;
+}
+
+
+void pgp_stream_fd(pgp_stream_t *st, int fd)
+{
+  memset(st, 0, sizeof *st);
+
+  st->fd = fd;
+  st->buf = malloc(PGP_BUF_SIZE);
+}
+
+
+void pgp_stream_done(pgp_stream_t *st)
+{
+  if(st->zlib) inflateEnd(&st->z);
+
+  if(st->fd >= 0 || st->body) free(st->buf);
+  free(st->zbuf);
+
+  memset(st, 0, sizeof *st);
+  st->fd = -1;
+}
+
+
+/*
+ * Make sure there's something in the buffer.
+ *
+ * Return number of bytes available.
+ */
+size_t pgp_fill(pgp_stream_t *st)
+{
+  ssize_t r;
+  int i;
+
+  if(st->pos < st->len) return st->len - st->pos;
+
+  if(st->eof) return 0;
+
+  st->pos = st->len = 0;
+
+  if(st->fd >= 0) {
+    r = read(st->fd, st->buf, PGP_BUF_SIZE);
+    if(r < 0 && errno == EINTR) return pgp_fill(st);
+    if(r <= 0) {
+      st->eof = 1;
+      if(r) st->error = 1;
+      return 0;
+    }
+
+    return st->len = r;
+  }
+
+  st->z.next_out = st->buf;
+  st->z.avail_out = PGP_BUF_SIZE;
+
+  while(st->z.avail_out == PGP_BUF_SIZE) {
+    if(!st->z.avail_in && !st->zin_eof) {
+      r = pgp_body_read(st->body, st->zbuf, PGP_BUF_SIZE);
+      if(r < 0) {
+        st->error = st->eof = 1;
+        break;
+      }
+      if(!r) st->zin_eof = 1;
+      st->z.next_in = st->zbuf;
+      st->z.avail_in = r;
+    }
+
+    i = inflate(&st->z, Z_NO_FLUSH);
+
+    if(i == Z_STREAM_END) {
+      st->eof = 1;
+      break;
+    }
+
+    if(i != Z_OK && !(i == Z_BUF_ERROR && !st->zin_eof)) {
+      // truncated or broken
+      st->error = st->eof = 1;
+      break;
+    }
+  }
+
+  return st->len = PGP_BUF_SIZE - st->z.avail_out;
+}
+
+
+size_t pgp_read(pgp_stream_t *st, unsigned char *buf, size_t len)
+{
+  size_t got = 0, n;
+
+  while(got < len && (n = pgp_fill(st))) {
+    if(n > len - got) n = len - got;
+    memcpy(buf + got, st->buf + st->pos, n);
+    st->pos += n;
+    got += n;
+  }
+
+  return got;
+}
+
+
+int pgp_getc(pgp_stream_t *st)
+{
+  if(!pgp_fill(st)) return -1;
+
+  return st->buf[st->pos++];
+}
+
+
+/*
+ * Read new format packet length.
+ */
+int pgp_length(pgp_stream_t *st, uint64_t *len, int *partial)
+{
+  int i, c = pgp_getc(st), c1;
+
+  *partial = 0;
+
+  if(c < 0) return -1;
+
+  if(c < 192) {
+    *len = c;
+  }
+  else if(c < 224) {
+    if((c1 = pgp_getc(st)) < 0) return -1;
+    *len = ((c - 192) << 8) + c1 + 192;
+  }
+  else if(c == 255) {
+    for(*len = i = 0; i < 4; i++) {
+      if((c1 = pgp_getc(st)) < 0) return -1;
+      *len = (*len << 8) + c1;
+    }
+  }
+  else {
+    *len = 1 << (c & 0x1f);
+    *partial = 1;
+  }
+
+  return 0;
+}
+
+
+/*
+ * Read packet header.
+ *
+ * Return packet tag, 0 at end of stream, or -1 on error.
+ */
+int pgp_packet(pgp_stream_t *st, pgp_body_t *body)
+{
+  int c, i, c1, tag, partial;
+
+  memset(body, 0, sizeof *body);
+  body->st = st;
+
+  if((c = pgp_getc(st)) < 0) return 0;
+
+  if(!(c & 0x80)) return -1;
+
+  if(c & 0x40) {
+    tag = c & 0x3f;
+    if(pgp_length(st, &body->left, &partial)) return -1;
+    body->partial = partial;
+  }
+  else {
+    tag = (c >> 2) & 0xf;
+    if((c & 3) == 3) {
+      body->to_eof = 1;
+    }
+    else {
+      for(i = 0; i < 1 << (c & 3); i++) {
+        if((c1 = pgp_getc(st)) < 0) return -1;
+        body->left = (body->left << 8) + c1;
+      }
+    }
+  }
+
+  return tag ? tag : -1;
+}
+
+
+/*
+ * Read from packet body.
+ *
+ * Return number of bytes read (0 at end of packet) or -1 on error.
+ */
+ssize_t pgp_body_read(pgp_body_t *body, unsigned char *buf, size_t len)
+{
+  size_t got = 0, n, r;
+  int partial;
+
+  if(body->to_eof) return pgp_read(body->st, buf, len);
+
+  while(got < len) {
+    if(!body->left) {
+      if(!body->partial) break;
+      if(pgp_length(body->st, &body->left, &partial)) return -1;
+      body->partial = partial;
+      continue;
+    }
+    n = len - got;
+    if(n > body->left) n = body->left;
+    r = pgp_read(body->st, buf + got, n);
+    got += r;
+    body->left -= r;
+    if(r < n) return -1;
+  }
+
+  return got;
+}
+
+
+/*
+ * Skip (rest of) packet body.
+ *
+ * Return 0 or -1 on error.
+ */
+int pgp_body_skip(pgp_body_t *body)
+{
+  unsigned char buf[1024];
+  ssize_t r;
+
+  while((r = pgp_body_read(body, buf, sizeof buf)) > 0);
+
+  return r;
+}
+
+
+/*
+ * Read (rest of) packet body into a malloc'ed buffer.
+ */
+unsigned char *pgp_body_get(pgp_body_t *body, size_t *len)
+{
+  unsigned char *buf = NULL;
+  size_t size = 0;
+  ssize_t r;
+
+  *len = 0;
+
+  do {
+    if(*len == size) {
+      if(size >= PGP_MAX_PACKET) {
+        free(buf);
+        return NULL;
+      }
+      buf = realloc(buf, size += 4096);
+    }
+    r = pgp_body_read(body, buf + *len, size - *len);
+    if(r > 0) *len += r;
+  } while(r > 0);
+
+  if(r < 0) {
+    free(buf);
+    return NULL;
+  }
+
+  return buf;
+}
+
+
+/*
+ * Multi-precision arithmetic, just enough for RSA signatures.
+ *
+ * Numbers are arrays of k 32-bit limbs, least significant first;
+ * multiplication uses Montgomery's method.
+ */
+void bn_from_bytes(uint32_t *a, unsigned k, unsigned char *buf, unsigned len)
+{
+  unsigned u;
+
+  memset(a, 0, k * sizeof *a);
+
+  for(u = 0; u < len && u < 4 * k; u++) {
+    a[u / 4] |= (uint32_t) buf[len - 1 - u] << (8 * (u % 4));
+  }
+}
+
+
+void bn_to_bytes(uint32_t *a, unsigned k, unsigned char *buf, unsigned len)
+{
+  unsigned u;
+
+  for(u = 0; u < len; u++) {
+    buf[len - 1 - u] = u < 4 * k ? a[u / 4] >> (8 * (u % 4)) : 0;
+  }
+}
+
+
+int bn_cmp(uint32_t *a, uint32_t *b, unsigned k)
+{
+  while(k--) {
+    if(a[k] != b[k]) return a[k] > b[k] ? 1 : -1;
+  }
+
+  return 0;
+}
+
+
+void bn_sub(uint32_t *a, uint32_t *b, unsigned k)
+{
+  uint64_t borrow = 0, d;
+  unsigned u;
+
+  for(u = 0; u < k; u++) {
+    d = (uint64_t) a[u] - b[u] - borrow;
+    a[u] = d;
+    borrow = (d >> 32) & 1;
+  }
+}
+
+
+/*
+ * -n^-1 mod 2^32
+ */
+unsigned bn_n0(uint32_t *n)
+{
+  uint32_t x = 1;
+  int i;
+
+  for(i = 0; i < 5; i++) x *= 2 - n[0] * x;
+
+  return -x;
+}
+
+
+/*
+ * r = a * b / 2^(32k) mod n
+ */
+void bn_mont_mul(uint32_t *r, uint32_t *a, uint32_t *b, uint32_t *n, uint32_t n0, unsigned k)
+{
+  uint32_t t[PGP_MAX_LIMBS + 2], m;
+  uint64_t c;
+  unsigned i, j;
+
+  memset(t, 0, sizeof t);
+
+  for(i = 0; i < k; i++) {
+    c = 0;
+    for(j = 0; j < k; j++) {
+      c += t[j] + (uint64_t) a[j] * b[i];
+      t[j] = c;
+      c >>= 32;
+    }
+    c += t[k];
+    t[k] = c;
+    t[k + 1] = c >> 32;
+
+    m = t[0] * n0;
+    c = (t[0] + (uint64_t) m * n[0]) >> 32;
+    for(j = 1; j < k; j++) {
+      c += t[j] + (uint64_t) m * n[j];
+      t[j - 1] = c;
+      c >>= 32;
+    }
+    c += t[k];
+    t[k - 1] = c;
+    t[k] = t[k + 1] + (c >> 32);
+  }
+
+  if(t[k] || bn_cmp(t, n, k) >= 0) bn_sub(t, n, k);
+
+  memcpy(r, t, k * sizeof *r);
+}
+
+
+/*
+ * r = a^e mod n
+ */
+void bn_mod_exp(uint32_t *r, uint32_t *a, unsigned char *e, unsigned e_len, uint32_t *n, unsigned k)
+{
+  uint32_t r2[PGP_MAX_LIMBS], x[PGP_MAX_LIMBS], am[PGP_MAX_LIMBS], one[PGP_MAX_LIMBS];
+  uint32_t n0 = bn_n0(n), carry;
+  unsigned u, bit;
+  int started = 0;
+
+  // 2^(64k) mod n
+  memset(r2, 0, sizeof r2);
+  r2[0] = 1;
+  for(u = 0; u < 64 * k; u++) {
+    carry = r2[k - 1] >> 31;
+    for(bit = k - 1; bit > 0; bit--) r2[bit] = (r2[bit] << 1) | (r2[bit - 1] >> 31);
+    r2[0] <<= 1;
+    if(carry || bn_cmp(r2, n, k) >= 0) bn_sub(r2, n, k);
+  }
+
+  memset(one, 0, sizeof one);
+  one[0] = 1;
+
+  bn_mont_mul(am, a, r2, n, n0, k);
+  bn_mont_mul(x, one, r2, n, n0, k);
+
+  for(u = 0; u < e_len; u++) {
+    for(bit = 0x80; bit; bit >>= 1) {
+      if(started) bn_mont_mul(x, x, x, n, n0, k);
+      if((e[u] & bit)) {
+        bn_mont_mul(x, x, am, n, n0, k);
+        started = 1;
+      }
+    }
+  }
+
+  bn_mont_mul(r, x, one, n, n0, k);
+}
@@ -0,0 +1,19 @@
+/*
+ *
+ * pgp.h         Header file for pgp.c
+ *
+ */
+
+#include <mediacheck.h>
+
+// return values of the pgp_verify_*() functions
+#define PGP_OK		0	// signature ok
+#define PGP_BAD		1	// signature wrong
+#define PGP_NOSIG	2	// not signed or not in the expected format
+#define PGP_UNSUPPORTED	-2	// can't tell; use gpg or rpmkeys
+
+int pgp_verify_inline(char *file);
+int pgp_verify_detached(char *file, char *sig_file);
+char *pgp_detached_hash(char *sig_file);
+int pgp_verify_digest(char *sig_file, mediacheck_digest_t *digest);
+int pgp_verify_rpm(char *file);
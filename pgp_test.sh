@@ -0,0 +1,116 @@
+#! /bin/bash
+
+# Check signature verification in pgp.c against known answers.
+#
+# test/pgp/rsa.txt has PKCS#1 v1.5 vectors for a 2048 bit (e = 65537) and
+# a 1030 bit (e = 3) key: valid signatures made with openssl for all
+# supported hashes, plus tampered signatures and malformed encodings.
+#
+# The other files in test/pgp were made with gpg:
+#
+#   key.gpg              RSA key, created 2020-01-01, no expiration date
+#   key-expired.gpg      same key with a later self-signature that sets a
+#                        1 day validity
+#   key-extended.gpg     as key-expired.gpg, plus a self-signature from
+#                        2020-02-01 without expiration date
+#   key-extended2.gpg    same, with the self-signatures in reverse order
+#   key-revoked.gpg      same key with a revocation signature
+#
+#   data.sig, data.asc   detached signatures (binary, armored) of data
+#   data.gpg             'gpg --sign' of data (compressed)
+#   small.gpg            'gpg -z 0 --sign' of small (uncompressed)
+#   small-bad.gpg        small.gpg with one byte of the literal data changed
+#   test.rpm             rpm with a header-only signature and a payload
+#                        digest in the header
+#   test-bad.rpm         test.rpm with one byte of the header changed
+#
+# All data signatures are from 2024-01-01.
+
+# exit on error immediately
+set -e
+
+DIR=$(mktemp -d)
+
+function cleanup()
+{
+  rm -rf "$DIR"
+}
+
+trap cleanup EXIT
+
+function fail()
+{
+  echo "ERROR: $1"
+  exit 1
+}
+
+# expect RESULT KEYRING pgptest_args...
+function expect()
+{
+  local result=$1 keyring=$2 cmd=$3 out
+
+  shift 3
+
+  out=$(./test/pgptest $cmd test/pgp/$keyring "$@" 2> "$DIR/log") || true
+
+  if [ "$out" != "$1: $result" ] ; then
+    cat "$DIR/log"
+    fail "$cmd $*, keyring $keyring: expected '$result', got '${out#*: }'"
+  fi
+
+  echo "$cmd $*, keyring $keyring: $result"
+}
+
+###############################################################################
+
+make -s -C test pgptest
+
+./test/pgptest rsa test/pgp/rsa.txt || fail "RSA known answer tests"
+
+###############################################################################
+
+cp test/pgp/data "$DIR/data-bad"
+printf X | dd of="$DIR/data-bad" bs=1 seek=1000 conv=notrunc 2> /dev/null
+
+expect ok key.gpg detached test/pgp/data test/pgp/data.sig
+expect ok key.gpg detached test/pgp/data test/pgp/data.asc
+expect bad key.gpg detached "$DIR/data-bad" test/pgp/data.sig
+
+###############################################################################
+
+for i in data small small-bad ; do
+  cp test/pgp/$i.gpg "$DIR"
+done
+
+expect ok key.gpg inline "$DIR/data.gpg"
+cmp "$DIR/data.gpg" test/pgp/data || fail "data.gpg: wrong contents"
+
+expect ok key.gpg inline "$DIR/small.gpg"
+cmp "$DIR/small.gpg" test/pgp/small || fail "small.gpg: wrong contents"
+
+expect bad key.gpg inline "$DIR/small-bad.gpg"
+
+expect nosig key.gpg inline "$DIR/small.gpg"
+
+###############################################################################
+
+cp test/pgp/test.rpm "$DIR/payload-bad.rpm"
+echo >> "$DIR/payload-bad.rpm"
+
+expect ok key.gpg rpm test/pgp/test.rpm
+expect bad key.gpg rpm test/pgp/test-bad.rpm
+expect bad key.gpg rpm "$DIR/payload-bad.rpm"
+
+###############################################################################
+
+for keyring in key-expired.gpg key-revoked.gpg ; do
+  expect bad $keyring detached test/pgp/data test/pgp/data.sig
+  expect bad $keyring rpm test/pgp/test.rpm
+done
+
+for keyring in key-extended.gpg key-extended2.gpg ; do
+  expect ok $keyring detached test/pgp/data test/pgp/data.sig
+  expect ok $keyring rpm test/pgp/test.rpm
+done
+
+echo "pgp test ok"
@@ -0,0 +1,1328 @@
+/*
+ *
+ * squashfs.c    Build squashfs images
+ *
+ * A squashfs (4.0, zlib compressed) image is created directly from a stream
+ * of file system entries (see archive_squash()); the files never exist
+ * anywhere else.
+ *
+ * File data are cut into blocks which are compressed by a pool of threads
+ * and written to the image (in order) as soon as they are done. Only the
+ * directory tree (names, attributes, block sizes) is kept in memory; the
+ * metadata tables are written at the end (see sq_finish()).
+ *
+ * Image layout: superblock, data blocks & fragments, inode table,
+ * directory table, fragment table, id table.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <zlib.h>
+
+#include "global.h"
+#include "util.h"
+#include "squashfs.h"
+
+#define SQ_MAGIC		0x73717368
+#define SQ_MAJOR		4
+#define SQ_BLOCK_LOG		17
+#define SQ_BLOCK_SIZE		(1 << SQ_BLOCK_LOG)
+#define SQ_METADATA_SIZE	8192
+#define SQ_SUPERBLOCK_SIZE	96
+#define SQ_ZLIB			1
+#define SQ_NO_XATTRS		0x0200
+#define SQ_INVALID_BLK		0xffffffffffffffffULL
+#define SQ_INVALID_FRAG		0xffffffff
+#define SQ_INVALID_XATTR	0xffffffff
+#define SQ_UNCOMPRESSED_BLOCK	(1 << 24)
+#define SQ_UNCOMPRESSED_META	0x8000
+#define SQ_MAX_NAME		256
+#define SQ_MAX_IDS		0xffff
+#define SQ_DIR_COUNT		256
+#define SQ_DIR_HEADER_SIZE	12
+#define SQ_DIR_ENTRY_SIZE	8
+#define SQ_FRAG_ENTRY_SIZE	16
+
+// the image size is padded to a multiple of this
+#define SQ_PAD			4096
+// compression jobs in flight, per thread
+#define SQ_JOBS_PER_THREAD	4
+
+// inode types
+#define SQ_DIR		1
+#define SQ_FILE		2
+#define SQ_SYMLINK	3
+#define SQ_BLKDEV	4
+#define SQ_CHRDEV	5
+#define SQ_FIFO		6
+#define SQ_SOCKET	7
+#define SQ_LDIR		8
+#define SQ_LFILE	9
+
+typedef struct sq_dentry_s {
+  struct sq_dentry_s *next;	// next entry in directory
+  struct sq_dentry_s *hash_next;
+  char *path;			// full path
+  char *name;			// last path component (points into path)
+  sq_node_t *node;
+} sq_dentry_t;
+
+struct sq_node_s {
+  struct sq_node_s *next;	// list of all nodes
+  mode_t mode;
+  unsigned uid, gid;		// id table indices
+  time_t mtime;
+  dev_t rdev;
+  char *link;			// symlink target
+  unsigned nlink;		// directory entries pointing here
+  unsigned ino;			// inode number
+  uint64_t ref;			// inode reference, once written
+  unsigned numbered:1;
+  unsigned written:1;
+  // regular files
+  uint64_t size;
+  uint64_t start;		// position of first data block
+  uint64_t sparse;		// bytes in sparse blocks
+  uint32_t *blocks;		// data block sizes
+  uint32_t frag;		// fragment index
+  uint32_t frag_ofs;		// offset in fragment
+  // directories
+  struct sq_node_s *parent;
+  sq_dentry_t *entries;
+  unsigned nentries;
+};
+
+// a block to be compressed and written
+typedef struct sq_job_s {
+  struct sq_job_s *next;
+  unsigned char *in, *out;
+  size_t in_len, out_len;
+  unsigned busy:1;
+  unsigned done:1;
+  unsigned sparse:1;		// all zeros, not stored
+  unsigned stored:1;		// stored uncompressed
+  sq_node_t *node;		// data block of this file ...
+  unsigned block;		// ... with this index
+  int frag;			// or fragment with this index (-1: none)
+} sq_job_t;
+
+// metadata table (inode & directory table)
+typedef struct {
+  unsigned char *data;		// compressed blocks
+  size_t len, max;
+  unsigned char buf[SQ_METADATA_SIZE];
+  unsigned buf_len;
+} sq_meta_t;
+
+struct sq_image_s {
+  int fd;
+  uint64_t pos;			// end of image
+  int err;
+  time_t mkfs_time;
+
+  sq_node_t *root;
+  sq_node_t *nodes;
+  sq_dentry_t **hash;
+  unsigned hash_size, hash_used;
+  unsigned inodes;
+
+  uint32_t *ids;
+  unsigned no_ids;
+
+  // file currently being written
+  sq_node_t *file;
+  uint64_t file_pos;
+  unsigned char *blk;
+  size_t blk_len;
+
+  // fragment being filled (index no_frags)
+  unsigned char *frag_buf;
+  size_t frag_len;
+  struct {
+    uint64_t start;
+    uint32_t size;
+  } *frags;
+  unsigned no_frags, max_frags;
+
+  sq_meta_t inode_table, dir_table;
+
+  // compression threads
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;		// job state changed
+  pthread_t *threads;
+  unsigned no_threads;
+  unsigned jobs;		// queued jobs
+  unsigned stop:1;
+  sq_job_t *queue, *queue_last;
+};
+
+static sq_node_t *sq_new_node(sq_image_t *sq, mode_t mode, uid_t uid, gid_t gid, time_t mtime);
+static unsigned sq_id(sq_image_t *sq, uint32_t id);
+static char *sq_clean_path(char *name);
+static unsigned sq_hash(char *path);
+static sq_dentry_t *sq_find(sq_image_t *sq, char *path);
+static void sq_hash_add(sq_image_t *sq, sq_dentry_t *de);
+static sq_node_t *sq_get_dir(sq_image_t *sq, char *path, size_t len);
+static int sq_add_dentry(sq_image_t *sq, char *path, sq_node_t *node);
+static void sq_submit_block(sq_image_t *sq);
+static void sq_submit_frag(sq_image_t *sq);
+static void sq_queue(sq_image_t *sq, sq_job_t *job);
+static void *sq_thread(void *arg);
+static void sq_stop_threads(sq_image_t *sq);
+static void sq_compress(sq_job_t *job);
+static void sq_retire(sq_image_t *sq, int all);
+static void sq_write_job(sq_image_t *sq, sq_job_t *job);
+static void sq_write(sq_image_t *sq, void *buf, size_t len);
+static unsigned char *sq_put(unsigned char *p, uint64_t val, unsigned bytes);
+static unsigned sq_meta_block(unsigned char *in, unsigned len, unsigned char *out);
+static void sq_meta_add(sq_meta_t *m, void *data, size_t len);
+static void sq_meta_flush(sq_meta_t *m);
+static uint64_t sq_meta_ref(sq_meta_t *m);
+static uint64_t sq_write_table(sq_image_t *sq, unsigned char *data, size_t len);
+static int sq_cmp_dentry(const void *p0, const void *p1);
+static void sq_number(sq_image_t *sq, sq_node_t *dir);
+static unsigned sq_type(mode_t mode);
+static void sq_write_inode(sq_image_t *sq, sq_node_t *node);
+static void sq_write_dir(sq_image_t *sq, sq_node_t *dir);
+
+
+/*
+ * Start a new image, written to fd.
+ *
+ * Data blocks are compressed using that many threads (0: no threads).
+ */
+sq_image_t *sq_new(int fd, unsigned threads)
+{
+  sq_image_t *sq = calloc(1, sizeof *sq);
+  unsigned u;
+
+  sq->fd = fd;
+  sq->mkfs_time = time(NULL);
+
+  sq->hash_size = 1 << 12;
+  sq->hash = calloc(sq->hash_size, sizeof *sq->hash);
+
+  sq->blk = malloc(SQ_BLOCK_SIZE);
+  sq->frag_buf = malloc(SQ_BLOCK_SIZE);
+
+  sq->root = sq_new_node(sq, S_IFDIR | 0755, 0, 0, sq->mkfs_time);
+  sq->root->nlink = 1;
+
+  // data follow the superblock
+  sq->pos = SQ_SUPERBLOCK_SIZE;
+  if(lseek(fd, sq->pos, SEEK_SET) != sq->pos) sq->err = 1;
+
+  pthread_mutex_init(&sq->mutex, NULL);
+  pthread_cond_init(&sq->cond, NULL);
+
+  if(threads) {
+    sq->threads = calloc(threads, sizeof *sq->threads);
+    for(u = 0; u < threads && !pthread_create(sq->threads + u, NULL, sq_thread, sq); u++);
+    sq->no_threads = u;
+  }
+
+  return sq;
+}
+
+
+/*
+ * Add file system entry.
+ *
+ * Missing parent directories are created. An existing entry is replaced;
+ * existing directories keep their contents.
+ *
+ * For regular files, add the data with sq_file_start() etc.
+ *
+ * Returns the new node or NULL.
+ */
+sq_node_t *sq_add(sq_image_t *sq, char *name, mode_t mode, uid_t uid, gid_t gid, time_t mtime, char *link, dev_t rdev)
+{
+  sq_dentry_t *de;
+  sq_node_t *node = NULL;
+  char *path;
+
+  switch(mode & S_IFMT) {
+    case S_IFDIR:
+    case S_IFREG:
+    case S_IFLNK:
+    case S_IFCHR:
+    case S_IFBLK:
+    case S_IFIFO:
+    case S_IFSOCK:
+      break;
+
+    default:
+      return NULL;
+  }
+
+  path = sq_clean_path(name);
+
+  if(S_ISDIR(mode)) {
+    if(!*path) {
+      node = sq->root;
+    }
+    else if((de = sq_find(sq, path)) && S_ISDIR(de->node->mode)) {
+      node = de->node;
+    }
+
+    if(node) {
+      node->mode = mode;
+      node->uid = sq_id(sq, uid);
+      node->gid = sq_id(sq, gid);
+      node->mtime = mtime;
+      free(path);
+
+      return node;
+    }
+  }
+
+  if(*path) {
+    node = sq_new_node(sq, mode, uid, gid, mtime);
+    node->rdev = rdev;
+    if(S_ISLNK(mode)) node->link = strdup(link ?: "");
+
+    if(sq_add_dentry(sq, path, node)) node = NULL;
+  }
+
+  free(path);
+
+  return node;
+}
+
+
+/*
+ * Find node for name.
+ */
+sq_node_t *sq_lookup(sq_image_t *sq, char *name)
+{
+  sq_dentry_t *de;
+  sq_node_t *node = NULL;
+  char *path;
+
+  path = sq_clean_path(name);
+
+  if(!*path) {
+    node = sq->root;
+  }
+  else if((de = sq_find(sq, path))) {
+    node = de->node;
+  }
+
+  free(path);
+
+  return node;
+}
+
+
+/*
+ * Add hard link 'name' to node.
+ *
+ * Returns 0 on success.
+ */
+int sq_link(sq_image_t *sq, char *name, sq_node_t *node)
+{
+  char *path;
+  int err;
+
+  if(!node || S_ISDIR(node->mode)) return -1;
+
+  path = sq_clean_path(name);
+  err = *path ? sq_add_dentry(sq, path, node) : -1;
+  free(path);
+
+  return err;
+}
+
+
+/*
+ * Start adding data to regular file.
+ *
+ * Exactly 'size' bytes must follow (sq_file_write()), then call
+ * sq_file_end().
+ *
+ * Returns 0 on success.
+ */
+int sq_file_start(sq_image_t *sq, sq_node_t *node, uint64_t size)
+{
+  uint64_t blocks = size >> SQ_BLOCK_LOG;
+
+  if(
+    sq->err ||
+    sq->file ||
+    !node ||
+    !S_ISREG(node->mode) ||
+    node->size ||
+    blocks > 0xffffffff
+  ) return -1;
+
+  node->size = size;
+  if(blocks) node->blocks = calloc(blocks, sizeof *node->blocks);
+
+  sq->file = node;
+  sq->file_pos = 0;
+  sq->blk_len = 0;
+
+  return 0;
+}
+
+
+/*
+ * Add file data.
+ *
+ * Returns 0 on success.
+ */
+int sq_file_write(sq_image_t *sq, void *buf, size_t len)
+{
+  size_t l;
+
+  if(!sq->file || sq->file_pos + len > sq->file->size) return -1;
+
+  while(len) {
+    l = SQ_BLOCK_SIZE - sq->blk_len;
+    if(l > len) l = len;
+
+    memcpy(sq->blk + sq->blk_len, buf, l);
+    sq->blk_len += l;
+    sq->file_pos += l;
+    buf += l;
+    len -= l;
+
+    if(sq->blk_len == SQ_BLOCK_SIZE) sq_submit_block(sq);
+  }
+
+  return sq->err ? -1 : 0;
+}
+
+
+/*
+ * Finish file; the last partial block goes into a fragment.
+ *
+ * Returns 0 on success.
+ */
+int sq_file_end(sq_image_t *sq)
+{
+  sq_node_t *node = sq->file;
+
+  if(!node) return -1;
+
+  sq->file = NULL;
+
+  if(sq->file_pos != node->size) return -1;
+
+  if(sq->blk_len) {
+    if(sq->frag_len + sq->blk_len > SQ_BLOCK_SIZE) sq_submit_frag(sq);
+
+    node->frag = sq->no_frags;
+    node->frag_ofs = sq->frag_len;
+
+    memcpy(sq->frag_buf + sq->frag_len, sq->blk, sq->blk_len);
+    sq->frag_len += sq->blk_len;
+    sq->blk_len = 0;
+  }
+
+  return sq->err ? -1 : 0;
+}
+
+
+/*
+ * Write outstanding data and all metadata; then the superblock.
+ *
+ * Returns 0 on success.
+ */
+int sq_finish(sq_image_t *sq)
+{
+  unsigned char sb[SQ_SUPERBLOCK_SIZE], *buf, *p;
+  uint64_t inode_table, dir_table, frag_table, id_table, bytes_used;
+  unsigned u;
+
+  if(sq->file) sq->err = 1;
+
+  if(sq->frag_len) sq_submit_frag(sq);
+
+  sq_retire(sq, 1);
+  sq_stop_threads(sq);
+
+  // number inodes, then write them bottom-up (directories need their children's refs)
+  sq->root->ino = ++sq->inodes;
+  sq->root->numbered = 1;
+  sq_number(sq, sq->root);
+
+  sq_write_dir(sq, sq->root);
+
+  sq_meta_flush(&sq->inode_table);
+  sq_meta_flush(&sq->dir_table);
+
+  inode_table = sq->pos;
+  sq_write(sq, sq->inode_table.data, sq->inode_table.len);
+
+  dir_table = sq->pos;
+  sq_write(sq, sq->dir_table.data, sq->dir_table.len);
+
+  p = buf = calloc(sq->no_frags + 1, SQ_FRAG_ENTRY_SIZE);
+  for(u = 0; u < sq->no_frags; u++) {
+    p = sq_put(p, sq->frags[u].start, 8);
+    p = sq_put(p, sq->frags[u].size, 4);
+    p = sq_put(p, 0, 4);
+  }
+  frag_table = sq_write_table(sq, buf, p - buf);
+  free(buf);
+
+  p = buf = calloc(sq->no_ids + 1, 4);
+  for(u = 0; u < sq->no_ids; u++) p = sq_put(p, sq->ids[u], 4);
+  id_table = sq_write_table(sq, buf, p - buf);
+  free(buf);
+
+  bytes_used = sq->pos;
+
+  // pad image
+  if(bytes_used % SQ_PAD) {
+    buf = calloc(1, SQ_PAD);
+    sq_write(sq, buf, SQ_PAD - bytes_used % SQ_PAD);
+    free(buf);
+  }
+
+  p = sb;
+  p = sq_put(p, SQ_MAGIC, 4);
+  p = sq_put(p, sq->inodes, 4);
+  p = sq_put(p, sq->mkfs_time, 4);
+  p = sq_put(p, SQ_BLOCK_SIZE, 4);
+  p = sq_put(p, sq->no_frags, 4);
+  p = sq_put(p, SQ_ZLIB, 2);
+  p = sq_put(p, SQ_BLOCK_LOG, 2);
+  p = sq_put(p, SQ_NO_XATTRS, 2);
+  p = sq_put(p, sq->no_ids, 2);
+  p = sq_put(p, SQ_MAJOR, 2);
+  p = sq_put(p, 0, 2);
+  p = sq_put(p, sq->root->ref, 8);
+  p = sq_put(p, bytes_used, 8);
+  p = sq_put(p, id_table, 8);
+  p = sq_put(p, SQ_INVALID_BLK, 8);
+  p = sq_put(p, inode_table, 8);
+  p = sq_put(p, dir_table, 8);
+  p = sq_put(p, frag_table, 8);
+  p = sq_put(p, SQ_INVALID_BLK, 8);
+
+  if(pwrite(sq->fd, sb, sizeof sb, 0) != sizeof sb) sq->err = 1;
+
+  return sq->err ? -1 : 0;
+}
+
+
+/*
+ * Free image data (the image file itself is not touched).
+ */
+void sq_free(sq_image_t *sq)
+{
+  sq_node_t *node, *next;
+  sq_dentry_t *de, *de_next;
+  sq_job_t *job, *job_next;
+  unsigned u;
+
+  if(!sq) return;
+
+  sq_stop_threads(sq);
+
+  for(job = sq->queue; job; job = job_next) {
+    job_next = job->next;
+    free(job->in);
+    free(job->out);
+    free(job);
+  }
+
+  for(u = 0; u < sq->hash_size; u++) {
+    for(de = sq->hash[u]; de; de = de_next) {
+      de_next = de->hash_next;
+      free(de->path);
+      free(de);
+    }
+  }
+
+  for(node = sq->nodes; node; node = next) {
+    next = node->next;
+    free(node->link);
+    free(node->blocks);
+    free(node);
+  }
+
+  pthread_mutex_destroy(&sq->mutex);
+  pthread_cond_destroy(&sq->cond);
+
+  free(sq->hash);
+  free(sq->ids);
+  free(sq->blk);
+  free(sq->frag_buf);
+  free(sq->frags);
+  free(sq->inode_table.data);
+  free(sq->dir_table.data);
+  free(sq->threads);
+  free(sq);
+}
+
+
+sq_node_t *sq_new_node(sq_image_t *sq, mode_t mode, uid_t uid, gid_t gid, time_t mtime)
+{
+  sq_node_t *node = calloc(1, sizeof *node);
+
+  node->mode = mode;
+  node->uid = sq_id(sq, uid);
+  node->gid = sq_id(sq, gid);
+  node->mtime = mtime;
+  node->frag = SQ_INVALID_FRAG;
+
+  node->next = sq->nodes;
+  sq->nodes = node;
+
+  return node;
+}
+
+
+/*
+ * Get id table index for uid/gid.
+ */
+unsigned sq_id(sq_image_t *sq, uint32_t id)
+{
+  unsigned u;
+
+  for(u = 0; u < sq->no_ids; u++) {
+    if(sq->ids[u] == id) return u;
+  }
+
+  if(sq->no_ids >= SQ_MAX_IDS) return 0;
+
+  sq->ids = realloc(sq->ids, (sq->no_ids + 1) * sizeof *sq->ids);
+  sq->ids[sq->no_ids] = id;
+
+  return sq->no_ids++;
+}
+
+
+/*
+ * Normalize path: no leading './' or '/', no trailing '/', no '//'.
+ *
+ * Returns a new string.
+ */
+char *sq_clean_path(char *name)
+{
+  char *path, *s, *t;
+
+  path = strdup(name ?: "");
+
+  for(s = t = path; *s; s++) {
+    if(*s == '/' && (t == path || t[-1] == '/')) continue;
+    if(*s == '.' && (s[1] == '/' || !s[1]) && (t == path || t[-1] == '/')) continue;
+    *t++ = *s;
+  }
+
+  while(t > path && t[-1] == '/') t--;
+  *t = 0;
+
+  return path;
+}
+
+
+unsigned sq_hash(char *path)
+{
+  unsigned h = 2166136261u;
+
+  while(*path) h = (h ^ (unsigned char) *path++) * 16777619u;
+
+  return h;
+}
+
+
+sq_dentry_t *sq_find(sq_image_t *sq, char *path)
+{
+  sq_dentry_t *de;
+
+  for(de = sq->hash[sq_hash(path) & (sq->hash_size - 1)]; de; de = de->hash_next) {
+    if(!strcmp(de->path, path)) break;
+  }
+
+  return de;
+}
+
+
+void sq_hash_add(sq_image_t *sq, sq_dentry_t *de)
+{
+  sq_dentry_t **hash, *next;
+  unsigned u, h;
+
+  // grow table
+  if(sq->hash_used >= sq->hash_size) {
+    hash = calloc(sq->hash_size * 2, sizeof *hash);
+    for(u = 0; u < sq->hash_size; u++) {
+      for(; sq->hash[u]; sq->hash[u] = next) {
+        next = sq->hash[u]->hash_next;
+        h = sq_hash(sq->hash[u]->path) & (sq->hash_size * 2 - 1);
+        sq->hash[u]->hash_next = hash[h];
+        hash[h] = sq->hash[u];
+      }
+    }
+    free(sq->hash);
+    sq->hash = hash;
+    sq->hash_size *= 2;
+  }
+
+  h = sq_hash(de->path) & (sq->hash_size - 1);
+  de->hash_next = sq->hash[h];
+  sq->hash[h] = de;
+  sq->hash_used++;
+}
+
+
+/*
+ * Get directory node for the first len chars of path; create it (and its
+ * parents) if necessary.
+ */
+sq_node_t *sq_get_dir(sq_image_t *sq, char *path, size_t len)
+{
+  sq_dentry_t *de;
+  sq_node_t *node = NULL;
+  char *dir;
+
+  if(!len) return sq->root;
+
+  dir = strndup(path, len);
+
+  if((de = sq_find(sq, dir))) {
+    if(S_ISDIR(de->node->mode)) node = de->node;
+  }
+  else {
+    node = sq_new_node(sq, S_IFDIR | 0755, 0, 0, sq->mkfs_time);
+    if(sq_add_dentry(sq, dir, node)) node = NULL;
+  }
+
+  free(dir);
+
+  return node;
+}
+
+
+/*
+ * Add directory entry 'path' for node (replacing an existing entry).
+ *
+ * Returns 0 on success.
+ */
+int sq_add_dentry(sq_image_t *sq, char *path, sq_node_t *node)
+{
+  sq_dentry_t *de;
+  sq_node_t *dir;
+  char *name;
+
+  name = strrchr(path, '/');
+  name = name ? name + 1 : path;
+
+  if(!*name || strlen(name) > SQ_MAX_NAME) return -1;
+
+  if(!(dir = sq_get_dir(sq, path, name > path ? name - path - 1 : 0))) return -1;
+
+  if((de = sq_find(sq, path))) {
+    de->node->nlink--;
+  }
+  else {
+    de = calloc(1, sizeof *de);
+    de->path = strdup(path);
+    de->name = de->path + (name - path);
+
+    de->next = dir->entries;
+    dir->entries = de;
+    dir->nentries++;
+
+    sq_hash_add(sq, de);
+  }
+
+  de->node = node;
+  node->nlink++;
+  if(S_ISDIR(node->mode)) node->parent = dir;
+
+  return 0;
+}
+
+
+/*
+ * Queue current (full) data block.
+ */
+void sq_submit_block(sq_image_t *sq)
+{
+  sq_job_t *job = calloc(1, sizeof *job);
+
+  job->in = sq->blk;
+  job->in_len = sq->blk_len;
+  job->node = sq->file;
+  job->block = (sq->file_pos - 1) >> SQ_BLOCK_LOG;
+  job->frag = -1;
+  job->sparse = !*job->in && !memcmp(job->in, job->in + 1, job->in_len - 1);
+
+  sq->blk = malloc(SQ_BLOCK_SIZE);
+  sq->blk_len = 0;
+
+  sq_queue(sq, job);
+}
+
+
+/*
+ * Queue current fragment block.
+ */
+void sq_submit_frag(sq_image_t *sq)
+{
+  sq_job_t *job = calloc(1, sizeof *job);
+
+  if(sq->no_frags >= sq->max_frags) {
+    sq->max_frags = sq->max_frags * 2 + 64;
+    sq->frags = realloc(sq->frags, sq->max_frags * sizeof *sq->frags);
+  }
+
+  job->in = sq->frag_buf;
+  job->in_len = sq->frag_len;
+  job->frag = sq->no_frags++;
+
+  sq->frag_buf = malloc(SQ_BLOCK_SIZE);
+  sq->frag_len = 0;
+
+  sq_queue(sq, job);
+}
+
+
+/*
+ * Add job to queue; then write whatever is done.
+ */
+void sq_queue(sq_image_t *sq, sq_job_t *job)
+{
+  // no threads: do it here
+  if(!sq->no_threads) {
+    sq_compress(job);
+    job->done = 1;
+  }
+
+  pthread_mutex_lock(&sq->mutex);
+
+  if(sq->queue_last) {
+    sq->queue_last->next = job;
+  }
+  else {
+    sq->queue = job;
+  }
+  sq->queue_last = job;
+  sq->jobs++;
+
+  pthread_cond_broadcast(&sq->cond);
+
+  pthread_mutex_unlock(&sq->mutex);
+
+  sq_retire(sq, 0);
+}
+
+
+/*
+ * Compression thread.
+ */
+void *sq_thread(void *arg)
+{
+  sq_image_t *sq = arg;
+  sq_job_t *job;
+
+  pthread_mutex_lock(&sq->mutex);
+
+  for(;;) {
+    for(job = sq->queue; job && (job->busy || job->done); job = job->next);
+
+    if(!job) {
+      if(sq->stop) break;
+      pthread_cond_wait(&sq->cond, &sq->mutex);
+      continue;
+    }
+
+    job->busy = 1;
+
+    pthread_mutex_unlock(&sq->mutex);
+    sq_compress(job);
+    pthread_mutex_lock(&sq->mutex);
+
+    job->busy = 0;
+    job->done = 1;
+
+    pthread_cond_broadcast(&sq->cond);
+  }
+
+  pthread_mutex_unlock(&sq->mutex);
+
+  return NULL;
+}
+
+
+void sq_stop_threads(sq_image_t *sq)
+{
+  unsigned u;
+
+  if(!sq->no_threads) return;
+
+  pthread_mutex_lock(&sq->mutex);
+  sq->stop = 1;
+  pthread_cond_broadcast(&sq->cond);
+  pthread_mutex_unlock(&sq->mutex);
+
+  for(u = 0; u < sq->no_threads; u++) pthread_join(sq->threads[u], NULL);
+
+  sq->no_threads = 0;
+}
+
+
+/*
+ * Compress block; keep it uncompressed if that doesn't help.
+ */
+void sq_compress(sq_job_t *job)
+{
+  uLongf len;
+
+  if(job->sparse) return;
+
+  len = compressBound(job->in_len);
+  job->out = malloc(len);
+
+  if(compress2(job->out, &len, job->in, job->in_len, Z_BEST_COMPRESSION) == Z_OK && len < job->in_len) {
+    job->out_len = len;
+  }
+  else {
+    free(job->out);
+    job->out = NULL;
+    job->stored = 1;
+  }
+}
+
+
+/*
+ * Write finished jobs, in order.
+ *
+ * Wait for running jobs if there are too many of them (or for all jobs if
+ * 'all' is set).
+ */
+void sq_retire(sq_image_t *sq, int all)
+{
+  sq_job_t *job;
+
+  pthread_mutex_lock(&sq->mutex);
+
+  while((job = sq->queue)) {
+    if(!job->done) {
+      if(!all && sq->jobs < sq->no_threads * SQ_JOBS_PER_THREAD) break;
+      pthread_cond_wait(&sq->cond, &sq->mutex);
+      continue;
+    }
+
+    if(!(sq->queue = job->next)) sq->queue_last = NULL;
+    sq->jobs--;
+
+    pthread_mutex_unlock(&sq->mutex);
+    sq_write_job(sq, job);
+    pthread_mutex_lock(&sq->mutex);
+  }
+
+  pthread_mutex_unlock(&sq->mutex);
+}
+
+
+/*
+ * Write block and note where it went.
+ */
+void sq_write_job(sq_image_t *sq, sq_job_t *job)
+{
+  uint64_t start = sq->pos;
+  uint32_t size = 0;
+
+  if(job->stored) {
+    sq_write(sq, job->in, job->in_len);
+    size = job->in_len | SQ_UNCOMPRESSED_BLOCK;
+  }
+  else if(!job->sparse) {
+    sq_write(sq, job->out, job->out_len);
+    size = job->out_len;
+  }
+
+  if(job->frag >= 0) {
+    sq->frags[job->frag].start = start;
+    sq->frags[job->frag].size = size;
+  }
+  else {
+    if(!job->block) job->node->start = start;
+    job->node->blocks[job->block] = size;
+    if(job->sparse) job->node->sparse += job->in_len;
+  }
+
+  free(job->in);
+  free(job->out);
+  free(job);
+}
+
+
+void sq_write(sq_image_t *sq, void *buf, size_t len)
+{
+  ssize_t i;
+
+  sq->pos += len;
+
+  while(len && !sq->err) {
+    i = write(sq->fd, buf, len);
+    if(i < 0 && errno == EINTR) continue;
+    if(i <= 0) {
+      sq->err = 1;
+      break;
+    }
+    buf += i;
+    len -= i;
+  }
+}
+
+
+/*
+ * Store value in little-endian byte order.
+ */
+unsigned char *sq_put(unsigned char *p, uint64_t val, unsigned bytes)
+{
+  while(bytes--) {
+    *p++ = val;
+    val >>= 8;
+  }
+
+  return p;
+}
+
+
+/*
+ * Make metadata block (with 2 byte header) from len (<= SQ_METADATA_SIZE)
+ * bytes.
+ *
+ * out must have room for SQ_METADATA_SIZE + 2 bytes.
+ *
+ * Returns block size.
+ */
+unsigned sq_meta_block(unsigned char *in, unsigned len, unsigned char *out)
+{
+  uLongf out_len = len - 1;
+
+  if(len > 1 && compress2(out + 2, &out_len, in, len, Z_BEST_COMPRESSION) == Z_OK) {
+    sq_put(out, out_len, 2);
+
+    return out_len + 2;
+  }
+
+  sq_put(out, len | SQ_UNCOMPRESSED_META, 2);
+  memcpy(out + 2, in, len);
+
+  return len + 2;
+}
+
+
+void sq_meta_add(sq_meta_t *m, void *data, size_t len)
+{
+  size_t l;
+
+  while(len) {
+    l = SQ_METADATA_SIZE - m->buf_len;
+    if(l > len) l = len;
+
+    memcpy(m->buf + m->buf_len, data, l);
+    m->buf_len += l;
+    data += l;
+    len -= l;
+
+    if(m->buf_len == SQ_METADATA_SIZE) sq_meta_flush(m);
+  }
+}
+
+
+void sq_meta_flush(sq_meta_t *m)
+{
+  if(!m->buf_len) return;
+
+  if(m->len + SQ_METADATA_SIZE + 2 > m->max) {
+    m->max = m->max * 2 + SQ_METADATA_SIZE + 2;
+    m->data = realloc(m->data, m->max);
+  }
+
+  m->len += sq_meta_block(m->buf, m->buf_len, m->data + m->len);
+  m->buf_len = 0;
+}
+
+
+/*
+ * Reference to the current position: start of metadata block (relative to
+ * the table) and offset in the uncompressed block.
+ */
+uint64_t sq_meta_ref(sq_meta_t *m)
+{
+  return ((uint64_t) m->len << 16) + m->buf_len;
+}
+
+
+/*
+ * Write table (fragment or id table) as metadata blocks, followed by an
+ * index of the block positions.
+ *
+ * Returns index position.
+ */
+uint64_t sq_write_table(sq_image_t *sq, unsigned char *data, size_t len)
+{
+  unsigned char block[SQ_METADATA_SIZE + 2], *index, *p;
+  unsigned l, blocks;
+  uint64_t start;
+
+  blocks = (len + SQ_METADATA_SIZE - 1) / SQ_METADATA_SIZE;
+  p = index = malloc(blocks * 8 + 1);
+
+  for(; len; data += l, len -= l) {
+    l = len > SQ_METADATA_SIZE ? SQ_METADATA_SIZE : len;
+    p = sq_put(p, sq->pos, 8);
+    sq_write(sq, block, sq_meta_block(data, l, block));
+  }
+
+  start = sq->pos;
+  sq_write(sq, index, p - index);
+
+  free(index);
+
+  return start;
+}
+
+
+int sq_cmp_dentry(const void *p0, const void *p1)
+{
+  return strcmp((*(sq_dentry_t **) p0)->name, (*(sq_dentry_t **) p1)->name);
+}
+
+
+/*
+ * Sort directory entries and assign inode numbers.
+ */
+void sq_number(sq_image_t *sq, sq_node_t *dir)
+{
+  sq_dentry_t **list, *de;
+  unsigned u;
+
+  if(dir->nentries > 1) {
+    list = malloc(dir->nentries * sizeof *list);
+    for(u = 0, de = dir->entries; de; de = de->next) list[u++] = de;
+
+    qsort(list, dir->nentries, sizeof *list, sq_cmp_dentry);
+
+    for(u = 0; u < dir->nentries; u++) list[u]->next = u + 1 < dir->nentries ? list[u + 1] : NULL;
+    dir->entries = list[0];
+
+    free(list);
+  }
+
+  for(de = dir->entries; de; de = de->next) {
+    if(de->node->numbered) continue;
+
+    de->node->ino = ++sq->inodes;
+    de->node->numbered = 1;
+
+    if(S_ISDIR(de->node->mode)) sq_number(sq, de->node);
+  }
+}
+
+
+/*
+ * Basic inode type.
+ */
+unsigned sq_type(mode_t mode)
+{
+  switch(mode & S_IFMT) {
+    case S_IFDIR:
+      return SQ_DIR;
+
+    case S_IFLNK:
+      return SQ_SYMLINK;
+
+    case S_IFBLK:
+      return SQ_BLKDEV;
+
+    case S_IFCHR:
+      return SQ_CHRDEV;
+
+    case S_IFIFO:
+      return SQ_FIFO;
+
+    case S_IFSOCK:
+      return SQ_SOCKET;
+  }
+
+  return SQ_FILE;
+}
+
+
+/*
+ * Write non-directory inode.
+ */
+void sq_write_inode(sq_image_t *sq, sq_node_t *node)
+{
+  unsigned char buf[64], *p = buf;
+  unsigned type = sq_type(node->mode);
+  uint64_t u, blocks;
+  unsigned ext = 0;
+
+  if(type == SQ_FILE) {
+    ext =
+      node->nlink > 1 ||
+      node->sparse ||
+      node->size > 0xffffffff ||
+      node->start > 0xffffffff;
+    if(ext) type = SQ_LFILE;
+  }
+
+  node->ref = sq_meta_ref(&sq->inode_table);
+
+  p = sq_put(p, type, 2);
+  p = sq_put(p, node->mode & 07777, 2);
+  p = sq_put(p, node->uid, 2);
+  p = sq_put(p, node->gid, 2);
+  p = sq_put(p, node->mtime, 4);
+  p = sq_put(p, node->ino, 4);
+
+  switch(type) {
+    case SQ_FILE:
+      p = sq_put(p, node->start, 4);
+      p = sq_put(p, node->frag, 4);
+      p = sq_put(p, node->frag_ofs, 4);
+      p = sq_put(p, node->size, 4);
+      break;
+
+    case SQ_LFILE:
+      p = sq_put(p, node->start, 8);
+      p = sq_put(p, node->size, 8);
+      p = sq_put(p, node->sparse, 8);
+      p = sq_put(p, node->nlink, 4);
+      p = sq_put(p, node->frag, 4);
+      p = sq_put(p, node->frag_ofs, 4);
+      p = sq_put(p, SQ_INVALID_XATTR, 4);
+      break;
+
+    case SQ_SYMLINK:
+      p = sq_put(p, node->nlink, 4);
+      p = sq_put(p, strlen(node->link), 4);
+      break;
+
+    case SQ_BLKDEV:
+    case SQ_CHRDEV:
+      p = sq_put(p, node->nlink, 4);
+      // like the kernel's new_encode_dev()
+      p = sq_put(p,
+        (minor(node->rdev) & 0xff) | (major(node->rdev) << 8) | ((minor(node->rdev) & ~0xff) << 12),
+        4
+      );
+      break;
+
+    default:
+      p = sq_put(p, node->nlink, 4);
+      break;
+  }
+
+  sq_meta_add(&sq->inode_table, buf, p - buf);
+
+  if(type == SQ_SYMLINK) sq_meta_add(&sq->inode_table, node->link, strlen(node->link));
+
+  if(type == SQ_FILE || type == SQ_LFILE) {
+    blocks = node->size >> SQ_BLOCK_LOG;
+    for(u = 0; u < blocks; u++) {
+      p = sq_put(buf, node->blocks[u], 4);
+      sq_meta_add(&sq->inode_table, buf, p - buf);
+    }
+  }
+
+  node->written = 1;
+}
+
+
+/*
+ * Write directory: first everything in it, then the directory listing,
+ * then the directory inode.
+ */
+void sq_write_dir(sq_image_t *sq, sq_node_t *dir)
+{
+  unsigned char buf[SQ_DIR_HEADER_SIZE + SQ_DIR_ENTRY_SIZE + SQ_MAX_NAME], *p;
+  sq_dentry_t *de, *run;
+  uint64_t listing;
+  uint32_t size = 3, subdirs = 0;
+  unsigned count, len;
+  int diff;
+
+  for(de = dir->entries; de; de = de->next) {
+    if(!de->node->written) {
+      if(S_ISDIR(de->node->mode)) {
+        sq_write_dir(sq, de->node);
+      }
+      else {
+        sq_write_inode(sq, de->node);
+      }
+    }
+    if(S_ISDIR(de->node->mode)) subdirs++;
+  }
+
+  listing = sq_meta_ref(&sq->dir_table);
+
+  for(de = dir->entries; de; ) {
+    // one header for up to 256 entries whose inodes are in the same metadata block
+    for(count = 1, run = de->next; run && count < SQ_DIR_COUNT; run = run->next, count++) {
+      diff = (int) run->node->ino - (int) de->node->ino;
+      if(run->node->ref >> 16 != de->node->ref >> 16 || diff < -32768 || diff > 32767) break;
+    }
+
+    p = sq_put(buf, count - 1, 4);
+    p = sq_put(p, de->node->ref >> 16, 4);
+    p = sq_put(p, de->node->ino, 4);
+    sq_meta_add(&sq->dir_table, buf, p - buf);
+    size += p - buf;
+
+    for(run = de; count--; de = de->next) {
+      len = strlen(de->name);
+      p = sq_put(buf, de->node->ref & 0xffff, 2);
+      p = sq_put(p, (de->node->ino - run->node->ino) & 0xffff, 2);
+      p = sq_put(p, sq_type(de->node->mode), 2);
+      p = sq_put(p, len - 1, 2);
+      memcpy(p, de->name, len);
+      p += len;
+      sq_meta_add(&sq->dir_table, buf, p - buf);
+      size += p - buf;
+    }
+  }
+
+  dir->ref = sq_meta_ref(&sq->inode_table);
+
+  p = sq_put(buf, size > 0xffff ? SQ_LDIR : SQ_DIR, 2);
+  p = sq_put(p, dir->mode & 07777, 2);
+  p = sq_put(p, dir->uid, 2);
+  p = sq_put(p, dir->gid, 2);
+  p = sq_put(p, dir->mtime, 4);
+  p = sq_put(p, dir->ino, 4);
+
+  if(size > 0xffff) {
+    p = sq_put(p, 2 + subdirs, 4);
+    p = sq_put(p, size, 4);
+    p = sq_put(p, listing >> 16, 4);
+    p = sq_put(p, dir->parent ? dir->parent->ino : sq->inodes + 1, 4);
+    p = sq_put(p, 0, 2);
+    p = sq_put(p, listing & 0xffff, 2);
+    p = sq_put(p, SQ_INVALID_XATTR, 4);
+  }
+  else {
+    p = sq_put(p, listing >> 16, 4);
+    p = sq_put(p, 2 + subdirs, 4);
+    p = sq_put(p, size, 2);
+    p = sq_put(p, listing & 0xffff, 2);
+    p = sq_put(p, dir->parent ? dir->parent->ino : sq->inodes + 1, 4);
+  }
+
+  sq_meta_add(&sq->inode_table, buf, p - buf);
+
+  dir->written = 1;
+}
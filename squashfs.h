@@ -0,0 +1,22 @@
+/*
+ *
+ * squashfs.h    Header file for squashfs.c
+ *
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <time.h>
+
+typedef struct sq_image_s sq_image_t;
+typedef struct sq_node_s sq_node_t;
+
+sq_image_t *sq_new(int fd, unsigned threads);
+sq_node_t *sq_add(sq_image_t *sq, char *name, mode_t mode, uid_t uid, gid_t gid, time_t mtime, char *link, dev_t rdev);
+sq_node_t *sq_lookup(sq_image_t *sq, char *name);
+int sq_link(sq_image_t *sq, char *name, sq_node_t *node);
+int sq_file_start(sq_image_t *sq, sq_node_t *node, uint64_t size);
+int sq_file_write(sq_image_t *sq, void *buf, size_t len);
+int sq_file_end(sq_image_t *sq);
+int sq_finish(sq_image_t *sq);
+void sq_free(sq_image_t *sq);
@@ -0,0 +1,75 @@
+/*
+ *
+ * archivetest.c Unpack archives like linuxrc does
+ *
+ * Test driver for ../archive.c: provides the few linuxrc functions it
+ * needs and calls archive_extract(). See archive_test.sh.
+ *
+ * Usage: archivetest FILE TYPE DIR
+ *
+ * TYPE is 'cpio', 'tar', or 'rpm'; compression is detected.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../global.h"
+#include "../util.h"
+#include "../archive.h"
+
+
+void util_log(unsigned level, char *format, ...)
+{
+  va_list args;
+
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+}
+
+
+void util_perror(unsigned level, char *msg)
+{
+  perror(msg);
+}
+
+
+char *compress_type(void *buf)
+{
+  if(!memcmp(buf, "\x1f\x8b", 2)) return "gzip";
+
+  if(!memcmp(buf, "\xfd""7zXZ", 6)) return "xz";
+
+  return NULL;
+}
+
+
+int main(int argc, char **argv)
+{
+  char buf[8] = { };
+  char *compr = NULL;
+  int fd, err;
+
+  if(argc != 4) {
+    fprintf(stderr, "usage: archivetest FILE TYPE DIR\n");
+    return 1;
+  }
+
+  if((fd = open(argv[1], O_RDONLY)) != -1) {
+    if(read(fd, buf, sizeof buf) == sizeof buf && strcmp(argv[2], "rpm")) compr = compress_type(buf);
+    close(fd);
+  }
+
+  err = archive_extract(argv[1], argv[2], compr, argv[3], NULL);
+
+  printf("%s: %s\n", argv[1], err ? "failed" : "ok");
+
+  return err ? 1 : 0;
+}
@@ -0,0 +1,199 @@
+/*
+ *
+ * pgptest.c     Verify signatures like linuxrc does
+ *
+ * Test driver for ../pgp.c: provides the few linuxrc functions it needs
+ * and calls the pgp_verify_*() functions. See pgp_test.sh.
+ *
+ * pgp.c is included directly so the RSA code can be checked on its own.
+ *
+ * Usage: pgptest rsa VECTORS
+ *        pgptest inline KEYRING FILE
+ *        pgptest detached KEYRING FILE SIG
+ *        pgptest rpm KEYRING FILE
+ *
+ * VECTORS has lines 'key N E' (hex) followed by lines
+ * 'HASH_ALGO HASH SIGNATURE ok|bad' for that key.
+ *
+ */
+
+#include "../pgp.c"
+
+#include <stdarg.h>
+
+
+void util_log(unsigned level, char *format, ...)
+{
+  va_list args;
+
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+}
+
+
+void util_perror(unsigned level, char *msg)
+{
+  perror(msg);
+}
+
+
+void str_copy(char **dst, const char *src)
+{
+  char *s;
+
+  if(!dst) return;
+
+  s = src ? strdup(src) : NULL;
+  free(*dst);
+  *dst = s;
+}
+
+
+void strprintf(char **buf, char *format, ...)
+{
+  char *new_buf;
+  va_list args;
+
+  va_start(args, format);
+  if(vasprintf(&new_buf, format, args) == -1) new_buf = NULL;
+  va_end(args);
+
+  free(*buf);
+
+  *buf = new_buf;
+}
+
+
+/*
+ * Decode hex string into newly allocated buffer.
+ *
+ * Return length or -1.
+ */
+static int from_hex(char *hex, unsigned char **buf)
+{
+  unsigned u, len = hex ? strlen(hex) : 1;
+
+  *buf = NULL;
+
+  if(len & 1) return -1;
+
+  *buf = malloc(len / 2 + 1);
+
+  for(u = 0; u < len / 2; u++) {
+    if(sscanf(hex + 2 * u, "%2hhx", *buf + u) != 1) return -1;
+  }
+
+  return len / 2;
+}
+
+
+/*
+ * Run RSA known-answer tests.
+ *
+ * Return number of failed tests.
+ */
+static int rsa_test(char *file)
+{
+  FILE *f;
+  char *line = NULL, *field[4];
+  size_t line_size = 0;
+  unsigned char *hash;
+  unsigned u, cnt = 0, line_nr = 0, failed = 0;
+  int hash_len, s_len, n_len = -1, e_len = -1, err;
+  pgp_key_t key = { };
+  pgp_sig_t sig = { };
+
+  if(!(f = fopen(file, "r"))) {
+    perror(file);
+
+    return 1;
+  }
+
+  while(getline(&line, &line_size, f) > 0) {
+    line_nr++;
+
+    for(u = 0; u < 4; u++) field[u] = strtok(u ? NULL : line, " \t\n");
+
+    if(!*field || **field == '#') continue;
+
+    if(!strcmp(*field, "key")) {
+      free(key.n);
+      free(key.e);
+      n_len = from_hex(field[1], &key.n);
+      e_len = from_hex(field[2], &key.e);
+      key.n_len = n_len;
+      key.e_len = e_len;
+      continue;
+    }
+
+    hash_len = from_hex(field[1], &hash);
+    s_len = from_hex(field[2], &sig.s);
+    sig.s_len = s_len;
+    sig.hash_algo = atoi(*field);
+
+    if(n_len <= 0 || e_len <= 0 || hash_len < 0 || s_len < 0 || !field[3]) {
+      fprintf(stderr, "%s:%u: syntax error\n", file, line_nr);
+      failed++;
+    }
+    else {
+      err = pgp_rsa_verify(&key, &sig, hash, hash_len);
+      if(strcmp(field[3], err == PGP_OK ? "ok" : "bad")) {
+        fprintf(stderr, "%s:%u: expected %s\n", file, line_nr, field[3]);
+        failed++;
+      }
+      cnt++;
+    }
+
+    free(hash);
+    free(sig.s);
+  }
+
+  free(key.n);
+  free(key.e);
+  free(line);
+  fclose(f);
+
+  printf("%s: %u tests, %u failed\n", file, cnt, failed);
+
+  return failed;
+}
+
+
+int main(int argc, char **argv)
+{
+  int err;
+
+  if(argc == 3 && !strcmp(argv[1], "rsa")) return rsa_test(argv[2]) ? 1 : 0;
+
+  if(argc < 4) {
+    fprintf(stderr,
+      "usage: pgptest rsa VECTORS\n"
+      "       pgptest inline|detached|rpm KEYRING FILE [SIG]\n"
+    );
+    return 1;
+  }
+
+  keyring_gpg.name = keyring_rpm.name = argv[2];
+
+  if(!strcmp(argv[1], "inline") && argc == 4) {
+    err = pgp_verify_inline(argv[3]);
+  }
+  else if(!strcmp(argv[1], "detached") && argc == 5) {
+    err = pgp_verify_detached(argv[3], argv[4]);
+  }
+  else if(!strcmp(argv[1], "rpm") && argc == 4) {
+    err = pgp_verify_rpm(argv[3]);
+  }
+  else {
+    fprintf(stderr, "pgptest: %s: wrong arguments\n", argv[1]);
+    return 1;
+  }
+
+  printf("%s: %s\n",
+    argv[3],
+    err == PGP_OK ? "ok" : err == PGP_BAD ? "bad" : err == PGP_NOSIG ? "nosig" : "unsupported"
+  );
+
+  return err == PGP_OK ? 0 : 1;
+}
@@ -0,0 +1,220 @@
+/*
+ *
+ * trace.c       Record time spent in the various boot phases
+ *
+ * Phases are recorded as nested spans (name + optional tag like a URL or
+ * module name). At the end they are written as Chrome trace file (load it
+ * in chrome://tracing or similar) next to the log file, and a summary is
+ * added to install.inf.
+ *
+ * Note: spans are expected to be recorded by the main thread only.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "global.h"
+#include "util.h"
+#include "trace.h"
+
+// max nesting level
+#define TRACE_DEPTH	32
+
+typedef struct {
+  char *name;
+  char *tag;
+  double start;		// seconds since boot
+  double end;		// 0: still running
+  int parent;		// index of enclosing span, -1: none
+} trace_span_t;
+
+static double trace_now(void);
+static void trace_json_str(FILE *f, char *str);
+
+static struct {
+  trace_span_t *list;
+  int len, size;
+  int open[TRACE_DEPTH];
+  int depth;
+  double start;
+} trace;
+
+
+/*
+ * Start new span. 'tag' is optional.
+ */
+void trace_begin(char *name, char *tag)
+{
+  trace_span_t *span;
+
+  if(!trace.start) trace.start = trace_now();
+
+  if(trace.len == trace.size) {
+    trace.size += 64;
+    trace.list = realloc(trace.list, trace.size * sizeof *trace.list);
+  }
+
+  span = trace.list + trace.len;
+  memset(span, 0, sizeof *span);
+
+  span->name = strdup(name);
+  if(tag) span->tag = strdup(tag);
+  span->start = trace_now();
+  span->parent = trace.depth ? trace.open[trace.depth - 1] : -1;
+
+  if(trace.depth < TRACE_DEPTH) trace.open[trace.depth++] = trace.len;
+
+  trace.len++;
+}
+
+
+/*
+ * End most recently started span.
+ */
+void trace_end()
+{
+  if(!trace.depth) return;
+
+  trace.list[trace.open[--trace.depth]].end = trace_now();
+}
+
+
+/*
+ * Write summary line to install.inf: total time spent in each phase.
+ *
+ * Nested spans of the same name (e.g. modules loaded as dependencies)
+ * are only counted once.
+ */
+void trace_summary(FILE *f)
+{
+  int i, j, k, p;
+  double now, *sum;
+  char **names;
+
+  if(!trace.len) return;
+
+  now = trace_now();
+
+  sum = calloc(trace.len, sizeof *sum);
+  names = calloc(trace.len, sizeof *names);
+
+  for(i = k = 0; i < trace.len; i++) {
+    for(p = trace.list[i].parent; p >= 0; p = trace.list[p].parent) {
+      if(!strcmp(trace.list[p].name, trace.list[i].name)) break;
+    }
+    if(p >= 0) continue;
+
+    for(j = 0; j < k; j++) if(!strcmp(names[j], trace.list[i].name)) break;
+    if(j == k) names[k++] = trace.list[i].name;
+
+    sum[j] += (trace.list[i].end ?: now) - trace.list[i].start;
+  }
+
+  fprintf(f, "BootProfile: start=%.2f total=%.2f", trace.start, now - trace.start);
+  for(j = 0; j < k; j++) fprintf(f, " %s=%.2f", names[j], sum[j]);
+  fprintf(f, "\n");
+
+  free(sum);
+  free(names);
+}
+
+
+/*
+ * Write all spans to trace file next to log file.
+ *
+ * Spans still running are written with their current duration.
+ */
+void trace_write()
+{
+  FILE *f;
+  char *file = NULL, *s;
+  double now;
+  int i;
+
+  if(!trace.len || !config.log.dest[2].name) return;
+
+  str_copy(&file, config.log.dest[2].name);
+  if((s = strrchr(file, '.')) && !strcmp(s, ".log")) *s = 0;
+  strprintf(&file, "%s.trace.json", file);
+
+  if(!(f = fopen(file, "w"))) {
+    log_debug("%s: failed to write trace\n", file);
+    str_copy(&file, NULL);
+
+    return;
+  }
+
+  now = trace_now();
+
+  fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+  for(i = 0; i < trace.len; i++) {
+    fprintf(f, "%s\n{\"name\":", i ? "," : "");
+    trace_json_str(f, trace.list[i].name);
+    fprintf(f, ",\"cat\":\"linuxrc\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.0f,\"dur\":%.0f",
+      trace.list[i].start * 1e6,
+      ((trace.list[i].end ?: now) - trace.list[i].start) * 1e6
+    );
+    if(trace.list[i].tag || !trace.list[i].end) {
+      fprintf(f, ",\"args\":{");
+      if(trace.list[i].tag) {
+        fprintf(f, "\"tag\":");
+        trace_json_str(f, trace.list[i].tag);
+      }
+      if(!trace.list[i].end) fprintf(f, "%s\"running\":true", trace.list[i].tag ? "," : "");
+      fprintf(f, "}");
+    }
+    fprintf(f, "}");
+  }
+
+  fprintf(f, "\n]}\n");
+
+  fclose(f);
+
+  log_info("boot profile written to %s\n", file);
+
+  str_copy(&file, NULL);
+}
+
+
+/*
+ * Time in seconds since boot (monotonic clock).
+ */
+double trace_now()
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+
+/*
+ * Write JSON string.
+ */
+void trace_json_str(FILE *f, char *str)
+{
+  unsigned char *s;
+
+  fputc('"', f);
+
+  for(s = (unsigned char *) str; *s; s++) {
+    if(*s == '"' || *s == '\\') {
+      fprintf(f, "\\%c", *s);
+    }
+    else if(*s < 0x20) {
+      fprintf(f, "\\u%04x", *s);
+    }
+    else {
+      fputc(*s, f);
+    }
+  }
+
+  fputc('"', f);
+}
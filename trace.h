@@ -0,0 +1,10 @@
+/*
+ *
+ * trace.h       Header file for trace.c
+ *
+ */
+
+void trace_begin(char *name, char *tag);
+void trace_end(void);
+void trace_summary(FILE *f);
+void trace_write(void);
@@ -21,6 +21,9 @@ known issues:
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mount.h>
+#include <sys/sysinfo.h>
+#include <time.h>
+#include <pthread.h>
 
 #include <curl/curl.h>
 
@@ -34,10 +37,66 @@ known issues:
 #include "display.h"
 #include "auto2.h"
 #include "url.h"
+#include "pgp.h"
+#include "trace.h"
+#include "lazydev.h"
+#include "mcast.h"
+#include "zram.h"
 
 #define CRAMFS_SUPER_MAGIC	0x28cd3d45
 #define CRAMFS_SUPER_MAGIC_BIG	0x453dcd28
 
+// max. progress update frequency (in s)
+#define URL_PROGRESS_INTERVAL	0.1
+// log download statistics this often (in s)
+#define URL_PROGRESS_LOG	10
+
+// resume interrupted downloads at most that many times in a row (without progress in between)
+#define URL_RETRIES		5
+// max. delay (in s) before resuming
+#define URL_RETRY_DELAY		30
+// give up on a connection after that many seconds without data
+#define URL_STALL_TIMEOUT	60
+
+// keep that much memory (in bytes, on top of config.memoryXXX.min_free) when prefetching
+#define URL_PREFETCH_RESERVE	(256 << 20)
+
+// race at most that many mirrors
+#define URL_MIRROR_MAX		16
+// wait that long (in s) for mirrors to answer
+#define URL_MIRROR_TIMEOUT	10
+// spread instsys parts over at most that many mirrors
+#define URL_MIRROR_SPREAD	4
+
+// prefetch states
+#define PF_QUEUED	0
+#define PF_LOADING	1
+#define PF_DONE		2
+#define PF_FAILED	3
+
+/*
+ * A file loaded in the background.
+ *
+ * The curl settings are prepared when the entry is queued (url_print() is
+ * not thread-safe). Only 'state', 'now', and 'total' are changed by the
+ * prefetch thread ('f' and 'received' are private to it); entries are freed
+ * by the main thread only.
+ */
+typedef struct url_prefetch_s {
+  struct url_prefetch_s *next;
+  char *url;			// full URL, as used by url_read()
+  char *mirror;			// if set, load it from there instead
+  char *file;			// local copy
+  char *proxy;
+  long ip_resolve;
+  unsigned ssl_verify:1;
+  unsigned abort:1;		// stop loading
+  int state;
+  unsigned now, total;		// bytes loaded so far, file size
+  FILE *f;			// 'file', while loading
+  off_t received;		// bytes written to 'f'
+} url_prefetch_t;
+
 struct cramfs_super_block {
   unsigned magic;
   unsigned size;
@@ -58,6 +117,12 @@ static int url_read_file_nosig(url_t *url, char *dir, char *src, char *dst, char
 static int url_mount_really(url_t *url, char *device, char *dir);
 static int url_mount_disk(url_t *url, char *dir, int (*test_func)(url_t *));
 static int url_progress(url_data_t *url_data, int stage);
+static double url_time(void);
+static int url_transient_error(CURL *c_handle, int err, off_t received);
+static int url_resume(void *data, unsigned delay);
+static int url_perform(CURL *c_handle, off_t *received, int (*resume)(void *, unsigned), void *data);
+static unsigned url_can_resume(instmode_t scheme);
+static char *url_stats(url_data_t *url_data);
 static int url_setup_device(url_t *url);
 static int url_setup_interface(url_t *url);
 static int url_setup_slp(url_t *url);
@@ -95,6 +160,24 @@ static unsigned url_scheme_attr(instmode_t scheme, char *attr_name);
 static void url_add_query_string(char **buf, int n, url_t *url);
 static char *url_replace_vars(char *url);
 static void url_replace_vars_with_backup(char **str, char **backup);
+static void url_curl_init(void);
+static url_t *url_append_path(url_t *url, char *src);
+static void url_prefetch(url_t *url, url_t *mirror, char *src);
+static void url_prefetch_instsys(url_t *url);
+static void url_prefetch_stop(void);
+static char *url_prefetch_wait(url_data_t *url_data);
+static void *url_prefetch_thread(void *arg);
+static int url_prefetch_load(url_prefetch_t *pf);
+static size_t url_prefetch_write_cb(void *buffer, size_t size, size_t nmemb, void *userp);
+static int url_prefetch_resume(void *data, unsigned delay);
+static int url_prefetch_progress_cb(void *clientp, double dltotal, double dlnow, double ultotal, double ulnow);
+static int url_prefetch_mem_ok(double size);
+static int url_lazy_instsys(url_t *url, char *src, char *dir);
+static void url_race_mirrors(url_t *url);
+static slist_t *url_mirror_candidates(url_t *url);
+static void url_switch_location(url_t *url, url_t *new_url);
+static void url_swap_state(url_t *url1, url_t *url2);
+static size_t url_mirror_write_cb(void *buffer, size_t size, size_t nmemb, void *data);
 
 
 // mapping of URL schemes to internal constants
@@ -132,15 +215,37 @@ static struct {
   { "relurl",    inst_rel           },
 };
 
+// mirrors of the install repo that answered, fastest first (see url_race_mirrors())
+static slist_t *url_mirrors;
+
+// url the mirrors were raced for (after switching to the winner)
+static char *url_mirrors_url;
+
+// background downloads, see url_prefetch()
+static struct {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  url_prefetch_t *list;
+  unsigned running;		// active prefetch threads
+  unsigned threads;		// max. prefetch threads (0 = 1)
+  unsigned stop:1;		// tell prefetch threads to stop
+  unsigned instsys:1;		// instsys parts have been queued
+} prefetch = {
+  .mutex = PTHREAD_MUTEX_INITIALIZER,
+  .cond = PTHREAD_COND_INITIALIZER
+};
+
 
 void url_read(url_data_t *url_data)
 {
   CURL *c_handle;
   int i;
   FILE *f;
-  char *buf, *s, *proxy_url = NULL;
+  char *buf, *s, *proxy_url = NULL, *local_file, *local_url = NULL;
   sighandler_t old_sigpipe = signal(SIGPIPE, SIG_IGN);
 
+  trace_begin("download", url_data->url->str);
+
   digests_init(url_data);
 
   c_handle = curl_easy_init();
@@ -151,43 +256,77 @@ void url_read(url_data_t *url_data)
   curl_easy_setopt(c_handle, CURLOPT_WRITEFUNCTION, url_write_cb);
   curl_easy_setopt(c_handle, CURLOPT_WRITEDATA, url_data);
   curl_easy_setopt(c_handle, CURLOPT_ERRORBUFFER, url_data->curl_err_buf);
-  curl_easy_setopt(c_handle, CURLOPT_FAILONERROR, 1);
-  curl_easy_setopt(c_handle, CURLOPT_FOLLOWLOCATION, 1);
-  curl_easy_setopt(c_handle, CURLOPT_MAXREDIRS, 10);
-  curl_easy_setopt(c_handle, CURLOPT_SSL_VERIFYPEER, config.sslcerts ? 1 : 0);
-  curl_easy_setopt(c_handle, CURLOPT_SSL_VERIFYHOST, config.sslcerts ? 2 : 0);
 
   curl_easy_setopt(c_handle, CURLOPT_PROGRESSFUNCTION, url_progress_cb);
   curl_easy_setopt(c_handle, CURLOPT_PROGRESSDATA, url_data);
   curl_easy_setopt(c_handle, CURLOPT_NOPROGRESS, 0);
 
-  if(config.net.ipv6 && !config.net.ipv4) {
-    curl_easy_setopt(c_handle, CURLOPT_IPRESOLVE, CURL_IPRESOLVE_V6);
-  }
-  else if(config.net.ipv4 && !config.net.ipv6) {
-    curl_easy_setopt(c_handle, CURLOPT_IPRESOLVE, CURL_IPRESOLVE_V4);
-  }
-  else {
-    curl_easy_setopt(c_handle, CURLOPT_IPRESOLVE, CURL_IPRESOLVE_WHATEVER);
-  }
+  str_copy(&proxy_url, url_print(config.url.proxy, 1));
+  if(proxy_url && config.debug >= 2) log_debug("using proxy %s\n", proxy_url);
+
+  url_curl_setopt(c_handle, config.sslcerts, url_ip_resolve(), proxy_url);
 
   url_data->err = curl_easy_setopt(c_handle, CURLOPT_URL, url_data->url->str);
 
   if(config.debug >= 2) log_debug("curl opt url = %d (%s)\n", url_data->err, url_data->curl_err_buf);
   if(config.debug >= 2) log_debug("url_read(%s)\n", url_data->url->str);
 
-  str_copy(&proxy_url, url_print(config.url.proxy, 1));
-  if(proxy_url) {
-    if(config.debug >= 2) log_debug("using proxy %s\n", proxy_url);
-    curl_easy_setopt(c_handle, CURLOPT_PROXY, proxy_url);
-    if(config.debug >= 2) log_debug("proxy: %s\n", proxy_url);
-  }
+  url_data->stats.start = url_data->stats.last = url_time();
+  url_data->stats.pos = 0;
+  url_data->stats.rate = 0;
+  url_data->stats.next_log = url_data->stats.start + URL_PROGRESS_LOG;
 
   if(url_data->progress) url_data->progress(url_data, 0);
 
+  // if the file has been prefetched, read the local copy instead
+  if(!url_data->err && (local_file = url_prefetch_wait(url_data))) {
+    log_info("%s: using prefetched data\n", url_print(url_data->url, 0));
+    strprintf(&local_url, "file://%s", local_file);
+    url_data->err = curl_easy_setopt(c_handle, CURLOPT_URL, local_url);
+    free(local_file);
+  }
+
+  // images may also be available via multicast
+  if(
+    !url_data->err &&
+    !local_url &&
+    url_data->progress &&
+    config.multicast &&
+    url_is_network(url_data->url->scheme) &&
+    !url_is_mountable(url_data->url->scheme)
+  ) {
+    local_file = strdup(new_download());
+    if(!mcast_receive(url_data, local_file)) {
+      strprintf(&local_url, "file://%s", local_file);
+      url_data->err = curl_easy_setopt(c_handle, CURLOPT_URL, local_url);
+    }
+    else {
+      unlink(local_file);
+    }
+    free(local_file);
+  }
+
+  url_data->resume.received = url_data->resume.offset = 0;
+
   if(!url_data->err) {
-    i = curl_easy_perform(c_handle);
-    if(!url_data->err) url_data->err = i;
+    /*
+     * If the transfer breaks, continue where it stopped. Everything that
+     * has been received so far has already gone through url_write_cb(), so
+     * digests and decompression just continue.
+     */
+    i = url_perform(
+      c_handle,
+      &url_data->resume.received,
+      local_url || !url_can_resume(url_data->url->scheme) ? NULL : url_resume,
+      url_data
+    );
+
+    if(i == -1) {
+      url_data->err = 102;
+    }
+    else if(!url_data->err) {
+      url_data->err = i;
+    }
   }
 
   if(!url_data->err) {
@@ -197,6 +336,14 @@ void url_read(url_data_t *url_data)
 
   if(config.debug >= 2) log_debug("curl perform = %d (%s)\n", url_data->err, url_data->curl_err_buf);
 
+  if(url_data->progress && url_data->p_now) {
+    log_info("%s: %u kB in %.1f s\n",
+      url_print(url_data->url, 0),
+      (url_data->p_now + 1023) >> 10,
+      url_time() - url_data->stats.start
+    );
+  }
+
   if(url_data->f) {
     i = url_data->pipe_fd >= 0 ? pclose(url_data->f) : fclose(url_data->f);
     url_data->f = NULL;
@@ -244,9 +391,14 @@ void url_read(url_data_t *url_data)
 
   curl_easy_cleanup(c_handle);
 
+  if(local_url) unlink(local_url + sizeof "file://" - 1);
+
   str_copy(&proxy_url, NULL);
+  str_copy(&local_url, NULL);
 
   signal(SIGPIPE, old_sigpipe);
+
+  trace_end();
 }
 
 
@@ -260,6 +412,8 @@ size_t url_write_cb(void *buffer, size_t size, size_t nmemb, void *userp)
 
   z1 = size * nmemb;
 
+  url_data->resume.received += z1;
+
   digests_process(url_data, buffer, z1);
 
   if(url_data->buf.len < url_data->buf.max && z1) {
@@ -375,9 +529,8 @@ size_t url_write_cb(void *buffer, size_t size, size_t nmemb, void *userp)
   }
 
   if(url_data->p_total || url_data->zp_total) {
-    if(url_data->progress) {
-      if(url_data->progress(url_data, 1) && !url_data->err) url_data->err = 102;
-    }
+    // final calls (buffer == NULL) always update the progress bar
+    if(url_progress_tick(url_data, !buffer) && !url_data->err) url_data->err = 102;
   }
 
   return url_data->err ? 0 : size * nmemb;
@@ -388,9 +541,236 @@ int url_progress_cb(void *clientp, double dltotal, double dlnow, double ultotal,
 {
   url_data_t *url_data = clientp;
 
-  if(!url_data->p_total) url_data->p_total = dltotal;
+  // when resuming, dltotal is just what's left
+  if(!url_data->p_total && dltotal) url_data->p_total = dltotal + url_data->resume.offset;
+
+  return url_progress_tick(url_data, 0);
+}
+
+
+/*
+ * Update download statistics and progress indicator.
+ *
+ * The curl callbacks run for every received block; to not slow down the
+ * download (esp. on a serial console) the progress indicator is only
+ * updated every URL_PROGRESS_INTERVAL seconds. With force set, it is
+ * updated in any case.
+ */
+int url_progress_tick(url_data_t *url_data, int force)
+{
+  double now, dt, rate;
+  unsigned pos;
+
+  if(!url_data->progress) return 0;
+
+  now = url_time();
+  dt = now - url_data->stats.last;
+
+  if(!force && dt < URL_PROGRESS_INTERVAL) return 0;
+
+  // progress is measured in what the percentage is based on
+  pos = url_data->p_total ? url_data->p_now : url_data->zp_now;
+
+  if(dt > 0 && pos >= url_data->stats.pos) {
+    rate = (pos - url_data->stats.pos) / dt;
+    // smooth it a bit
+    url_data->stats.rate = url_data->stats.rate ? 0.8 * url_data->stats.rate + 0.2 * rate : rate;
+  }
+
+  url_data->stats.pos = pos;
+  url_data->stats.last = now;
+
+  if(now >= url_data->stats.next_log) {
+    url_data->stats.next_log = now + URL_PROGRESS_LOG;
+    log_debug("%s: %s\n", url_print(url_data->url, 0), url_stats(url_data));
+  }
+
+  return url_data->progress(url_data, 1);
+}
+
+
+/*
+ * Check if it makes sense to retry after a failed transfer.
+ *
+ * A refused connection is final unless the server went away in the middle
+ * of the transfer ('received' > 0) - else every probe for a non-existing
+ * server would go through all retries.
+ */
+int url_transient_error(CURL *c_handle, int err, off_t received)
+{
+  long code = 0;
+
+  switch(err) {
+    case CURLE_COULDNT_CONNECT:
+      return received > 0;
+
+    case CURLE_PARTIAL_FILE:
+    case CURLE_OPERATION_TIMEDOUT:
+    case CURLE_GOT_NOTHING:
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+      return 1;
+
+    case CURLE_HTTP_RETURNED_ERROR:
+      curl_easy_getinfo(c_handle, CURLINFO_RESPONSE_CODE, &code);
+      return code >= 500;
+  }
+
+  return 0;
+}
+
+
+/*
+ * Wait 'delay' seconds before resuming a download (see url_perform()).
+ *
+ * Return 1 if the download was aborted.
+ */
+int url_resume(void *data, unsigned delay)
+{
+  url_data_t *url_data = data;
+  double end = url_time() + delay;
+
+  log_info("%s: %s; resuming at %lld in %u s\n",
+    url_print(url_data->url, 0),
+    url_data->curl_err_buf,
+    (long long) url_data->resume.received,
+    delay
+  );
+
+  while(url_time() < end) {
+    usleep(200000);
+    if(url_progress_tick(url_data, 0)) return 1;
+  }
+
+  *url_data->curl_err_buf = 0;
+  url_data->resume.offset = url_data->resume.received;
+
+  return 0;
+}
+
+
+/*
+ * Run the transfer set up in 'c_handle'. If it breaks, continue where it
+ * stopped.
+ *
+ * received: bytes received so far, kept up to date by the write callback
+ * resume: called with the delay (in s) before resuming, returns 1 to give
+ *   up; if NULL, the transfer is not resumed
+ *
+ * Return curl error code or -1 if resume() gave up.
+ */
+int url_perform(CURL *c_handle, off_t *received, int (*resume)(void *, unsigned), void *data)
+{
+  unsigned retry, delay;
+  off_t last;
+  int err;
+
+  for(retry = 0;; retry++) {
+    last = *received;
+
+    err = curl_easy_perform(c_handle);
+
+    if(!err || !resume || !url_transient_error(c_handle, err, *received)) break;
+
+    // start counting again if there was some progress
+    if(*received > last) retry = 0;
+
+    if(retry >= URL_RETRIES) break;
+
+    delay = retry < 5 ? 1 << retry : URL_RETRY_DELAY;
+    if(delay > URL_RETRY_DELAY) delay = URL_RETRY_DELAY;
+
+    if(resume(data, delay)) return -1;
+
+    curl_easy_setopt(c_handle, CURLOPT_RESUME_FROM_LARGE, (curl_off_t) *received);
+  }
+
+  return err;
+}
+
+
+/*
+ * Curl settings common to all downloads.
+ *
+ * The prefetch threads call this, too; so pass everything taken from
+ * 'config' as argument.
+ */
+void url_curl_setopt(CURL *c_handle, unsigned ssl_verify, long ip_resolve, char *proxy)
+{
+  curl_easy_setopt(c_handle, CURLOPT_FAILONERROR, 1);
+  curl_easy_setopt(c_handle, CURLOPT_FOLLOWLOCATION, 1);
+  curl_easy_setopt(c_handle, CURLOPT_MAXREDIRS, 10);
+  curl_easy_setopt(c_handle, CURLOPT_SSL_VERIFYPEER, ssl_verify ? 1 : 0);
+  curl_easy_setopt(c_handle, CURLOPT_SSL_VERIFYHOST, ssl_verify ? 2 : 0);
+  curl_easy_setopt(c_handle, CURLOPT_CONNECTTIMEOUT, URL_STALL_TIMEOUT);
+  curl_easy_setopt(c_handle, CURLOPT_LOW_SPEED_LIMIT, 1);
+  curl_easy_setopt(c_handle, CURLOPT_LOW_SPEED_TIME, URL_STALL_TIMEOUT);
+  curl_easy_setopt(c_handle, CURLOPT_IPRESOLVE, ip_resolve);
+
+  if(proxy) curl_easy_setopt(c_handle, CURLOPT_PROXY, proxy);
+}
+
+
+/*
+ * Curl name resolution setting according to config.net.
+ */
+long url_ip_resolve()
+{
+  if(config.net.ipv6 && !config.net.ipv4) return CURL_IPRESOLVE_V6;
+  if(config.net.ipv4 && !config.net.ipv6) return CURL_IPRESOLVE_V4;
+
+  return CURL_IPRESOLVE_WHATEVER;
+}
+
+
+/*
+ * Check if downloads using 'scheme' can be resumed.
+ */
+unsigned url_can_resume(instmode_t scheme)
+{
+  return scheme == inst_http || scheme == inst_https || scheme == inst_ftp;
+}
+
+
+/*
+ * Current time in seconds (monotonic clock).
+ */
+double url_time()
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+
+/*
+ * Format download statistics: throughput and estimated remaining time.
+ *
+ * Returns static buffer.
+ */
+char *url_stats(url_data_t *url_data)
+{
+  static char buf[64];
+  unsigned total, left;
+  double rate = url_data->stats.rate;
+
+  total = url_data->p_total ?: url_data->zp_total;
+
+  if(rate >= 1 << 20) {
+    snprintf(buf, sizeof buf, "%.1f MB/s", rate / (1 << 20));
+  }
+  else {
+    snprintf(buf, sizeof buf, "%.0f kB/s", rate / (1 << 10));
+  }
+
+  if(rate >= 1 && total > url_data->stats.pos) {
+    left = (total - url_data->stats.pos) / rate;
+    snprintf(buf + strlen(buf), sizeof buf - strlen(buf), ", %u:%02u left", left / 60, left % 60);
+  }
 
-  return url_data->progress ? url_data->progress(url_data, 1) : 0;
+  return buf;
 }
 
 
@@ -1288,8 +1668,6 @@ url_t *url_free(url_t *url)
 
 url_data_t *url_data_new()
 {
-  static int curl_init = 0;
-  int err;
   url_data_t *url_data = calloc(1, sizeof *url_data);
 
   url_data->err_buf_len = CURL_ERROR_SIZE;
@@ -1302,13 +1680,25 @@ url_data_t *url_data_new()
   url_data->pipe_fd = -1;
   url_data->percent = -1;
 
+  url_curl_init();
+
+  return url_data;
+}
+
+
+/*
+ * Initialize curl library (once).
+ */
+void url_curl_init()
+{
+  static int curl_init = 0;
+  int err;
+
   if(!curl_init) {
     curl_init = 1;
     err = curl_global_init(CURL_GLOBAL_ALL);
     if(err) log_info("curl init = %d\n", err);
   }
-
-  return url_data;
 }
 
 
@@ -1325,6 +1715,8 @@ void url_data_free(url_data_t *url_data)
   free(url_data->label);
   free(url_data->compressed);
 
+  mediacheck_digest_done(url_data->digest.sig);
+
   free(url_data);
 }
 
@@ -1451,6 +1843,7 @@ int url_progress(url_data_t *url_data, int stage)
 
       url_data->percent = percent;
     }
+    if(with_win && url_data->stats.rate) dia_status_info(&config.progress_win, url_stats(url_data));
   }
   else {
     percent = (url_data->zp_now ?: url_data->p_now) >> 10;
@@ -2032,6 +2425,19 @@ int is_gpg_signed(char *file)
     return err;
   }
 
+  // handle the common cases ourselves, use gpg for the rest
+  if((err = pgp_verify_inline(file)) != PGP_UNSUPPORTED) {
+    if(err == 0 || err == 1) {
+      log_info("%s: gpg signature %s\n", file, err ? "failed" : "ok");
+    }
+
+    log_debug("%s: gpg check = %d\n", file, err);
+
+    return err;
+  }
+
+  err = -1;
+
   strprintf(&cmd,
     "gpg --homedir /root/.gnupg --batch --no-default-keyring --keyring /installkey.gpg "
     "--ignore-valid-from --ignore-time-conflict --output '%s.unpacked' '%s' 2>&1",
@@ -2103,6 +2509,19 @@ int is_rpm_signed(char *file)
   char *type = util_fstype(file, NULL);
   if(!type || strcmp(type, "rpm")) return 2;
 
+  // handle the common cases ourselves, use rpmkeys for the rest
+  if((err = pgp_verify_rpm(file)) != PGP_UNSUPPORTED) {
+    if(err == 0 || err == 1) {
+      log_info("%s: rpm signature %s\n", file, err ? "failed" : "ok");
+    }
+
+    log_debug("%s: rpm sig check = %d\n", file, err);
+
+    return err;
+  }
+
+  err = -1;
+
   strprintf(&cmd, "rpmkeys --checksig --define '%%_keyringpath /pubkeys' '%s' 2>&1", file);
 
   if((f = popen(cmd, "r"))) {
@@ -2174,6 +2593,14 @@ int is_signed(char *file, int check)
 }
 
 
+// detached signature state of the transfer in progress, see url_read_file()
+typedef struct {
+  char *hash;			// digest type to compute while loading (or NULL)
+  mediacheck_digest_t *digest;	// digest of the file as stored
+} tc_sig_t;
+
+static tc_sig_t *tc_sig;
+
 /*
  * Read file 'src' relative to 'url' and write it to 'dst'. If 'dir' is set,
  * mount 'url' at 'dir' if necessary.
@@ -2193,6 +2620,7 @@ int url_read_file(url_t *url, char *dir, char *src, char *dst, char *label, unsi
 {
   int err, gpg;
   char *src_sig = NULL, *dst_sig = NULL, *buf = NULL, *old_path = NULL, *s;
+  tc_sig_t sig = { }, *old_sig;
 
   str_copy(&old_path, url->path);
 
@@ -2206,11 +2634,28 @@ int url_read_file(url_t *url, char *dir, char *src, char *dst, char *label, unsi
 
   flags |= URL_FLAG_NODIGEST;
 
+  /*
+   * In secure mode, hash the file while it is loaded using the digest type
+   * detached signatures normally have. If it turns out to need one, the
+   * file then doesn't have to be read again for verification.
+   *
+   * rpms carry their own signature, so don't bother for them.
+   */
+  s = src ?: old_path;
+  if(config.secure && !(s && strlen(s) > 4 && !strcmp(s + strlen(s) - 4, ".rpm"))) {
+    sig.hash = "sha256";
+  }
+
+  old_sig = tc_sig;
+  tc_sig = &sig;
   err = url_read_file_nosig(url, dir, src, dst, label, flags);
+  tc_sig = old_sig;
   str_copy(&url->path, old_path);
 
   if(err) {
+    mediacheck_digest_done(sig.digest);
     free(old_path);
+
     return err;
   }
 
@@ -2218,56 +2663,56 @@ int url_read_file(url_t *url, char *dir, char *src, char *dst, char *label, unsi
 
   if(!config.secure) {
     is_signed(dst, 0);
-    free(old_path);
-    return err;
   }
-
-  gpg = is_signed(dst, 1);
-
-  if(gpg != 2) {
-    free(old_path);
-    return gpg ? 1 : 0;
+  else if((gpg = is_signed(dst, 1)) != 2) {
+    err = gpg ? 1 : 0;
   }
+  else {
+    config.sig_failed = 1;
 
-  config.sig_failed = 1;
-
-  if(!(src || (url && url->path)) || !dst) {
-    free(old_path);
-    return err;
-  }
+    // not signed inline, look for a detached signature
+    if((src || (url && url->path)) && dst) {
+      if(src) {
+        strprintf(&src_sig, "%s.asc", src);
+      }
+      else {
+        strprintf(&url->path, "%s.asc", old_path);
+      }
+      strprintf(&dst_sig, "%s.asc", dst);
 
-  if(src) {
-    strprintf(&src_sig, "%s.asc", src);
-  }
-  else {
-    strprintf(&url->path, "%s.asc", old_path);
-  }
-  strprintf(&dst_sig, "%s.asc", dst);
-  strprintf(&buf,
-    "gpg --homedir /root/.gnupg --batch --no-default-keyring --keyring /installkey.gpg --ignore-valid-from --ignore-time-conflict --verify '%s' '%s'",
-    dst_sig, dst
-  );
+      err = url_read_file_nosig(url, dir, src_sig, dst_sig, NULL, flags);
+      str_copy(&url->path, old_path);
 
-  err = url_read_file_nosig(url, dir, src_sig, dst_sig, NULL, flags);
-  str_copy(&url->path, old_path);
+      s = url_print2(url, src);
 
-  s = url_print2(url, src);
+      if(!err) {
+        gpg = sig.digest ? pgp_verify_digest(dst_sig, sig.digest) : PGP_UNSUPPORTED;
+        if(gpg == PGP_UNSUPPORTED) gpg = pgp_verify_detached(dst, dst_sig);
+        if(gpg == PGP_UNSUPPORTED) {
+          strprintf(&buf,
+            "gpg --homedir /root/.gnupg --batch --no-default-keyring --keyring /installkey.gpg --ignore-valid-from --ignore-time-conflict --verify '%s' '%s'",
+            dst_sig, dst
+          );
+          gpg = lxrc_run(buf);
+        }
+        if(gpg) {
+          log_info("%s: signature check failed\n", s);
+          config.sig_failed = 2;
+        }
+        else {
+          log_info("%s: signature ok\n", s);
+          config.sig_failed = 0;
+        }
+      }
+      else {
+        log_info("%s: no signature\n", s);
+      }
 
-  if(!err) {
-    if(lxrc_run(buf)) {
-      log_info("%s: signature check failed\n", s);
-      config.sig_failed = 2;
+      err = warn_signature_failed(s);
     }
-    else {
-      log_info("%s: signature ok\n", s);
-      config.sig_failed = 0;
-    }
-  }
-  else {
-    log_info("%s: no signature\n", s);
   }
 
-  err = warn_signature_failed(s);
+  mediacheck_digest_done(sig.digest);
 
   free(buf);
   free(dst_sig);
@@ -2286,7 +2731,7 @@ static char *tc_label;
 static int test_and_copy(url_t *url)
 {
   int ok = 0, new_url = 0, i, win;
-  char *old_path, *buf = NULL;
+  char *buf = NULL;
   url_data_t *url_data;
 
   if(!url) return 0;
@@ -2306,25 +2751,7 @@ static int test_and_copy(url_t *url)
 
   url_data = url_data_new();
 
-  old_path = url->path;
-  url->path = NULL;
-
-  /* there is probably an easier way... */
-  i = strlen(old_path);
-  strprintf(&url->path, "%s%s%s",
-    old_path,
-    (i && old_path[i - 1] == '/') || !*old_path || !*tc_src || *tc_src == '/' ? "" : "/",
-    strcmp(tc_src, "/") ? tc_src : ""
-  );
-  if(url->path[0] == '/' && url->path[1] == '/') str_copy(&url->path, url->path + 1);
-
-  if(config.debug >= 3) log_debug("path: \"%s\" + \"%s\" = \"%s\"\n", old_path, tc_src, url->path);
-
-  str_copy(&buf, url_print(url, 1));
-  url_data->url = url_set(buf);
-
-  free(url->path);
-  url->path = old_path;
+  url_data->url = url_append_path(url, tc_src);
 
   url_data->file_name = strdup(tc_dst);
 
@@ -2332,6 +2759,7 @@ static int test_and_copy(url_t *url)
   if((tc_flags & URL_FLAG_UNZIP)) url_data->unzip = 1;
   if((tc_flags & URL_FLAG_PROGRESS)) url_data->progress = url_progress;
   str_copy(&url_data->label, tc_label);
+  if(tc_sig && tc_sig->hash) url_data->digest.sig = mediacheck_digest_init(tc_sig->hash, NULL);
 
   log_info("loading %s -> %s\n", url_print(url_data->url, 0), url_data->file_name);
 
@@ -2383,6 +2811,13 @@ static int test_and_copy(url_t *url)
 
   str_copy(&buf, NULL);
 
+  // the signature is over the file as stored, so the digest is only usable if nothing was unpacked
+  if(ok && url_data->digest.sig && !url_data->compressed) {
+    mediacheck_digest_done(tc_sig->digest);
+    tc_sig->digest = url_data->digest.sig;
+    url_data->digest.sig = NULL;
+  }
+
   if(new_url) url_free(url);
 
   url_data_free(url_data);
@@ -2390,20 +2825,58 @@ static int test_and_copy(url_t *url)
   return ok;
 }
 
+
 /*
- * Parameters as for url_read_file().
+ * Return new url with 'src' appended to the path of 'url'.
  *
- * return:
- *   0: ok
- *   1: failed
+ * This is the url url_read() is eventually called with.
  */
-int url_read_file_nosig(url_t *url, char *dir, char *src, char *dst, char *label, unsigned flags)
+url_t *url_append_path(url_t *url, char *src)
 {
-  int err = 0, free_src = 0;
-  char *buf1 = NULL, *s, *t;
+  char *old_path, *buf = NULL;
+  url_t *new_url;
+  int i;
 
-  // don't assign tc_src yet, src may get modified
-  tc_dst = dst;
+  old_path = url->path;
+  url->path = NULL;
+
+  /* there is probably an easier way... */
+  i = strlen(old_path);
+  strprintf(&url->path, "%s%s%s",
+    old_path,
+    (i && old_path[i - 1] == '/') || !*old_path || !*src || *src == '/' ? "" : "/",
+    strcmp(src, "/") ? src : ""
+  );
+  if(url->path[0] == '/' && url->path[1] == '/') str_copy(&url->path, url->path + 1);
+
+  if(config.debug >= 3) log_debug("path: \"%s\" + \"%s\" = \"%s\"\n", old_path, src, url->path);
+
+  str_copy(&buf, url_print(url, 1));
+  new_url = url_set(buf);
+
+  free(url->path);
+  url->path = old_path;
+
+  str_copy(&buf, NULL);
+
+  return new_url;
+}
+
+
+/*
+ * Parameters as for url_read_file().
+ *
+ * return:
+ *   0: ok
+ *   1: failed
+ */
+int url_read_file_nosig(url_t *url, char *dir, char *src, char *dst, char *label, unsigned flags)
+{
+  int err = 0, free_src = 0;
+  char *buf1 = NULL, *s, *t;
+
+  // don't assign tc_src yet, src may get modified
+  tc_dst = dst;
   tc_flags = flags;
   tc_label = label;
 
@@ -2579,6 +3052,32 @@ static int test_is_repo(url_t *url)
     !config.url.instsys->scheme
   ) return 0;
 
+  // network is up: pick the fastest mirror and start loading what we are
+  // going to need in the background
+  if(!url->is.mountable && !config.zen) {
+    url_race_mirrors(url);
+
+    if(!config.keepinstsysconfig) {
+      static char *meta[] = { "/content", "/repodata/repomd.xml", "/CHECKSUMS" };
+
+      for(i = 0; i < sizeof meta / sizeof *meta; i++) {
+        if(config.secure) {
+          strprintf(&buf, "%s.asc", meta[i]);
+          url_prefetch(url, NULL, buf);
+        }
+        url_prefetch(url, NULL, meta[i]);
+      }
+    }
+
+    if(
+      config.url.instsys->scheme == inst_rel &&
+      config.kexec != 1 &&
+      !config.keepinstsysconfig
+    ) {
+      url_prefetch(url, NULL, url_instsys_config(config.url.instsys->path));
+    }
+  }
+
   if(!config.keepinstsysconfig) {
     config.digests.failed = 0;
 
@@ -2622,7 +3121,7 @@ static int test_is_repo(url_t *url)
             log_info("found a multi product medium\n");
         }
         else
-          file_parse_repomd("/repomd.xml");
+          file_parse_repomd("/repomd.xml", &config.digests.list, &config.repomd_data);
       }
 
       // download CHECKSUMS ...
@@ -2634,7 +3133,7 @@ static int test_is_repo(url_t *url)
       if(read_failed && config.norepo) return 0;
 
       // ... and parse it
-      if(!read_failed) file_parse_checksums("/CHECKSUMS");
+      if(!read_failed) file_parse_checksums("/CHECKSUMS", &config.digests.list);
     }
 
     if(!config.sig_failed && util_check_exist(buf)) {
@@ -2678,6 +3177,8 @@ static int test_is_repo(url_t *url)
 
   url_build_instsys_list(config.url.instsys->path, 1);
 
+  if(!url->is.mountable) url_prefetch_instsys(url);
+
   if(url->is.mountable) {
     for(sl = config.url.instsys_list; sl; sl = sl->next) {
       opt = *(s = sl->key) == '?' && s++;
@@ -2753,7 +3254,10 @@ static int test_is_repo(url_t *url)
         str_copy(&buf2, config.rescue ? "Loading Rescue System" : "Loading Installation System");
       }
 
-      if(!url_read_file(url,
+      if(!copy && url_lazy_instsys(url, t, sl->value)) {
+        file_name = NULL;
+      }
+      else if(!url_read_file(url,
         NULL,
         t,
         file_name = strdup(new_download()),
@@ -2811,7 +3315,14 @@ int url_find_repo(url_t *url, char *dir)
 
   log_info("repository: looking for %s\n", url_print(url, 0));
 
+  trace_begin("repo", url_print(url, 0));
   err = url_mount(url, dir, test_is_repo);
+  trace_end();
+
+  // if the instsys is loaded separately, url_find_instsys() stops prefetching
+  if(err || config.url.instsys->mount || config.url.instsys->scheme == inst_rel) url_prefetch_stop();
+
+  zram_log_stats();
 
   if(err) {
     log_info("repository: not found\n");
@@ -2848,6 +3359,8 @@ int url_find_instsys(url_t *url, char *dir)
     !url->path
   ) return 1;
 
+  trace_begin("instsys", url_print(url, 0));
+
   if(config.download.instsys || config.rescue) url->download = 1;
 
   str_copy(&url_path, url->path);
@@ -2881,6 +3394,8 @@ int url_find_instsys(url_t *url, char *dir)
   if(*s == '/') s++;
   url_build_instsys_list(s, 1);
 
+  if(!url->is.mountable) url_prefetch_instsys(url);
+
   ok = 1;
 
   if(url->is.mountable && url->mount) {
@@ -2961,7 +3476,10 @@ int url_find_instsys(url_t *url, char *dir)
           str_copy(&buf2, config.rescue ? "Loading Rescue System" : "Loading Installation System");
         }
 
-        if(!url_read_file(url,
+        if(!copy && url_lazy_instsys(url, t, sl->value)) {
+          file_name = NULL;
+        }
+        else if(!url_read_file(url,
           NULL,
           *t ? t : NULL,
           file_name = strdup(new_download()),
@@ -3007,10 +3525,776 @@ int url_find_instsys(url_t *url, char *dir)
   str_copy(&url->path, NULL);
   url->path = url_path;
 
+  url_prefetch_stop();
+
+  zram_log_stats();
+
+  trace_end();
+
   return ok ? 0 : 1;
 }
 
 
+/*
+ * Load file 'src' relative to 'url' in the background.
+ *
+ * The file is stored in the download area. When url_read() is later asked
+ * for exactly this url, it waits for the download to finish and then uses the
+ * local copy instead (so unpacking, digests, and signatures are handled as
+ * usual).
+ *
+ * If 'mirror' is set, the file is loaded from there (but still handed out
+ * for 'url').
+ *
+ * Files are loaded one after the other, in the order they are queued (with
+ * prefetch.threads > 1, several at a time). Use url_prefetch_stop() to stop
+ * loading and drop unused files.
+ */
+void url_prefetch(url_t *url, url_t *mirror, char *src)
+{
+  url_prefetch_t *pf, **p;
+  url_t *new_url;
+  pthread_attr_t attr;
+  pthread_t thread;
+
+  if(
+    !config.prefetch ||
+    !url ||
+    !url->path ||
+    url->is.mountable ||
+    !url_is_network(url->scheme) ||
+    !src ||
+    !*src
+  ) return;
+
+  url_curl_init();
+
+  new_url = url_append_path(url, src);
+
+  pthread_mutex_lock(&prefetch.mutex);
+
+  for(p = &prefetch.list; (pf = *p); p = &pf->next) {
+    if(!strcmp(pf->url, new_url->str)) break;
+  }
+
+  if(!pf) {
+    *p = pf = calloc(1, sizeof *pf);
+
+    str_copy(&pf->url, new_url->str);
+    if(mirror) {
+      url_free(new_url);
+      new_url = url_append_path(mirror, src);
+      str_copy(&pf->mirror, new_url->str);
+    }
+    str_copy(&pf->file, new_download());
+    str_copy(&pf->proxy, url_print(config.url.proxy, 1));
+    pf->ssl_verify = config.sslcerts;
+    pf->ip_resolve = url_ip_resolve();
+
+    log_debug("prefetch %s -> %s\n", url_print(new_url, 0), pf->file);
+
+    if(prefetch.running < (prefetch.threads ?: 1)) {
+      pthread_attr_init(&attr);
+      pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+      if(!pthread_create(&thread, &attr, url_prefetch_thread, NULL)) {
+        prefetch.running++;
+      }
+      else {
+        log_info("prefetch: failed to start thread\n");
+      }
+      pthread_attr_destroy(&attr);
+    }
+  }
+
+  pthread_mutex_unlock(&prefetch.mutex);
+
+  url_free(new_url);
+}
+
+
+/*
+ * Prefetch all instsys parts (after url_build_instsys_list()).
+ */
+void url_prefetch_instsys(url_t *url)
+{
+  slist_t *sl;
+  char *s, *t;
+  url_t *mirror[URL_MIRROR_SPREAD] = { };
+  int i, mirrors = 1;
+
+  // images are going to be received via multicast
+  if(config.multicast) return;
+
+  // already queued (the list is kept until the instsys has been loaded)
+  pthread_mutex_lock(&prefetch.mutex);
+  i = prefetch.instsys;
+  prefetch.instsys = 1;
+  pthread_mutex_unlock(&prefetch.mutex);
+  if(i) return;
+
+  // load the parts from several mirrors at the same time (mirror[0] is 'url')
+  if(config.mirrorspread && url_mirrors && url->str && !strcmp(url_mirrors->key, url->str)) {
+    for(sl = url_mirrors->next; sl && mirrors < URL_MIRROR_SPREAD; sl = sl->next) {
+      mirror[mirrors++] = url_set(sl->key);
+    }
+
+    if(mirrors > 1) {
+      log_info("prefetch: using %d mirrors\n", mirrors);
+      pthread_mutex_lock(&prefetch.mutex);
+      prefetch.threads = mirrors;
+      pthread_mutex_unlock(&prefetch.mutex);
+    }
+  }
+
+  for(i = 0, sl = config.url.instsys_list; sl; sl = sl->next, i++) {
+    s = sl->key;
+    if(*s == '?') s++;
+    t = url_config_get_path(s);
+    // in lazy mode, only the manifest is needed (see url_lazy_instsys())
+    if(config.lazyinstsys && !strstr(s, "?copy=1")) strprintf(&t, "%s.chunks", t);
+    url_prefetch(url, mirror[i % mirrors], t);
+    free(t);
+  }
+
+  for(i = 1; i < mirrors; i++) url_free(mirror[i]);
+}
+
+
+/*
+ * Stop prefetching and remove files that have not been used.
+ */
+void url_prefetch_stop()
+{
+  url_prefetch_t *pf, *next;
+  int unused = 0;
+
+  pthread_mutex_lock(&prefetch.mutex);
+
+  prefetch.stop = 1;
+
+  while(prefetch.running) pthread_cond_wait(&prefetch.cond, &prefetch.mutex);
+
+  for(pf = prefetch.list; pf; pf = next) {
+    next = pf->next;
+    if(pf->state == PF_DONE) {
+      unlink(pf->file);
+      unused++;
+    }
+    free(pf->url);
+    free(pf->mirror);
+    free(pf->file);
+    free(pf->proxy);
+    free(pf);
+  }
+
+  prefetch.list = NULL;
+  prefetch.threads = 0;
+  prefetch.stop = prefetch.instsys = 0;
+
+  pthread_mutex_unlock(&prefetch.mutex);
+
+  if(unused) log_debug("prefetch: %d files not used\n", unused);
+}
+
+
+/*
+ * If url_data->url is being prefetched, wait for it to finish.
+ *
+ * While waiting, url_data's progress indicator shows the prefetch progress.
+ * If the prefetch doesn't make progress for URL_STALL_TIMEOUT seconds, it
+ * is dropped and the file is loaded normally.
+ *
+ * Return name of local copy (malloc'ed, caller has to remove the file)
+ * or NULL if the file is not available.
+ */
+char *url_prefetch_wait(url_data_t *url_data)
+{
+  url_prefetch_t *pf, **p;
+  struct timespec ts;
+  char *file = NULL;
+  int aborted = 0;
+  unsigned last_now = 0;
+  double last_time = url_time();
+
+  pthread_mutex_lock(&prefetch.mutex);
+
+  for(p = &prefetch.list; (pf = *p); p = &pf->next) {
+    if(!strcmp(pf->url, url_data->url->str)) break;
+  }
+
+  if(!pf) {
+    pthread_mutex_unlock(&prefetch.mutex);
+
+    return NULL;
+  }
+
+  while(pf->state == PF_LOADING) {
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += 200 * 1000000;
+    if(ts.tv_nsec >= 1000000000) {
+      ts.tv_sec++;
+      ts.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&prefetch.cond, &prefetch.mutex, &ts);
+
+    if(pf->state != PF_LOADING || pf->abort) continue;
+
+    if(pf->now != last_now) {
+      last_now = pf->now;
+      last_time = url_time();
+    }
+    else if(url_time() - last_time > URL_STALL_TIMEOUT) {
+      pf->abort = 1;
+      continue;
+    }
+
+    url_data->p_now = pf->now;
+    url_data->p_total = pf->total;
+
+    // pf stays valid: entries are freed by the main thread only
+    pthread_mutex_unlock(&prefetch.mutex);
+    aborted = url_progress_tick(url_data, 0);
+    pthread_mutex_lock(&prefetch.mutex);
+
+    if(aborted) pf->abort = 1;
+  }
+
+  *p = pf->next;
+
+  pthread_mutex_unlock(&prefetch.mutex);
+
+  if(pf->state == PF_DONE && !pf->abort) {
+    file = pf->file;
+    pf->file = NULL;
+  }
+  else if(pf->state == PF_DONE) {
+    unlink(pf->file);
+  }
+  else if(pf->abort && !aborted) {
+    log_info("%s: prefetch stalled\n", url_print(url_data->url, 0));
+  }
+
+  free(pf->url);
+  free(pf->mirror);
+  free(pf->file);
+  free(pf->proxy);
+  free(pf);
+
+  // the real download starts from scratch
+  url_data->p_now = url_data->p_total = 0;
+  url_data->stats.pos = 0;
+
+  if(aborted) url_data->err = 102;
+
+  return file;
+}
+
+
+/*
+ * Prefetch thread: load queued files one after the other.
+ *
+ * There may be several of them, each picks the next queued file.
+ *
+ * Note: no logging here.
+ */
+void *url_prefetch_thread(void *arg)
+{
+  url_prefetch_t *pf;
+  int ok;
+
+  for(;;) {
+    pthread_mutex_lock(&prefetch.mutex);
+
+    for(pf = prefetch.list; pf && pf->state != PF_QUEUED; pf = pf->next);
+
+    if(!pf || prefetch.stop) {
+      prefetch.running--;
+      pthread_cond_broadcast(&prefetch.cond);
+      pthread_mutex_unlock(&prefetch.mutex);
+
+      break;
+    }
+
+    pf->state = PF_LOADING;
+
+    pthread_mutex_unlock(&prefetch.mutex);
+
+    ok = url_prefetch_load(pf);
+
+    pthread_mutex_lock(&prefetch.mutex);
+    pf->state = ok ? PF_DONE : PF_FAILED;
+    pthread_cond_broadcast(&prefetch.cond);
+    pthread_mutex_unlock(&prefetch.mutex);
+  }
+
+  return NULL;
+}
+
+
+/*
+ * Load a single file (unmodified) to pf->file.
+ *
+ * return:
+ *   0: failed
+ *   1: ok
+ */
+int url_prefetch_load(url_prefetch_t *pf)
+{
+  CURL *c_handle;
+  FILE *f;
+  int err;
+
+  if(!url_prefetch_mem_ok(0)) return 0;
+
+  if(!(f = fopen(pf->file, "w"))) return 0;
+
+  c_handle = curl_easy_init();
+
+  pf->f = f;
+  pf->received = 0;
+
+  curl_easy_setopt(c_handle, CURLOPT_WRITEFUNCTION, url_prefetch_write_cb);
+  curl_easy_setopt(c_handle, CURLOPT_WRITEDATA, pf);
+  curl_easy_setopt(c_handle, CURLOPT_NOSIGNAL, 1);
+
+  curl_easy_setopt(c_handle, CURLOPT_PROGRESSFUNCTION, url_prefetch_progress_cb);
+  curl_easy_setopt(c_handle, CURLOPT_PROGRESSDATA, pf);
+  curl_easy_setopt(c_handle, CURLOPT_NOPROGRESS, 0);
+
+  url_curl_setopt(c_handle, pf->ssl_verify, pf->ip_resolve, pf->proxy);
+
+  err = curl_easy_setopt(c_handle, CURLOPT_URL, pf->mirror ?: pf->url);
+
+  if(!err) err = url_perform(c_handle, &pf->received, url_prefetch_resume, pf);
+
+  curl_easy_cleanup(c_handle);
+
+  if(fclose(f) && !err) err = 1;
+
+  if(err) unlink(pf->file);
+
+  return err ? 0 : 1;
+}
+
+
+/*
+ * Write prefetched data to pf->file.
+ */
+size_t url_prefetch_write_cb(void *buffer, size_t size, size_t nmemb, void *userp)
+{
+  url_prefetch_t *pf = userp;
+  size_t len;
+
+  len = fwrite(buffer, size, nmemb, pf->f) * size;
+  pf->received += len;
+
+  return len;
+}
+
+
+/*
+ * Wait 'delay' seconds before resuming a prefetch (see url_perform()).
+ *
+ * Return 1 if the prefetch should be given up.
+ */
+int url_prefetch_resume(void *data, unsigned delay)
+{
+  url_prefetch_t *pf = data;
+  struct timespec ts;
+  int abort;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_sec += delay;
+
+  pthread_mutex_lock(&prefetch.mutex);
+  while(
+    !(abort = pf->abort || prefetch.stop) &&
+    pthread_cond_timedwait(&prefetch.cond, &prefetch.mutex, &ts) != ETIMEDOUT
+  );
+  pthread_mutex_unlock(&prefetch.mutex);
+
+  return abort;
+}
+
+
+/*
+ * Update prefetch progress; abort if requested or if we are running out of memory.
+ */
+int url_prefetch_progress_cb(void *clientp, double dltotal, double dlnow, double ultotal, double ulnow)
+{
+  url_prefetch_t *pf = clientp;
+  double offset;
+  int abort;
+
+  // after resuming, curl counts from where it continued
+  offset = pf->received - dlnow;
+  if(offset < 0) offset = 0;
+
+  pthread_mutex_lock(&prefetch.mutex);
+  pf->now = pf->received;
+  if(dltotal) pf->total = dltotal + offset;
+  abort = pf->abort || prefetch.stop;
+  pthread_mutex_unlock(&prefetch.mutex);
+
+  // the rest of the file plus the copy the real download will create
+  if(!abort && dltotal > dlnow) abort = !url_prefetch_mem_ok(2 * dltotal - dlnow);
+
+  return abort;
+}
+
+
+/*
+ * Check if there's enough free memory left to prefetch 'size' bytes.
+ */
+int url_prefetch_mem_ok(double size)
+{
+  struct sysinfo si;
+
+  if(sysinfo(&si)) return 0;
+
+  return (double) si.freeram * si.mem_unit >= config.memoryXXX.min_free + URL_PREFETCH_RESERVE + size;
+}
+
+
+/*
+ * Make instsys image 'src' relative to 'url' available as block device
+ * that loads data on demand (see lazydev.c) and mount it at 'dir'.
+ *
+ * This needs a manifest file '<src>.chunks' next to the image. If the
+ * image can't be mounted directly (e.g. it is compressed or a cpio
+ * archive), the device is released again.
+ *
+ * return:
+ *   0: not mounted, the image should be downloaded as usual
+ *   1: ok
+ */
+int url_lazy_instsys(url_t *url, char *src, char *dir)
+{
+  char *manifest = NULL, *file_name = NULL, *proxy = NULL, *dev = NULL;
+  url_t *image;
+
+  if(
+    !config.lazyinstsys ||
+    !url ||
+    (url->scheme != inst_http && url->scheme != inst_https && url->scheme != inst_ftp) ||
+    !src ||
+    !*src
+  ) return 0;
+
+  strprintf(&manifest, "%s.chunks", src);
+  str_copy(&file_name, new_download());
+
+  if(!url_read_file(url, NULL, manifest, file_name, NULL, URL_FLAG_OPTIONAL)) {
+    image = url_append_path(url, src);
+    str_copy(&proxy, url_print(config.url.proxy, 1));
+    dev = lazydev_setup(image->str, file_name, proxy, config.sslcerts);
+    url_free(image);
+  }
+  else {
+    log_info("%s: no manifest, loading image\n", manifest);
+  }
+
+  unlink(file_name);
+
+  str_copy(&manifest, NULL);
+  str_copy(&file_name, NULL);
+  str_copy(&proxy, NULL);
+
+  if(!dev) return 0;
+
+  log_info("mount %s -> %s\n", dev, dir);
+
+  if(util_mount_ro(dev, dir, url->file_list)) {
+    log_info("%s: mount failed, loading image\n", dev);
+    lazydev_release(dev);
+
+    return 0;
+  }
+
+  return 1;
+}
+
+
+/*
+ * Pick the fastest mirror of 'url' and switch 'url' to it.
+ *
+ * All candidates (see url_mirror_candidates()) are asked at the same time
+ * for '/content' and '/repodata/repomd.xml'; the first one to deliver
+ * either file wins. Mirrors answering within twice that time are also
+ * remembered in url_mirrors (fastest first) for url_prefetch_instsys().
+ *
+ * If no mirror answers, 'url' is left alone. Once a mirror has answered,
+ * further calls for the same url do nothing.
+ */
+void url_race_mirrors(url_t *url)
+{
+  static char *probe[] = { "/content", "/repodata/repomd.xml" };
+  CURLM *multi;
+  CURLMsg *msg;
+  CURL *c_handle[URL_MIRROR_MAX][2] = { };
+  url_t *mirror[URL_MIRROR_MAX] = { }, *tmp;
+  slist_t *candidates, *sl;
+  int i, j, mirrors, running, left, result;
+  char *proxy = NULL, *priv;
+  double start, now, end;
+  long ip_resolve = CURL_IPRESOLVE_WHATEVER;
+
+  // test_is_repo() may run several times; race once per install url
+  if(url_mirrors_url && url->str && !strcmp(url_mirrors_url, url->str)) return;
+
+  url_mirrors = slist_free(url_mirrors);
+  str_copy(&url_mirrors_url, NULL);
+
+  if(!url->is.network || (!config.url.mirrors && !config.url.mirrorlist)) return;
+
+  candidates = url_mirror_candidates(url);
+
+  if(!candidates->next) {
+    slist_free(candidates);
+
+    return;
+  }
+
+  url_curl_init();
+
+  multi = curl_multi_init();
+
+  str_copy(&proxy, url_print(config.url.proxy, 1));
+  if(config.net.ipv6 && !config.net.ipv4) ip_resolve = CURL_IPRESOLVE_V6;
+  if(config.net.ipv4 && !config.net.ipv6) ip_resolve = CURL_IPRESOLVE_V4;
+
+  for(mirrors = 0, sl = candidates; sl && mirrors < URL_MIRROR_MAX; sl = sl->next) {
+    tmp = url_set(sl->key);
+    if(!tmp->path || tmp->is.mountable || !tmp->is.network) {
+      log_info("mirror %s: not supported\n", url_print(tmp, 0));
+      url_free(tmp);
+      continue;
+    }
+
+    mirror[mirrors] = tmp;
+
+    for(i = 0; i < sizeof probe / sizeof *probe; i++) {
+      tmp = url_append_path(mirror[mirrors], probe[i]);
+
+      c_handle[mirrors][i] = curl_easy_init();
+
+      curl_easy_setopt(c_handle[mirrors][i], CURLOPT_URL, tmp->str);
+      curl_easy_setopt(c_handle[mirrors][i], CURLOPT_PRIVATE, (char *) mirror[mirrors]);
+      curl_easy_setopt(c_handle[mirrors][i], CURLOPT_WRITEFUNCTION, url_mirror_write_cb);
+      curl_easy_setopt(c_handle[mirrors][i], CURLOPT_NOSIGNAL, 1);
+      curl_easy_setopt(c_handle[mirrors][i], CURLOPT_FAILONERROR, 1);
+      curl_easy_setopt(c_handle[mirrors][i], CURLOPT_FOLLOWLOCATION, 1);
+      curl_easy_setopt(c_handle[mirrors][i], CURLOPT_MAXREDIRS, 10);
+      curl_easy_setopt(c_handle[mirrors][i], CURLOPT_TIMEOUT, URL_MIRROR_TIMEOUT);
+      curl_easy_setopt(c_handle[mirrors][i], CURLOPT_SSL_VERIFYPEER, config.sslcerts ? 1 : 0);
+      curl_easy_setopt(c_handle[mirrors][i], CURLOPT_SSL_VERIFYHOST, config.sslcerts ? 2 : 0);
+      curl_easy_setopt(c_handle[mirrors][i], CURLOPT_IPRESOLVE, ip_resolve);
+      if(proxy) curl_easy_setopt(c_handle[mirrors][i], CURLOPT_PROXY, proxy);
+
+      curl_multi_add_handle(multi, c_handle[mirrors][i]);
+
+      url_free(tmp);
+    }
+
+    mirrors++;
+  }
+
+  slist_free(candidates);
+
+  log_info("racing %d mirrors\n", mirrors);
+
+  start = now = url_time();
+  end = start + URL_MIRROR_TIMEOUT;
+
+  do {
+    curl_multi_perform(multi, &running);
+
+    while((msg = curl_multi_info_read(multi, &left))) {
+      if(msg->msg != CURLMSG_DONE) continue;
+
+      result = msg->data.result;
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &priv);
+      tmp = (url_t *) priv;
+
+      for(i = 0; i < mirrors; i++) {
+        for(j = 0; j < sizeof probe / sizeof *probe; j++) {
+          if(c_handle[i][j] == msg->easy_handle) {
+            curl_multi_remove_handle(multi, c_handle[i][j]);
+            curl_easy_cleanup(c_handle[i][j]);
+            c_handle[i][j] = NULL;
+          }
+        }
+      }
+
+      if(result || slist_getentry(url_mirrors, tmp->str)) continue;
+
+      now = url_time();
+
+      log_info("mirror %s: %.2f s\n", url_print(tmp, 0), now - start);
+
+      // first one: give the others a bit more time
+      if(!url_mirrors) {
+        end = now + (now - start);
+        if(end > start + URL_MIRROR_TIMEOUT) end = start + URL_MIRROR_TIMEOUT;
+      }
+
+      slist_append_str(&url_mirrors, tmp->str);
+    }
+
+    if(running) curl_multi_wait(multi, NULL, 0, 100, NULL);
+
+    now = url_time();
+  }
+  while(running && now < end);
+
+  for(i = 0; i < mirrors; i++) {
+    for(j = 0; j < sizeof probe / sizeof *probe; j++) {
+      if(c_handle[i][j]) {
+        curl_multi_remove_handle(multi, c_handle[i][j]);
+        curl_easy_cleanup(c_handle[i][j]);
+      }
+    }
+  }
+
+  curl_multi_cleanup(multi);
+
+  if(url_mirrors && strcmp(url_mirrors->key, url->str)) {
+    for(i = 0; i < mirrors && strcmp(mirror[i]->str, url_mirrors->key); i++);
+    if(i < mirrors) {
+      log_info("using mirror %s\n", url_print(mirror[i], 0));
+      url_switch_location(url, mirror[i]);
+    }
+  }
+
+  // if nobody answered, try again (maybe via another interface)
+  if(url_mirrors) {
+    str_copy(&url_mirrors_url, url->str);
+  }
+  else {
+    log_info("no mirror answered\n");
+  }
+
+  for(i = 0; i < mirrors; i++) url_free(mirror[i]);
+
+  str_copy(&proxy, NULL);
+}
+
+
+/*
+ * List of mirrors to try: 'url' itself, then config.url.mirrors, then the
+ * entries of config.url.mirrorlist.
+ *
+ * The mirror list is either a plain list (one url per line) or a metalink
+ * file; then all '<url>' elements are used. As metalink urls point to
+ * files, a trailing '/content' or '/repodata/repomd.xml' is removed.
+ */
+slist_t *url_mirror_candidates(url_t *url)
+{
+  slist_t *candidates = NULL, *list = NULL, *sl;
+  url_t *list_url;
+  FILE *f;
+  char *file_name = NULL, *buf = NULL, *s;
+  size_t len = 0;
+  int i;
+
+  slist_append_str(&candidates, url->str);
+
+  for(sl = config.url.mirrors; sl; sl = sl->next) {
+    if(!slist_getentry(candidates, sl->key)) slist_append_str(&candidates, sl->key);
+  }
+
+  if(!config.url.mirrorlist) return candidates;
+
+  str_copy(&file_name, new_download());
+  list_url = url_set(config.url.mirrorlist);
+
+  if(!url_read_file(list_url, NULL, NULL, file_name, NULL, URL_FLAG_NODIGEST)) {
+    list = file_parse_xmllike(file_name, "url");
+
+    if(!list && (f = fopen(file_name, "r"))) {
+      while(getline(&buf, &len, f) > 0) {
+        for(s = buf; isspace(*s); s++);
+        if(*s == '#') continue;
+        for(i = strlen(s); i > 0 && isspace(s[i - 1]); ) s[--i] = 0;
+        if(*s) slist_append_str(&list, s);
+      }
+      fclose(f);
+      free(buf);
+    }
+
+    for(sl = list; sl; sl = sl->next) {
+      s = sl->value ?: sl->key;
+      i = strlen(s);
+      if(i > sizeof "/repodata/repomd.xml" - 1 && !strcmp(s + i - (sizeof "/repodata/repomd.xml" - 1), "/repodata/repomd.xml")) {
+        s[i - (sizeof "/repodata/repomd.xml" - 1)] = 0;
+      }
+      else if(i > sizeof "/content" - 1 && !strcmp(s + i - (sizeof "/content" - 1), "/content")) {
+        s[i - (sizeof "/content" - 1)] = 0;
+      }
+      if(*s && !slist_getentry(candidates, s)) slist_append_str(&candidates, s);
+    }
+
+    slist_free(list);
+  }
+  else {
+    log_info("%s: failed to read mirror list\n", url_print(list_url, 0));
+  }
+
+  unlink(file_name);
+
+  url_free(list_url);
+  str_copy(&file_name, NULL);
+
+  return candidates;
+}
+
+
+/*
+ * Point 'url' to the location 'new_url' refers to.
+ *
+ * Everything url_set() parsed (including query, flags, and original values)
+ * is exchanged; only the local state stays with 'url' (see
+ * url_swap_state()). 'new_url' gets the old location.
+ */
+void url_switch_location(url_t *url, url_t *new_url)
+{
+  url_t tmp = *url;
+
+  *url = *new_url;
+  *new_url = tmp;
+
+  url_swap_state(url, new_url);
+}
+
+
+/*
+ * Exchange device, mount points, and used device of 'url1' and 'url2'.
+ */
+void url_swap_state(url_t *url1, url_t *url2)
+{
+  url_t tmp = *url1;
+
+  url1->device = url2->device;
+  url1->mount = url2->mount;
+  url1->tmp_mount = url2->tmp_mount;
+  url1->used = url2->used;
+
+  url2->device = tmp.device;
+  url2->mount = tmp.mount;
+  url2->tmp_mount = tmp.tmp_mount;
+  url2->used = tmp.used;
+}
+
+
+/*
+ * Mirror probes: just drop the data.
+ */
+size_t url_mirror_write_cb(void *buffer, size_t size, size_t nmemb, void *data)
+{
+  return size * nmemb;
+}
+
+
 /*
  * Load fs module or setup network interface.
  *
@@ -3087,12 +4371,14 @@ int url_setup_interface(url_t *url)
   if(!slist_getentry(config.ifcfg.if_up, net_get_ifname(config.ifcfg.manual))) {
     check_ptp(config.ifcfg.manual->device);
 
+    trace_begin("network", net_get_ifname(config.ifcfg.manual));
     if(config.ifcfg.manual->dhcp && !config.ifcfg.manual->ptp) {
       net_dhcp();
     }
     else {
       net_static();
     }
+    trace_end();
   }
 
   if(!slist_getentry(config.ifcfg.if_up, net_get_ifname(config.ifcfg.manual))) {
@@ -3607,6 +4893,8 @@ void digests_process(url_data_t *url_data, void *buffer, size_t len)
   for(i = 0; i < max_digests; i++) {
     mediacheck_digest_process(url_data->digest.list[i], buffer, len);
   }
+
+  if(url_data->digest.sig) mediacheck_digest_process(url_data->digest.sig, buffer, len);
 }
 
 
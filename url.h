@@ -1,3 +1,4 @@
+#include <curl/curl.h>
 #include <mediacheck.h>
 
 typedef struct url_data_s {
@@ -29,6 +30,17 @@ typedef struct url_data_s {
     unsigned char *data;
   } buf;
   int (*progress)(struct url_data_s *, int);
+  struct {
+    double start;		///< download start time (in s)
+    double last;		///< time of last progress update
+    double next_log;		///< time for next log entry
+    unsigned pos;		///< bytes done at last progress update
+    double rate;		///< smoothed throughput (bytes/s)
+  } stats;
+  struct {
+    off_t received;		///< bytes passed to url_write_cb() so far
+    off_t offset;		///< where the current transfer started
+  } resume;
   struct {
     /*
      * The list must be able to hold an entry for each digest type (md5, sha1, ...)
@@ -38,6 +50,7 @@ typedef struct url_data_s {
      * Pick some value between those...
      */
     mediacheck_digest_t *list[6];
+    mediacheck_digest_t *sig;	/**< digest for detached signature, if any */
   } digest;
 } url_data_t;
 
@@ -50,6 +63,9 @@ typedef struct url_data_s {
 #define URL_FLAG_CHECK_SIG	(1 << 6)
 
 void url_read(url_data_t *url_data);
+int url_progress_tick(url_data_t *url_data, int force);
+void url_curl_setopt(CURL *c_handle, unsigned ssl_verify, long ip_resolve, char *proxy);
+long url_ip_resolve(void);
 url_t *url_set(char *str);
 void url_log(url_t *url);
 url_t *url_free(url_t *url);
@@ -43,9 +43,24 @@
 #include <linux/major.h>
 #include <linux/raid/md_u.h>
 #include <execinfo.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <spawn.h>
+#include <poll.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 
 #define CDROMEJECT	0x5309	/* Ejects the cdrom media */
 
+// not in net/if.h resp. older kernel headers
+#ifndef IFF_LOWER_UP
+#define IFF_LOWER_UP	0x10000
+#endif
+#ifndef IFLA_PERM_ADDRESS
+#define IFLA_PERM_ADDRESS	54
+#endif
+
 #include <linux/posix_types.h>
 #undef dev_t
 #define dev_t __kernel_dev_t
@@ -67,6 +82,8 @@
 #include "utf8.h"
 #include "url.h"
 #include "linuxrc.h"
+#include "archive.h"
+#include "zram.h"
 
 extern char **environ;
 
@@ -90,6 +107,28 @@ static struct hlink_s {
   char *dst;
 } *hlink_list = NULL;
 
+/*
+ * Network interface table, see netif_update().
+ */
+typedef struct {
+  char *name;
+  int index;
+  char *mac;			// current hardware address, NULL if none
+  char *perm_mac;		// permanent hardware address, NULL if none
+  char *driver;
+  unsigned up:1;		// link is up
+} netif_t;
+
+static struct {
+  netif_t *list;		// sorted by interface index
+  netif_t **by_name;		// sorted by name
+  netif_t **by_mac;		// entries with mac, sorted by mac (then index)
+  unsigned len, mac_len;
+  int fd;			// netlink socket for link events
+  unsigned fd_ok:1;		// fd has been opened
+  unsigned valid:1;		// table is up to date
+} netif;
+
 static char *exclude = NULL;
 static int rec_level = 0;
 static int extend_ready = 0;
@@ -105,7 +144,6 @@ static int cmp_dir_entry(slist_t *sl0, slist_t *sl1);
 static int cmp_dir_entry_s(const void *p0, const void *p1);
 static void create_update_name(unsigned idx);
 
-static char *read_symlink(char *name);
 static void scsi_rename_devices(void);
 static void scsi_rename_onedevice(char **dev);
 
@@ -113,13 +151,71 @@ static int skip_spaces(unsigned char **str);
 static int word_size(unsigned char *str, int *width, int *enc_len);
 
 static char *mac_to_interface_log(char *mac, int log);
+static void netif_update(void);
+static void netif_read_netlink(void);
+static void netif_read_sysfs(void);
+static netif_t *netif_add(char *name, int index);
+static char *netif_format_mac(unsigned char *addr, int len);
+static netif_t *netif_by_name(char *name);
+static netif_t *netif_by_mac(char *mac);
+static int netif_cmp_name(const void *p0, const void *p1);
+static int netif_cmp_mac(const void *p0, const void *p1);
+static int netif_cmp_index(const void *p0, const void *p1);
 
 static void util_extend_usr1(int signum);
 static int util_extend(char *extension, char task, int verbose);
 
 static int cmp_alpha(slist_t *sl0, slist_t *sl1);
 static int cmp_alpha_s(const void *p0, const void *p1);
-static slist_t *get_kernel_list(char *dev);
+static slist_t *get_kernel_list(char *dev, char *dir);
+static char *get_os_name(char *dir);
+static int sys_probe_mount(char *dev, char *dir, char *type);
+static void *sys_probe_worker(void *arg);
+static void sys_probe(slist_t **root_list, slist_t **kernel_list, window_t *win);
+
+// number of threads used by sys_probe()
+#define SYS_PROBE_THREADS	8
+
+// partition to look at in sys_probe()
+typedef struct {
+  char *dev;			// partition
+  char *dev_path;		// full device path, see long_dev()
+  char *type;			// fs type
+  char *blk_id;			// see blk_ident()
+  char *os_name;		// see get_os_name()
+  slist_t *kernels;		// see get_kernel_list()
+  int err;			// errno if mount failed
+  unsigned serial:1;		// use util_mount() from main thread
+  unsigned done:1;		// probe finished
+  unsigned reported:1;		// result has been collected
+} sys_probe_t;
+
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;		// signalled when a probe is done
+  unsigned len, next;
+  sys_probe_t *list;
+} sys_probe_queue_t;
+
+typedef struct {
+  pthread_t thread;
+  sys_probe_queue_t *queue;
+  char *dir;			// mountpoint
+} sys_probe_worker_t;
+
+// growable buffer, see util_buf_add()
+typedef struct {
+  char *buf;
+  size_t len;
+  size_t size;
+} util_buf_t;
+
+static void util_buf_add(util_buf_t *kb, char *data, size_t len);
+static void kmsg_buf_add_msg(util_buf_t *kb, char *msg);
+static void write_all(int fd, char *buf, size_t len);
+static void update_kernellog_klogctl(void);
+static void *run_drain_thread(void *arg);
+static int cmp_proc_entry(const void *p0, const void *p1);
 
 void util_redirect_kmsg()
 {
@@ -380,65 +476,215 @@ int util_fileinfo(char *file_name, int *size, int *compressed)
 }
 
 
-void util_update_kernellog (void)
-    {
-    FILE  *outfile_pri;
-    FILE  *lastfile_pri;
-    FILE  *bootmsg_pri;
-    char   buffer_ti [1 << 19];
-    char   line_ti [MAX_X - 30];
-    int    i_ii = 1;
-    int    pos_ii;
-    int    size_ii;
-
-
-    outfile_pri = fopen (kernellog_tg, "a");
-    if (!outfile_pri)
-        return;
+/*
+ * Append new kernel messages to kernellog_tg & bootmsg_tg; lastlog_tg gets
+ * only the messages from this call.
+ *
+ * Messages are read incrementally from /dev/kmsg; the open fd keeps the
+ * read position, so each call sees only records we haven't seen before.
+ * All records of one call are collected and written with a single write()
+ * per file.
+ *
+ * Falls back to reading (and clearing) the klogctl() ring buffer if
+ * /dev/kmsg is not available.
+ */
+void util_update_kernellog()
+{
+  static int kmsg_fd = -2;
+  static uint64_t kmsg_next_seq;
+  char rec[8192], prefix[16], *msg, *s;
+  util_buf_t log = { }, boot = { };
+  unsigned pri;
+  uint64_t seq;
+  ssize_t len;
+  int i, fd;
 
-    lastfile_pri = fopen (lastlog_tg, "w");
-    if (!lastfile_pri)
-        {
-        fclose (outfile_pri);
-        return;
-        }
+  if(kmsg_fd == -2) {
+    kmsg_fd = open("/dev/kmsg", O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    // after a restart the old messages have already been logged
+    if(kmsg_fd >= 0 && config.restarted) lseek(kmsg_fd, 0, SEEK_END);
+  }
+
+  if(kmsg_fd < 0) {
+    update_kernellog_klogctl();
+
+    return;
+  }
 
-    bootmsg_pri = fopen (bootmsg_tg, "a");
+  for(;;) {
+    len = read(kmsg_fd, rec, sizeof rec - 1);
 
-    size_ii = klogctl (3, buffer_ti, sizeof (buffer_ti));
+    if(len < 0) {
+      // EPIPE: we were too slow and records got overwritten; just continue
+      if(errno == EPIPE) continue;
+      break;
+    }
+    if(len == 0) break;
 
-    if (size_ii > 0 && bootmsg_pri)
-        fwrite (buffer_ti, 1, size_ii, bootmsg_pri);
+    rec[len] = 0;
 
-    if (bootmsg_pri) fclose (bootmsg_pri);
+    // format: 'pri,seq,timestamp,flags[,...];message\n[ key=value\n]...'
+    if(
+      !(msg = strchr(rec, ';')) ||
+      sscanf(rec, "%u,%" SCNu64 ",", &pri, &seq) != 2
+    ) continue;
 
-    for (pos_ii = 0; pos_ii < size_ii; pos_ii++)
-        {
-        line_ti [i_ii] = buffer_ti [pos_ii];
-        if (line_ti [i_ii] == '\n' || i_ii >= (int) sizeof (line_ti) - 2)
-            {
-            line_ti [i_ii + 1] = 0;
-            if (line_ti [1] == '<')
-                {
-                fputs (line_ti + 4, outfile_pri);
-                fputs (line_ti + 4, lastfile_pri);
-                }
-            else
-                {
-                fputs (line_ti + 1, outfile_pri);
-                fputs (line_ti + 1, lastfile_pri);
-                }
-            i_ii = 0;
-            }
+    if(seq < kmsg_next_seq) continue;
+    kmsg_next_seq = seq + 1;
 
-        ++i_ii;
-        }
+    msg++;
+    // strip the dictionary lines
+    if((s = strchr(msg, '\n'))) *s = 0;
+
+    // keep the '<pri>' prefix for boot.msg, like klogctl() provides it
+    i = snprintf(prefix, sizeof prefix, "<%u>", pri & 7);
+    util_buf_add(&boot, prefix, i);
+    kmsg_buf_add_msg(&boot, msg);
+
+    kmsg_buf_add_msg(&log, msg);
+  }
+
+  if((fd = open(lastlog_tg, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) >= 0) {
+    write_all(fd, log.buf, log.len);
+    close(fd);
+  }
+
+  if(log.len) {
+    if((fd = open(kernellog_tg, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) >= 0) {
+      write_all(fd, log.buf, log.len);
+      close(fd);
+    }
+
+    if((fd = open(bootmsg_tg, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) >= 0) {
+      write_all(fd, boot.buf, boot.len);
+      close(fd);
+    }
+  }
+
+  free(log.buf);
+  free(boot.buf);
+}
+
+
+/*
+ * Append len bytes to buffer.
+ *
+ * The buffer grows geometrically, so appending is amortized O(1).
+ */
+void util_buf_add(util_buf_t *kb, char *data, size_t len)
+{
+  if(kb->len + len + 1 > kb->size) {
+    kb->size = kb->size ? kb->size * 2 : 4096;
+    if(kb->size < kb->len + len + 1) kb->size = kb->len + len + 1;
+    kb->buf = realloc(kb->buf, kb->size);
+  }
+
+  memcpy(kb->buf + kb->len, data, len);
+  kb->len += len;
+  kb->buf[kb->len] = 0;
+}
+
+
+/*
+ * Append /dev/kmsg message text to buffer.
+ *
+ * Unescape '\xNN' sequences the kernel uses for non-printable chars;
+ * message lines are wrapped at MAX_X - 30 chars like the klogctl() variant
+ * did.
+ */
+void kmsg_buf_add_msg(util_buf_t *kb, char *msg)
+{
+  unsigned u;
+  int col = 0;
+  char c;
+
+  while(*msg) {
+    c = *msg++;
+    if(c == '\\' && msg[0] == 'x' && sscanf(msg + 1, "%2x", &u) == 1) {
+      c = u;
+      msg += 3;
+    }
+    util_buf_add(kb, &c, 1);
+    if(c == '\n') {
+      col = 0;
+    }
+    else if(++col >= MAX_X - 32) {
+      util_buf_add(kb, "\n", 1);
+      col = 0;
+    }
+  }
+
+  util_buf_add(kb, "\n", 1);
+}
+
+
+/*
+ * Write buffer completely, retrying on short writes.
+ */
+void write_all(int fd, char *buf, size_t len)
+{
+  ssize_t i;
+
+  while(len) {
+    i = write(fd, buf, len);
+    if(i < 0 && errno == EINTR) continue;
+    if(i <= 0) break;
+    buf += i;
+    len -= i;
+  }
+}
+
+
+/*
+ * Old-style kernel log update using the klogctl() ring buffer.
+ *
+ * Used only if /dev/kmsg is not available.
+ */
+void update_kernellog_klogctl()
+{
+  util_buf_t log = { };
+  char *buf, *s, *t;
+  int size, fd;
+
+  size = klogctl(10, NULL, 0);
+  if(size <= 0) size = 1 << 19;
+
+  buf = malloc(size + 1);
+
+  size = klogctl(3, buf, size);
+
+  if(size > 0) {
+    buf[size] = 0;
+
+    if((fd = open(bootmsg_tg, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) >= 0) {
+      write_all(fd, buf, size);
+      close(fd);
+    }
 
-    klogctl (5, 0, 0);
+    for(s = buf; *s; s = t) {
+      if(!(t = strchr(s, '\n'))) t = s + strlen(s);
+      if(*t) *t++ = 0;
+      // strip '<pri>' prefix
+      if(s[0] == '<' && s[1] && s[2] == '>') s += 3;
+      kmsg_buf_add_msg(&log, s);
+    }
+
+    if((fd = open(kernellog_tg, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) >= 0) {
+      write_all(fd, log.buf, log.len);
+      close(fd);
+    }
 
-    fclose (outfile_pri);
-    fclose (lastfile_pri);
+    if((fd = open(lastlog_tg, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) >= 0) {
+      write_all(fd, log.buf, log.len);
+      close(fd);
     }
+  }
+
+  klogctl(5, NULL, 0);
+
+  free(log.buf);
+  free(buf);
+}
 
 
 void util_print_banner (void)
@@ -491,7 +737,7 @@ void util_print_banner (void)
     disp_set_color (colors_prg->has_colors ? COL_BWHITE : colors_prg->msg_fg,
                     win_ri.bg_color);
     win_print (&win_ri, 1, 1, text_ti);
-    fflush (stdout);
+    disp_flush ();
     }
 
 
@@ -1713,20 +1959,6 @@ void util_splash_mode(char *mode)
 }
 
 
-char *read_symlink(char *file)
-{
-  static char buf[256];
-  int i;
-
-  i = readlink(file, buf, sizeof buf);
-  buf[sizeof buf - 1] = 0;
-  if(i >= 0 && (unsigned) i < sizeof buf) buf[i] = 0;
-  if(i < 0) *buf = 0;
-
-  return buf;
-}
-
-
 char *util_process_cmdline(pid_t pid)
 {
   char pe[100];
@@ -2162,7 +2394,7 @@ int util_swapon_main(int argc, char **argv)
 void util_free_mem()
 {
   file_t *f0, *f;
-  int64_t i, mem_total = 0, mem_free = 0, mem_free_swap = 0;
+  int64_t i, mem_total = 0, mem_free = 0, mem_free_swap = 0, zram_total, zram_free;
   char *s;
 
   f0 = file_read_file("/proc/meminfo", kf_mem);
@@ -2195,6 +2427,12 @@ void util_free_mem()
 
   file_free_file(f0);
 
+  // zram swap is not free memory at its full size: the compressed data live in RAM
+  zram_swap_cost(&zram_total, &zram_free);
+  mem_total -= zram_total >> 10;
+  mem_free -= zram_free >> 10;
+  mem_free_swap -= zram_free >> 10;
+
   config.memoryXXX.total = mem_total << 10;
   config.memoryXXX.free = mem_free << 10;
   config.memoryXXX.free_swap = mem_free_swap << 10;
@@ -2881,6 +3119,19 @@ int util_mount(char *dev, char *dir, unsigned long flags, slist_t *file_list)
     char *buf = NULL;
     char *msg;
 
+    // build the squashfs image directly, without unpacking the archive first
+    if(config.squash) {
+      tmp_dev = new_download();
+      log_info("%s -> %s: converting to squashfs\n", dev, tmp_dev);
+      err = archive_squash(dev, type, compr, tmp_dev, file_list);
+      if(!err) {
+        // if we downloaded the file, it's no longer needed
+        if(!strncmp(dev, config.download.base, strlen(config.download.base))) unlink(dev);
+        return util_mount(tmp_dev, dir, flags, NULL);
+      }
+      log_info("%s: direct conversion failed, using mksquashfs\n", dev);
+    }
+
     err = mount("tmpfs", dir, "tmpfs", 0, "size=0,nr_inodes=0");
     if(err) {
       if(config.run_as_linuxrc) log_info("mount: tmpfs: %s\n", strerror(errno));
@@ -2889,36 +3140,42 @@ int util_mount(char *dev, char *dir, unsigned long flags, slist_t *file_list)
 
     chmod(dir, 0755);
 
-    str_copy(&cpio_opts, "--quiet --sparse -dimu --no-absolute-filenames");
+    err = archive_extract(dev, type, compr, dir, file_list);
+    msg = "unpacking";
 
-    if(file_list) {
-      s = slist_join("' '", file_list);
-      strprintf(&cpio_opts, "%s '%s'", cpio_opts, s);
-      free(s);
-    }
+    // fall back to external tools
+    if(err == AR_UNSUPPORTED) {
+      str_copy(&cpio_opts, "--quiet --sparse -dimu --no-absolute-filenames");
+
+      if(file_list) {
+        s = slist_join("' '", file_list);
+        strprintf(&cpio_opts, "%s '%s'", cpio_opts, s);
+        free(s);
+      }
 
-    if(!strcmp(type, "cpio")) {
-      if(compr) {
-        strprintf(&buf, "cd %s ; %s -dc %s | cpio %s", dir, compr, dev, cpio_opts);
+      if(!strcmp(type, "cpio")) {
+        if(compr) {
+          strprintf(&buf, "cd %s ; %s -dc %s | cpio %s", dir, compr, dev, cpio_opts);
+        }
+        else {
+          strprintf(&buf, "cd %s ; cpio %s < %s", dir, cpio_opts, dev);
+        }
+        msg = "cpio";
+      }
+      else if(!strcmp(type, "tar")) {
+        strprintf(&buf, "cd %s ; tar -xpf %s", dir, dev);
+        msg = "tar";
       }
       else {
-        strprintf(&buf, "cd %s ; cpio %s < %s", dir, cpio_opts, dev);
+        strprintf(&buf, "cd %s ; rpm2cpio %s | cpio %s", dir, dev, cpio_opts);
+        msg = "rpm unpacking";
       }
-      msg = "cpio";
-    }
-    else if(!strcmp(type, "tar")) {
-      strprintf(&buf, "cd %s ; tar -xpf %s", dir, dev);
-      msg = "tar";
-    }
-    else {
-      strprintf(&buf, "cd %s ; rpm2cpio %s | cpio %s", dir, dev, cpio_opts);
-      msg = "rpm unpacking";
-    }
 
-    str_copy(&cpio_opts, NULL);
+      str_copy(&cpio_opts, NULL);
 
-    err = lxrc_run(buf);
-    str_copy(&buf, NULL);
+      err = lxrc_run(buf);
+      str_copy(&buf, NULL);
+    }
 
     if(err) {
       if(config.run_as_linuxrc) log_info("mount: %s failed\n", msg);
@@ -3295,11 +3552,25 @@ char *long_dev(char *dev)
 }
 
 
-static int is_there(char *name);
-static int is_dir(char *name);
-static int is_link(char *name);
-static char *read_symlink(char *name);
-static int make_links(char *src, char *dst);
+// directory entry, see make_links_at()
+typedef struct {
+  char *name;
+  unsigned char type;		// DT_* from readdir()
+  unsigned char action;		// lndir_action_t
+  unsigned link:1;		// entry is a symlink
+  unsigned dir:1;		// entry is a directory (or a link to one)
+} lndir_entry_t;
+
+// what to do with a directory entry
+typedef enum { ln_skip, ln_link, ln_merge, ln_split } lndir_action_t;
+
+static unsigned lndir_read(int dir_fd, lndir_entry_t **list);
+static void lndir_free(lndir_entry_t *list, unsigned len);
+static int cmp_lndir_entry(const void *p0, const void *p1);
+static unsigned char lndir_type(int dir_fd, char *name, unsigned char type, int follow);
+static char *lndir_readlink(int dir_fd, char *name, char **buf);
+static int make_links(char *src, char *dst, slist_t *skip);
+static int make_links_at(int src_fd, char *src, int dst_fd, char *dst, slist_t *skip);
 
 
 int util_lndir_main(int argc, char **argv)
@@ -3308,66 +3579,151 @@ int util_lndir_main(int argc, char **argv)
 
   if(argc != 2) return 1;
 
-  return make_links(argv[0], argv[1]);
+  return make_links(argv[0], argv[1], NULL);
 }
 
 
-int is_there(char *name)
+/*
+ * Read directory dir_fd; return number of entries.
+ *
+ * '.' and '..' are skipped.
+ */
+unsigned lndir_read(int dir_fd, lndir_entry_t **list)
 {
-  struct stat sbuf;
+  DIR *dir;
+  struct dirent *de;
+  unsigned len = 0, size = 0;
+  int fd;
 
-  if(stat(name, &sbuf) == -1) return 0;
+  *list = NULL;
 
-  return 1;
+  if((fd = dup(dir_fd)) == -1) return 0;
+
+  if(!(dir = fdopendir(fd))) {
+    close(fd);
+    return 0;
+  }
+
+  while((de = readdir(dir))) {
+    if(!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
+    if(len == size) {
+      size = size ? 2 * size : 64;
+      *list = realloc(*list, size * sizeof **list);
+    }
+    memset(*list + len, 0, sizeof **list);
+    (*list)[len].name = strdup(de->d_name);
+    (*list)[len++].type = de->d_type;
+  }
+
+  closedir(dir);
+
+  return len;
 }
 
 
-int is_dir(char *name)
+void lndir_free(lndir_entry_t *list, unsigned len)
 {
-  struct stat sbuf;
+  unsigned u;
+
+  for(u = 0; u < len; u++) free(list[u].name);
 
-  if(stat(name, &sbuf) == -1) return 0;
+  free(list);
+}
 
-  if(S_ISDIR(sbuf.st_mode)) return 1;
 
-  return 0;
+int cmp_lndir_entry(const void *p0, const void *p1)
+{
+  return strcmp(((lndir_entry_t *) p0)->name, ((lndir_entry_t *) p1)->name);
 }
 
 
-int is_link(char *name)
+/*
+ * Get file type (DT_*) of name in dir_fd; follow symlinks if follow is set.
+ *
+ * type is the type readdir() reported; stat only if it's not good enough.
+ * DT_UNKNOWN means there's no such file (or a dangling link).
+ */
+unsigned char lndir_type(int dir_fd, char *name, unsigned char type, int follow)
 {
   struct stat sbuf;
 
-  if(lstat(name, &sbuf) == -1) return 0;
+  if(type != DT_UNKNOWN && (type != DT_LNK || !follow)) return type;
 
-  if(S_ISLNK(sbuf.st_mode)) return 1;
+  if(fstatat(dir_fd, name, &sbuf, follow ? 0 : AT_SYMLINK_NOFOLLOW)) return DT_UNKNOWN;
 
-  return 0;
+  return IFTODT(sbuf.st_mode);
+}
+
+
+/*
+ * Read symlink name in dir_fd into buf.
+ *
+ * Return buf; it's an empty string on failure.
+ */
+char *lndir_readlink(int dir_fd, char *name, char **buf)
+{
+  char tmp[0x1000];
+  ssize_t len;
+
+  len = readlinkat(dir_fd, name, tmp, sizeof tmp - 1);
+  tmp[len > 0 ? len : 0] = 0;
+  str_copy(buf, tmp);
+
+  return *buf;
 }
 
 
 /*
  * Link directory tree src to dst. Keep existing files in dst.
+ *
+ * Top-level entries listed in skip are left alone.
  */
-int make_links(char *src, char *dst)
+int make_links(char *src, char *dst, slist_t *skip)
 {
-  DIR *dir;
-  struct dirent *de;
+  int src_fd, dst_fd, err;
+
+  if((src_fd = open(src, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) {
+    perror_info(src);
+    return 1;
+  }
+
+  if((dst_fd = open(dst, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) {
+    perror_info(dst);
+    close(src_fd);
+    return 1;
+  }
+
+  err = make_links_at(src_fd, src, dst_fd, dst, skip);
+
+  close(src_fd);
+  close(dst_fd);
+
+  return err;
+}
+
+
+/*
+ * Link directory tree src (opened as src_fd) to dst (opened as dst_fd).
+ *
+ * Both directories are read once and compared; only then dst is modified.
+ * The path names are needed for the link targets. Entries listed in skip
+ * are left alone.
+ */
+int make_links_at(int src_fd, char *src, int dst_fd, char *dst, slist_t *skip)
+{
+  lndir_entry_t *src_list, *dst_list, *ent, *dst_ent, key = { };
+  unsigned u, src_len, dst_len;
+  unsigned char type, dst_type, dst_ltype;
+  char *src2 = NULL, *dst2 = NULL, *tmp_dir = NULL, *link = NULL, *link_dir = NULL, *s;
   struct stat sbuf;
-  struct utimbuf ubuf;
-  char src2[0x400], dst2[0x400], tmp_dir[0x400], tmp_link[0x400], *tmp_s = NULL;
-  char *s, *t;
-  int err = 0;
+  int i, fd0, fd1, err = 0;
 
   // log_info("make_links: %s -> %s\n", src, dst);
 
-  if((dir = opendir(src))) {
-    while((de = readdir(dir))) {
-      if(!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
-      sprintf(src2, "%s/%s", src, de->d_name);
-      sprintf(dst2, "%s/%s", dst, de->d_name);
+  src_len = lndir_read(src_fd, &src_list);
+  dst_len = lndir_read(dst_fd, &dst_list);
 
-      // log_info("?: %s -> %s\n", src2, dst2);
+  if(dst_len) qsort(dst_list, dst_len, sizeof *dst_list, cmp_lndir_entry);
 
 #if 0
 
@@ -3399,148 +3755,518 @@ int make_links(char *src, char *dst)
 
 #endif
 
-      /* Why on earth '&& !is_link(src2)'??? */
-      /* new try: && !relative_link() */
-      if(is_dir(src2) /* && !is_link(src2) */) {
-        /* add directory */
-
-        // log_info("dir: %s -> %s\n", src2, dst2);
-
-        if(is_dir(dst2)) {
-          if(is_link(dst2)) {
-            /* remove link and make directory */
-            sprintf(tmp_dir, "%s/mklXXXXXX", dst);
-            s = mkdtemp(tmp_dir);
-            if(!s) {
-              perror_info(tmp_dir);
-              err = 2;
-              continue;
-            }
-            str_copy(&tmp_s, read_symlink(dst2));
-            s = tmp_s;
-            if(!*s) {
-              err = 3;
-              continue;
-            }
-            if(*s != '/') {
-              strcpy(tmp_link, dst2);
-              t = strrchr(tmp_link, '/');
-              strcpy(t ? t + 1 : tmp_link, s);
-              // sprintf(tmp_link, "%s/%s", dst2, s);
-              s = tmp_link;
-            }
-            if((err = make_links(s, tmp_dir))) continue;
-            if(unlink(dst2)) {
-              perror_info(dst2);
-              err = 4;
-              continue;
-            }
-            if(rename(tmp_dir, dst2)) {
-              perror_info(tmp_dir);
-              err = 5;
-              continue;
-            }
-            if(stat(src2, &sbuf) != -1) {
-              chmod(dst2, sbuf.st_mode);
-              ubuf.actime = sbuf.st_atime;
-              ubuf.modtime = sbuf.st_mtime;
-              utime(dst2, &ubuf);
-              lchown(dst2, sbuf.st_uid, sbuf.st_gid);
-            }
-          }
-          if((err = make_links(src2, dst2))) continue;
-        }
-        else if(!is_there(dst2)) {
-          unlink(dst2);
-          s = src2;
-          if(is_link(src2)) s = read_symlink(src2);
-          if(symlink(s, dst2)) {
-            perror_info(s);
-            err = 7;
-            continue;
-          }
-        }
+  // first pass: decide what to do
+  for(u = 0; u < src_len; u++) {
+    ent = src_list + u;
+
+    if(skip && slist_getentry(skip, ent->name)) continue;
+
+    ent->type = lndir_type(src_fd, ent->name, ent->type, 0);
+    ent->link = ent->type == DT_LNK;
+    type = lndir_type(src_fd, ent->name, ent->type, 1);
+    ent->dir = type == DT_DIR;
+
+    key.name = ent->name;
+    dst_ent = dst_len ? bsearch(&key, dst_list, dst_len, sizeof *dst_list, cmp_lndir_entry) : NULL;
+    dst_ltype = dst_ent ? lndir_type(dst_fd, dst_ent->name, dst_ent->type, 0) : DT_UNKNOWN;
+    dst_type = dst_ent ? lndir_type(dst_fd, dst_ent->name, dst_ltype, 1) : DT_UNKNOWN;
+
+    if(ent->dir) {
+      if(dst_type == DT_DIR) {
+        /* link to directory in dst: make it a directory */
+        ent->action = dst_ltype == DT_LNK ? ln_split : ln_merge;
       }
-      else if(!is_there(dst2) || is_link(dst2)) {
-        unlink(dst2);
-        s = src2;
-        if(is_link(src2)) s = read_symlink(src2);
-        if(symlink(s, dst2)) {
-          perror_info(s);
-          err = 6;
-          continue;
-        }
+      else {
+        ent->action = dst_type == DT_UNKNOWN ? ln_link : ln_skip;
       }
     }
-
-    closedir(dir);
-
-    free(tmp_s);
-  }
-  else {
-    perror_info(src);
-    return 1;
+    else {
+      ent->action = dst_type == DT_UNKNOWN || dst_ltype == DT_LNK ? ln_link : ln_skip;
+    }
   }
 
-  return err;
-}
+  // second pass: do it
+  for(u = 0; u < src_len; u++) {
+    ent = src_list + u;
 
+    if(ent->action == ln_skip) continue;
 
-void util_notty()
-{
-  int fd;
-
-  fd = open("/dev/tty", O_RDWR);
+    strprintf(&src2, "%s/%s", src, ent->name);
+    strprintf(&dst2, "%s/%s", dst, ent->name);
 
-  if(fd != -1) {
-    ioctl(fd, TIOCNOTTY);
-    close(fd);
-  }
-}
+    // log_info("?: %s -> %s\n", src2, dst2);
 
+    if(ent->action == ln_link) {
+      unlinkat(dst_fd, ent->name, 0);
+      s = ent->link ? lndir_readlink(src_fd, ent->name, &link) : src2;
+      if(symlinkat(s, dst_fd, ent->name)) {
+        perror_info(s);
+        err = ent->dir ? 7 : 6;
+      }
+      continue;
+    }
 
-void util_killall(char *name, int sig)
+    if(ent->action == ln_split) {
+      /* remove link and make directory */
+      strprintf(&tmp_dir, "%s/mklXXXXXX", dst);
+      if(!mkdtemp(tmp_dir)) {
+        perror_info(tmp_dir);
+        err = 2;
+        continue;
+      }
+      s = lndir_readlink(dst_fd, ent->name, &link);
+      if(!*s) {
+        err = 3;
+        continue;
+      }
+      if(*s != '/') {
+        strprintf(&link_dir, "%s/%s", dst, s);
+        s = link_dir;
+      }
+      if((err = make_links(s, tmp_dir, NULL))) continue;
+      if(unlinkat(dst_fd, ent->name, 0)) {
+        perror_info(dst2);
+        err = 4;
+        continue;
+      }
+      if(renameat(dst_fd, strrchr(tmp_dir, '/') + 1, dst_fd, ent->name)) {
+        perror_info(tmp_dir);
+        err = 5;
+        continue;
+      }
+      if(!fstatat(src_fd, ent->name, &sbuf, 0)) {
+        struct timespec times[2] = { sbuf.st_atim, sbuf.st_mtim };
+
+        fchmodat(dst_fd, ent->name, sbuf.st_mode & 07777, 0);
+        utimensat(dst_fd, ent->name, times, 0);
+        fchownat(dst_fd, ent->name, sbuf.st_uid, sbuf.st_gid, AT_SYMLINK_NOFOLLOW);
+      }
+    }
+
+    /* add directory */
+    if((fd0 = openat(src_fd, ent->name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) {
+      perror_info(src2);
+      err = 1;
+      continue;
+    }
+    if((fd1 = openat(dst_fd, ent->name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) {
+      perror_info(dst2);
+      close(fd0);
+      err = 1;
+      continue;
+    }
+    if((i = make_links_at(fd0, src2, fd1, dst2, NULL))) err = i;
+    close(fd0);
+    close(fd1);
+  }
+
+  lndir_free(src_list, src_len);
+  lndir_free(dst_list, dst_len);
+
+  str_copy(&src2, NULL);
+  str_copy(&dst2, NULL);
+  str_copy(&tmp_dir, NULL);
+  str_copy(&link, NULL);
+  str_copy(&link_dir, NULL);
+
+  return err;
+}
+
+
+// directory tree merged from overlayfs mounts, see util_layer_add()
+typedef struct overlay_s {
+  struct overlay_s *next;
+  char *dir;			// directory the layers are merged into
+  char *base;			// tmpfs holding upper and work dirs
+  slist_t *layers;		// lower layers, in the order they were added
+  slist_t *mounts;		// top-level dirs with overlay; value: original dir, if any
+  slist_t *lowers;		// top-level dirs with overlay; value: current lowerdir option
+} overlay_t;
+
+static overlay_t *overlays;
+
+// never put an overlay on these
+static char *overlay_skip[] = {
+  "dev", "proc", "sys", "run", "tmp", "mounts", "parts", "lost+found", NULL
+};
+
+static overlay_t *overlay_get(char *dir);
+static int overlay_usable(overlay_t *ov, char *layer, char *name);
+static int overlay_mount(overlay_t *ov, slist_t *mnt, int mounted);
+static slist_t *overlay_update(overlay_t *ov, char *layer);
+
+
+/*
+ * Merge directory tree layer into dir; files already in dir win.
+ *
+ * Normally this creates a symlink farm (see make_links()).
+ *
+ * With config.overlay set, top-level directories become overlayfs mounts
+ * and layer is just added to their lower layers. Anything that can't be
+ * handled this way is still linked.
+ */
+int util_layer_add(char *layer, char *dir)
 {
-  pid_t mypid, pid;
-  struct dirent *de;
-  DIR *d;
-  char *s;
-  slist_t *sl0 = NULL, *sl;
+  overlay_t *ov;
+  slist_t *sl, *skip = NULL;
+  int err;
 
-  if(!name) return;
+  if(config.overlay && (ov = overlay_get(dir))) {
+    if(!slist_getentry(ov->layers, layer)) {
+      slist_append_str(&ov->layers, layer);
+      skip = overlay_update(ov, layer);
+    }
+    else {
+      // already there, just redo the links
+      for(sl = ov->mounts; sl; sl = sl->next) slist_append_str(&skip, sl->key);
+    }
+  }
 
-  mypid = getpid();
+  err = make_links(layer, dir, skip);
+
+  slist_free(skip);
+
+  return err;
+}
+
+
+/*
+ * Remove layer from directory tree dir.
+ *
+ * This affects only overlayfs mounts (see util_layer_add()); links into
+ * layer stay.
+ *
+ * Return 0 if layer is no longer in use by any overlay.
+ */
+int util_layer_remove(char *layer, char *dir)
+{
+  overlay_t *ov;
+  slist_t **sl, *entry, *busy;
+
+  for(ov = overlays; ov; ov = ov->next) {
+    if(!strcmp(ov->dir, dir)) break;
+  }
+
+  if(!ov) return 0;
+
+  for(sl = &ov->layers; *sl; sl = &(*sl)->next) {
+    if(!strcmp((*sl)->key, layer)) break;
+  }
+
+  if(!(entry = *sl)) return 0;
+
+  log_info("overlay: removing %s from %s\n", layer, dir);
+
+  *sl = entry->next;
+
+  if(!(busy = overlay_update(ov, NULL))) {
+    entry->next = NULL;
+    slist_free(entry);
+
+    return 0;
+  }
+
+  // some overlays still use it; put it back
+  *sl = entry;
+  log_info("overlay: %s: still in use\n", layer);
+  slist_free(busy);
+
+  return -1;
+}
+
+
+/*
+ * Get overlay state for dir; set it up if necessary.
+ */
+overlay_t *overlay_get(char *dir)
+{
+  overlay_t *ov;
+  char *base, *buf = NULL, **s;
+
+  for(ov = overlays; ov; ov = ov->next) {
+    if(!strcmp(ov->dir, dir)) return ov;
+  }
+
+  mkdir(config.mountpoint.base, 0755);
+  base = new_mountpoint();
+  if(mount("tmpfs", base, "tmpfs", 0, "size=100%,nr_inodes=0")) {
+    log_info("overlay: %s: %s\n", base, strerror(errno));
+    return NULL;
+  }
+
+  for(s = (char *[]) { "upper", "work", "lower", NULL }; *s; s++) {
+    strprintf(&buf, "%s/%s", base, *s);
+    mkdir(buf, 0755);
+  }
+  str_copy(&buf, NULL);
+
+  ov = calloc(1, sizeof *ov);
+  ov->dir = strdup(dir);
+  ov->base = strdup(base);
+
+  ov->next = overlays;
+  overlays = ov;
+
+  return ov;
+}
+
+
+/*
+ * Check whether directory name in layer can become an overlay in ov->dir.
+ */
+int overlay_usable(overlay_t *ov, char *layer, char *name)
+{
+  char **s;
+  struct stat sbuf, dir_sbuf;
+  int dir_fd, ok;
+
+  for(s = overlay_skip; *s; s++) {
+    if(!strcmp(*s, name)) return 0;
+  }
+
+  if((dir_fd = open(layer, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) return 0;
+
+  ok = !fstatat(dir_fd, name, &sbuf, AT_SYMLINK_NOFOLLOW) && S_ISDIR(sbuf.st_mode);
+
+  close(dir_fd);
+
+  if(!ok || slist_getentry(ov->mounts, name)) return ok;
+
+  if((dir_fd = open(ov->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) return 0;
+
+  // must be a plain directory (or nothing) and not some other mount
+  if(fstatat(dir_fd, name, &sbuf, AT_SYMLINK_NOFOLLOW)) {
+    ok = errno == ENOENT;
+  }
+  else {
+    ok = S_ISDIR(sbuf.st_mode) && !fstat(dir_fd, &dir_sbuf) && sbuf.st_dev == dir_sbuf.st_dev;
+  }
+
+  close(dir_fd);
+
+  return ok;
+}
+
+
+/*
+ * Mount overlay for top-level directory mnt->key (replacing the current one
+ * if mounted is set). If there's nothing left to mount, remove it.
+ *
+ * The original directory (if any) is the topmost lower layer, then come
+ * all layers having this directory, in the order they were added.
+ *
+ * Two overlays must never share upper and work dir. So the current overlay
+ * is unmounted first (no lazy unmount, it must really be gone); if it's
+ * busy, it stays as it is. If the new overlay can't be mounted, the old
+ * one is put back.
+ *
+ * Return 0 or errno.
+ */
+int overlay_mount(overlay_t *ov, slist_t *mnt, int mounted)
+{
+  char *target = NULL, *lower = NULL, *upper = NULL, *work = NULL, *opts = NULL, *buf = NULL;
+  slist_t *sl, *cur;
+  struct stat sbuf;
+  int err = 0;
+
+  if(mnt->value) str_copy(&lower, mnt->value);
+
+  for(sl = ov->layers; sl; sl = sl->next) {
+    strprintf(&buf, "%s/%s", sl->key, mnt->key);
+    if(!lstat(buf, &sbuf) && S_ISDIR(sbuf.st_mode)) {
+      if(lower) {
+        strprintf(&lower, "%s:%s", lower, buf);
+      }
+      else {
+        str_copy(&lower, buf);
+      }
+    }
+  }
+
+  strprintf(&target, "%s/%s", strcmp(ov->dir, "/") ? ov->dir : "", mnt->key);
 
-  if(!(d = opendir("/proc"))) return;
+  if(!(cur = slist_getentry(ov->lowers, mnt->key))) {
+    cur = slist_append_str(&ov->lowers, mnt->key);
+  }
+
+  if(mounted && lower && cur->value && !strcmp(lower, cur->value)) {
+    // nothing changed
+    str_copy(&lower, NULL);
+    mounted = 0;
+  }
+  else if(mounted && umount(target) && errno != EINVAL) {
+    err = errno;
+    log_info("overlay: %s: %s, keeping %s\n", target, strerror(err), cur->value ?: "it");
+  }
+  else if(!lower) {
+    // nothing left
+    if(mounted) {
+      log_info("overlay: %s: removed\n", target);
+      rmdir(target);
+    }
+    slist_free_entry(&ov->lowers, mnt->key);
+    err = ENOENT;
+  }
+
+  if(!err && lower) {
+    strprintf(&upper, "%s/upper/%s", ov->base, mnt->key);
+    if(!mkdir(upper, 0755)) {
+      // the overlay gets its permissions from the upper dir; use the topmost layer's
+      str_copy(&buf, lower);
+      if(strchr(buf, ':')) *strchr(buf, ':') = 0;
+      if(!stat(buf, &sbuf)) {
+        chmod(upper, sbuf.st_mode & 07777);
+        chown(upper, sbuf.st_uid, sbuf.st_gid);
+      }
+    }
+
+    strprintf(&work, "%s/work/%s", ov->base, mnt->key);
+    mkdir(work, 0755);
+
+    log_info("overlay: %s = %s\n", target, lower);
+
+    mkdir(target, 0755);
+
+    strprintf(&opts, "lowerdir=%s,upperdir=%s,workdir=%s", lower, upper, work);
+    if(mount("overlay", target, "overlay", 0, opts)) {
+      err = errno;
+      log_info("overlay: %s: %s\n", target, strerror(err));
+      // put the old one back
+      if(mounted && cur->value) {
+        strprintf(&opts, "lowerdir=%s,upperdir=%s,workdir=%s", cur->value, upper, work);
+        if(mount("overlay", target, "overlay", 0, opts)) {
+          log_info("overlay: %s: %s, overlay lost\n", target, strerror(errno));
+          slist_free_entry(&ov->lowers, mnt->key);
+        }
+      }
+    }
+    else {
+      str_copy(&cur->value, lower);
+    }
+  }
+
+  str_copy(&target, NULL);
+  str_copy(&lower, NULL);
+  str_copy(&upper, NULL);
+  str_copy(&work, NULL);
+  str_copy(&opts, NULL);
+  str_copy(&buf, NULL);
+
+  return err;
+}
+
+
+/*
+ * Rebuild the overlays in ov->dir after layer has been added to ov->layers,
+ * or all of them if layer is NULL.
+ *
+ * Return list of the top-level directories in layer that are overlays; if
+ * layer is NULL, list of overlays that could not be rebuilt.
+ */
+slist_t *overlay_update(overlay_t *ov, char *layer)
+{
+  DIR *d;
+  struct dirent *de;
+  slist_t *mnt, *next, *done = NULL;
+  char *target = NULL;
+  int mounted, err;
+
+  if(!layer) {
+    for(mnt = ov->mounts; mnt; mnt = next) {
+      next = mnt->next;
+      if((err = overlay_mount(ov, mnt, 1)) == ENOENT) {
+        str_copy(&target, mnt->key);
+        slist_free_entry(&ov->mounts, target);
+      }
+      else if(err) {
+        slist_append_str(&done, mnt->key);
+      }
+    }
+    str_copy(&target, NULL);
+
+    return done;
+  }
+
+  if(!(d = opendir(layer))) return NULL;
 
-  /* make a (reversed) list of all process ids */
   while((de = readdir(d))) {
-    pid = strtoul(de->d_name, &s, 10);
-    if(!*s && *util_process_cmdline(pid)) {
-      sl = slist_add(&sl0, slist_new());
-      sl->key = strdup(de->d_name);
-      sl->value = strdup(util_process_name(pid));
+    if(!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
+    if(!overlay_usable(ov, layer, de->d_name)) continue;
+
+    if(!(mounted = (mnt = slist_getentry(ov->mounts, de->d_name)) != NULL)) {
+      mnt = slist_append_str(&ov->mounts, de->d_name);
+
+      // keep the original contents visible
+      strprintf(&target, "%s/%s", strcmp(ov->dir, "/") ? ov->dir : "", de->d_name);
+      if(util_check_exist(target) == 'd') {
+        strprintf(&mnt->value, "%s/lower/%s", ov->base, de->d_name);
+        mkdir(mnt->value, 0755);
+        if(mount(target, mnt->value, "none", MS_BIND, 0)) {
+          log_info("overlay: %s: %s\n", target, strerror(errno));
+          slist_free_entry(&ov->mounts, de->d_name);
+          continue;
+        }
+      }
+    }
+
+    if(!overlay_mount(ov, mnt, mounted)) {
+      slist_append_str(&done, de->d_name);
+    }
+    else if(!mounted) {
+      if(mnt->value) umount(mnt->value);
+      slist_free_entry(&ov->mounts, de->d_name);
     }
   }
 
   closedir(d);
 
-  for(sl = sl0; sl; sl = sl->next) {
-    pid = strtoul(sl->key, NULL, 10);
-    if(pid == mypid) continue;
-    if(!strcmp(sl->value, name)) {
-      log_debug("kill -%d %d\n", sig, pid);
-      kill(pid, sig);
-      usleep(20000);
-    }
+  str_copy(&target, NULL);
+
+  return done;
+}
+
+
+void util_notty()
+{
+  int fd;
+
+  fd = open("/dev/tty", O_RDWR);
+
+  if(fd != -1) {
+    ioctl(fd, TIOCNOTTY);
+    close(fd);
   }
+}
 
-  slist_free(sl0);
 
-  while(waitpid(-1, NULL, WNOHANG) > 0);
+void util_killall(char *name, int sig)
+{
+  pid_t mypid, *pids;
+  proc_table_t *pt;
+  proc_entry_t *pe;
+  unsigned len = 0;
+
+  if(!name) return;
+
+  mypid = getpid();
+
+  pt = util_proc_snapshot();
+  pids = calloc(pt->len + 1, sizeof *pids);
+
+  for(pe = util_proc_find(pt, name); pe && pe < pt->list + pt->len && !strcmp(pe->name, name); pe++) {
+    if(pe->kthread || pe->zombie || pe->pid == mypid) continue;
+    log_debug("kill -%d %d\n", sig, pe->pid);
+    pids[len++] = pe->pid;
+  }
+
+  util_proc_kill(pids, len, sig, 0);
+
+  free(pids);
+  util_proc_free(pt);
 }
 
 
+
 void util_get_ram_size()
 {
   hd_data_t *hd_data;
@@ -3859,63 +4585,252 @@ char *get_translation(slist_t *trans, char *locale)
 
 int util_process_running(char *name)
 {
-  pid_t pid;
-  struct dirent *de;
-  DIR *d;
-  char *s;
+  proc_table_t *pt;
+  int running;
 
   if(!name) return 0;
 
-  if(!(d = opendir("/proc"))) return 0;
-
-  while((de = readdir(d))) {
-    pid = strtoul(de->d_name, &s, 10);
-    if(!*s && !strcmp(util_process_name(pid), name)) break;
-  }
-
-  closedir(d);
+  pt = util_proc_snapshot();
+  running = util_proc_find(pt, name) ? 1 : 0;
+  util_proc_free(pt);
 
-  return de ? 1 : 0;
+  return running;
 }
 
 
-char *blk_ident(char *dev)
+/*
+ * Get a snapshot of the process table.
+ *
+ * /proc is scanned once; for each process only /proc/<pid>/stat is read
+ * (it has both the process name and the kernel thread flag).
+ *
+ * Entries are sorted by name (then pid), so util_proc_find() can do a
+ * binary search.
+ *
+ * Free the result with util_proc_free().
+ */
+proc_table_t *util_proc_snapshot()
 {
-  char *type, *label, *size;
-  static char *id = NULL;
+  proc_table_t *pt;
+  proc_entry_t *pe;
+  struct dirent *de;
+  DIR *d;
+  char buf[512], *s, *t, state;
+  unsigned long flags;
+  unsigned size = 0;
+  ssize_t len;
+  int dfd, fd;
+  pid_t pid;
 
-  if(id) {
-    free(id);
-    id = NULL;
-  }
+  pt = calloc(1, sizeof *pt);
 
-  if(!dev) return id;
+  if(!(d = opendir("/proc"))) return pt;
 
-  if(!config.blkid.cache) blkid_get_cache(&config.blkid.cache, "/dev/null");
+  dfd = dirfd(d);
 
-  type = blkid_get_tag_value(config.blkid.cache, "TYPE", dev);
-  label = blkid_get_tag_value(config.blkid.cache, "LABEL", dev);
-  size = blk_size_str(dev);
+  while((de = readdir(d))) {
+    if(de->d_type != DT_DIR && de->d_type != DT_UNKNOWN) continue;
+    pid = strtoul(de->d_name, &s, 10);
+    if(*s || pid <= 0) continue;
 
-  if(!size) return id;
+    snprintf(buf, sizeof buf, "%d/stat", pid);
+    if((fd = openat(dfd, buf, O_RDONLY | O_CLOEXEC)) == -1) continue;
+    len = pread(fd, buf, sizeof buf - 1, 0);
+    close(fd);
+    if(len <= 0) continue;
+    buf[len] = 0;
 
-  asprintf(&id, "%s, %s%s%s", size, type ?: "no fs", label ? ", " : "", label ?: "");
+    // format: 'pid (comm) state ppid pgrp session tty_nr tpgid flags ...'
+    if(!(s = strchr(buf, '(')) || !(t = strrchr(s, ')'))) continue;
+    *t = 0;
+    if(sscanf(t + 2, "%c %*d %*d %*d %*d %*d %lu", &state, &flags) != 2) continue;
 
-  free(type);
-  free(label);
+    if(pt->len == size) {
+      size = size ? size * 2 : 256;
+      pt->list = realloc(pt->list, size * sizeof *pt->list);
+    }
 
-  return id;
+    pe = pt->list + pt->len++;
+    pe->pid = pid;
+    pe->kthread = (flags & 0x00200000) ? 1 : 0;	/* PF_KTHREAD */
+    pe->zombie = state == 'Z' ? 1 : 0;
+    snprintf(pe->name, sizeof pe->name, "%s", s + 1);
+  }
+
+  closedir(d);
+
+  if(pt->len) qsort(pt->list, pt->len, sizeof *pt->list, cmp_proc_entry);
+
+  return pt;
 }
 
 
-char *blk_size_str(char *dev)
+/*
+ * Free process table.
+ *
+ * Returns NULL.
+ */
+proc_table_t *util_proc_free(proc_table_t *pt)
 {
-  uint64_t size;
-  static char *s = NULL, unit;
-
-  if(s) {
-    free(s);
-    s = NULL;
+  if(pt) {
+    free(pt->list);
+    free(pt);
+  }
+
+  return NULL;
+}
+
+
+/*
+ * Find first process with given name in process table.
+ *
+ * All processes with that name follow directly after it.
+ */
+proc_entry_t *util_proc_find(proc_table_t *pt, char *name)
+{
+  proc_entry_t *pe = NULL;
+  unsigned lo = 0, hi, mid;
+  int i;
+
+  if(!pt || !name) return NULL;
+
+  for(hi = pt->len; lo < hi;) {
+    mid = (lo + hi) / 2;
+    i = strcmp(pt->list[mid].name, name);
+    if(i < 0) {
+      lo = mid + 1;
+    }
+    else {
+      if(!i) pe = pt->list + mid;
+      hi = mid;
+    }
+  }
+
+  return pe;
+}
+
+
+int cmp_proc_entry(const void *p0, const void *p1)
+{
+  const proc_entry_t *pe0 = p0, *pe1 = p1;
+  int i;
+
+  i = strcmp(pe0->name, pe1->name);
+
+  return i ?: pe0->pid - pe1->pid;
+}
+
+
+/*
+ * Send signal sig to all processes in list and wait up to timeout ms for
+ * them to go away.
+ *
+ * Entries of processes that are gone are set to 0.
+ *
+ * Returns number of processes still running.
+ */
+unsigned util_proc_kill(pid_t *pids, unsigned len, int sig, unsigned timeout)
+{
+  struct pollfd *pfds;
+  struct timespec t0, t1;
+  unsigned u, alive, no_pidfd = 0;
+  int ms;
+
+  pfds = calloc(len + 1, sizeof *pfds);
+
+  for(u = 0; u < len; u++) {
+    pfds[u].fd = -1;
+    if(!pids[u]) continue;
+#ifdef SYS_pidfd_open
+    if(timeout) pfds[u].fd = syscall(SYS_pidfd_open, pids[u], 0);
+#endif
+    if(pfds[u].fd < 0) no_pidfd = 1;
+    pfds[u].events = POLLIN;
+    if(kill(pids[u], sig) && errno == ESRCH) pids[u] = 0;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
+  for(;;) {
+    for(alive = u = 0; u < len; u++) {
+      if(
+        pids[u] &&
+        // we might have been sent zombies - but leave other children alone
+        waitpid(pids[u], NULL, WNOHANG) != pids[u] &&
+        !(
+          pfds[u].fd >= 0 ?
+            (pfds[u].revents & (POLLIN | POLLHUP | POLLERR)) :
+            (kill(pids[u], 0) && errno == ESRCH)
+        )
+      ) {
+        alive++;
+        continue;
+      }
+
+      // gone; a pidfd of a dead process would make poll() return at once
+      pids[u] = 0;
+      if(pfds[u].fd >= 0) close(pfds[u].fd);
+      pfds[u].fd = -1;
+    }
+
+    if(!alive || !timeout) break;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    ms = timeout - ((t1.tv_sec - t0.tv_sec) * 1000 + (t1.tv_nsec - t0.tv_nsec) / 1000000);
+    if(ms <= 0) break;
+
+    // without pidfd, check every 10 ms
+    if(no_pidfd && ms > 10) ms = 10;
+    if(poll(pfds, len, ms) < 0 && errno != EINTR) break;
+  }
+
+  for(u = 0; u < len; u++) {
+    if(pfds[u].fd >= 0) close(pfds[u].fd);
+  }
+
+  free(pfds);
+
+  return alive;
+}
+
+
+char *blk_ident(char *dev)
+{
+  char *type, *label, *size;
+  static char *id = NULL;
+
+  if(id) {
+    free(id);
+    id = NULL;
+  }
+
+  if(!dev) return id;
+
+  if(!config.blkid.cache) blkid_get_cache(&config.blkid.cache, "/dev/null");
+
+  type = blkid_get_tag_value(config.blkid.cache, "TYPE", dev);
+  label = blkid_get_tag_value(config.blkid.cache, "LABEL", dev);
+  size = blk_size_str(dev);
+
+  if(!size) return id;
+
+  asprintf(&id, "%s, %s%s%s", size, type ?: "no fs", label ? ", " : "", label ?: "");
+
+  free(type);
+  free(label);
+
+  return id;
+}
+
+
+char *blk_size_str(char *dev)
+{
+  uint64_t size;
+  static char *s = NULL, unit;
+
+  if(s) {
+    free(s);
+    s = NULL;
   }
 
   size = blk_size(dev);
@@ -4429,7 +5344,7 @@ int iscsi_check()
   DIR *d;
 
   if(util_check_exist("/modules/iscsi_ibft.ko")) {
-    lxrc_run("/sbin/modprobe iscsi_ibft");
+    lxrc_run_argv("/sbin/modprobe", "iscsi_ibft");
     sleep(1);
   }
 
@@ -4505,24 +5420,306 @@ int iscsi_check()
  */
 char *interface_to_mac(char *device)
 {
-  char *buf = NULL;
+  netif_t *nf;
+  char *addr;
 
   if(!device) return NULL;
 
-  strprintf(&buf, "/sys/class/net/%s/address", device);
+  netif_update();
 
-  char *addr = util_get_attr(buf);
-
-  if(!strcmp(addr, "00:00:00:00:00:00")) *addr = 0;
+  addr = (nf = netif_by_name(device)) && nf->mac ? nf->mac : "";
 
   log_debug("if_to_mac: %s = %s\n", device, addr);
 
-  str_copy(&buf, addr ?: NULL);
+  return strdup(addr);
+}
+
+
+/*
+ * Update network interface table, if necessary.
+ *
+ * The table is read via netlink; a netlink socket subscribed to link
+ * events tells us when it has to be re-read. If netlink is not available,
+ * fall back to reading /sys/class/net (every time).
+ */
+void netif_update()
+{
+  struct sockaddr_nl addr = { .nl_family = AF_NETLINK, .nl_groups = RTMGRP_LINK };
+  char buf[4096];
+  unsigned u;
+
+  if(!netif.fd_ok) {
+    netif.fd_ok = 1;
+    netif.fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_ROUTE);
+    if(netif.fd >= 0 && bind(netif.fd, (struct sockaddr *) &addr, sizeof addr)) {
+      log_info("netlink: %s\n", strerror(errno));
+      close(netif.fd);
+      netif.fd = -1;
+    }
+  }
+
+  if(netif.fd < 0) {
+    netif.valid = 0;
+  }
+  else {
+    // any link event (or lost events) invalidates the table
+    while(recv(netif.fd, buf, sizeof buf, MSG_DONTWAIT) > 0 || errno == ENOBUFS) {
+      netif.valid = 0;
+    }
+  }
+
+  if(netif.valid) return;
+
+  for(u = 0; u < netif.len; u++) {
+    free(netif.list[u].name);
+    free(netif.list[u].mac);
+    free(netif.list[u].perm_mac);
+    free(netif.list[u].driver);
+  }
+  free(netif.list);
+  free(netif.by_name);
+  free(netif.by_mac);
+  netif.list = NULL;
+  netif.by_name = netif.by_mac = NULL;
+  netif.len = netif.mac_len = 0;
+
+  if(netif.fd >= 0) {
+    netif_read_netlink();
+  }
+  else {
+    netif_read_sysfs();
+  }
+
+  qsort(netif.list, netif.len, sizeof *netif.list, netif_cmp_index);
+
+  netif.by_name = calloc(netif.len + 1, sizeof *netif.by_name);
+  netif.by_mac = calloc(netif.len + 1, sizeof *netif.by_mac);
+
+  for(u = 0; u < netif.len; u++) {
+    netif.by_name[u] = netif.list + u;
+    if(netif.list[u].mac) netif.by_mac[netif.mac_len++] = netif.list + u;
+  }
+
+  qsort(netif.by_name, netif.len, sizeof *netif.by_name, netif_cmp_name);
+  qsort(netif.by_mac, netif.mac_len, sizeof *netif.by_mac, netif_cmp_mac);
+
+  netif.valid = netif.fd >= 0;
+
+  log_debug("netif: %u interfaces\n", netif.len);
+}
+
+
+/*
+ * Read network interfaces via netlink (RTM_GETLINK dump).
+ */
+void netif_read_netlink()
+{
+  struct {
+    struct nlmsghdr nh;
+    struct ifinfomsg ifi;
+  } req = {
+    .nh = {
+      .nlmsg_len = NLMSG_LENGTH(sizeof (struct ifinfomsg)),
+      .nlmsg_type = RTM_GETLINK,
+      .nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
+      .nlmsg_seq = 1
+    },
+    .ifi = { .ifi_family = AF_UNSPEC }
+  };
+  static unsigned char buf[32 << 10];
+  struct nlmsghdr *nh;
+  struct ifinfomsg *ifi;
+  struct rtattr *rta;
+  netif_t *nf;
+  char *s = NULL, *name;
+  int fd, len, rta_len, done = 0;
+
+  if((fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)) < 0) return;
+
+  if(send(fd, &req, req.nh.nlmsg_len, 0) < 0) done = 1;
+
+  while(!done && (len = recv(fd, buf, sizeof buf, 0)) > 0) {
+    for(nh = (struct nlmsghdr *) buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+      if(nh->nlmsg_type == NLMSG_DONE || nh->nlmsg_type == NLMSG_ERROR) {
+        done = 1;
+        break;
+      }
+      if(nh->nlmsg_type != RTM_NEWLINK) continue;
+
+      ifi = NLMSG_DATA(nh);
+
+      // find name first
+      name = NULL;
+      rta_len = IFLA_PAYLOAD(nh);
+      for(rta = IFLA_RTA(ifi); RTA_OK(rta, rta_len); rta = RTA_NEXT(rta, rta_len)) {
+        if(rta->rta_type == IFLA_IFNAME) name = RTA_DATA(rta);
+      }
+      if(!name) continue;
+
+      nf = netif_add(name, ifi->ifi_index);
+      nf->up = (ifi->ifi_flags & IFF_LOWER_UP) ? 1 : 0;
+
+      rta_len = IFLA_PAYLOAD(nh);
+      for(rta = IFLA_RTA(ifi); RTA_OK(rta, rta_len); rta = RTA_NEXT(rta, rta_len)) {
+        if(rta->rta_type == IFLA_ADDRESS) {
+          nf->mac = netif_format_mac(RTA_DATA(rta), RTA_PAYLOAD(rta));
+        }
+        else if(rta->rta_type == IFLA_PERM_ADDRESS) {
+          nf->perm_mac = netif_format_mac(RTA_DATA(rta), RTA_PAYLOAD(rta));
+        }
+      }
+
+      if(config.debug >= 2) {
+        strprintf(&s, "netif: %d %s %s", nf->index, nf->name, nf->mac ?: "-");
+        if(nf->perm_mac) strprintf(&s, "%s (perm %s)", s, nf->perm_mac);
+        log_debug("%s, %s, link %s\n", s, nf->driver ?: "-", nf->up ? "up" : "down");
+      }
+    }
+  }
+
+  str_copy(&s, NULL);
+
+  close(fd);
+}
+
+
+/*
+ * Read network interfaces from /sys/class/net.
+ */
+void netif_read_sysfs()
+{
+  struct dirent *de;
+  DIR *d;
+  char *attr = NULL, *s;
+  netif_t *nf;
+
+  if(!(d = opendir("/sys/class/net"))) return;
+
+  while((de = readdir(d))) {
+    if(de->d_name[0] == '.') continue;
+    strprintf(&attr, "/sys/class/net/%s/ifindex", de->d_name);
+    nf = netif_add(de->d_name, util_get_int_attr(attr));
+    strprintf(&attr, "/sys/class/net/%s/address", de->d_name);
+    s = util_get_attr(attr);
+    if(*s && strcmp(s, "00:00:00:00:00:00")) nf->mac = strdup(s);
+    strprintf(&attr, "/sys/class/net/%s/carrier", de->d_name);
+    nf->up = util_get_int_attr(attr) == 1;
+  }
+
+  closedir(d);
+
+  str_copy(&attr, NULL);
+}
+
+
+/*
+ * Add entry to network interface table.
+ */
+netif_t *netif_add(char *name, int index)
+{
+  netif_t *nf;
+  char *buf = NULL, *s, link[256];
+  ssize_t len;
+
+  if(!(netif.len & 15)) {
+    netif.list = realloc(netif.list, (netif.len + 16) * sizeof *netif.list);
+  }
+
+  nf = netif.list + netif.len++;
+  memset(nf, 0, sizeof *nf);
+
+  nf->name = strdup(name);
+  nf->index = index;
+
+  strprintf(&buf, "/sys/class/net/%s/device/driver", name);
+  if((len = readlink(buf, link, sizeof link - 1)) > 0) {
+    link[len] = 0;
+    if((s = strrchr(link, '/'))) nf->driver = strdup(s + 1);
+  }
+  str_copy(&buf, NULL);
+
+  return nf;
+}
+
+
+/*
+ * Format hardware address as 'xx:xx:...'; all zeros count as no address.
+ *
+ * Return value must be freed.
+ */
+char *netif_format_mac(unsigned char *addr, int len)
+{
+  char *buf;
+  int i, zero = 1;
+
+  if(len <= 0) return NULL;
+
+  buf = malloc(3 * len);
+
+  for(i = 0; i < len; i++) {
+    sprintf(buf + 3 * i, "%02x%s", addr[i], i == len - 1 ? "" : ":");
+    if(addr[i]) zero = 0;
+  }
+
+  if(zero) {
+    free(buf);
+    buf = NULL;
+  }
 
   return buf;
 }
 
 
+netif_t *netif_by_name(char *name)
+{
+  netif_t key = { .name = name }, *kp = &key, **nf;
+
+  nf = bsearch(&kp, netif.by_name, netif.len, sizeof *netif.by_name, netif_cmp_name);
+
+  return nf ? *nf : NULL;
+}
+
+
+/*
+ * Find interface with lowest index for mac (no wildcards).
+ */
+netif_t *netif_by_mac(char *mac)
+{
+  netif_t key = { .mac = mac }, *kp = &key, **nf;
+
+  nf = bsearch(&kp, netif.by_mac, netif.mac_len, sizeof *netif.by_mac, netif_cmp_mac);
+
+  if(!nf) return NULL;
+
+  while(nf > netif.by_mac && !strcasecmp(nf[-1]->mac, mac)) nf--;
+
+  return *nf;
+}
+
+
+int netif_cmp_name(const void *p0, const void *p1)
+{
+  return strcmp((*(netif_t **) p0)->name, (*(netif_t **) p1)->name);
+}
+
+
+int netif_cmp_mac(const void *p0, const void *p1)
+{
+  netif_t *nf0 = *(netif_t **) p0, *nf1 = *(netif_t **) p1;
+  int i;
+
+  if((i = strcasecmp(nf0->mac, nf1->mac))) return i;
+
+  return nf0->index - nf1->index;
+}
+
+
+int netif_cmp_index(const void *p0, const void *p1)
+{
+  return ((netif_t *) p0)->index - ((netif_t *) p1)->index;
+}
+
+
 /*
  * Internal function, use mac_to_interface().
  *
@@ -4530,41 +5727,44 @@ char *interface_to_mac(char *device)
  */
 char *mac_to_interface_log(char *mac, int log)
 {
-  struct dirent *de;
-  DIR *d;
-  char *sys = "/sys/class/net", *if_name = NULL, *attr, *if_mac;
+  netif_t *nf = NULL;
+  unsigned u;
 
   if(!mac) return NULL;
 
-  if(util_check_exist2(sys, mac)) return strdup(mac);
-
-  if(log) log_debug("%s = ?\n", mac);
+  netif_update();
 
-  if(!(d = opendir(sys))) return NULL;
+  if(netif_by_name(mac)) return strdup(mac);
 
-  while((de = readdir(d))) {
-    if(de->d_name[0] == '.') continue;
-    asprintf(&attr, "%s/%s/address", sys, de->d_name);
-    if_mac = util_get_attr(attr);
-    free(attr);
-    if(!*if_mac || !strcmp(if_mac, "00:00:00:00:00:00")) continue;
+  if(log) log_debug("%s = ?\n", mac);
 
-    if(!if_name && !fnmatch(mac, if_mac, FNM_CASEFOLD)) {
-      if_name = strdup(de->d_name);
+  if(!strpbrk(mac, "*?[")) {
+    nf = netif_by_mac(mac);
+  }
+  else {
+    for(u = 0; u < netif.len; u++) {
+      if(netif.list[u].mac && !fnmatch(mac, netif.list[u].mac, FNM_CASEFOLD)) {
+        nf = netif.list + u;
+        break;
+      }
     }
+  }
 
-    if(log) {
-      log_debug("%s = %s%s\n",
-        if_mac,
-        de->d_name,
-        if_name && !strcmp(if_name, de->d_name) ? " *" : ""
-      );
+  // e.g. bonding slaves don't have their original mac
+  for(u = 0; !nf && u < netif.len; u++) {
+    if(netif.list[u].perm_mac && !fnmatch(mac, netif.list[u].perm_mac, FNM_CASEFOLD)) {
+      nf = netif.list + u;
     }
   }
 
-  closedir(d);
+  if(log) {
+    for(u = 0; u < netif.len; u++) {
+      if(!netif.list[u].mac) continue;
+      log_debug("%s = %s%s\n", netif.list[u].mac, netif.list[u].name, nf == netif.list + u ? " *" : "");
+    }
+  }
 
-  return if_name;
+  return nf ? strdup(nf->name) : NULL;
 }
 
 
@@ -4914,6 +6114,7 @@ void util_restart()
   config.restarting = 1;
   lxrc_end();
   setenv("restarted", "42", 1);
+  util_log_flush(1);
   execve(*config.argv, config.argv, environ);
 }
 
@@ -5013,9 +6214,11 @@ int cmp_alpha_s(const void *p0, const void *p1)
 
 
 /*
- * Scan parition mounted at /mnt for kernel & initrd.
+ * Scan partition mounted at dir for kernel & initrd.
+ *
+ * Note: this is run from the sys_probe_worker() threads; so no logging here.
  */
-slist_t *get_kernel_list(char *dev)
+slist_t *get_kernel_list(char *dev, char *dir)
 {
 #if defined(__s390__) || defined(__s390x__)
   char *kernel_pattern = "image-*";
@@ -5026,36 +6229,35 @@ slist_t *get_kernel_list(char *dev)
 #else
   char *kernel_pattern = "vmlinux-*";
 #endif
-  char *dirs[] = { "/mnt", "/mnt/boot", "/mnt/efi/boot", "/mnt/efi/SuSE" };
+  char *dirs[] = { "", "/boot", "/efi/boot", "/efi/SuSE" };
 
   int i;
   DIR *d;
   struct dirent *de;
-  char *buf = NULL;
+  char *buf = NULL, *path = NULL;
   slist_t *sl, *kernel_list = NULL;
 
   for(i = 0; i < sizeof dirs/sizeof *dirs; i++) {
     char link_name[2];
 
+    strprintf(&path, "%s%s", dir, dirs[i]);
+
     // skip boot -> . symlink and absolute symlinks
     if(
-      readlink(dirs[i], link_name, sizeof link_name) == 1 &&
+      readlink(path, link_name, sizeof link_name) == 1 &&
       (*link_name == '.' || *link_name == '/')
     ) continue;
 
-    if((d = opendir(dirs[i]))) {
+    if((d = opendir(path))) {
       while((de = readdir(d))) {
         if(!fnmatch(kernel_pattern, de->d_name, FNM_PATHNAME)) {
           char *t = strchr(de->d_name, '-');
           if(t) {
-            strprintf(&buf, "%s/initrd%s", dirs[i], t);
-            log_info("%s matched, initrd? %s\n", de->d_name, buf);
+            strprintf(&buf, "%s/initrd%s", path, t);
             if(util_check_exist(buf) == 'r') {
-              char *t2 = dirs[i] + sizeof "/mnt" - 1;
               sl = slist_append(&kernel_list, slist_new());
-              strprintf(&sl->key, "%s:%s/%s", dev, t2, de->d_name);
-              strprintf(&sl->value, "%s:%s/initrd%s", dev, t2, t);
-              log_info("kernel: %s / %s\n", sl->key, sl->value);
+              strprintf(&sl->key, "%s:%s/%s", dev, dirs[i], de->d_name);
+              strprintf(&sl->value, "%s:%s/initrd%s", dev, dirs[i], t);
             }
             str_copy(&buf, NULL);
           }
@@ -5066,93 +6268,278 @@ slist_t *get_kernel_list(char *dev)
     }
   }
 
+  str_copy(&path, NULL);
+
   return kernel_list;
 }
 
 
 /*
- * Boot installed system.
+ * Get name of OS installed on partition mounted at dir.
  *
- *   1. analyze disks: mount every partition and
- *       - look for /etc/{os,SuSE}-release; every such partition is considered
- *         to be a root file system
- *       - look for <kernel>-XXX and matching initrd-XXX files; every such pair
- *         is considered a bootable kernel/initrd combination; <kernel> may be
- *         vmlinux, vmlinuz, or image depending on the architecture
+ * Return malloc'ed string or NULL if there's none.
  *
- *   2. present 4 (resp. 5) dialogs to user:
- *       - select root partition
- *       - select kernel/initrd
- *       - optionally select alternative (persistent) root partition name
- *       - optionally add further kernel parameters
- *       - if in debug mode: optionally edit kexec options
+ * Note: this is run from the sys_probe_worker() threads; so no logging here.
  */
-void util_boot_system()
+char *get_os_name(char *dir)
 {
-  window_t win;
-  char *buf = NULL;
-  slist_t *sl;
-  slist_t *root_list = NULL, *root = NULL;
-  slist_t *kernel_list = NULL, *kernel = NULL;
-  char *kernel_options = NULL;
-  int i, items;
-  char **item_list;
+  char *name = NULL, *file = NULL, *s, *t;
+  char buf[1024];
+  int i, fd, os_release;
 
-  strprintf(&buf, "Analysing disks...");
-  log_info("%s\n", buf);
-  if(config.win) {
-    dia_info(&win, buf, MSGTYPE_INFO);
+  strprintf(&file, "%s/etc/os-release", dir);
+  if(!(os_release = util_check_exist(file))) {
+    strprintf(&file, "%s/etc/SuSE-release", dir);
+  }
+
+  *buf = 0;
+  if((fd = open(file, O_RDONLY)) >= 0) {
+    i = read(fd, buf, sizeof buf - 1);
+    buf[i > 0 ? i : 0] = 0;
+    close(fd);
+  }
+  str_copy(&file, NULL);
+
+  if(os_release) {
+    if((s = strstr(buf, "PRETTY_NAME=\""))) {
+      s += sizeof "PRETTY_NAME=\"" - 1;
+      if((t = strchr(s, '"'))) {
+        *t = 0;
+        name = strdup(s);
+      }
+    }
   }
   else {
-    printf("%s\n", buf);
-    fflush(stdout);
+    if((t = strchr(buf, '\n'))) *t = 0;
+    if(*buf) name = strdup(buf);
   }
-  str_copy(&buf, NULL);
 
-  util_update_disk_list(NULL, 1);
+  return name;
+}
 
-  for(sl = config.partitions; sl; sl = sl->next) {
-    char *type = util_fstype(long_dev(sl->key), NULL);
-    char *blk_id = blk_ident(long_dev(sl->key));
-    if(type && strcmp(type, "swap")) {
-      if(!util_mount_ro(long_dev(sl->key), "/mnt", NULL)) {
-        char *os_name = NULL;
 
-        if(util_check_exist("/mnt/etc/os-release")) {
-          char *s = util_get_attr("/mnt/etc/os-release");
-          char *t = strstr(s, "PRETTY_NAME=\"");
-          if(t) {
-            t += sizeof "PRETTY_NAME=\"" - 1;
-            char *t2 = strchr(t, '"');
-            if(t2) {
-              *t2 = 0;
-              os_name = t;
-            }
-          }
-        }
-        else if(util_check_exist("/mnt/etc/SuSE-release")) {
-          char *s = util_get_attr("/mnt/etc/SuSE-release");
-          char *t = strchr(s, '\n');
-          if(t) *t = 0;
-          if(*s) os_name = s;
-        }
+/*
+ * Mount partition read-only for a quick look.
+ *
+ * Ask the file system not to replay its journal: it's faster and leaves the
+ * device alone. Fall back to a regular read-only mount if that fails.
+ *
+ * Return 0 or errno.
+ */
+int sys_probe_mount(char *dev, char *dir, char *type)
+{
+  unsigned long flags = MS_MGC_VAL | MS_RDONLY | MS_NOATIME;
+  char *opts = NULL;
 
-        strprintf(&buf, "%s (%s) -- %s", sl->key, blk_id, os_name ?: "");
-        log_info("%s\n", buf);
-        if(os_name) {
-          slist_t *sl2 = slist_append_str(&root_list, long_dev(sl->key));
-          str_copy(&sl2->value, buf);
-        }
-        str_copy(&buf, NULL);
+  if(!strcmp(type, "ext3") || !strcmp(type, "ext4")) opts = "noload";
+  else if(!strcmp(type, "xfs")) opts = "norecovery";
+  else if(!strcmp(type, "btrfs")) opts = "nologreplay";
+
+  if(opts && !mount(dev, dir, type, flags, opts)) return 0;
 
-        slist_append(&kernel_list, get_kernel_list(sl->key));
+  return mount(dev, dir, type, flags, 0) ? errno : 0;
+}
+
+
+/*
+ * Thread function: probe partitions from job queue until it's empty.
+ *
+ * Each thread uses its own mountpoint in its own mount namespace so nobody
+ * else sees the temporary mounts.
+ */
+void *sys_probe_worker(void *arg)
+{
+  sys_probe_worker_t *worker = arg;
+  sys_probe_queue_t *queue = worker->queue;
+  sys_probe_t *probe;
+
+  if(!unshare(CLONE_NEWNS)) mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL);
+
+  for(;;) {
+    pthread_mutex_lock(&queue->lock);
+    while(queue->next < queue->len && queue->list[queue->next].serial) queue->next++;
+    probe = queue->next < queue->len ? queue->list + queue->next++ : NULL;
+    pthread_mutex_unlock(&queue->lock);
+
+    if(!probe) break;
+
+    probe->err = sys_probe_mount(probe->dev_path, worker->dir, probe->type);
+    if(!probe->err) {
+      probe->os_name = get_os_name(worker->dir);
+      probe->kernels = get_kernel_list(probe->dev, worker->dir);
+      umount2(worker->dir, MNT_DETACH);
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    probe->done = 1;
+    pthread_cond_signal(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+  }
+
+  return NULL;
+}
 
-        util_umount("/mnt");
+
+/*
+ * Look at all partitions and build lists of installed systems and kernels.
+ *
+ * Partitions are mounted in parallel by up to SYS_PROBE_THREADS threads.
+ * Results are logged as they come in; progress is shown in win (if not NULL).
+ *
+ * root_list: key = device, value = description
+ * kernel_list: key = kernel, value = initrd (both "dev:path")
+ */
+void sys_probe(slist_t **root_list, slist_t **kernel_list, window_t *win)
+{
+  sys_probe_queue_t queue = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+  sys_probe_worker_t workers[SYS_PROBE_THREADS];
+  sys_probe_t *probe;
+  slist_t *sl;
+  char *type, *module, *dir, *buf = NULL;
+  unsigned u, done, threads = 0, parallel = 0;
+
+  for(sl = config.partitions; sl; sl = sl->next) queue.len++;
+
+  queue.list = calloc(queue.len + 1, sizeof *queue.list);
+
+  /*
+   * Identify everything up front: neither blkid nor module loading
+   * are meant to be used concurrently.
+   */
+  for(queue.len = 0, sl = config.partitions; sl; sl = sl->next) {
+    type = util_fstype(long_dev(sl->key), &module);
+    if(!type || !strcmp(type, "swap")) continue;
+    if(module) mod_modprobe(module, NULL);
+
+    probe = queue.list + queue.len++;
+    probe->dev = sl->key;
+    // long_dev() is not thread-safe; so do it here
+    probe->dev_path = strdup(long_dev(sl->key));
+    probe->type = strdup(type);
+    probe->blk_id = strdup(blk_ident(long_dev(sl->key)) ?: "");
+
+    // leave everything that needs more than a plain mount to util_mount()
+    probe->serial =
+      !strcmp(type, "cpio") || !strcmp(type, "tar") || !strcmp(type, "rpm") ||
+      (config.ntfs_3g && !strcmp(type, "ntfs"));
+
+    if(!probe->serial) parallel++;
+  }
+
+  log_info("sys_probe: %u partitions, %u parallel\n", queue.len, parallel);
+
+  for(u = 0; u < parallel && u < SYS_PROBE_THREADS; u++) {
+    workers[threads].queue = &queue;
+    workers[threads].dir = strdup(new_mountpoint());
+    if(pthread_create(&workers[threads].thread, NULL, sys_probe_worker, workers + threads)) {
+      rmdir(workers[threads].dir);
+      free(workers[threads].dir);
+      break;
+    }
+    threads++;
+  }
+
+  // no threads at all: do it the old way
+  if(!threads) {
+    for(u = 0; u < queue.len; u++) queue.list[u].serial = 1;
+  }
+
+  // meanwhile, handle the rest ourselves
+  for(u = 0; u < queue.len; u++) {
+    probe = queue.list + u;
+    if(!probe->serial) continue;
+    dir = new_mountpoint();
+    if(!(probe->err = util_mount_ro(probe->dev_path, dir, NULL) ? EIO : 0)) {
+      probe->os_name = get_os_name(dir);
+      probe->kernels = get_kernel_list(probe->dev, dir);
+    }
+    util_umount(dir);
+    pthread_mutex_lock(&queue.lock);
+    probe->done = 1;
+    pthread_mutex_unlock(&queue.lock);
+  }
+
+  // collect results as they come in
+  for(done = 0; done < queue.len;) {
+    pthread_mutex_lock(&queue.lock);
+    for(;;) {
+      for(u = 0; u < queue.len; u++) {
+        if(queue.list[u].done && !queue.list[u].reported) break;
+      }
+      if(u < queue.len) break;
+      pthread_cond_wait(&queue.cond, &queue.lock);
+    }
+    probe = queue.list + u;
+    probe->reported = 1;
+    pthread_mutex_unlock(&queue.lock);
+
+    done++;
+
+    if(probe->err) {
+      log_info("%s: mount failed: %s\n", probe->dev, strerror(probe->err));
+    }
+    else {
+      strprintf(&buf, "%s (%s) -- %s", probe->dev, probe->blk_id, probe->os_name ?: "");
+      log_info("%s\n", buf);
+      if(probe->os_name) {
+        sl = slist_append_str(root_list, probe->dev_path);
+        str_copy(&sl->value, buf);
+      }
+      for(sl = probe->kernels; sl; sl = sl->next) {
+        log_info("kernel: %s / %s\n", sl->key, sl->value);
       }
+      slist_append(kernel_list, probe->kernels);
+      probe->kernels = NULL;
     }
+
+    if(win) dia_status(win, done * 100 / queue.len);
+  }
+
+  for(u = 0; u < threads; u++) {
+    pthread_join(workers[u].thread, NULL);
+    rmdir(workers[u].dir);
+    free(workers[u].dir);
+  }
+
+  for(u = 0; u < queue.len; u++) {
+    free(queue.list[u].dev_path);
+    free(queue.list[u].type);
+    free(queue.list[u].blk_id);
+    free(queue.list[u].os_name);
+  }
+
+  free(queue.list);
+  str_copy(&buf, NULL);
+}
+
+
+void util_boot_system()
+{
+  window_t win;
+  char *buf = NULL;
+  slist_t *sl;
+  slist_t *root_list = NULL, *root = NULL;
+  slist_t *kernel_list = NULL, *kernel = NULL;
+  char *kernel_options = NULL;
+  int i, items;
+  char **item_list;
+
+  strprintf(&buf, "Analysing disks...");
+  log_info("%s\n", buf);
+  if(config.win) {
+    dia_status_on(&win, buf);
+  }
+  else {
+    printf("%s\n", buf);
+    fflush(stdout);
   }
+  str_copy(&buf, NULL);
+
+  util_update_disk_list(NULL, 1);
 
-  if(config.win) win_close(&win);
+  sys_probe(&root_list, &kernel_list, config.win ? &win : NULL);
+
+  if(config.win) dia_status_off(&win);
 
   if(!root_list || !kernel_list) {
     dia_message("No bootable system found.", MSGTYPE_ERROR);
@@ -5353,22 +6740,382 @@ int util_is_wlan(char *device)
 }
 
 
+/*
+ * Asynchronous log writing.
+ *
+ * Each log destination that is opened by name (log file, log console) gets
+ * a ring buffer and a thread that writes the buffer contents. util_log()
+ * only copies the message into the buffer, so slow serial consoles or
+ * remote log files don't hold up linuxrc.
+ *
+ * The ring buffer is lock-free: writers reserve space by advancing
+ * 'reserve' and publish their data in order by advancing 'commit'; the
+ * flusher thread writes everything up to 'commit' and advances 'tail'.
+ *
+ * Everything is written synchronously again after util_log_flush(1)
+ * (e.g. in the segfault handler) and in child processes.
+ */
+
+#define LOG_RING_SIZE	(1 << 18)
+
+struct log_ring_s {
+  log_file_t *lf;
+  char *buf;
+  uint64_t reserve;	/**< next free position (writers) */
+  uint64_t commit;	/**< data up to here is complete */
+  uint64_t tail;	/**< data up to here has been written */
+  unsigned flushing;	/**< set while someone writes out data */
+  sem_t wake;		/**< wake up flusher thread */
+  pthread_t thread;
+};
+
+static void log_ring_start(log_file_t *lf);
+static void *log_ring_thread(void *arg);
+static int log_ring_put(struct log_ring_s *ring, char *data, size_t len);
+static int log_ring_lock(struct log_ring_s *ring, int wait);
+static void log_ring_unlock(struct log_ring_s *ring);
+static void log_ring_write(struct log_ring_s *ring);
+static void log_ring_drain(struct log_ring_s *ring, int force);
+static void log_atfork_child(void);
+static void util_log_flush_atexit(void);
+static char *log_caller(void *addr, char *buf, size_t size) __attribute__ ((noinline));
+
+// set when async logging must no longer be used
+static int log_sync;
+
+// set while the current thread is inside util_log()
+static __thread int log_busy;
+
+// cache of function names for util_get_caller(), indexed by return address
+static struct {
+  void *addr;
+  char *name;
+} log_caller_cache[256];
+static pthread_mutex_t log_caller_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// serializes log_ring_start()
+static pthread_mutex_t log_ring_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*
+ * Set up ring buffer and flusher thread for log destination.
+ */
+void log_ring_start(log_file_t *lf)
+{
+  static int atfork_registered;
+  struct log_ring_s *ring;
+
+  if(lf->ring || log_sync || !config.log.async || !config.run_as_linuxrc) return;
+
+  pthread_mutex_lock(&log_ring_mutex);
+
+  // another thread might have been faster
+  if(__atomic_load_n(&lf->ring, __ATOMIC_ACQUIRE) || log_sync) {
+    pthread_mutex_unlock(&log_ring_mutex);
+
+    return;
+  }
+
+  if(!atfork_registered) {
+    atfork_registered = 1;
+    pthread_atfork(NULL, NULL, log_atfork_child);
+    atexit(util_log_flush_atexit);
+  }
+
+  ring = calloc(1, sizeof *ring);
+  ring->lf = lf;
+  ring->buf = malloc(LOG_RING_SIZE);
+  sem_init(&ring->wake, 0, 0);
+
+  if(pthread_create(&ring->thread, NULL, log_ring_thread, ring)) {
+    sem_destroy(&ring->wake);
+    free(ring->buf);
+    free(ring);
+  }
+  else {
+    pthread_detach(ring->thread);
+    __atomic_store_n(&lf->ring, ring, __ATOMIC_RELEASE);
+  }
+
+  pthread_mutex_unlock(&log_ring_mutex);
+}
+
+
+/*
+ * Flusher thread: write buffer contents when there's something new.
+ */
+void *log_ring_thread(void *arg)
+{
+  struct log_ring_s *ring = arg;
+  sigset_t set;
+
+  // leave signal handling to the main thread
+  sigfillset(&set);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+  for(;;) {
+    while(sem_wait(&ring->wake) == -1 && errno == EINTR);
+    log_ring_drain(ring, 0);
+  }
+
+  return NULL;
+}
+
+
+/*
+ * Add data to ring buffer.
+ *
+ * Waits if the buffer is full. Returns 0 if the data doesn't fit at all.
+ */
+int log_ring_put(struct log_ring_s *ring, char *data, size_t len)
+{
+  uint64_t pos;
+  size_t ofs, l;
+
+  if(len > LOG_RING_SIZE / 2) return 0;
+
+  // reserve space
+  for(;;) {
+    pos = __atomic_load_n(&ring->reserve, __ATOMIC_ACQUIRE);
+    if(pos + len - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) > LOG_RING_SIZE) {
+      sem_post(&ring->wake);
+      usleep(1000);
+      continue;
+    }
+    if(__atomic_compare_exchange_n(&ring->reserve, &pos, pos + len, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) break;
+  }
+
+  ofs = pos % LOG_RING_SIZE;
+  l = LOG_RING_SIZE - ofs;
+  if(l > len) l = len;
+  memcpy(ring->buf + ofs, data, l);
+  if(l < len) memcpy(ring->buf, data + l, len - l);
+
+  // publish in order
+  while(__atomic_load_n(&ring->commit, __ATOMIC_ACQUIRE) != pos) sched_yield();
+  __atomic_store_n(&ring->commit, pos + len, __ATOMIC_RELEASE);
+
+  sem_post(&ring->wake);
+
+  return 1;
+}
+
+
+/*
+ * Get exclusive right to write out buffer data.
+ *
+ * If wait is set, wait up to a second for a concurrently running flusher
+ * (we might be in a signal handler that interrupted it); else give up
+ * immediately.
+ *
+ * Returns 0 on success.
+ */
+int log_ring_lock(struct log_ring_s *ring, int wait)
+{
+  int i;
+
+  for(i = 0; __atomic_exchange_n(&ring->flushing, 1, __ATOMIC_ACQUIRE); i++) {
+    if(!wait || i >= 1000) return -1;
+    usleep(1000);
+  }
+
+  return 0;
+}
+
+
+void log_ring_unlock(struct log_ring_s *ring)
+{
+  __atomic_store_n(&ring->flushing, 0, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Write out everything that has been committed so far.
+ *
+ * The caller must hold the ring lock (see log_ring_lock()).
+ */
+void log_ring_write(struct log_ring_s *ring)
+{
+  uint64_t tail, commit;
+  size_t ofs, len;
+  ssize_t i;
+  int fd;
+
+  for(;;) {
+    tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    commit = __atomic_load_n(&ring->commit, __ATOMIC_ACQUIRE);
+    if(tail == commit) break;
+
+    ofs = tail % LOG_RING_SIZE;
+    len = commit - tail;
+    if(len > LOG_RING_SIZE - ofs) len = LOG_RING_SIZE - ofs;
+
+    fd = ring->lf->f ? fileno(ring->lf->f) : -1;
+    if(fd >= 0) {
+      i = write(fd, ring->buf + ofs, len);
+      if(i < 0 && errno == EINTR) continue;
+      // on errors, drop the data
+      if(i > 0) len = i;
+    }
+
+    __atomic_store_n(&ring->tail, tail + len, __ATOMIC_RELEASE);
+  }
+}
+
+
+/*
+ * Write out everything that has been committed so far.
+ *
+ * If force is set, wait (a bit) for a concurrently running flusher; if it
+ * doesn't finish, leave the data to it.
+ */
+void log_ring_drain(struct log_ring_s *ring, int force)
+{
+  if(log_ring_lock(ring, force)) return;
+
+  log_ring_write(ring);
+
+  log_ring_unlock(ring);
+}
+
+
+/*
+ * Threads are gone in the child process; log synchronously there.
+ *
+ * Data still in the buffers is the parent's business.
+ */
+void log_atfork_child()
+{
+  log_file_t *lf;
+
+  log_sync = 1;
+
+  for(lf = config.log.dest; lf < config.log.dest + sizeof config.log.dest / sizeof *config.log.dest; lf++) {
+    lf->ring = NULL;
+  }
+}
+
+
+/*
+ * Write out all buffered log messages.
+ *
+ * If final is set, switch to synchronous logging afterwards. This is meant
+ * for the segfault handler and for right before exec'ing another program.
+ */
+void util_log_flush(int final)
+{
+  log_file_t *lf;
+  struct log_ring_s *ring;
+
+  if(final) log_sync = 1;
+
+  for(lf = config.log.dest; lf < config.log.dest + sizeof config.log.dest / sizeof *config.log.dest; lf++) {
+    if(!(ring = __atomic_load_n(&lf->ring, __ATOMIC_ACQUIRE))) continue;
+    log_ring_drain(ring, 1);
+    if(final) lf->ring = NULL;
+  }
+}
+
+
+/*
+ * atexit() variant of util_log_flush().
+ */
+void util_log_flush_atexit()
+{
+  util_log_flush(1);
+}
+
+
+/*
+ * Switch log destination to file 'name'.
+ *
+ * Pending messages still go to the old file - unless the flusher thread is
+ * stuck (e.g. in write() to a serial console); then they go to the new one
+ * and the old file is left open as the flusher might still use it.
+ */
+void util_log_set_file(log_file_t *lf, char *name)
+{
+  struct log_ring_s *ring = __atomic_load_n(&lf->ring, __ATOMIC_ACQUIRE);
+  FILE *f;
+  int locked = 0;
+
+  // keep the flusher thread away while the file changes
+  if(ring && !log_ring_lock(ring, 1)) {
+    locked = 1;
+    log_ring_write(ring);
+  }
+
+  str_copy(&lf->name, name);
+  f = lf->f;
+  __atomic_store_n(&lf->f, name ? fopen(name, "a") : NULL, __ATOMIC_RELEASE);
+  if(f && (locked || !ring)) fclose(f);
+
+  if(locked) log_ring_unlock(ring);
+
+  if(ring && !locked) log_info("log: flusher busy, %s switched without draining\n", name ?: "log");
+}
+
+
+/*
+ * Get name of calling function, cached by return address.
+ *
+ * The name is copied to buf (of size bytes). Returns buf or NULL.
+ */
+char *log_caller(void *addr, char *buf, size_t size)
+{
+  unsigned idx = ((uintptr_t) addr >> 2) % (sizeof log_caller_cache / sizeof *log_caller_cache);
+  char *name = NULL;
+
+  pthread_mutex_lock(&log_caller_mutex);
+
+  if(log_caller_cache[idx].addr == addr) {
+    name = log_caller_cache[idx].name;
+  }
+  else {
+    // skip log_caller() and util_log()
+    name = util_get_caller(2);
+    if(name) {
+      free(log_caller_cache[idx].name);
+      log_caller_cache[idx].name = name = strdup(name);
+      log_caller_cache[idx].addr = addr;
+    }
+  }
+
+  // the cache entry may be replaced as soon as we release the lock
+  if(name) {
+    snprintf(buf, size, "%s", name);
+    name = buf;
+  }
+
+  pthread_mutex_unlock(&log_caller_mutex);
+
+  return name;
+}
+
+
 /*
  * Write log message.
  *
  * level is a bitmask determining the destination to log to.
  *
  * Add a time stamp when the destination has the LOG_TIMESTAMP flag set.
+ *
+ * Messages to destinations opened by name are written asynchronously, see
+ * log_ring_start().
  */
 void util_log(unsigned level, char *format, ...)
 {
   va_list args;
-  char *buf, *caller = NULL;
-  int buf_len = 0;
+  char *buf, *caller = NULL, *rec, caller_buf[128];
+  int buf_len = 0, rec_len, reentered;
   log_file_t *lf;
+  struct log_ring_s *ring, *locked;
+  struct tm tm, *gm;
 
   time_t t = time(NULL);
-  struct tm *gm = gmtime(&t);
+  gm = gmtime_r(&t, &tm);
+
+  reentered = log_busy++;
 
   va_start(args, format);
   if(vasprintf(&buf, format, args) == -1) buf = NULL;
@@ -5381,11 +7128,50 @@ void util_log(unsigned level, char *format, ...)
         lf->f = fopen(lf->name, "a");
       }
       if(lf->f) {
+        if(lf->name && !lf->ring) log_ring_start(lf);
+        ring = reentered || log_sync ? NULL : __atomic_load_n(&lf->ring, __ATOMIC_ACQUIRE);
+        locked = NULL;
+
+        if(ring) {
+          // assemble the complete entry so it can be put into the ring buffer at once
+          rec = NULL;
+          rec_len = 0;
+          if((lf->level & LOG_TIMESTAMP) && gm) {
+            if((lf->level & LOG_CALLER) && !caller) caller = log_caller(__builtin_return_address(0), caller_buf, sizeof caller_buf);
+            rec_len = asprintf(&rec, "%02d:%02d:%02d <%u>%s%-*s: %s%s",
+              gm->tm_hour, gm->tm_min, gm->tm_sec, level,
+              caller && (lf->level & LOG_CALLER) ? " " : "",
+              caller && (lf->level & LOG_CALLER) ? 28 : 0,
+              caller && (lf->level & LOG_CALLER) ? caller : "",
+              buf ?: "",
+              buf_len && buf[buf_len - 1] != '\n' ? "\n" : ""
+            );
+          }
+          else if(buf_len) {
+            rec_len = asprintf(&rec, "%s", buf);
+          }
+          if(rec_len > 0 && log_ring_put(ring, rec, rec_len)) {
+            free(rec);
+            continue;
+          }
+          free(rec);
+          if(!buf_len && rec_len <= 0) continue;
+          // too large for the buffer: write synchronously after all pending data
+          // (unless the flusher is stuck - then drop it)
+          if(log_ring_lock(ring, 1)) continue;
+          log_ring_write(ring);
+          locked = ring;
+        }
+        else if(reentered && (ring = __atomic_load_n(&lf->ring, __ATOMIC_ACQUIRE))) {
+          // we can't wait for our own pending data; just try to write out what we can
+          log_ring_drain(ring, 0);
+        }
+
         if((lf->level & LOG_TIMESTAMP)) {
           if(gm) {
             fprintf(lf->f, "%02d:%02d:%02d <%u>", gm->tm_hour, gm->tm_min, gm->tm_sec, level);
             if((lf->level & LOG_CALLER)) {
-              if(!caller) caller = util_get_caller(1);
+              if(!caller && !reentered) caller = log_caller(__builtin_return_address(0), caller_buf, sizeof caller_buf);
               if(caller) fprintf(lf->f, " %-28s", caller);
             }
             fprintf(lf->f, ": ");
@@ -5400,13 +7186,16 @@ void util_log(unsigned level, char *format, ...)
           ) {
             fputc('\n', lf->f);
           }
-          fflush(lf->f);
         }
+        fflush(lf->f);
+        if(locked) log_ring_unlock(locked);
       }
     }
   }
 
   str_copy(&buf, NULL);
+
+  log_busy--;
 }
 
 
@@ -5414,43 +7203,254 @@ void util_log(unsigned level, char *format, ...)
  * Run command and redirect and log stderr to linuxrc log file.
  *
  * If log_stdout is != 0, redirect and log also stdout.
+ *
+ * The command is run via '/bin/sh -c'; see util_run_argv().
  */
 int util_run(char *cmd, unsigned log_stdout)
 {
-  char buf[1024], *buf2 = NULL, *cmd2 = NULL;
-  int fd, i, err = -1;
+  char *argv[] = { cmd, NULL };
+
+  if(!cmd) return -1;
+
+  return util_run_argv(argv, RUN_SHELL | (log_stdout ? RUN_LOG_STDOUT : 0), 0);
+}
+
+
+/*
+ * Read output of background processes started by util_run_argv() until
+ * they close it.
+ */
+void *run_drain_thread(void *arg)
+{
+  int fd = (intptr_t) arg;
+  char buf[1024];
+  ssize_t len;
+  sigset_t set;
 
-  if(!cmd) return err;
+  sigfillset(&set);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
 
-  fd = open("/tmp", O_TMPFILE | O_RDWR, S_IRUSR | S_IWUSR);
+  fcntl(fd, F_SETFL, 0);
+
+  while((len = read(fd, buf, sizeof buf - 1)) != 0) {
+    if(len < 0) {
+      if(errno == EINTR) continue;
+      break;
+    }
+    buf[len] = 0;
+    log_debug("exec: background output:\n%s", buf);
+  }
+
+  close(fd);
+
+  return NULL;
+}
+
+
+/*
+ * Run program and redirect and log stderr to linuxrc log file.
+ *
+ * argv[0] is looked up in PATH; no shell is involved unless flags has
+ * RUN_SHELL set - then argv[0] is a shell command line.
+ *
+ * If flags has RUN_LOG_STDOUT set, redirect and log also stdout.
+ *
+ * If timeout is != 0, the program is terminated after timeout seconds.
+ *
+ * Output is collected through a pipe while the program runs.
+ *
+ * Returns the exit status, 128 + signal number if the program was killed,
+ * or 127 if it could not be started (like the shell does). If its exit
+ * status can't be determined, returns -1.
+ */
+int util_run_argv(char **argv, unsigned flags, unsigned timeout)
+{
+  char *sh_argv[] = { "sh", "-c", NULL, NULL }, *cmd = NULL, **s;
+  int pfd[2], err = 127, i, status = 0, exited = 0, timed_out = 0;
+  posix_spawn_file_actions_t fa;
+  posix_spawnattr_t attr;
+  struct pollfd pollfd = { };
+  struct timespec t0, t1;
+  struct rusage ru = { };
+  util_buf_t out = { };
+  sigset_t set;
+  int64_t elapsed, deadline, drain_end = 0;
+  char discard[4096];
+  ssize_t len;
+  pthread_t drain_thread;
+  pid_t pid;
+
+  if(!argv || !*argv) return -1;
+
+  if((flags & RUN_SHELL)) {
+    str_copy(&cmd, *argv);
+  }
+  else {
+    for(s = argv; *s; s++) strprintf(&cmd, "%s%s%s", cmd ?: "", s == argv ? "" : " ", *s);
+  }
+
+  if(pipe2(pfd, O_CLOEXEC)) {
+    perror_debug("failed to create pipe");
+    str_copy(&cmd, NULL);
+
+    return -1;
+  }
+
+  posix_spawn_file_actions_init(&fa);
+  posix_spawn_file_actions_adddup2(&fa, pfd[1], 2);
+  if((flags & RUN_LOG_STDOUT)) posix_spawn_file_actions_adddup2(&fa, pfd[1], 1);
+
+  posix_spawnattr_init(&attr);
+  sigemptyset(&set);
+  posix_spawnattr_setsigmask(&attr, &set);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
+  if((flags & RUN_SHELL)) {
+    sh_argv[2] = *argv;
+    i = posix_spawn(&pid, "/bin/sh", &fa, &attr, sh_argv, environ);
+  }
+  else {
+    i = posix_spawnp(&pid, *argv, &fa, &attr, argv, environ);
+  }
 
-  if(fd == -1) {
-    perror_debug("failed to create tmp file");
+  posix_spawn_file_actions_destroy(&fa);
+  posix_spawnattr_destroy(&attr);
+
+  close(pfd[1]);
+
+  if(i) {
+    log_info("exec: %s: %s\n", cmd, strerror(i));
+    close(pfd[0]);
+    str_copy(&cmd, NULL);
 
     return err;
   }
 
-  strprintf(&cmd2, "%s 2>&%d%s", cmd, fd, log_stdout ? " >&2" : "");
+  deadline = timeout * 1000;
 
-  err = WEXITSTATUS(system(cmd2));
+  pollfd.fd = pfd[0];
+  pollfd.events = POLLIN;
 
-  log_info_maybe(config.debug, "exec: %s = %d\n", cmd, err);
+  /*
+   * Read until EOF or until the program has exited - a daemon started by
+   * the program might keep the pipe open forever.
+   *
+   * Check for exit and timeout in every round: the program (or that
+   * daemon) might keep writing all the time.
+   */
+  for(;;) {
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    elapsed = (t1.tv_sec - t0.tv_sec) * 1000 + (t1.tv_nsec - t0.tv_nsec) / 1000000;
 
-  lseek(fd, 0, SEEK_SET);
+    if(!exited && wait4(pid, &status, WNOHANG, &ru) == pid) {
+      exited = 1;
+      // get what is left (for at most a second) and stop
+      fcntl(pfd[0], F_SETFL, O_NONBLOCK);
+      drain_end = elapsed + 1000;
+    }
 
-  while((i = read(fd, buf, sizeof buf - 1)) > 0) {
-    buf[i] = 0;
-    strprintf(&buf2, "%s%s", buf2 ?: "", buf);
+    if(exited && elapsed >= drain_end) {
+      i = 0;
+      break;
+    }
+
+    if(!exited && timeout && elapsed >= deadline) {
+      if(!timed_out) {
+        log_info("exec: %s: timeout after %us\n", cmd, timeout);
+        kill(pid, SIGTERM);
+        timed_out = 1;
+      }
+      else {
+        kill(pid, SIGKILL);
+      }
+      // give it 2 more seconds
+      deadline = elapsed + 2000;
+    }
+
+    i = poll(&pollfd, 1, 100);
+
+    if(i > 0) {
+      if(out.size - out.len < 4096 + 1 && out.size < (1 << 20)) {
+        out.size = out.size ? out.size * 2 : 16384;
+        out.buf = realloc(out.buf, out.size);
+      }
+      // buffer full: drop the rest
+      if(out.size - out.len < 4096 + 1) {
+        len = read(pfd[0], discard, sizeof discard);
+        if(len > 0) continue;
+      }
+      else {
+        len = read(pfd[0], out.buf + out.len, out.size - out.len - 1);
+      }
+      if(len > 0) {
+        out.len += len;
+        continue;
+      }
+      if(len < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+      // EOF
+      break;
+    }
+    if(i < 0 && errno != EINTR) break;
+
+    // the pipe is still open, but there's nothing more to read for now
+    if(exited && i == 0) break;
   }
 
-  close(fd);
+  if(exited && i == 0) {
+    // still open - keep reading in the background so nobody gets SIGPIPE
+    if(pthread_create(&drain_thread, NULL, run_drain_thread, (void *) (intptr_t) pfd[0])) {
+      close(pfd[0]);
+    }
+    else {
+      pthread_detach(drain_thread);
+    }
+  }
+  else {
+    close(pfd[0]);
+  }
+
+  if(!exited) {
+    while((i = wait4(pid, &status, 0, &ru)) == -1 && errno == EINTR);
+    if(i == pid) {
+      exited = 1;
+    }
+    else {
+      log_info("exec: %s: wait failed: %s\n", cmd, strerror(errno));
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  // we don't know what happened to it
+  if(!exited) {
+    err = -1;
+  }
+  else if(WIFEXITED(status)) {
+    err = WEXITSTATUS(status);
+  }
+  else if(WIFSIGNALED(status)) {
+    err = 128 + WTERMSIG(status);
+  }
+
+  log_info_maybe(config.debug, "exec: %s = %d\n", cmd, err);
+
+  log_debug(
+    "exec: %.3fs real, %.3fs user, %.3fs sys, %ld kB max rss\n",
+    (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9,
+    ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6,
+    ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6,
+    ru.ru_maxrss
+  );
 
-  if(buf2) {
-    log_debug("%sstderr:\n%s", log_stdout ? "stdout + " : "", buf2);
+  if(out.len) {
+    out.buf[out.len] = 0;
+    log_debug("%sstderr:\n%s", (flags & RUN_LOG_STDOUT) ? "stdout + " : "", out.buf);
   }
 
-  str_copy(&buf2, NULL);
-  str_copy(&cmd2, NULL);
+  free(out.buf);
+  str_copy(&cmd, NULL);
 
   return err;
 }
@@ -93,6 +93,8 @@ char *long_dev(char *dev);
 void util_mkdevs(void);
 
 int util_lndir_main(int argc, char **argv);
+int util_layer_add(char *layer, char *dir);
+int util_layer_remove(char *layer, char *dir);
 
 void util_notty(void);
 void util_killall(char *name, int sig);
@@ -115,6 +117,10 @@ int util_read_and_chop(char* path, char* dst, int dst_size);
 
 char *get_translation(slist_t *trans, char *locale);
 int util_process_running(char *name);
+proc_table_t *util_proc_snapshot(void);
+proc_table_t *util_proc_free(proc_table_t *pt);
+proc_entry_t *util_proc_find(proc_table_t *pt, char *name);
+unsigned util_proc_kill(pid_t *pids, unsigned len, int sig, unsigned timeout);
 
 char *blk_size_str(char *dev);
 uint64_t blk_size(char *dev);
@@ -154,7 +160,10 @@ void util_set_wlan(char *device);
 int util_is_wlan(char *device);
 
 void util_log(unsigned level, char *format, ...);
+void util_log_flush(int final);
+void util_log_set_file(log_file_t *lf, char *name);
 int util_run(char *cmd, unsigned log_stdout);
+int util_run_argv(char **argv, unsigned flags, unsigned timeout);
 void util_perror(unsigned level, char *msg);
 char *util_get_caller(int skip);
 void util_set_hostname(char *hostname);
@@ -250,7 +250,7 @@ void win_button_pressed (button_t *button_prr, int stay_iv)
     win_open (&button_prr->win);
     disp_set_color (button_prr->win.fg_color, button_prr->win.bg_color);
     win_print (&button_prr->win, 1, 1, button_prr->text);
-    fflush (stdout);
+    disp_flush ();
 
     if (!stay_iv)
         {
@@ -266,7 +266,7 @@ void win_button_unpressed (button_t *button_prr)
     win_open (&button_prr->win);
     disp_set_color (button_prr->win.fg_color, button_prr->win.bg_color);
     win_print (&button_prr->win, 1, 1, button_prr->text);
-    fflush (stdout);
+    disp_flush ();
     }
 
 
@@ -274,7 +274,7 @@ void win_button_select (button_t *button_prr)
     {
     disp_set_color (colors_prg->button_fg, colors_prg->button_bg);
     win_print (&button_prr->win, 1, 1, button_prr->text);
-    fflush (stdout);
+    disp_flush ();
     }
 
 
@@ -282,7 +282,7 @@ void win_button_unselect (button_t *button_prr)
     {
     disp_set_color (button_prr->win.fg_color, button_prr->win.bg_color);
     win_print (&button_prr->win, 1, 1, button_prr->text);
-    fflush (stdout);
+    disp_flush ();
     }
 
 
@@ -545,7 +545,7 @@ int win_input (int x, int y, char *buf, int buf_len, int field_len, int pw_mode)
     disp_set_color(colors_prg->input_fg, colors_prg->input_bg);
     disp_write_utf32string(field);
     disp_gotoxy(x + cur, y);
-    fflush(stdout);
+    disp_flush();
 
     key = kbd_getch(TRUE);
 
@@ -0,0 +1,263 @@
+/*
+ *
+ * zram.c        Compressed swap in RAM for small-memory systems
+ *
+ * Downloads (instsys parts, driver updates, kexec kernels) are kept in the
+ * tmpfs download area (config.download.base). With a zram device as high
+ * priority swap, the kernel moves tmpfs pages that are not currently used
+ * into compressed RAM when memory gets tight. Loop mounts of downloaded
+ * images keep working unchanged; pages are decompressed as they are read.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/swap.h>
+
+#include "global.h"
+#include "util.h"
+#include "module.h"
+#include "zram.h"
+
+// swap priority; above any disk swap
+#define ZRAM_SWAP_PRIO		100
+
+// wait that long (in s) for udev to create the device node
+#define ZRAM_DEV_WAIT		5
+
+// assumed compression ratio when estimating memory (on the safe side)
+#define ZRAM_RATIO		2
+
+static int zram_swap_info(int64_t *size, int64_t *avail);
+static char *zram_get_device(void);
+static int zram_set_attr(char *dev, char *attr, char *val);
+
+
+/*
+ * Set up zram swap (config.zram.*).
+ *
+ * return:
+ *   0: ok
+ *   1: failed
+ */
+int zram_setup()
+{
+  char *dev, *buf = NULL;
+  int64_t size;
+  int i, err = 0;
+
+  if(!config.zram.algo || config.zram.dev) return 0;
+
+  // might be built into the kernel
+  mod_modprobe("zram", NULL);
+
+  if(!(dev = zram_get_device())) {
+    log_info("zram: no device available\n");
+
+    return 1;
+  }
+
+  if(*config.zram.algo && zram_set_attr(dev, "comp_algorithm", config.zram.algo)) {
+    log_info("zram: %s: compression not supported\n", config.zram.algo);
+  }
+
+  // by default, half the RAM (uncompressed)
+  if(!(size = config.zram.size)) {
+    util_get_ram_size();
+    size = config.memoryXXX.ram / 2;
+  }
+
+  if(size <= 0) {
+    log_info("zram: unknown RAM size\n");
+    err = 1;
+  }
+
+  if(!err) {
+    strprintf(&buf, "%lld", (long long) size);
+    err = zram_set_attr(dev, "disksize", buf);
+  }
+
+  if(!err) {
+    strprintf(&buf, "/dev/%s", dev);
+    for(i = 0; i < ZRAM_DEV_WAIT * 10 && !util_check_exist(buf); i++) usleep(100000);
+
+    strprintf(&buf, "/sbin/mkswap /dev/%s", dev);
+    err = lxrc_run(buf) ? 1 : 0;
+  }
+
+  if(!err) {
+    strprintf(&buf, "/dev/%s", dev);
+    if(swapon(buf, SWAP_FLAG_PREFER | (ZRAM_SWAP_PRIO << SWAP_FLAG_PRIO_SHIFT))) {
+      log_info("zram: ");
+      perror_info(buf);
+      err = 1;
+    }
+  }
+
+  if(!err) {
+    str_copy(&config.zram.dev, dev);
+    log_info("zram: %s: %lld MB swap\n", buf, (long long) (size >> 20));
+    strprintf(&buf, "/sys/block/%s/comp_algorithm", dev);
+    log_info("zram: compression %s\n", util_get_attr(buf));
+  }
+  else {
+    log_info("zram: %s: setup failed\n", dev);
+    zram_set_attr(dev, "reset", "1");
+  }
+
+  str_copy(&buf, NULL);
+
+  return err;
+}
+
+
+/*
+ * Log how much memory zram currently saves.
+ */
+void zram_log_stats()
+{
+  char *buf = NULL;
+  unsigned long long orig, compr, used;
+
+  if(!config.zram.dev) return;
+
+  strprintf(&buf, "/sys/block/%s/mm_stat", config.zram.dev);
+
+  if(sscanf(util_get_attr(buf), "%llu %llu %llu", &orig, &compr, &used) == 3) {
+    log_info("zram: %llu MB stored in %llu MB, %lld MB saved\n",
+      orig >> 20,
+      used >> 20,
+      ((long long) orig - (long long) used) / (1 << 20)
+    );
+  }
+
+  str_copy(&buf, NULL);
+}
+
+
+/*
+ * RAM needed to fill the zram swap completely ('total') and to fill its
+ * free space ('avail'), in bytes (estimated).
+ *
+ * /proc/meminfo counts zram swap at its uncompressed size; subtract this
+ * to get the memory that is really available.
+ */
+void zram_swap_cost(int64_t *total, int64_t *avail)
+{
+  int64_t size, size_free;
+
+  *total = *avail = 0;
+
+  if(zram_swap_info(&size, &size_free)) return;
+
+  *total = size / ZRAM_RATIO;
+  *avail = size_free / ZRAM_RATIO;
+}
+
+
+/*
+ * Estimated amount of memory zram adds, in bytes.
+ */
+int64_t zram_gain()
+{
+  int64_t size, size_free;
+
+  if(zram_swap_info(&size, &size_free)) return 0;
+
+  return size - size / ZRAM_RATIO;
+}
+
+
+/*
+ * Size and free space of the zram swap device (see /proc/swaps), in bytes.
+ *
+ * return:
+ *   0: ok
+ *   1: no zram swap
+ */
+int zram_swap_info(int64_t *size, int64_t *avail)
+{
+  FILE *f;
+  char *buf = NULL, name[64], dev[64];
+  size_t len = 0;
+  long long s, used;
+  int err = 1;
+
+  if(!config.zram.dev || !(f = fopen("/proc/swaps", "r"))) return 1;
+
+  snprintf(name, sizeof name, "/dev/%s", config.zram.dev);
+
+  while(getline(&buf, &len, f) > 0) {
+    if(
+      sscanf(buf, "%63s %*s %lld %lld", dev, &s, &used) == 3 &&
+      !strcmp(dev, name)
+    ) {
+      *size = (int64_t) s << 10;
+      *avail = (int64_t) (s - used) << 10;
+      err = 0;
+      break;
+    }
+  }
+
+  fclose(f);
+  free(buf);
+
+  return err;
+}
+
+
+/*
+ * Get an unused zram device.
+ *
+ * Return device name (without '/dev/') or NULL.
+ */
+char *zram_get_device()
+{
+  static char dev[32];
+  int i;
+
+  // zram0 is created when the module is loaded
+  if(!strcmp(util_get_attr("/sys/block/zram0/disksize"), "0")) return strcpy(dev, "zram0");
+
+  // ask for another one
+  if(sscanf(util_get_attr("/sys/class/zram-control/hot_add"), "%d", &i) == 1) {
+    snprintf(dev, sizeof dev, "zram%d", i);
+
+    return dev;
+  }
+
+  return NULL;
+}
+
+
+/*
+ * Write 'val' to zram device attribute 'attr'.
+ *
+ * return:
+ *   0: ok
+ *   1: failed
+ */
+int zram_set_attr(char *dev, char *attr, char *val)
+{
+  char *buf = NULL;
+  FILE *f;
+  int err = 1;
+
+  strprintf(&buf, "/sys/block/%s/%s", dev, attr);
+
+  if((f = fopen(buf, "w"))) {
+    err = fputs(val, f) < 0;
+    if(fclose(f)) err = 1;
+  }
+
+  if(err) log_debug("zram: %s = %s failed\n", buf, val);
+
+  str_copy(&buf, NULL);
+
+  return err;
+}
@@ -0,0 +1,10 @@
+/*
+ *
+ * zram.h        Header file for zram.c
+ *
+ */
+
+int zram_setup(void);
+void zram_log_stats(void);
+void zram_swap_cost(int64_t *total, int64_t *avail);
+int64_t zram_gain(void);